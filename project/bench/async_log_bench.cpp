@@ -0,0 +1,188 @@
+/* Logging benchmark: cost per call of engine/async_logger.h against the
+ * open-append-close per message that module05's LogError() used to do, and
+ * a check that every queued line reaches the file.
+ *
+ * usage: async_log_bench [-m messages] [-t threads]
+ *
+ * 4000 distinct error lines (by default, so a run fits the 4096-slot ring)
+ * are logged by one thread and then split across several, followed by a
+ * storm of one identical message that the rate limit should reduce to a
+ * handful of lines. Only the file is written; neither path echoes to stderr.
+ *
+ * A larger -m outruns the writer thread and the ring drops the excess. The
+ * ring rows therefore count the drops and divide the time by the messages
+ * that were accepted, since a dropped call returns after a failed claim and
+ * costs less than a queued one.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <engine/async_logger.h>
+
+using namespace std; // Uses the standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const char* const LOG_PATH = "async_log_bench.txt";
+
+    double millisecondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    string message(int thread, int index)
+    {
+        char text[128];
+        snprintf(text, sizeof(text), "Uniform 'lightColor%d_%d' not found in program 3", thread, index);
+        return text;
+    }
+
+    size_t countLines(const char* path, const char* containing)
+    {
+        ifstream file(path);
+        string line;
+        size_t count = 0;
+        while (getline(file, line))
+            count += line.find(containing) != string::npos ? 1 : 0;
+        return count;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int messages = 4000;
+    int threads = 4;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            messages = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            threads = max(1, atoi(argv[++i]));
+        else
+        {
+            cout << "usage: " << argv[0] << " [-m messages] [-t threads]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Messages are formatted up front so only the logging is timed
+    vector<vector<string> > texts(threads);
+    for (int t = 0; t < threads; ++t)
+        for (int i = t; i < messages; i += threads)
+            texts[t].push_back(message(t, i));
+    vector<string> single;
+    for (int i = 0; i < messages; ++i)
+        single.push_back(message(0, i));
+
+    cout << messages << " messages" << endl;
+    cout << setw(20) << "path" << setw(14) << "us per msg" << setw(12) << "total ms" << setw(12) << "flush ms" << setw(10) << "dropped" << endl;
+
+    // What LogError() did for every message
+    remove(LOG_PATH);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < messages; ++i)
+    {
+        ofstream errorLog(LOG_PATH, ios::app);
+        errorLog << single[i] << endl;
+    }
+    double total = millisecondsSince(start);
+    cout << setw(20) << "open per message" << fixed << setprecision(3) << setw(14) << total * 1000.0 / messages
+         << setw(12) << total << setw(12) << 0.0 << setw(10) << 0 << endl;
+    bool correct = countLines(LOG_PATH, "lightColor") == static_cast<size_t>(messages);
+
+    // One thread, then several, through the ring
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const int producers = pass == 0 ? 1 : threads;
+        remove(LOG_PATH);
+        AsyncLogger logger;
+        logger.SetEchoLevel(LOG_SEVERITY_COUNT);
+        logger.Start(LOG_PATH);
+
+        start = chrono::steady_clock::now();
+        if (producers == 1)
+        {
+            for (int i = 0; i < messages; ++i)
+                logger.Log(LOG_ERROR, single[i]);
+        }
+        else
+        {
+            vector<thread> workers;
+            for (int t = 0; t < producers; ++t)
+                workers.push_back(thread([&logger, &texts, t]()
+                {
+                    for (size_t i = 0; i < texts[t].size(); ++i)
+                        logger.Log(LOG_ERROR, texts[t][i]);
+                }));
+            for (size_t t = 0; t < workers.size(); ++t)
+                workers[t].join();
+        }
+        total = millisecondsSince(start);
+        start = chrono::steady_clock::now();
+        logger.Flush();
+        const double flushTime = millisecondsSince(start);
+        logger.Stop();
+
+        // Time per message that reached the ring; drops are cheaper and would flatter the average
+        const size_t dropped = logger.GetDroppedCount();
+        const size_t accepted = messages - dropped;
+        char name[32];
+        snprintf(name, sizeof(name), "ring, %d thread%s", producers, producers == 1 ? "" : "s");
+        cout << setw(20) << name << setw(14) << (accepted ? total * 1000.0 / accepted : 0.0) << setw(12) << total
+             << setw(12) << flushTime << setw(10) << dropped << endl;
+
+        // Every message is in the file unless the ring overflowed, and then the drops are reported
+        const size_t lines = countLines(LOG_PATH, "lightColor");
+        if (lines != accepted || (dropped > 0 && countLines(LOG_PATH, "messages dropped") == 0))
+        {
+            cout << "ERROR: " << lines << " lines written, " << dropped << " dropped, " << messages << " logged" << endl;
+            correct = false;
+        }
+    }
+
+    // A storm of one message, as from a bad uniform name every frame
+    {
+        remove(LOG_PATH);
+        AsyncLogger logger;
+        logger.SetEchoLevel(LOG_SEVERITY_COUNT);
+        logger.Start(LOG_PATH);
+        const string storm = "Uniform 'lightColr' not found in program 3";
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < messages; ++i)
+            logger.Log(LOG_ERROR, storm);
+        total = millisecondsSince(start);
+        logger.Stop();
+        const size_t lines = countLines(LOG_PATH, "lightColr");
+        cout << setw(20) << "storm, rate limited" << setw(14) << total * 1000.0 / messages << setw(12) << total
+             << setw(12) << 0.0 << setw(10) << logger.GetDroppedCount() << "  " << lines << " lines" << endl;
+        correct = correct && lines >= 1 && lines <= LOG_RATE_LIMIT * static_cast<size_t>(total / (LOG_RATE_WINDOW_SECONDS * 1000.0) + 1.0);
+    }
+
+    // A shader info log longer than one slot stays one line
+    {
+        remove(LOG_PATH);
+        AsyncLogger logger;
+        logger.SetEchoLevel(LOG_SEVERITY_COUNT);
+        logger.Start(LOG_PATH);
+        const string longMessage = "Shader compilation error: " + string(500, 'x') + "end";
+        logger.Log(LOG_ERROR, longMessage);
+        logger.Stop();
+        correct = correct && countLines(LOG_PATH, longMessage.c_str()) == 1;
+    }
+    remove(LOG_PATH);
+
+    cout << (correct ? "INFO: every message was written or reported dropped" : "ERROR: messages are missing from the log") << endl;
+    exit(correct ? EXIT_SUCCESS : EXIT_FAILURE);
+}
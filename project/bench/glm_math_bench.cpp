@@ -0,0 +1,134 @@
+/* GLM micro-benchmarks: lookAt, perspective, rotate, mat4 * mat4 and
+ * mat4 * vec4, in whichever math mode this binary was built with.
+ *
+ * usage: glm_math_bench [-n passes]
+ *
+ * The Makefile builds it twice, as glm_math_bench (GLM's scalar code) and
+ * glm_math_bench_simd (the GLM_SIMD=1 configuration of engine/math_config.h),
+ * so the two outputs can be compared line by line. Inputs are arrays of
+ * 4096 random values, cycled so the compiler cannot fold the work away.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <engine/math_config.h>
+
+using namespace std; // Uses the standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const size_t INPUT_COUNT = 4096;
+
+    // xorshift32, so both builds see the same inputs
+    float random(unsigned &state, float low, float high)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return low + (high - low) * ((state >> 8) * (1.0f / 16777216.0f));
+    }
+
+    glm::vec3 randomVec3(unsigned &state, float low, float high)
+    {
+        return glm::vec3(random(state, low, high), random(state, low, high), random(state, low, high));
+    }
+
+    glm::mat4 randomMat4(unsigned &state)
+    {
+        glm::mat4 m;
+        for (int c = 0; c < 4; ++c)
+            m[c] = glm::vec4(random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f));
+        return m;
+    }
+
+    // Keeps results alive without adding measurable work
+    float gSink = 0.0f;
+
+    void report(const char* name, chrono::steady_clock::time_point start, size_t operations)
+    {
+        const double nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        cout << setw(14) << name << fixed << setprecision(2) << setw(10) << nanoseconds / operations << " ns/op" << endl;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int passes = 2000;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            passes = max(1, atoi(argv[++i]));
+        else
+        {
+            cout << "usage: " << argv[0] << " [-n passes]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    unsigned state = 2024u;
+    vector<glm::vec3> eyes(INPUT_COUNT), targets(INPUT_COUNT), axes(INPUT_COUNT);
+    vector<float> angles(INPUT_COUNT), fovs(INPUT_COUNT);
+    vector<glm::mat4> matrices(INPUT_COUNT), results(INPUT_COUNT);
+    vector<glm::vec4> vectors(INPUT_COUNT), transformed(INPUT_COUNT);
+    for (size_t i = 0; i < INPUT_COUNT; ++i)
+    {
+        eyes[i] = randomVec3(state, -10.0f, 10.0f);
+        targets[i] = randomVec3(state, -10.0f, 10.0f);
+        axes[i] = glm::normalize(randomVec3(state, 0.1f, 1.0f));
+        angles[i] = random(state, -3.0f, 3.0f);
+        fovs[i] = random(state, 0.5f, 1.5f);
+        matrices[i] = randomMat4(state);
+        vectors[i] = glm::vec4(randomVec3(state, -1.0f, 1.0f), 1.0f);
+    }
+    const size_t operations = INPUT_COUNT * static_cast<size_t>(passes);
+
+    cout << "GLM " << GlmSimdName() << ", " << operations << " operations each" << endl;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+        for (size_t i = 0; i < INPUT_COUNT; ++i)
+            results[i] = glm::lookAt(eyes[i], targets[i], glm::vec3(0.0f, 1.0f, 0.0f));
+    report("lookAt", start, operations);
+    gSink += results[passes % INPUT_COUNT][3][0];
+
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+        for (size_t i = 0; i < INPUT_COUNT; ++i)
+            results[i] = glm::perspective(fovs[i], 4.0f / 3.0f, 0.1f, 100.0f);
+    report("perspective", start, operations);
+    gSink += results[passes % INPUT_COUNT][1][1];
+
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+        for (size_t i = 0; i < INPUT_COUNT; ++i)
+            results[i] = glm::rotate(matrices[i], angles[i], axes[i]);
+    report("rotate", start, operations);
+    gSink += results[passes % INPUT_COUNT][2][1];
+
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+        for (size_t i = 0; i < INPUT_COUNT; ++i)
+            results[i] = matrices[i] * matrices[(i + 1) % INPUT_COUNT];
+    report("mat4 * mat4", start, operations);
+    gSink += results[passes % INPUT_COUNT][3][3];
+
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+        for (size_t i = 0; i < INPUT_COUNT; ++i)
+            transformed[i] = matrices[i] * vectors[(i + pass) % INPUT_COUNT];
+    report("mat4 * vec4", start, operations);
+    gSink += transformed[passes % INPUT_COUNT].w;
+
+    cout << "INFO: checksum " << gSink << endl;
+    exit(EXIT_SUCCESS);
+}
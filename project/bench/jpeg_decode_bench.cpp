@@ -0,0 +1,169 @@
+/* JPEG decode benchmark: stb_image_aug with its scalar IDCT/colour
+ * conversion against the SSE2 and AVX2 hooks from engine/jpeg_simd.h.
+ *
+ * usage: jpeg_decode_bench [-n passes] file.jpg [file.jpg ...]
+ *
+ * Every file is decoded 'passes' times per mode; the SIMD output is
+ * compared byte for byte against the scalar output. Files that cannot be
+ * read or decoded (stb_image_aug has no progressive JPEG support) are
+ * skipped with a message.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <stb_image_aug.h>
+#include <engine/jpeg_simd.h>
+
+using namespace std; // Uses the standard namespace
+
+// Unnamed namespace
+namespace
+{
+    struct CorpusFile
+    {
+        string name;
+        vector<unsigned char> bytes;
+        vector<unsigned char> reference;    // scalar output
+        size_t pixels;
+    };
+
+    bool readFile(const char* filename, vector<unsigned char> &bytes)
+    {
+        ifstream file(filename, ios::binary);
+        if (!file)
+            return false;
+        bytes.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Decodes the whole corpus 'passes' times; returns milliseconds, or -1 on failure
+    double decodeCorpus(vector<CorpusFile> &corpus, int passes, bool keepReference, size_t &mismatches)
+    {
+        mismatches = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            for (size_t i = 0; i < corpus.size(); ++i)
+            {
+                CorpusFile &file = corpus[i];
+                int width, height, channels;
+                unsigned char *image = stbi_load_from_memory(&file.bytes[0], static_cast<int>(file.bytes.size()), &width, &height, &channels, 0);
+                if (!image)
+                {
+                    cout << "Failed to decode " << file.name << ": " << stbi_failure_reason() << endl;
+                    return -1.0;
+                }
+
+                const size_t size = static_cast<size_t>(width) * height * channels;
+                if (pass == 0 && keepReference)
+                {
+                    file.reference.assign(image, image + size);
+                    file.pixels = static_cast<size_t>(width) * height;
+                }
+                else if (pass == 0 && (size != file.reference.size() || memcmp(image, &file.reference[0], size) != 0))
+                    ++mismatches;
+                stbi_image_free(image);
+            }
+        }
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    void report(const char* mode, double milliseconds, double scalarMilliseconds, size_t pixels, size_t mismatches)
+    {
+        cout << setw(8) << mode << fixed << setprecision(1)
+             << setw(10) << milliseconds << " ms"
+             << setw(10) << pixels / (milliseconds * 1000.0) << " MPix/s"
+             << setw(8) << setprecision(2) << scalarMilliseconds / milliseconds << "x";
+        if (mismatches)
+            cout << "   " << mismatches << " image(s) differ from scalar";
+        cout << endl;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int passes = 10;
+    vector<CorpusFile> corpus;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            passes = max(1, atoi(argv[++i]));
+            continue;
+        }
+
+        CorpusFile file;
+        file.name = argv[i];
+        if (!readFile(argv[i], file.bytes) || file.bytes.empty())
+        {
+            cout << "Skipping " << argv[i] << ": cannot read it" << endl;
+            continue;
+        }
+
+        // Only files the decoder can handle are timed
+        int width, height, channels;
+        unsigned char *image = stbi_load_from_memory(&file.bytes[0], static_cast<int>(file.bytes.size()), &width, &height, &channels, 0);
+        if (!image)
+        {
+            cout << "Skipping " << argv[i] << ": " << stbi_failure_reason() << endl;
+            continue;
+        }
+        stbi_image_free(image);
+        corpus.push_back(file);
+    }
+
+    if (corpus.empty())
+    {
+        cout << "usage: " << argv[0] << " [-n passes] file.jpg [file.jpg ...]" << endl;
+        cout << "ERROR: no decodable file given" << endl;
+        return EXIT_FAILURE;
+    }
+
+#ifndef JPEG_SIMD_SSE2
+    cout << "Built without STBI_SIMD or SSE2; only the scalar path is available" << endl;
+#endif
+
+    // The scalar routines are installed until InstallJpegSimd() replaces them
+    size_t mismatches;
+    double scalar = decodeCorpus(corpus, passes, true, mismatches);
+    if (scalar < 0.0)
+        return EXIT_FAILURE;
+
+    size_t pixels = 0;
+    for (size_t i = 0; i < corpus.size(); ++i)
+        pixels += corpus[i].pixels * passes;
+
+    cout << corpus.size() << " file(s), " << passes << " pass(es)" << endl;
+    report("scalar", scalar, scalar, pixels, 0);
+
+#ifdef JPEG_SIMD_SSE2
+    InstallJpegSimd(false);
+    double sse2 = decodeCorpus(corpus, passes, false, mismatches);
+    if (sse2 < 0.0)
+        return EXIT_FAILURE;
+    report("sse2", sse2, scalar, pixels, mismatches);
+
+    if (InstallJpegSimd() == JPEG_SIMD_AVX2_LEVEL)
+    {
+        double avx2 = decodeCorpus(corpus, passes, false, mismatches);
+        if (avx2 < 0.0)
+            return EXIT_FAILURE;
+        report("avx2", avx2, scalar, pixels, mismatches);
+    }
+    else
+    {
+        cout << "INFO: CPU has no AVX2, skipping the AVX2 colour conversion" << endl;
+    }
+#endif
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,200 @@
+/* Multi-view benchmark: cull time and upload size of engine/multi_view_renderer.h
+ * for one view, two overlapping views and two disjoint views, with every
+ * draw list checked against a loop over all objects.
+ *
+ * usage: multi_view_bench [-o objects] [-f frames]
+ *
+ * 200k boxes (by default) are scattered over a 1000 x 1000 ground plane and
+ * shared by 16 materials. The fly camera looks along the ground; the second
+ * view is either a wide top-down overview of the same area or a camera
+ * looking the other way. Only Cull() is timed, which does everything but
+ * the one glBufferData, so no GL context is needed.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <engine/multi_view_renderer.h>
+
+using namespace std; // Uses the standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const float WORLD_SIZE = 1000.0f;
+    const int MATERIAL_COUNT = 16;
+
+    // xorshift32, so every run benchmarks the same scene
+    float random(unsigned &state, float low, float high)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return low + (high - low) * ((state >> 8) * (1.0f / 16777216.0f));
+    }
+
+    double millisecondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    bool insideFrustum(const glm::vec4 *planes, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p)
+        {
+            const glm::vec3 corner(planes[p].x >= 0.0f ? boundsMax.x : boundsMin.x,
+                                   planes[p].y >= 0.0f ? boundsMax.y : boundsMin.y,
+                                   planes[p].z >= 0.0f ? boundsMax.z : boundsMin.z);
+            if (glm::dot(glm::vec3(planes[p]), corner) + planes[p].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool drawOrder(const ViewDraw &a, const ViewDraw &b)
+    {
+        return a.material != b.material ? a.material < b.material : a.object < b.object;
+    }
+
+    RenderView perspectiveView(const glm::vec3 &position, const glm::vec3 &target)
+    {
+        RenderView view;
+        view.position = position;
+        view.view = glm::lookAt(position, target, glm::vec3(0.0f, 1.0f, 0.0f));
+        view.projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+        view.viewport = glm::ivec4(0, 0, 1920, 1080);
+        return view;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int objects = 200000;
+    int frames = 50;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            objects = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            frames = max(1, atoi(argv[++i]));
+        else
+        {
+            cout << "usage: " << argv[0] << " [-o objects] [-f frames]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    unsigned state = 4242u;
+    vector<glm::mat4> models(objects);
+    vector<int> materials(objects);
+    const glm::vec3 localMin(-0.5f), localMax(0.5f);
+
+    // The fly camera at the middle of the plane, and the second views it is paired with
+    const glm::vec3 center(WORLD_SIZE * 0.5f, 0.0f, WORLD_SIZE * 0.5f);
+    const RenderView fly = perspectiveView(center + glm::vec3(0.0f, 10.0f, 0.0f), center + glm::vec3(0.0f, 0.0f, -100.0f));
+    RenderView overview;
+    overview.position = center + glm::vec3(0.0f, 300.0f, -150.0f);
+    overview.view = glm::lookAt(overview.position, center + glm::vec3(0.0f, 0.0f, -150.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+    overview.projection = glm::ortho(-200.0f, 200.0f, -200.0f, 200.0f, 1.0f, 400.0f);
+    overview.viewport = glm::ivec4(1440, 780, 480, 300);
+    const RenderView behind = perspectiveView(center + glm::vec3(0.0f, 10.0f, 0.0f), center + glm::vec3(0.0f, 0.0f, 100.0f));
+
+    struct Setup
+    {
+        const char* name;
+        vector<RenderView> views;
+    };
+    Setup setups[3];
+    setups[0].name = "fly";
+    setups[0].views.push_back(fly);
+    setups[1].name = "fly+overview";
+    setups[1].views.push_back(fly);
+    setups[1].views.push_back(overview);
+    setups[2].name = "fly+behind";
+    setups[2].views.push_back(fly);
+    setups[2].views.push_back(behind);
+
+    for (int i = 0; i < objects; ++i)
+    {
+        const glm::vec3 position(random(state, 0.0f, WORLD_SIZE), random(state, 0.0f, 4.0f), random(state, 0.0f, WORLD_SIZE));
+        const glm::vec3 scale(random(state, 0.5f, 2.0f), random(state, 0.5f, 4.0f), random(state, 0.5f, 2.0f));
+        models[i] = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), position), random(state, 0.0f, 6.28f), glm::vec3(0.0f, 1.0f, 0.0f)), scale);
+        materials[i] = i % MATERIAL_COUNT;
+    }
+
+    cout << objects << " objects, " << MATERIAL_COUNT << " materials" << endl;
+    cout << setw(14) << "views" << setw(12) << "cull ms" << setw(10) << "draws" << setw(10) << "shared"
+         << setw(12) << "upload KB" << setw(12) << "objects KB" << endl;
+    bool correct = true;
+    for (int s = 0; s < 3; ++s)
+    {
+        MultiViewRenderer renderer;
+        renderer.SetOffsetAlignment(256);
+        for (int m = 0; m < MATERIAL_COUNT; ++m)
+            renderer.AddMaterial(glm::vec3(m / float(MATERIAL_COUNT)));
+        for (int i = 0; i < objects; ++i)
+            renderer.AddObject(localMin, localMax, models[i], materials[i]);
+        for (size_t v = 0; v < setups[s].views.size(); ++v)
+            renderer.AddView(setups[s].views[v]);
+        renderer.Cull();    // builds the tree
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame)
+            renderer.Cull();
+        const double cullTime = millisecondsSince(start) / frames;
+
+        size_t draws = 0;
+        for (size_t v = 0; v < renderer.GetViewCount(); ++v)
+            draws += renderer.GetDrawList(static_cast<int>(v)).size();
+        cout << setw(14) << setups[s].name << fixed << setprecision(3) << setw(12) << cullTime << setw(10) << draws
+             << setw(10) << renderer.GetSharedObjectCount() << setprecision(1) << setw(12) << renderer.GetUploadBytes() / 1024.0
+             << setw(12) << renderer.GetObjectBytes() / 1024.0 << endl;
+
+        // Brute force: every view's list, grouped by material, and the union of them
+        vector<char> seen(objects, 0);
+        size_t expectedShared = 0;
+        for (size_t v = 0; v < setups[s].views.size(); ++v)
+        {
+            glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+            ExtractFrustumPlanes(setups[s].views[v].projection * setups[s].views[v].view, planes);
+            vector<ViewDraw> expected;
+            for (int i = 0; i < objects; ++i)
+            {
+                const glm::vec3 worldCenter(models[i][3]);
+                const glm::mat3 m(models[i]);
+                const glm::vec3 extent = 0.5f * (glm::abs(m[0]) + glm::abs(m[1]) + glm::abs(m[2]));
+                if (insideFrustum(planes, worldCenter - extent, worldCenter + extent))
+                {
+                    ViewDraw draw;
+                    draw.material = materials[i];
+                    draw.object = i;
+                    expected.push_back(draw);
+                    expectedShared += seen[i] ? 0 : 1;
+                    seen[i] = 1;
+                }
+            }
+            sort(expected.begin(), expected.end(), drawOrder);
+            vector<ViewDraw> found = renderer.GetDrawList(static_cast<int>(v));
+            bool same = found.size() == expected.size();
+            for (size_t d = 1; same && d < found.size(); ++d)
+                same = found[d - 1].material <= found[d].material;
+            sort(found.begin(), found.end(), drawOrder);
+            for (size_t d = 0; same && d < found.size(); ++d)
+                same = found[d].object == expected[d].object && found[d].material == expected[d].material;
+            correct = correct && same;
+        }
+        correct = correct && expectedShared == renderer.GetSharedObjectCount();
+    }
+
+    cout << (correct ? "INFO: draw lists match brute force" : "ERROR: draw lists differ from brute force") << endl;
+    exit(correct ? EXIT_SUCCESS : EXIT_FAILURE);
+}
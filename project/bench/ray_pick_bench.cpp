@@ -0,0 +1,198 @@
+/* Ray picking benchmark: pick times of engine/ray_picker.h on a scene of
+ * millions of triangles, with the AVX and scalar triangle tests, and picks
+ * checked against a loop over every triangle.
+ *
+ * usage: ray_pick_bench [-t triangles per mesh] [-i instances] [-p picks]
+ *
+ * One bumpy sphere of 256k triangles (by default) is placed 16 times with
+ * different rotations and scales, four million triangles in all. The cursor
+ * is dragged across the screen, picking at every step as the tutorials do
+ * while a button is held.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <engine/ray_picker.h>
+
+using namespace std; // Uses the standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const float PI = 3.14159265f;
+
+    double millisecondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // Latitude/longitude sphere with ridges, as interleaved position + normal floats and GLuint indices
+    void createSphere(int rings, int segments, vector<float> &vertices, vector<unsigned> &indices)
+    {
+        for (int r = 0; r <= rings; ++r)
+        {
+            const float theta = PI * r / rings;
+            for (int s = 0; s <= segments; ++s)
+            {
+                const float phi = 2.0f * PI * s / segments;
+                const glm::vec3 normal(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+                const glm::vec3 position = normal * (1.0f + 0.05f * sin(13.0f * theta) * sin(17.0f * phi));
+                vertices.insert(vertices.end(), { position.x, position.y, position.z, normal.x, normal.y, normal.z });
+            }
+        }
+        for (int r = 0; r < rings; ++r)
+        {
+            for (int s = 0; s < segments; ++s)
+            {
+                const unsigned a = r * (segments + 1) + s, b = a + segments + 1;
+                indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+            }
+        }
+    }
+
+    // Nearest hit of a world-space ray over every triangle of every object
+    bool bruteForce(const vector<float> &vertices, const vector<unsigned> &indices, const vector<glm::mat4> &models,
+                    const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, PickHit &hit)
+    {
+        hit.object = -1;
+        hit.distance = maxDistance;
+        for (size_t o = 0; o < models.size(); ++o)
+        {
+            for (size_t i = 0; i < indices.size(); i += 3)
+            {
+                glm::vec3 v[3];
+                for (int c = 0; c < 3; ++c)
+                    v[c] = glm::vec3(models[o] * glm::vec4(vertices[indices[i + c] * 6], vertices[indices[i + c] * 6 + 1], vertices[indices[i + c] * 6 + 2], 1.0f));
+                const glm::vec3 edge1 = v[1] - v[0], edge2 = v[2] - v[0];
+                const glm::vec3 p = glm::cross(direction, edge2);
+                const float det = glm::dot(edge1, p);
+                if (fabs(det) < 1e-12f)
+                    continue;
+                const glm::vec3 s = origin - v[0];
+                const float u = glm::dot(s, p) / det;
+                const glm::vec3 q = glm::cross(s, edge1);
+                const float w = glm::dot(direction, q) / det;
+                const float t = glm::dot(edge2, q) / det;
+                if (u >= 0.0f && w >= 0.0f && u + w <= 1.0f && t > 0.0f && t < hit.distance)
+                {
+                    hit.object = static_cast<int>(o);
+                    hit.triangle = static_cast<int>(i / 3);
+                    hit.distance = t;
+                }
+            }
+        }
+        return hit.object >= 0;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int triangles = 256 * 1024;
+    int instances = 16;
+    int picks = 2000;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            triangles = max(8, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            instances = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            picks = max(1, atoi(argv[++i]));
+        else
+        {
+            cout << "usage: " << argv[0] << " [-t triangles per mesh] [-i instances] [-p picks]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // rings * segments * 2 triangles, twice as many segments as rings
+    const int rings = max(2, static_cast<int>(sqrt(triangles / 4.0)));
+    vector<float> vertices;
+    vector<unsigned> indices;
+    createSphere(rings, rings * 2, vertices, indices);
+
+    RayPicker picker;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const int mesh = picker.AddMesh(vertices.data(), 6, vertices.size() / 6, indices.data(), indices.size());
+    const double meshTime = millisecondsSince(start);
+
+    // A square grid of spheres facing the camera
+    const int columns = static_cast<int>(ceil(sqrt(static_cast<double>(instances))));
+    vector<glm::mat4> models(instances);
+    for (int i = 0; i < instances; ++i)
+    {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * (i % columns - 0.5f * (columns - 1)), 3.0f * (i / columns - 0.5f * (columns - 1)), 0.0f));
+        model = glm::rotate(model, 0.7f * i, glm::normalize(glm::vec3(1.0f, 2.0f, 3.0f)));
+        models[i] = glm::scale(model, glm::vec3(1.0f + 0.1f * (i % 3), 1.0f, 1.0f - 0.1f * (i % 2)));
+        picker.AddObject(mesh, models[i]);
+    }
+    cout << indices.size() / 3 * instances << " triangles in " << instances << " objects" << endl;
+    cout << setw(14) << "mesh" << fixed << setprecision(3) << setw(10) << meshTime << " ms" << endl;
+
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 2.5f * columns + 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    const glm::mat4 viewProjection = projection * view;
+
+    // A drag along a Lissajous curve, one pick per step
+    vector<glm::vec2> cursor(picks);
+    for (int p = 0; p < picks; ++p)
+        cursor[p] = glm::vec2(0.9f * sin(0.011f * p), 0.9f * sin(0.017f * p + 0.5f));
+
+    bool correct = true;
+    const char* names[] = { "scalar", "avx" };
+    for (int useAvx = 0; useAvx <= 1; ++useAvx)
+    {
+        picker.SetUseAvx(useAvx != 0);
+        if (useAvx && !picker.UsesAvx())
+        {
+            cout << setw(14) << names[useAvx] << "  not supported by this CPU" << endl;
+            continue;
+        }
+        vector<PickHit> hits(picks);
+        double total = 0.0, worst = 0.0;
+        int hitCount = 0;
+        for (int p = 0; p < picks; ++p)
+        {
+            start = chrono::steady_clock::now();
+            hitCount += picker.Pick(viewProjection, cursor[p].x, cursor[p].y, hits[p]) ? 1 : 0;
+            const double pickTime = millisecondsSince(start);
+            total += pickTime;
+            worst = max(worst, pickTime);
+        }
+        cout << setw(14) << names[useAvx] << setw(10) << total / picks << " ms per pick, " << worst
+             << " ms worst, " << hitCount << "/" << picks << " hits" << endl;
+
+        // Brute force on a sample of the drag
+        const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+        for (int p = 0; p < picks; p += max(1, picks / 20))
+        {
+            const glm::vec4 nearPoint = inverseViewProjection * glm::vec4(cursor[p], -1.0f, 1.0f);
+            const glm::vec4 farPoint = inverseViewProjection * glm::vec4(cursor[p], 1.0f, 1.0f);
+            const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+            const glm::vec3 segment = glm::vec3(farPoint) / farPoint.w - origin;
+            PickHit expected;
+            bruteForce(vertices, indices, models, origin, glm::normalize(segment), glm::length(segment), expected);
+            if (expected.object != hits[p].object
+                || (expected.object >= 0 && fabs(expected.distance - hits[p].distance) > 1e-3f * expected.distance))
+            {
+                cout << "ERROR: pick " << p << " hit object " << hits[p].object << " at " << hits[p].distance
+                     << ", expected " << expected.object << " at " << expected.distance << endl;
+                correct = false;
+            }
+        }
+    }
+
+    cout << (correct ? "INFO: picks match brute force" : "ERROR: picks differ from brute force") << endl;
+    exit(correct ? EXIT_SUCCESS : EXIT_FAILURE);
+}
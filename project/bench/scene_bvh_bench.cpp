@@ -0,0 +1,190 @@
+/* Scene BVH benchmark: build, refit and query times of engine/scene_bvh.h,
+ * with every query checked against a loop over all objects.
+ *
+ * usage: scene_bvh_bench [-o objects] [-f frames] [-m moving percent]
+ *
+ * A million boxes (by default) are scattered through a 1000-unit cube. Every
+ * frame one percent of them drift and jitter, the tree is updated, and the
+ * frustum, sphere, box and ray queries run; the last frame's results are
+ * compared with brute force.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <engine/quaternion_camera.h>
+#include <engine/scene_bvh.h>
+
+using namespace std; // Uses the standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const float WORLD_SIZE = 1000.0f;
+
+    // xorshift32, so every run benchmarks the same scene
+    float random(unsigned &state, float low, float high)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return low + (high - low) * ((state >> 8) * (1.0f / 16777216.0f));
+    }
+
+    double millisecondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    void report(const char* name, double milliseconds, size_t results)
+    {
+        cout << setw(14) << name << fixed << setprecision(3) << setw(10) << milliseconds << " ms";
+        if (results > 0)
+            cout << setw(10) << results << " objects";
+        cout << endl;
+    }
+
+    // Same result as a query, from a loop over every object
+    bool sameObjects(vector<int> found, vector<int> expected)
+    {
+        sort(found.begin(), found.end());
+        sort(expected.begin(), expected.end());
+        return found == expected;
+    }
+
+    bool insideFrustum(const glm::vec4 *planes, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p)
+        {
+            const glm::vec3 corner(planes[p].x >= 0.0f ? boundsMax.x : boundsMin.x,
+                                   planes[p].y >= 0.0f ? boundsMax.y : boundsMin.y,
+                                   planes[p].z >= 0.0f ? boundsMax.z : boundsMin.z);
+            if (glm::dot(glm::vec3(planes[p]), corner) + planes[p].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int objects = 1000000;
+    int frames = 20;
+    float movingPercent = 1.0f;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            objects = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            frames = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            movingPercent = static_cast<float>(max(0.0, min(100.0, atof(argv[++i]))));
+        else
+        {
+            cout << "usage: " << argv[0] << " [-o objects] [-f frames] [-m moving percent]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    unsigned state = 777u;
+    vector<glm::vec3> centers(objects), halfSizes(objects), velocities(objects);
+    SceneBvh bvh;
+    for (int i = 0; i < objects; ++i)
+    {
+        centers[i] = glm::vec3(random(state, 0.0f, WORLD_SIZE), random(state, 0.0f, WORLD_SIZE), random(state, 0.0f, WORLD_SIZE));
+        halfSizes[i] = glm::vec3(random(state, 0.25f, 1.0f), random(state, 0.25f, 1.0f), random(state, 0.25f, 1.0f));
+        velocities[i] = glm::vec3(random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f));
+        bvh.Add(centers[i] - halfSizes[i], centers[i] + halfSizes[i]);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bvh.Update();
+    cout << objects << " objects, " << bvh.GetNodeCount() << " nodes" << endl;
+    report("build", millisecondsSince(start), 0);
+
+    QuaternionCamera camera(glm::vec3(-50.0f, WORLD_SIZE * 0.5f, -50.0f), 45.0f, 0.0f);
+    camera.SetPerspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+    const glm::vec3 sphereCenter(WORLD_SIZE * 0.5f), boxMin(WORLD_SIZE * 0.4f), boxMax(WORLD_SIZE * 0.45f);
+    const float sphereRadius = 40.0f;
+    const glm::vec3 rayOrigin(0.0f), rayDirection(glm::normalize(glm::vec3(1.0f, 0.9f, 0.8f)));
+
+    const int moving = static_cast<int>(objects * movingPercent / 100.0f);
+    double updateTime = 0.0, frustumTime = 0.0, sphereTime = 0.0, boxTime = 0.0, rayTime = 0.0;
+    vector<int> visible, nearSphere, inBox, alongRay;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (int m = 0; m < moving; ++m)
+        {
+            const int i = static_cast<int>(random(state, 0.0f, static_cast<float>(objects))) % objects;
+            centers[i] += velocities[i];
+            bvh.SetBounds(i, centers[i] - halfSizes[i], centers[i] + halfSizes[i]);
+        }
+        start = chrono::steady_clock::now();
+        bvh.Update();
+        updateTime += millisecondsSince(start);
+
+        camera.Rotate(glm::radians(1.0f), 0.0f);
+        visible.clear();
+        start = chrono::steady_clock::now();
+        bvh.QueryFrustum(camera.GetFrustumPlanes(), visible);
+        frustumTime += millisecondsSince(start);
+
+        nearSphere.clear();
+        start = chrono::steady_clock::now();
+        bvh.QuerySphere(sphereCenter, sphereRadius, nearSphere);
+        sphereTime += millisecondsSince(start);
+
+        inBox.clear();
+        start = chrono::steady_clock::now();
+        bvh.QueryAabb(boxMin, boxMax, inBox);
+        boxTime += millisecondsSince(start);
+
+        alongRay.clear();
+        start = chrono::steady_clock::now();
+        bvh.QueryRay(rayOrigin, rayDirection, WORLD_SIZE * 2.0f, alongRay);
+        rayTime += millisecondsSince(start);
+    }
+    cout << frames << " frames, " << moving << " objects moving per frame" << endl;
+    report("update", updateTime / frames, 0);
+    report("frustum", frustumTime / frames, visible.size());
+    report("sphere", sphereTime / frames, nearSphere.size());
+    report("aabb", boxTime / frames, inBox.size());
+    report("ray", rayTime / frames, alongRay.size());
+
+    // Brute force over the last frame's scene
+    vector<int> expectedVisible, expectedSphere, expectedBox, expectedRay;
+    const glm::vec4 *planes = camera.GetFrustumPlanes();
+    const glm::vec3 inverseDirection = 1.0f / rayDirection;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < objects; ++i)
+    {
+        if (insideFrustum(planes, centers[i] - halfSizes[i], centers[i] + halfSizes[i]))
+            expectedVisible.push_back(i);
+    }
+    report("frustum loop", millisecondsSince(start), expectedVisible.size());
+    for (int i = 0; i < objects; ++i)
+    {
+        const glm::vec3 boundsMin = centers[i] - halfSizes[i], boundsMax = centers[i] + halfSizes[i];
+        const glm::vec3 nearest = glm::clamp(sphereCenter, boundsMin, boundsMax);
+        if (glm::dot(nearest - sphereCenter, nearest - sphereCenter) <= sphereRadius * sphereRadius)
+            expectedSphere.push_back(i);
+        if (glm::all(glm::lessThanEqual(boundsMin, boxMax)) && glm::all(glm::greaterThanEqual(boundsMax, boxMin)))
+            expectedBox.push_back(i);
+        if (scene_bvh::rayEnter(boundsMin, boundsMax, rayOrigin, inverseDirection, WORLD_SIZE * 2.0f) != FLT_MAX)
+            expectedRay.push_back(i);
+    }
+
+    const bool correct = sameObjects(visible, expectedVisible) && sameObjects(nearSphere, expectedSphere)
+                      && sameObjects(inBox, expectedBox) && sameObjects(alongRay, expectedRay);
+    cout << (correct ? "INFO: all queries match brute force" : "ERROR: queries differ from brute force") << endl;
+    exit(correct ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,163 @@
+/* Model matrix composition benchmark: the glm::translate * glm::rotate *
+ * glm::scale chain used by the tutorials against the batched composers of
+ * engine/transform_soa.h.
+ *
+ * usage: trs_compose_bench [-n passes] [-o objects]
+ *
+ * Every pass composes the matrices of all objects (100000 by default); each
+ * composer's output is compared against the GLM chain.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <engine/transform_soa.h>
+
+using namespace std; // Uses the standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // What the tutorials keep per object
+    struct EulerTransform
+    {
+        glm::vec3 position;
+        glm::vec3 axis;
+        float angle;
+        glm::vec3 scale;
+    };
+
+    // xorshift32, so every run benchmarks the same scene
+    float random(unsigned &state, float low, float high)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return low + (high - low) * ((state >> 8) * (1.0f / 16777216.0f));
+    }
+
+    float maxDifference(const vector<glm::mat4> &a, const vector<glm::mat4> &b)
+    {
+        float difference = 0.0f;
+        for (size_t i = 0; i < a.size(); ++i)
+            for (int c = 0; c < 4; ++c)
+                for (int r = 0; r < 4; ++r)
+                    difference = max(difference, fabs(a[i][c][r] - b[i][c][r]));
+        return difference;
+    }
+
+    // Keeps the optimizer from dropping the work
+    float checksum(const vector<glm::mat4> &models)
+    {
+        float sum = 0.0f;
+        for (size_t i = 0; i < models.size(); i += 97)
+            sum += models[i][3][0] + models[i][0][0];
+        return sum;
+    }
+
+    void report(const char* mode, double milliseconds, double chainMilliseconds, size_t objects, int passes, float difference)
+    {
+        cout << setw(10) << mode << fixed << setprecision(3)
+             << setw(10) << milliseconds / passes << " ms/pass"
+             << setw(10) << setprecision(1) << objects * static_cast<double>(passes) / (milliseconds * 1000.0) << " Mobj/s"
+             << setw(8) << setprecision(2) << chainMilliseconds / milliseconds << "x"
+             << "   max error " << scientific << setprecision(1) << difference << endl;
+        cout.unsetf(ios::floatfield);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int passes = 50;
+    size_t objects = 100000;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            passes = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            objects = static_cast<size_t>(max(1, atoi(argv[++i])));
+        else
+        {
+            cout << "usage: " << argv[0] << " [-n passes] [-o objects]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The same random scene in both representations
+    vector<EulerTransform> scene(objects);
+    TransformSoA transforms;
+    unsigned state = 12345u;
+    for (size_t i = 0; i < objects; ++i)
+    {
+        EulerTransform &t = scene[i];
+        t.position = glm::vec3(random(state, -100.0f, 100.0f), random(state, -100.0f, 100.0f), random(state, -100.0f, 100.0f));
+        t.axis = glm::normalize(glm::vec3(random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f), random(state, 0.1f, 1.0f)));
+        t.angle = random(state, -3.14159265f, 3.14159265f);
+        t.scale = glm::vec3(random(state, 0.5f, 2.0f), random(state, 0.5f, 2.0f), random(state, 0.5f, 2.0f));
+        transforms.Add(t.position, glm::angleAxis(t.angle, t.axis), t.scale);
+    }
+
+    vector<glm::mat4> reference(objects), models(objects);
+    float sum = 0.0f;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < objects; ++i)
+            reference[i] = glm::translate(scene[i].position) * glm::rotate(scene[i].angle, scene[i].axis) * glm::scale(scene[i].scale);
+        sum += checksum(reference);
+    }
+    const double chain = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    cout << objects << " objects, " << passes << " pass(es)" << endl;
+    report("glm chain", chain, chain, objects, passes, 0.0f);
+
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        transforms.ComposeScalar(&models[0]);
+        sum += checksum(models);
+    }
+    report("scalar", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), chain, objects, passes, maxDifference(reference, models));
+
+#ifdef TRANSFORM_SOA_SSE
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        transforms.ComposeSse(&models[0]);
+        sum += checksum(models);
+    }
+    report("sse", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), chain, objects, passes, maxDifference(reference, models));
+
+    if (transforms.GetLevel() == TRANSFORM_SIMD_AVX)
+    {
+        start = chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            transforms.ComposeAvx(&models[0]);
+            sum += checksum(models);
+        }
+        report("avx", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), chain, objects, passes, maxDifference(reference, models));
+    }
+    else
+    {
+        cout << "INFO: CPU has no AVX, skipping the 8-wide composer" << endl;
+    }
+#else
+    cout << "Built without SSE; only the scalar composer is available" << endl;
+#endif
+
+    cout << "INFO: checksum " << sum << endl;
+    exit(EXIT_SUCCESS);
+}
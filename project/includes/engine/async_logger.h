@@ -0,0 +1,416 @@
+/* Logging that costs the calling thread a timestamp and a memcpy.
+ *
+ * Log() copies the message into a fixed-size ring of slots and returns; a
+ * background thread formats whatever has arrived and hands it to the file
+ * (and stderr) in one fwrite() per batch, so an error repeated every frame
+ * no longer opens, appends to and closes a file each time:
+ *
+ *     AsyncLogger gLog;
+ *     gLog.Start("error_log.txt");
+ *     gLog.Log(LOG_ERROR, "Shader has no Transforms block");
+ *     ...
+ *     gLog.Stop();                 // writes everything still queued
+ *
+ * The ring is a bounded multi-producer, single-consumer queue: producers
+ * claim slots with one compare-and-swap on the tail and publish each slot
+ * through its sequence number, the writer thread frees them in order. A
+ * message longer than one slot claims several consecutive slots in the same
+ * swap, so its pieces are never interleaved with another thread's. When the
+ * ring is full the message is dropped, counted, and the count is reported
+ * in the log instead; logging never blocks. While no writer is running
+ * (before Start(), after Stop(), or when the file could not be opened) there
+ * is nobody to empty the ring, so Log() writes the message to stderr itself.
+ * Stop() waits for Log() calls already past that check to publish, so a
+ * message Log() accepted is never left in the ring.
+ *
+ * Messages below the level set with SetLevel() return before taking the
+ * timestamp. Identical messages are rate limited: each one may be logged
+ * LOG_RATE_LIMIT times per LOG_RATE_WINDOW_SECONDS, and the next one logged
+ * after the window says how many repeats were suppressed. Identical means
+ * equal hashes in a small table, so the limit is per message text, not per
+ * call site, and two messages sharing a table entry share its budget.
+ */
+
+#ifndef ASYNC_LOGGER_H
+#define ASYNC_LOGGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+const size_t ASYNC_LOG_SLOTS = 4096;            // ring capacity, a power of two
+const size_t ASYNC_LOG_SLOT_TEXT = 104;         // message bytes per slot (slots are 128 bytes)
+const unsigned ASYNC_LOG_MAX_SLOTS = 32;        // longer messages are truncated
+const size_t ASYNC_LOG_BATCH_BYTES = 64 * 1024; // written once this much is formatted
+const int ASYNC_LOG_IDLE_MILLISECONDS = 2;      // writer sleep when the ring is empty
+const unsigned LOG_RATE_LIMIT = 10;             // identical messages per window
+const double LOG_RATE_WINDOW_SECONDS = 1.0;
+const size_t LOG_RATE_TABLE_SIZE = 256;         // a power of two
+
+enum LogSeverity { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR, LOG_SEVERITY_COUNT };
+
+
+namespace async_logger
+{
+    const char* const SEVERITY_NAMES[LOG_SEVERITY_COUNT] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+    // One piece of a message; the first piece of a message carries its header
+    struct Slot
+    {
+        std::atomic<size_t> sequence;   // position + 1 once published, position + capacity once freed
+        long long time;                 // nanoseconds since the logger was created
+        unsigned suppressed;            // repeats of this message dropped by the rate limit
+        unsigned short length;          // text bytes in this slot
+        unsigned char severity;
+        unsigned char pieces;           // slots of the message, 0 in continuation slots
+        char text[ASYNC_LOG_SLOT_TEXT];
+    };
+
+    // Rate limit state of the messages hashing to one table entry
+    struct RateEntry
+    {
+        std::atomic<unsigned> hash;
+        std::atomic<long long> windowStart;
+        std::atomic<unsigned> count;
+        std::atomic<unsigned> suppressed;
+    };
+
+    // FNV-1a
+    inline unsigned hashText(const char* text, size_t length)
+    {
+        unsigned hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i)
+            hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+        return hash;
+    }
+
+    // One unbuffered fwrite() of the whole batch
+    inline bool writeAll(std::FILE* file, const char* data, size_t size)
+    {
+        const bool written = std::fwrite(data, 1, size, file) == size;
+        return std::fflush(file) == 0 && written;
+    }
+
+    // "[  12.345678] ERROR: " in front of a message
+    inline int formatHeader(char* header, size_t size, long long time, int severity)
+    {
+        return snprintf(header, size, "[%11.6f] %s: ", time * 1e-9, SEVERITY_NAMES[severity]);
+    }
+}
+
+
+class AsyncLogger
+{
+public:
+    AsyncLogger() : mSlots(ASYNC_LOG_SLOTS), mRates(LOG_RATE_TABLE_SIZE), mTail(0), mWritten(0), mDropped(0),
+                    mLevel(LOG_INFO), mEchoLevel(LOG_WARNING), mRunning(false), mProducers(0), mStopWriter(false),
+                    mFile(NULL), mHead(0), mReportedDropped(0),
+                    mEpoch(std::chrono::steady_clock::now())
+    {
+        for (size_t i = 0; i < ASYNC_LOG_SLOTS; ++i)
+            mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        for (size_t i = 0; i < LOG_RATE_TABLE_SIZE; ++i)
+        {
+            mRates[i].hash.store(0, std::memory_order_relaxed);
+            mRates[i].windowStart.store(0, std::memory_order_relaxed);
+            mRates[i].count.store(0, std::memory_order_relaxed);
+            mRates[i].suppressed.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~AsyncLogger()
+    {
+        Stop();
+    }
+
+    // Opens 'path' for appending and starts the writer; on failure messages keep going to stderr
+    bool Start(const char* path)
+    {
+        Stop();
+        mFile = std::fopen(path, "a");
+        if (!mFile)
+        {
+            std::cout << "ERROR::ASYNC_LOGGER::CANNOT_OPEN " << path << std::endl;
+            return false;
+        }
+
+        // Runs append to the same file, so mark where this one begins
+        char banner[64];
+        const std::time_t now = std::time(NULL);
+        const size_t length = std::strftime(banner, sizeof(banner), "--- log started %Y-%m-%d %H:%M:%S ---\n", std::localtime(&now));
+        std::setvbuf(mFile, NULL, _IONBF, 0);    // batches are already whole
+        async_logger::writeAll(mFile, banner, length);
+
+        // Set before the thread exists, so drops in the moment before it is scheduled are still reported
+        mReportedDropped = mDropped.load(std::memory_order_relaxed);
+        mStopWriter.store(false);
+        mRunning.store(true);
+        mWriter = std::thread(&AsyncLogger::writerLoop, this);
+        return true;
+    }
+
+    // Writes what is queued, then stops the writer and closes the file
+    void Stop()
+    {
+        if (mWriter.joinable())
+        {
+            // Log() calls that saw the flag still set are queueing; the writer's last drain must see them
+            mRunning.store(false);
+            while (mProducers.load() != 0)
+                std::this_thread::yield();
+            mStopWriter.store(true);
+            mWriter.join();
+        }
+        if (mFile)
+            std::fclose(mFile);
+        mFile = NULL;
+    }
+
+    // Messages below 'level' are ignored; those at or above 'echoLevel' also go to stderr
+    void SetLevel(LogSeverity level) { mLevel.store(level, std::memory_order_relaxed); }
+    void SetEchoLevel(LogSeverity echoLevel) { mEchoLevel.store(echoLevel, std::memory_order_relaxed); }
+
+    // Queues a message from any thread; false when it was filtered, rate limited or the ring was full.
+    // Without a running writer the message is written to stderr before returning. True means the
+    // message is written, even when Stop() runs concurrently.
+    bool Log(LogSeverity severity, const char* text, size_t length)
+    {
+        if (severity < mLevel.load(std::memory_order_relaxed))
+            return false;
+        const long long time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mEpoch).count();
+
+        unsigned suppressed = 0;
+        if (!allowRate(text, length, time, suppressed))
+            return false;
+        // Registered before the check, so Stop() either is seen here or waits for this message
+        mProducers.fetch_add(1);
+        if (!mRunning.load())
+        {
+            mProducers.fetch_sub(1, std::memory_order_release);
+            writeDirect(severity, text, length, time, suppressed);
+            return true;
+        }
+
+        length = std::min(length, ASYNC_LOG_MAX_SLOTS * ASYNC_LOG_SLOT_TEXT);
+        const size_t pieces = std::max<size_t>(1, (length + ASYNC_LOG_SLOT_TEXT - 1) / ASYNC_LOG_SLOT_TEXT);
+        size_t position;
+        if (!claim(pieces, position))
+        {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            mProducers.fetch_sub(1, std::memory_order_release);
+            return false;
+        }
+
+        for (size_t piece = 0; piece < pieces; ++piece)
+        {
+            async_logger::Slot &slot = mSlots[(position + piece) & (ASYNC_LOG_SLOTS - 1)];
+            const size_t offset = piece * ASYNC_LOG_SLOT_TEXT;
+            slot.length = static_cast<unsigned short>(std::min(ASYNC_LOG_SLOT_TEXT, length - offset));
+            memcpy(slot.text, text + offset, slot.length);
+            slot.time = time;
+            slot.severity = static_cast<unsigned char>(severity);
+            slot.suppressed = piece == 0 ? suppressed : 0;
+            slot.pieces = static_cast<unsigned char>(piece == 0 ? pieces : 0);
+            slot.sequence.store(position + piece + 1, std::memory_order_release);
+        }
+        mProducers.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    bool Log(LogSeverity severity, const char* text) { return Log(severity, text, strlen(text)); }
+    bool Log(LogSeverity severity, const std::string &text) { return Log(severity, text.data(), text.size()); }
+
+    // Waits until every message queued before the call is written
+    void Flush()
+    {
+        const size_t target = mTail.load(std::memory_order_acquire);
+        while (mWriter.joinable() && mWritten.load(std::memory_order_acquire) < target)
+            std::this_thread::sleep_for(std::chrono::milliseconds(ASYNC_LOG_IDLE_MILLISECONDS));
+    }
+
+    // Messages lost to a full ring since the logger was created
+    size_t GetDroppedCount() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<async_logger::Slot> mSlots;
+    std::vector<async_logger::RateEntry> mRates;
+    std::atomic<size_t> mTail;              // next position producers claim
+    std::atomic<size_t> mWritten;           // positions written out by the writer
+    std::atomic<size_t> mDropped;
+    std::atomic<int> mLevel;
+    std::atomic<int> mEchoLevel;
+    std::atomic<bool> mRunning;
+    std::atomic<unsigned> mProducers;       // Log() calls between the mRunning check and publishing
+    std::atomic<bool> mStopWriter;          // set by Stop() once no Log() call is still queueing
+    std::thread mWriter;
+    std::FILE* mFile;
+
+    // Writer thread only
+    size_t mHead;                           // next position to read
+    size_t mReportedDropped;                // drops already mentioned in the log
+    std::vector<char> mFileBatch;
+    std::vector<char> mEchoBatch;
+
+    const std::chrono::steady_clock::time_point mEpoch;
+
+    // Claims 'pieces' consecutive positions; the writer frees slots in order, so the last one being free means all are
+    bool claim(size_t pieces, size_t &position)
+    {
+        position = mTail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const size_t last = position + pieces - 1;
+            const size_t sequence = mSlots[last & (ASYNC_LOG_SLOTS - 1)].sequence.load(std::memory_order_acquire);
+            const long long difference = static_cast<long long>(sequence) - static_cast<long long>(last);
+            if (difference < 0)
+                return false;   // full
+            if (difference == 0)
+            {
+                if (mTail.compare_exchange_weak(position, position + pieces, std::memory_order_relaxed))
+                    return true;
+            }
+            else
+                position = mTail.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Counts the message against its table entry; opening a new window hands back the repeats suppressed in the last one
+    bool allowRate(const char* text, size_t length, long long time, unsigned &suppressed)
+    {
+        const unsigned hash = async_logger::hashText(text, length);
+        async_logger::RateEntry &entry = mRates[hash & (LOG_RATE_TABLE_SIZE - 1)];
+        const long long window = static_cast<long long>(LOG_RATE_WINDOW_SECONDS * 1e9);
+        if (entry.hash.load(std::memory_order_relaxed) != hash
+            || time - entry.windowStart.load(std::memory_order_relaxed) >= window)
+        {
+            // Races here only blur the counts of one window
+            const bool sameMessage = entry.hash.exchange(hash, std::memory_order_relaxed) == hash;
+            entry.windowStart.store(time, std::memory_order_relaxed);
+            entry.count.store(1, std::memory_order_relaxed);
+            const unsigned previous = entry.suppressed.exchange(0, std::memory_order_relaxed);
+            suppressed = sameMessage ? previous : 0;
+            return true;
+        }
+        if (entry.count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT)
+            return true;
+        entry.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void writerLoop()
+    {
+        mFileBatch.reserve(ASYNC_LOG_BATCH_BYTES + 1024);
+        mEchoBatch.reserve(ASYNC_LOG_BATCH_BYTES + 1024);
+        for (;;)
+        {
+            // Read the flag first, so a stop request still drains what was queued before it
+            const bool stopping = mStopWriter.load();
+            if (!drain() && stopping)
+                break;
+            if (mWritten.load(std::memory_order_relaxed) == mTail.load(std::memory_order_relaxed))
+                std::this_thread::sleep_for(std::chrono::milliseconds(ASYNC_LOG_IDLE_MILLISECONDS));
+        }
+    }
+
+    // Formats every published message, writing a batch whenever it fills; false when there was nothing
+    bool drain()
+    {
+        bool any = false;
+        for (;;)
+        {
+            async_logger::Slot &first = mSlots[mHead & (ASYNC_LOG_SLOTS - 1)];
+            if (first.sequence.load(std::memory_order_acquire) != mHead + 1)
+                break;
+
+            // A message's other pieces were claimed together with it and follow shortly
+            const size_t pieces = first.pieces;
+            for (size_t piece = 1; piece < pieces; ++piece)
+            {
+                while (mSlots[(mHead + piece) & (ASYNC_LOG_SLOTS - 1)].sequence.load(std::memory_order_acquire) != mHead + piece + 1)
+                    std::this_thread::yield();
+            }
+            const bool echo = first.severity >= mEchoLevel.load(std::memory_order_relaxed);
+            format(first, pieces, mFileBatch);
+            if (echo)
+                format(first, pieces, mEchoBatch);
+            for (size_t piece = 0; piece < pieces; ++piece)
+                mSlots[(mHead + piece) & (ASYNC_LOG_SLOTS - 1)].sequence.store(mHead + piece + ASYNC_LOG_SLOTS, std::memory_order_release);
+            mHead += pieces;
+            any = true;
+
+            if (mFileBatch.size() >= ASYNC_LOG_BATCH_BYTES || mEchoBatch.size() >= ASYNC_LOG_BATCH_BYTES)
+                writeBatch();
+        }
+
+        const size_t dropped = mDropped.load(std::memory_order_relaxed);
+        if (dropped != mReportedDropped)
+        {
+            char line[96];
+            const int length = snprintf(line, sizeof(line), "WARNING: %zu messages dropped, the log ring was full\n", dropped - mReportedDropped);
+            mFileBatch.insert(mFileBatch.end(), line, line + length);
+            if (LOG_WARNING >= mEchoLevel.load(std::memory_order_relaxed))
+                mEchoBatch.insert(mEchoBatch.end(), line, line + length);
+            mReportedDropped = dropped;
+            any = true;
+        }
+        if (any)
+            writeBatch();
+        return any;
+    }
+
+    // The fallback while no writer runs: one fwrite() so concurrent callers' lines stay whole
+    static void writeDirect(LogSeverity severity, const char* text, size_t length, long long time, unsigned suppressed)
+    {
+        char header[64];
+        const int headerLength = async_logger::formatHeader(header, sizeof(header), time, severity);
+        std::string line(header, headerLength);
+        line.append(text, length);
+        if (suppressed > 0)
+        {
+            char trailer[48];
+            line.append(trailer, snprintf(trailer, sizeof(trailer), " (%u repeats suppressed)", suppressed));
+        }
+        line += '\n';
+        async_logger::writeAll(stderr, line.data(), line.size());
+    }
+
+    // "[  12.345678] ERROR: text (37 repeats suppressed)\n"
+    void format(const async_logger::Slot &first, size_t pieces, std::vector<char> &batch)
+    {
+        char header[64];
+        const int headerLength = async_logger::formatHeader(header, sizeof(header), first.time, first.severity);
+        batch.insert(batch.end(), header, header + headerLength);
+        for (size_t piece = 0; piece < pieces; ++piece)
+        {
+            const async_logger::Slot &slot = mSlots[(mHead + piece) & (ASYNC_LOG_SLOTS - 1)];
+            batch.insert(batch.end(), slot.text, slot.text + slot.length);
+        }
+        if (first.suppressed > 0)
+        {
+            char trailer[48];
+            const int trailerLength = snprintf(trailer, sizeof(trailer), " (%u repeats suppressed)", first.suppressed);
+            batch.insert(batch.end(), trailer, trailer + trailerLength);
+        }
+        batch.push_back('\n');
+    }
+
+    void writeBatch()
+    {
+        if (!mFileBatch.empty())
+            async_logger::writeAll(mFile, mFileBatch.data(), mFileBatch.size());
+        if (!mEchoBatch.empty())
+            async_logger::writeAll(stderr, mEchoBatch.data(), mEchoBatch.size());
+        mFileBatch.clear();
+        mEchoBatch.clear();
+        mWritten.store(mHead, std::memory_order_release);
+    }
+};
+
+#endif
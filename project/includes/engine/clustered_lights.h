@@ -0,0 +1,349 @@
+/* Clustered forward lighting.
+ *
+ * The view frustum is cut into a grid of froxels: CLUSTER_TILES_X by
+ * CLUSTER_TILES_Y screen tiles, each split into CLUSTER_SLICES depth slices
+ * spaced exponentially between the near and far planes. Every frame Build()
+ * moves the point lights into view space and tests each light's sphere
+ * against the view-space bounds of the froxels in its depth range, four
+ * froxels per SSE compare, with the slices spread over the threads of a
+ * WorkerPool that is started on the first large Build() and kept. The
+ * result goes to three shader storage buffers:
+ *
+ *     binding 3  ClusterLights   one PointLight per light
+ *     binding 4  LightClusters   grid size, tile size, slice mapping and
+ *                                near/far planes, then an (offset, count)
+ *                                pair per froxel
+ *     binding 5  LightIndices    the lights of every froxel, back to back
+ *
+ * A fragment finds its froxel from gl_FragCoord and loops over just the
+ * lights touching it, so shading cost follows the local light count instead
+ * of the total. Requires GL 4.3 for the storage buffers.
+ *
+ *     gClusteredLights.Configure(framebufferWidth, framebufferHeight, glm::radians(gCamera.Zoom), 0.1f, 100.0f);
+ *     gClusteredLights.Build(&gLights[0], gLights.size(), view);
+ *     ... draw with a SHADER_CLUSTERED_LIGHTS program ...
+ */
+
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <engine/math_config.h>    // GpuVec3
+#include <engine/worker_pool.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLUSTERED_LIGHTS_SSE
+#include <emmintrin.h>
+#endif
+
+const unsigned CLUSTER_TILES_X = 16;
+const unsigned CLUSTER_TILES_Y = 9;
+const unsigned CLUSTER_SLICES  = 24;
+const unsigned CLUSTERS_PER_SLICE = CLUSTER_TILES_X * CLUSTER_TILES_Y;  // a multiple of 4 for the SSE loop
+const unsigned CLUSTER_COUNT = CLUSTERS_PER_SLICE * CLUSTER_SLICES;
+
+// uvec4 grid size and light count, vec4 tile size and slice mapping, vec4 near/far
+const unsigned CLUSTER_HEADER_WORDS = 12;
+
+const GLuint CLUSTER_LIGHTS_BINDING  = 3;
+const GLuint LIGHT_CLUSTERS_BINDING  = 4;
+const GLuint LIGHT_INDICES_BINDING   = 5;
+
+// Fewer lights than this are binned on the calling thread
+const size_t CLUSTER_THREADING_THRESHOLD = 64;
+
+// std430 image of the shader's PointLight; falloff reaches 0 at 'radius'
+struct PointLight
+{
+    GpuVec3 position;
+    float radius;
+    GpuVec3 color;
+    float intensity;
+};
+
+static_assert(sizeof(PointLight) == 32, "PointLight must match the std430 layout");
+
+// GLSL side of the buffers, pasted into shaders that read the clusters
+const char* const CLUSTERED_LIGHTS_GLSL = R"(
+struct PointLight
+{
+    vec3 position;
+    float radius;
+    vec3 color;
+    float intensity;
+};
+layout (std430, binding = 3) readonly buffer ClusterLights
+{
+    PointLight lights[];
+};
+layout (std430, binding = 4) readonly buffer LightClusters
+{
+    uvec4 clusterCounts; // tiles x, tiles y, depth slices, total lights
+    vec4 clusterParams; // tile width and height in pixels, log-depth slice scale and bias
+    vec4 clusterDepth; // near and far plane
+    uvec2 clusterRanges[]; // per cluster: first entry in lightIndices, light count
+};
+layout (std430, binding = 5) readonly buffer LightIndices
+{
+    uint lightIndices[];
+};
+
+// Linear view-space depth of a window-space depth value
+float clusterViewDepth(float windowDepth)
+{
+    float ndcDepth = windowDepth * 2.0 - 1.0;
+    return 2.0 * clusterDepth.x * clusterDepth.y / (clusterDepth.y + clusterDepth.x - ndcDepth * (clusterDepth.y - clusterDepth.x));
+}
+
+// Lights of the cluster containing a pixel: screen tile from its position, slice from its depth
+uvec2 clusterRange(vec2 fragCoord, float viewDepth)
+{
+    uvec3 cluster = uvec3(uvec2(fragCoord / clusterParams.xy), uint(max(log(viewDepth) * clusterParams.z + clusterParams.w, 0.0)));
+    cluster = min(cluster, clusterCounts.xyz - 1u);
+    return clusterRanges[(cluster.z * clusterCounts.y + cluster.y) * clusterCounts.x + cluster.x];
+}
+
+// Smooth window reaching 0 at the light's radius
+float lightFalloff(PointLight light, float lightDistance)
+{
+    float window = clamp(1.0 - pow(lightDistance / light.radius, 4.0), 0.0, 1.0);
+    return window * window * light.intensity;
+}
+)";
+
+
+class ClusteredLights
+{
+public:
+    ClusteredLights() : mWidth(0), mHeight(0), mFovY(0.0f), mNear(0.0f), mFar(0.0f), mIndexCount(0)
+    {
+        mBuffers[0] = mBuffers[1] = mBuffers[2] = 0;
+        mSliceMinX.resize(CLUSTER_COUNT);
+        mSliceMinY.resize(CLUSTER_COUNT);
+        mSliceMaxX.resize(CLUSTER_COUNT);
+        mSliceMaxY.resize(CLUSTER_COUNT);
+        mClusterLights.resize(CLUSTER_COUNT);
+    }
+
+    // Rebuilds the froxel bounds; cheap to call every frame, it only does work when the projection changed.
+    // 'width' and 'height' are the current framebuffer size in pixels, which sets the tile size fragments see.
+    void Configure(int width, int height, float fovY, float nearPlane, float farPlane)
+    {
+        if (width == mWidth && height == mHeight && fovY == mFovY && nearPlane == mNear && farPlane == mFar)
+            return;
+        mWidth = width;
+        mHeight = height;
+        mFovY = fovY;
+        mNear = nearPlane;
+        mFar = farPlane;
+
+        const float tanY = std::tan(fovY * 0.5f);
+        const float tanX = tanY * width / static_cast<float>(height);
+        for (unsigned k = 0; k < CLUSTER_SLICES; ++k)
+        {
+            mSliceNear[k] = sliceDepth(k);
+            mSliceFar[k] = sliceDepth(k + 1);
+            for (unsigned j = 0; j < CLUSTER_TILES_Y; ++j)
+            {
+                for (unsigned i = 0; i < CLUSTER_TILES_X; ++i)
+                {
+                    // Tile edges in NDC; the froxel widens with depth, so its box spans both end caps
+                    const float x0 = (-1.0f + 2.0f * i / CLUSTER_TILES_X) * tanX;
+                    const float x1 = (-1.0f + 2.0f * (i + 1) / CLUSTER_TILES_X) * tanX;
+                    const float y0 = (-1.0f + 2.0f * j / CLUSTER_TILES_Y) * tanY;
+                    const float y1 = (-1.0f + 2.0f * (j + 1) / CLUSTER_TILES_Y) * tanY;
+                    const size_t c = k * CLUSTERS_PER_SLICE + j * CLUSTER_TILES_X + i;
+                    mSliceMinX[c] = std::min(x0 * mSliceNear[k], x0 * mSliceFar[k]);
+                    mSliceMaxX[c] = std::max(x1 * mSliceNear[k], x1 * mSliceFar[k]);
+                    mSliceMinY[c] = std::min(y0 * mSliceNear[k], y0 * mSliceFar[k]);
+                    mSliceMaxY[c] = std::max(y1 * mSliceNear[k], y1 * mSliceFar[k]);
+                }
+            }
+        }
+    }
+
+    // Bins 'count' world-space lights for the camera 'view' and uploads the three buffers
+    void Build(const PointLight *lights, size_t count, const glm::mat4 &view)
+    {
+        mViewLights.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const glm::vec4 center = view * glm::vec4(lights[i].position, 1.0f);
+            ViewLight &light = mViewLights[i];
+            light.x = center.x;
+            light.y = center.y;
+            light.depth = -center.z;
+            light.radius = lights[i].radius;
+        }
+
+        // Each worker owns whole slices, so the per-froxel lists need no locking
+        if (count >= CLUSTER_THREADING_THRESHOLD)
+        {
+            const unsigned workers = std::max(1u, std::min(std::thread::hardware_concurrency(), CLUSTER_SLICES / 4));
+            mWorkers.Start(workers - 1);    // once; the threads wait between frames
+            mWorkers.Run(binTask, this);
+        }
+        else
+            binSlices(0, 1);
+
+        // Header, then (offset, count) per froxel
+        mClusterData.resize(CLUSTER_HEADER_WORDS + 2 * CLUSTER_COUNT);
+        mClusterData[0] = CLUSTER_TILES_X;
+        mClusterData[1] = CLUSTER_TILES_Y;
+        mClusterData[2] = CLUSTER_SLICES;
+        mClusterData[3] = static_cast<GLuint>(count);
+        const float logRatio = std::log(mFar / mNear);
+        const float params[8] =
+        {
+            mWidth / static_cast<float>(CLUSTER_TILES_X),
+            mHeight / static_cast<float>(CLUSTER_TILES_Y),
+            CLUSTER_SLICES / logRatio,
+            -static_cast<float>(CLUSTER_SLICES) * std::log(mNear) / logRatio,
+            mNear, mFar, 0.0f, 0.0f
+        };
+        memcpy(&mClusterData[4], params, sizeof(params));
+
+        mIndices.clear();
+        for (unsigned c = 0; c < CLUSTER_COUNT; ++c)
+        {
+            mClusterData[CLUSTER_HEADER_WORDS + 2 * c] = static_cast<GLuint>(mIndices.size());
+            mClusterData[CLUSTER_HEADER_WORDS + 2 * c + 1] = static_cast<GLuint>(mClusterLights[c].size());
+            mIndices.insert(mIndices.end(), mClusterLights[c].begin(), mClusterLights[c].end());
+        }
+        mIndexCount = mIndices.size();
+        if (mIndices.empty())
+            mIndices.push_back(0);  // zero-sized buffers cannot be bound
+
+        upload(0, CLUSTER_LIGHTS_BINDING, std::max<size_t>(count, 1) * sizeof(PointLight), count ? lights : NULL);
+        upload(1, LIGHT_CLUSTERS_BINDING, mClusterData.size() * sizeof(GLuint), &mClusterData[0]);
+        upload(2, LIGHT_INDICES_BINDING, mIndices.size() * sizeof(GLuint), &mIndices[0]);
+    }
+
+    // Froxel references written by the last Build(); a light counts once per froxel it touches
+    size_t GetIndexCount() const { return mIndexCount; }
+    size_t GetLightCount(unsigned cluster) const { return mClusterLights[cluster].size(); }
+
+    void Destroy()
+    {
+        mWorkers.Stop();
+        glDeleteBuffers(3, mBuffers);
+        mBuffers[0] = mBuffers[1] = mBuffers[2] = 0;
+    }
+
+private:
+    struct ViewLight
+    {
+        float x, y, depth, radius;
+    };
+
+    int mWidth;
+    int mHeight;
+    float mFovY;
+    float mNear;
+    float mFar;
+    float mSliceNear[CLUSTER_SLICES];
+    float mSliceFar[CLUSTER_SLICES];
+    // Froxel bounds in view space, slice-major; z comes from the slice
+    std::vector<float> mSliceMinX;
+    std::vector<float> mSliceMinY;
+    std::vector<float> mSliceMaxX;
+    std::vector<float> mSliceMaxY;
+
+    std::vector<ViewLight> mViewLights;
+    std::vector<std::vector<GLuint> > mClusterLights;
+    std::vector<GLuint> mClusterData;
+    std::vector<GLuint> mIndices;
+    size_t mIndexCount;
+    GLuint mBuffers[3];
+    WorkerPool mWorkers;
+
+    float sliceDepth(unsigned k) const
+    {
+        return mNear * std::pow(mFar / mNear, k / static_cast<float>(CLUSTER_SLICES));
+    }
+
+    static void binTask(void *context, unsigned worker, unsigned workers)
+    {
+        static_cast<ClusteredLights*>(context)->binSlices(worker, workers);
+    }
+
+    // Bins every light into slices first, first + stride, first + 2 * stride, ...
+    void binSlices(unsigned first, unsigned stride)
+    {
+        for (unsigned k = first; k < CLUSTER_SLICES; k += stride)
+        {
+            for (unsigned c = 0; c < CLUSTERS_PER_SLICE; ++c)
+                mClusterLights[k * CLUSTERS_PER_SLICE + c].clear();
+
+            for (size_t l = 0; l < mViewLights.size(); ++l)
+            {
+                const ViewLight &light = mViewLights[l];
+                if (light.depth + light.radius < mSliceNear[k] || light.depth - light.radius > mSliceFar[k])
+                    continue;
+
+                // Distance from the light to the slab along z; the x/y part is per froxel
+                const float dz = std::max(0.0f, std::max(mSliceNear[k] - light.depth, light.depth - mSliceFar[k]));
+                const float remaining = light.radius * light.radius - dz * dz;
+                binLight(k, static_cast<GLuint>(l), light, remaining);
+            }
+        }
+    }
+
+    // Sphere against the x/y extents of the froxels of slice k
+    void binLight(unsigned k, GLuint index, const ViewLight &light, float remaining)
+    {
+        const size_t base = k * CLUSTERS_PER_SLICE;
+#ifdef CLUSTERED_LIGHTS_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 x = _mm_set1_ps(light.x);
+        const __m128 y = _mm_set1_ps(light.y);
+        const __m128 limit = _mm_set1_ps(remaining);
+        for (unsigned c = 0; c < CLUSTERS_PER_SLICE; c += 4)
+        {
+            const __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&mSliceMinX[base + c]), x), zero),
+                                         _mm_max_ps(_mm_sub_ps(x, _mm_loadu_ps(&mSliceMaxX[base + c])), zero));
+            const __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&mSliceMinY[base + c]), y), zero),
+                                         _mm_max_ps(_mm_sub_ps(y, _mm_loadu_ps(&mSliceMaxY[base + c])), zero));
+            const __m128 distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            int hits = _mm_movemask_ps(_mm_cmple_ps(distance, limit));
+            while (hits)
+            {
+                const int lane = hits & 1 ? 0 : hits & 2 ? 1 : hits & 4 ? 2 : 3;
+                mClusterLights[base + c + lane].push_back(index);
+                hits &= hits - 1;
+            }
+        }
+#else
+        for (unsigned c = 0; c < CLUSTERS_PER_SLICE; ++c)
+        {
+            const float dx = std::max(0.0f, std::max(mSliceMinX[base + c] - light.x, light.x - mSliceMaxX[base + c]));
+            const float dy = std::max(0.0f, std::max(mSliceMinY[base + c] - light.y, light.y - mSliceMaxY[base + c]));
+            if (dx * dx + dy * dy <= remaining)
+                mClusterLights[base + c].push_back(index);
+        }
+#endif
+    }
+
+    // Replaces a buffer's contents (orphaning the old storage) and binds it
+    void upload(int slot, GLuint binding, size_t bytes, const void *data)
+    {
+        if (!mBuffers[slot])
+            glGenBuffers(1, &mBuffers[slot]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffers[slot]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, data, GL_STREAM_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, mBuffers[slot]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,253 @@
+/* Deferred shading over a compact G-buffer.
+ *
+ * The geometry pass draws every object once with a SHADER_GBUFFER variant of
+ * the standard shader into two color targets and a depth buffer:
+ *
+ *     target 0  RGBA8        albedo, specular intensity in alpha
+ *     target 1  RG16_SNORM   normal, octahedral encoded
+ *     depth     DEPTH24_STENCIL8
+ *
+ * Positions are not stored; the light pass rebuilds them from depth with
+ * the inverse view-projection. Lighting is then one full-screen triangle
+ * that reads the ClusteredLights buffers, so each pixel is shaded exactly
+ * once, only by the lights of its cluster, however much overdraw the
+ * geometry had:
+ *
+ *     gDeferred.BeginGeometry();
+ *     ... draw objects with their GBUFFER programs ...
+ *     gDeferred.Light(projection * view, gCamera.Position);
+ *     gDeferred.CopyDepth();     // forward-drawn objects depth test against the scene
+ *
+ * The G-buffer matches the default framebuffer pixel for pixel, so the
+ * window's framebuffer size callback must pass new sizes to Resize().
+ */
+
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <GL/glew.h>
+
+#include <iostream>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include <engine/clustered_lights.h>
+#include <engine/program_builder.h>
+#include <engine/program_reflection.h>
+#include <engine/standard_shader.h>
+
+// Full-screen triangle from gl_VertexID; no vertex buffers
+const char* const DEFERRED_LIGHT_VERTEX_SHADER = R"(#version 440 core
+
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const std::string DEFERRED_LIGHT_FRAGMENT_SHADER_SOURCE = std::string(R"(#version 440 core
+
+layout (binding = 0) uniform sampler2D gAlbedoSpecular;
+layout (binding = 1) uniform sampler2D gNormal;
+layout (binding = 2) uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+uniform vec3 viewPosition;
+
+out vec4 fragmentColor;
+)") + CLUSTERED_LIGHTS_GLSL + PHONG_LIGHTING_GLSL + OCTAHEDRAL_NORMAL_GLSL + R"(
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0)
+        discard; // nothing was drawn here; keep the clear color
+
+    // World position from the depth buffer
+    vec4 clip = vec4(gl_FragCoord.xy / screenSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * clip;
+    vec3 fragmentPos = world.xyz / world.w;
+
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, pixel, 0);
+    vec3 norm = decodeOctahedral(texelFetch(gNormal, pixel, 0).xy);
+    vec3 viewDir = normalize(viewPosition - fragmentPos);
+
+    float ambientStrength = 0.1f;
+    uvec2 range = clusterRange(gl_FragCoord.xy, clusterViewDepth(depth));
+    vec3 lighting = vec3(ambientStrength);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        PointLight light = lights[lightIndices[range.x + i]];
+        vec3 toLight = light.position - fragmentPos;
+        float lightDistance = length(toLight);
+        lighting += lightFalloff(light, lightDistance) * phong(norm, toLight / max(lightDistance, 1e-4), viewDir, light.color, albedoSpecular.a);
+    }
+
+    fragmentColor = vec4(lighting * albedoSpecular.rgb, 1.0f);
+}
+)";
+const char* const DEFERRED_LIGHT_FRAGMENT_SHADER = DEFERRED_LIGHT_FRAGMENT_SHADER_SOURCE.c_str();
+
+
+class DeferredRenderer
+{
+public:
+    DeferredRenderer() : mWidth(0), mHeight(0), mFramebuffer(0), mDepth(0), mVao(0), mLightProgramId(0)
+    {
+        mTargets[0] = mTargets[1] = 0;
+        mViewport[0] = mViewport[1] = mViewport[2] = mViewport[3] = 0;
+    }
+
+    // Allocates the G-buffer and queues the light pass program on 'builder'
+    bool Create(int width, int height, ProgramBuilder &builder)
+    {
+        mWidth = width;
+        mHeight = height;
+        glGenFramebuffers(1, &mFramebuffer);
+        if (!allocateTargets())
+            return false;
+
+        glGenVertexArrays(1, &mVao);
+        builder.Add(DEFERRED_LIGHT_VERTEX_SHADER, DEFERRED_LIGHT_FRAGMENT_SHADER, mLightProgramId);
+        return true;
+    }
+
+    // Call after the builder finished; looks up the light pass uniforms
+    bool Reflect()
+    {
+        if (!mReflection.Reflect(mLightProgramId))
+            return false;
+        mInverseViewProjection = mReflection.Uniform<glm::mat4>("inverseViewProjection");
+        mScreenSize = mReflection.Uniform<glm::vec2>("screenSize");
+        mViewPosition = mReflection.Uniform<glm::vec3>("viewPosition");
+        mScreenSize.Set(glm::vec2(mWidth, mHeight));
+        return true;
+    }
+
+    // Reallocates the G-buffer for a new framebuffer size; the targets have immutable storage, so they are replaced
+    bool Resize(int width, int height)
+    {
+        if (!mFramebuffer || width <= 0 || height <= 0)
+            return false;
+        if (width == mWidth && height == mHeight)
+            return true;
+
+        mWidth = width;
+        mHeight = height;
+        glDeleteTextures(2, mTargets);
+        glDeleteTextures(1, &mDepth);
+        mScreenSize.Set(glm::vec2(mWidth, mHeight));
+        return allocateTargets();
+    }
+
+    // Binds and clears the G-buffer; the geometry pass draws after this
+    void BeginGeometry()
+    {
+        // The G-buffer covers the whole window; Light() puts the caller's viewport back
+        glGetIntegerv(GL_VIEWPORT, mViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glViewport(0, 0, mWidth, mHeight);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // Shades the G-buffer into the default framebuffer with the clustered lights
+    void Light(const glm::mat4 &viewProjection, const glm::vec3 &viewPosition)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(mViewport[0], mViewport[1], mViewport[2], mViewport[3]);
+        glDisable(GL_DEPTH_TEST);
+
+        glUseProgram(mLightProgramId);
+        mInverseViewProjection.Set(glm::inverse(viewProjection));
+        mViewPosition.Set(viewPosition);
+        mReflection.Flush();
+
+        for (int i = 0; i < 2; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, mTargets[i]);
+        }
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, mDepth);
+        glActiveTexture(GL_TEXTURE0);
+
+        glBindVertexArray(mVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // Copies the scene depth into the default framebuffer for objects drawn forward afterwards
+    void CopyDepth()
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, mFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void Destroy()
+    {
+        glDeleteFramebuffers(1, &mFramebuffer);
+        glDeleteTextures(2, mTargets);
+        glDeleteTextures(1, &mDepth);
+        glDeleteVertexArrays(1, &mVao);
+        if (mLightProgramId)
+            glDeleteProgram(mLightProgramId);
+        mFramebuffer = mDepth = mVao = mLightProgramId = 0;
+        mTargets[0] = mTargets[1] = 0;
+    }
+
+private:
+    int mWidth;
+    int mHeight;
+    GLuint mFramebuffer;
+    GLuint mTargets[2];
+    GLuint mDepth;
+    GLuint mVao;
+    GLuint mLightProgramId;
+    GLint mViewport[4];                 // the caller's, saved by BeginGeometry()
+    ProgramReflection mReflection;
+    UniformHandle<glm::mat4> mInverseViewProjection;
+    UniformHandle<glm::vec2> mScreenSize;
+    UniformHandle<glm::vec3> mViewPosition;
+
+    // Creates the three targets at the current size and attaches them to the framebuffer
+    bool allocateTargets()
+    {
+        glGenTextures(2, mTargets);
+        allocateTarget(mTargets[0], GL_RGBA8);
+        allocateTarget(mTargets[1], GL_RG16_SNORM);
+        glGenTextures(1, &mDepth);
+        allocateTarget(mDepth, GL_DEPTH24_STENCIL8);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mTargets[0], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mTargets[1], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mDepth, 0);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::FRAMEBUFFER::GBUFFER_INCOMPLETE 0x" << std::hex << status << std::dec << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void allocateTarget(GLuint texture, GLenum format)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, mWidth, mHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,98 @@
+/* GPU time of a span of GL commands, without stalling the pipeline.
+ *
+ * Begin()/End() wrap the commands in a GL_TIME_ELAPSED query. Results are
+ * read back a few frames later from a small ring of queries, so asking for
+ * the time never waits for the GPU to catch up:
+ *
+ *     gFrameTimer.Begin();
+ *     ... draw ...
+ *     gFrameTimer.End();
+ *     double milliseconds;
+ *     if (gFrameTimer.Read(milliseconds)) ...
+ *
+ * A span skipped while every query is in flight is never returned, so a
+ * caller that needs to know which frame a result belongs to passes a tag to
+ * Begin() and gets it back from Read().
+ */
+
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <GL/glew.h>
+
+const int GPU_TIMER_LATENCY = 4;     // queries in flight
+
+
+class GpuTimer
+{
+public:
+    GpuTimer() : mNext(0), mPending(0), mActive(false)
+    {
+        for (int i = 0; i < GPU_TIMER_LATENCY; ++i)
+        {
+            mQueries[i] = 0;
+            mTags[i] = 0;
+        }
+    }
+
+    void Begin(int tag = 0)
+    {
+        if (!mQueries[0])
+            glGenQueries(GPU_TIMER_LATENCY, mQueries);
+        if (mPending == GPU_TIMER_LATENCY)
+            return;     // every query still in flight; skip this span
+        glBeginQuery(GL_TIME_ELAPSED, mQueries[mNext]);
+        mTags[mNext] = tag;
+        mActive = true;
+    }
+
+    void End()
+    {
+        if (!mActive)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        mActive = false;
+        mNext = (mNext + 1) % GPU_TIMER_LATENCY;
+        ++mPending;
+    }
+
+    // The oldest finished span, if one is available, and the tag it began with
+    bool Read(double &milliseconds, int *tag = NULL)
+    {
+        if (mPending == 0)
+            return false;
+
+        const int oldest = (mNext + GPU_TIMER_LATENCY - mPending) % GPU_TIMER_LATENCY;
+        const GLuint query = mQueries[oldest];
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        --mPending;
+        milliseconds = nanoseconds / 1.0e6;
+        if (tag)
+            *tag = mTags[oldest];
+        return true;
+    }
+
+    void Destroy()
+    {
+        if (mQueries[0])
+            glDeleteQueries(GPU_TIMER_LATENCY, mQueries);
+        for (int i = 0; i < GPU_TIMER_LATENCY; ++i)
+            mQueries[i] = 0;
+        mNext = mPending = 0;
+    }
+
+private:
+    GLuint mQueries[GPU_TIMER_LATENCY];
+    int mTags[GPU_TIMER_LATENCY];
+    int mNext;
+    int mPending;
+    bool mActive;
+};
+
+#endif
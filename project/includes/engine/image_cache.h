@@ -0,0 +1,294 @@
+/* Memory-mapped image loading with a decoded-pixel cache.
+ *
+ * CachedImage::Open maps the source file and decodes it with
+ * stbi_load_from_memory instead of going through buffered FILE* reads. The
+ * decoded pixels and their full mip chain are then written next to the
+ * source as "<file>.pxc" (or "<file>.flipped.pxc"): a fixed header followed
+ * by every level starting on a page boundary. The image is served from that
+ * mapping as soon as it is written, and later runs map it and hand the
+ * levels straight to glTexImage2D without decoding. The cache is rebuilt
+ * whenever the source size or modification time changes.
+ */
+
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef STBI_INCLUDE_STB_IMAGE_H    // the including file may already have pulled in the implementation
+#include <stb_image.h>
+#endif
+
+#include <engine/mapped_file.h>
+#include <engine/mip_chain.h>
+
+const char     PIXEL_CACHE_MAGIC[4]  = { 'P', 'X', 'C', '1' };
+const unsigned PIXEL_CACHE_VERSION   = 1;
+const unsigned PIXEL_CACHE_MAX_MIPS  = 24;
+const size_t   PIXEL_CACHE_ALIGNMENT = 4096;
+
+const unsigned PIXEL_CACHE_FLIPPED   = 1u << 0;
+
+
+// On-disk layout of a .pxc file; level data follows at page-aligned offsets
+struct PixelCacheHeader
+{
+    char magic[4];
+    unsigned version;
+    unsigned width, height, channels;
+    unsigned levelCount;
+    unsigned flags;
+    unsigned reserved;
+    unsigned long long sourceSize;
+    long long sourceModified;
+    unsigned long long levelOffset[PIXEL_CACHE_MAX_MIPS];
+    unsigned long long levelSize[PIXEL_CACHE_MAX_MIPS];
+};
+
+
+// An image and its mip chain, served from the pixel cache when it is current
+class CachedImage
+{
+public:
+    CachedImage() : mWidth(0), mHeight(0), mChannels(0), mLevelCount(0), mFromCache(false)
+    {
+    }
+
+    // Loads the image; 'flipVertically' is part of the cache key
+    bool Open(const char *filename, bool flipVertically = false)
+    {
+        Close();
+
+        struct stat source;
+        if (stat(filename, &source) != 0)
+            return false;
+
+        const std::string cachePath = std::string(filename) + (flipVertically ? ".flipped.pxc" : ".pxc");
+        const unsigned flags = flipVertically ? PIXEL_CACHE_FLIPPED : 0u;
+
+        if (openCache(cachePath.c_str(), source, flags))
+            return true;
+
+        if (!decode(filename, flipVertically))
+            return false;
+
+        // Serve the levels from the file just written, so the decoded copy can go
+        if (writeCache(cachePath, source, flags))
+        {
+            std::vector<const unsigned char*> decodedLevels;
+            decodedLevels.swap(mLevels);
+            if (openCache(cachePath.c_str(), source, flags))
+            {
+                MipChain().swap(mDecoded);
+                return true;
+            }
+            decodedLevels.swap(mLevels);
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        mCache.Close();
+        mDecoded.clear();
+        mLevels.clear();
+        mWidth = mHeight = mChannels = mLevelCount = 0;
+        mFromCache = false;
+    }
+
+    int Width() const { return mWidth; }
+    int Height() const { return mHeight; }
+    int Channels() const { return mChannels; }
+    int LevelCount() const { return mLevelCount; }
+    int LevelWidth(int level) const { return std::max(1, mWidth >> level); }
+    int LevelHeight(int level) const { return std::max(1, mHeight >> level); }
+    size_t LevelBytes(int level) const { return static_cast<size_t>(LevelWidth(level)) * LevelHeight(level) * mChannels; }
+
+    // Pixels of the given level, tightly packed rows
+    const unsigned char* Level(int level) const { return mLevels[level]; }
+
+    // True when the levels are served from a mapped .pxc file rather than decoded memory
+    bool FromCache() const { return mFromCache; }
+
+private:
+    MappedFile mCache;
+    MipChain mDecoded;
+    std::vector<const unsigned char*> mLevels;
+    int mWidth, mHeight, mChannels, mLevelCount;
+    bool mFromCache;
+
+    static long long modifiedTime(const struct stat &info)
+    {
+        return static_cast<long long>(info.st_mtime);
+    }
+
+    static size_t alignUp(size_t value)
+    {
+        return (value + PIXEL_CACHE_ALIGNMENT - 1) & ~(PIXEL_CACHE_ALIGNMENT - 1);
+    }
+
+    bool openCache(const char *cachePath, const struct stat &source, unsigned flags)
+    {
+        if (!mCache.Open(cachePath))
+            return false;
+
+        PixelCacheHeader header;
+        if (mCache.Size() < sizeof(header))
+        {
+            mCache.Close();
+            return false;
+        }
+        memcpy(&header, mCache.Data(), sizeof(header));
+
+        bool valid = memcmp(header.magic, PIXEL_CACHE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == PIXEL_CACHE_VERSION
+            && header.flags == flags
+            && header.sourceSize == static_cast<unsigned long long>(source.st_size)
+            && header.sourceModified == modifiedTime(source)
+            && header.width > 0 && header.height > 0
+            && header.levelCount > 0 && header.levelCount <= PIXEL_CACHE_MAX_MIPS
+            && header.levelCount == static_cast<unsigned>(MipLevelCount(header.width, header.height))
+            && (header.channels == 3 || header.channels == 4);
+
+        for (unsigned level = 0; valid && level < header.levelCount; ++level)
+        {
+            unsigned long long expected = static_cast<unsigned long long>(std::max(1u, header.width >> level)) * std::max(1u, header.height >> level) * header.channels;
+            valid = header.levelSize[level] == expected
+                && header.levelOffset[level] + header.levelSize[level] <= mCache.Size();
+        }
+
+        if (!valid)
+        {
+            mCache.Close();
+            return false;
+        }
+
+        mWidth = header.width;
+        mHeight = header.height;
+        mChannels = header.channels;
+        mLevelCount = header.levelCount;
+        for (unsigned level = 0; level < header.levelCount; ++level)
+            mLevels.push_back(mCache.Data() + header.levelOffset[level]);
+        mFromCache = true;
+        return true;
+    }
+
+    bool decode(const char *filename, bool flipVertically)
+    {
+        MappedFile source;
+        if (!source.Open(filename))
+            return false;
+
+        int width, height, channels;
+        unsigned char *image = stbi_load_from_memory(source.Data(), static_cast<int>(source.Size()), &width, &height, &channels, 0);
+        if (!image)
+            return false;
+
+        if (flipVertically)
+            FlipImageVertically(image, width, height, channels);
+
+        BuildMipChain(image, width, height, channels, mDecoded);
+        stbi_image_free(image);
+
+        mWidth = width;
+        mHeight = height;
+        mChannels = channels;
+        mLevelCount = static_cast<int>(mDecoded.size());
+        for (int level = 0; level < mLevelCount; ++level)
+            mLevels.push_back(&mDecoded[level][0]);
+        return true;
+    }
+
+    // Best effort: a failed write only costs the next run a decode
+    bool writeCache(const std::string &cachePath, const struct stat &source, unsigned flags) const
+    {
+        if (mLevelCount > static_cast<int>(PIXEL_CACHE_MAX_MIPS) || (mChannels != 3 && mChannels != 4))
+            return false;
+
+        PixelCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PIXEL_CACHE_MAGIC, sizeof(header.magic));
+        header.version = PIXEL_CACHE_VERSION;
+        header.width = mWidth;
+        header.height = mHeight;
+        header.channels = mChannels;
+        header.levelCount = mLevelCount;
+        header.flags = flags;
+        header.sourceSize = static_cast<unsigned long long>(source.st_size);
+        header.sourceModified = modifiedTime(source);
+
+        size_t offset = alignUp(sizeof(header));
+        for (int level = 0; level < mLevelCount; ++level)
+        {
+            header.levelOffset[level] = offset;
+            header.levelSize[level] = LevelBytes(level);
+            offset = alignUp(offset + LevelBytes(level));
+        }
+
+        // Write under a temporary name so a concurrent reader never maps a half-written file
+        const std::string tempPath = cachePath + ".tmp";
+        FILE *file = fopen(tempPath.c_str(), "wb");
+        if (!file)
+            return false;
+
+        static const unsigned char padding[PIXEL_CACHE_ALIGNMENT] = { 0 };
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        size_t written = sizeof(header);
+        for (int level = 0; ok && level < mLevelCount; ++level)
+        {
+            size_t pad = static_cast<size_t>(header.levelOffset[level]) - written;
+            ok = fwrite(padding, 1, pad, file) == pad
+                && fwrite(mLevels[level], 1, LevelBytes(level), file) == LevelBytes(level);
+            written += pad + LevelBytes(level);
+        }
+        ok = fclose(file) == 0 && ok;
+
+        if (ok)
+        {
+            remove(cachePath.c_str());
+            ok = rename(tempPath.c_str(), cachePath.c_str()) == 0;
+        }
+        if (!ok)
+            remove(tempPath.c_str());
+        return ok;
+    }
+};
+
+
+// Allocates immutable storage for the currently bound GL_TEXTURE_2D and uploads every level. Requires <GL/glew.h>.
+#ifdef __glew_h__
+inline bool UploadCachedImage(const CachedImage &image)
+{
+    GLenum format;
+    GLenum internalFormat;
+    if (image.Channels() == 3)
+    {
+        format = GL_RGB;
+        internalFormat = GL_RGB8;
+    }
+    else if (image.Channels() == 4)
+    {
+        format = GL_RGBA;
+        internalFormat = GL_RGBA8;
+    }
+    else
+        return false;
+
+    // Immutable storage: the driver can skip mip completeness checks on every bind
+    glTexStorage2D(GL_TEXTURE_2D, image.LevelCount(), internalFormat, image.Width(), image.Height());
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < image.LevelCount(); ++level)
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, image.LevelWidth(level), image.LevelHeight(level), format, GL_UNSIGNED_BYTE, image.Level(level));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return true;
+}
+#endif
+
+#endif
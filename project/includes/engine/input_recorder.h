@@ -0,0 +1,322 @@
+/* Records a session's input to a file and plays it back frame for frame.
+ *
+ * The tutorials move the camera from two places: keys polled with
+ * glfwGetKey() in UProcessInput, and the cursor, scroll and button
+ * callbacks fired by glfwPollEvents(). The recorder sits in front of both:
+ *
+ *     gDeltaTime = currentFrame - gLastFrame;
+ *     if (!gInput.BeginFrame(gDeltaTime))      // end of a replay
+ *         break;
+ *     UProcessInput(gWindow);                  // polls gInput.GetKey(window, key)
+ *     URender();
+ *     UPollEvents();                           // glfwPollEvents(), then any NextEvent()
+ *
+ *     void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
+ *     {
+ *         gInput.RecordCursor(xpos, ypos);     // does nothing unless recording
+ *         ...
+ *     }
+ *
+ * A replay leaves the cursor, scroll and button callbacks unregistered and
+ * UPollEvents() calls them with the recorded events instead.
+ *
+ * While recording, every frame writes its delta time, the keys whose polled
+ * state changed, and the callback events in the order they arrived. A
+ * replay reads one frame per BeginFrame(): it returns that frame's delta
+ * time (or a fixed timestep instead), answers GetKey() from the recorded
+ * key states and hands the callback events out through NextEvent(). Live
+ * input is ignored, so a replay renders the same frame sequence on every
+ * run and every build, as fast as the window allows.
+ *
+ * The file is a header followed by tightly packed records in the machine's
+ * byte order: a frame is 5 bytes, a key change 8, a button 9 and a cursor
+ * or scroll event 21. A minute at 60 Hz with a moving mouse is about 100 KB.
+ */
+
+#ifndef INPUT_RECORDER_H
+#define INPUT_RECORDER_H
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <GLFW/glfw3.h>
+
+const unsigned INPUT_RECORDER_MAGIC = 0x504E4955u;  // "UINP"
+const unsigned INPUT_RECORDER_VERSION = 1;
+
+enum InputMode { INPUT_LIVE, INPUT_RECORD, INPUT_REPLAY };
+enum InputEventType { INPUT_FRAME, INPUT_KEY, INPUT_BUTTON, INPUT_CURSOR, INPUT_SCROLL };
+
+// One callback event or polled key change
+struct InputEvent
+{
+    InputEventType type;
+    float time;             // seconds since recording started
+    int code;               // GLFW key or mouse button
+    int action;             // GLFW_PRESS or GLFW_RELEASE
+    int mods;
+    double x;               // cursor position or scroll offsets
+    double y;
+
+    InputEvent() : type(INPUT_KEY), time(0.0f), code(0), action(0), mods(0), x(0.0), y(0.0)
+    {
+    }
+};
+
+
+class InputRecorder
+{
+public:
+    InputRecorder() : mMode(INPUT_LIVE), mFile(NULL), mStartTime(0.0), mFixedDeltaTime(0.0f),
+                      mFrames(0), mNextEvent(0), mFinished(false)
+    {
+        memset(mKeys, GLFW_RELEASE, sizeof(mKeys));
+    }
+
+    ~InputRecorder()
+    {
+        Stop();
+    }
+
+    bool StartRecording(const char* path)
+    {
+        Stop();
+        mFile = fopen(path, "wb");
+        if (!mFile)
+        {
+            std::cout << "ERROR::INPUT_RECORDER::CANNOT_CREATE " << path << std::endl;
+            return false;
+        }
+        const unsigned header[2] = { INPUT_RECORDER_MAGIC, INPUT_RECORDER_VERSION };
+        fwrite(header, sizeof(header), 1, mFile);
+        mMode = INPUT_RECORD;
+        mStartTime = glfwGetTime();
+        return true;
+    }
+
+    // 'fixedDeltaTime' replaces the recorded frame times when it is above zero
+    bool StartReplay(const char* path, float fixedDeltaTime = 0.0f)
+    {
+        Stop();
+        mFile = fopen(path, "rb");
+        unsigned header[2] = { 0, 0 };
+        if (!mFile || fread(header, sizeof(header), 1, mFile) != 1
+            || header[0] != INPUT_RECORDER_MAGIC || header[1] != INPUT_RECORDER_VERSION)
+        {
+            std::cout << "ERROR::INPUT_RECORDER::NOT_A_RECORDING " << path << std::endl;
+            Stop();
+            return false;
+        }
+        mMode = INPUT_REPLAY;
+        mFixedDeltaTime = fixedDeltaTime;
+        // The first frame record comes right after the header
+        mFinished = !readRecord(mPending);
+        return true;
+    }
+
+    // Closes the file; input is live again
+    void Stop()
+    {
+        if (mFile)
+            fclose(mFile);
+        mFile = NULL;
+        mMode = INPUT_LIVE;
+        mEvents.clear();
+        mNextEvent = 0;
+        mFrames = 0;
+        mFinished = false;
+        memset(mKeys, GLFW_RELEASE, sizeof(mKeys));
+    }
+
+    // Starts a frame; a replay replaces 'deltaTime' and returns false once every frame has been played
+    bool BeginFrame(float &deltaTime)
+    {
+        if (mMode == INPUT_RECORD)
+        {
+            writeByte(INPUT_FRAME);
+            fwrite(&deltaTime, sizeof(deltaTime), 1, mFile);
+        }
+        else if (mMode == INPUT_REPLAY)
+        {
+            mEvents.clear();
+            mNextEvent = 0;
+            if (mFinished)
+                return false;
+
+            // mPending is this frame's record; its events follow it up to the next frame
+            deltaTime = mFixedDeltaTime > 0.0f ? mFixedDeltaTime : static_cast<float>(mPending.x);
+            InputEvent event;
+            bool more;
+            while ((more = readRecord(event)) && event.type != INPUT_FRAME)
+            {
+                // Key changes were seen by this frame's polling, so they apply before it
+                if (event.type == INPUT_KEY)
+                    mKeys[event.code] = static_cast<unsigned char>(event.action);
+                else
+                    mEvents.push_back(event);
+            }
+            mFinished = !more;
+            mPending = event;
+        }
+        ++mFrames;
+        return true;
+    }
+
+    // glfwGetKey(), recorded or replayed
+    int GetKey(GLFWwindow* window, int key)
+    {
+        if (key < 0 || key > GLFW_KEY_LAST)
+            return GLFW_RELEASE;
+        if (mMode == INPUT_REPLAY)
+            return mKeys[key];
+
+        const int state = glfwGetKey(window, key);
+        if (mMode == INPUT_RECORD && state != mKeys[key])
+        {
+            InputEvent event;
+            event.type = INPUT_KEY;
+            event.code = key;
+            event.action = state;
+            record(event);
+            mKeys[key] = static_cast<unsigned char>(state);
+        }
+        return state;
+    }
+
+    // Callback events of the current frame; they do nothing unless recording
+    void RecordCursor(double x, double y) { recordPosition(INPUT_CURSOR, x, y); }
+    void RecordScroll(double xOffset, double yOffset) { recordPosition(INPUT_SCROLL, xOffset, yOffset); }
+
+    void RecordButton(int button, int action, int mods)
+    {
+        InputEvent event;
+        event.type = INPUT_BUTTON;
+        event.code = button;
+        event.action = action;
+        event.mods = mods;
+        record(event);
+    }
+
+    // The replayed frame's callback events, in the order they were recorded
+    bool NextEvent(InputEvent &event)
+    {
+        if (mNextEvent >= mEvents.size())
+            return false;
+        event = mEvents[mNextEvent++];
+        return true;
+    }
+
+    bool IsRecording() const { return mMode == INPUT_RECORD; }
+    bool IsReplaying() const { return mMode == INPUT_REPLAY; }
+    size_t GetFrameCount() const { return mFrames; }
+
+private:
+    InputMode mMode;
+    FILE* mFile;
+    double mStartTime;                          // glfwGetTime() when recording started
+    float mFixedDeltaTime;
+    size_t mFrames;
+    unsigned char mKeys[GLFW_KEY_LAST + 1];     // last recorded or replayed state of every key
+
+    // Replay
+    std::vector<InputEvent> mEvents;            // callback events of the current frame
+    size_t mNextEvent;
+    InputEvent mPending;                        // next frame's record, its delta time in x
+    bool mFinished;                             // no frame record left
+
+    void recordPosition(InputEventType type, double x, double y)
+    {
+        InputEvent event;
+        event.type = type;
+        event.x = x;
+        event.y = y;
+        record(event);
+    }
+
+    void record(const InputEvent &event)
+    {
+        if (mMode != INPUT_RECORD)
+            return;
+
+        const float time = static_cast<float>(glfwGetTime() - mStartTime);
+        writeByte(event.type);
+        fwrite(&time, sizeof(time), 1, mFile);
+        if (event.type == INPUT_KEY)
+        {
+            const short key = static_cast<short>(event.code);
+            fwrite(&key, sizeof(key), 1, mFile);
+            writeByte(event.action);
+        }
+        else if (event.type == INPUT_BUTTON)
+        {
+            writeByte(event.code);
+            writeByte(event.action);
+            writeByte(event.mods);
+            writeByte(0);
+        }
+        else
+        {
+            const double position[2] = { event.x, event.y };
+            fwrite(position, sizeof(position), 1, mFile);
+        }
+    }
+
+    void writeByte(int value)
+    {
+        fputc(value & 0xFF, mFile);
+    }
+
+    int readByte()
+    {
+        return fgetc(mFile);
+    }
+
+    bool readRecord(InputEvent &event)
+    {
+        const int type = readByte();
+        if (type < INPUT_FRAME || type > INPUT_SCROLL)
+            return false;
+        event = InputEvent();
+        event.type = static_cast<InputEventType>(type);
+        if (event.type == INPUT_FRAME)
+        {
+            float deltaTime;
+            if (fread(&deltaTime, sizeof(deltaTime), 1, mFile) != 1)
+                return false;
+            event.x = deltaTime;
+            return true;
+        }
+
+        if (fread(&event.time, sizeof(event.time), 1, mFile) != 1)
+            return false;
+        if (event.type == INPUT_KEY)
+        {
+            short key;
+            if (fread(&key, sizeof(key), 1, mFile) != 1 || key < 0 || key > GLFW_KEY_LAST)
+                return false;
+            event.code = key;
+            event.action = readByte();
+            return event.action != EOF;
+        }
+        if (event.type == INPUT_BUTTON)
+        {
+            unsigned char button[4];
+            if (fread(button, sizeof(button), 1, mFile) != 1)
+                return false;
+            event.code = button[0];
+            event.action = button[1];
+            event.mods = button[2];
+            return true;
+        }
+        double position[2];
+        if (fread(position, sizeof(position), 1, mFile) != 1)
+            return false;
+        event.x = position[0];
+        event.y = position[1];
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,331 @@
+/* Grid of spherical-harmonic irradiance probes for ambient light.
+ *
+ * A constant ambient term lights every surface the same, whatever it faces
+ * and however enclosed it is. Probes instead record, at points of a regular
+ * 3D grid, the light arriving from every direction: each probe traces rays
+ * into the scene (against the lightmap baker's BVH), shades what they hit
+ * with the static lights and keeps the result as nine L2 spherical-harmonic
+ * coefficients per color channel. Probes bake in parallel on all cores.
+ *
+ * The coefficients are stored already convolved with the cosine lobe and
+ * divided by pi, so evaluating them for a normal gives the ambient light
+ * directly, in the same units as the shaders' diffuse term:
+ *
+ *     gProbes.SetScene(meshes, MESH_COUNT, lights, LIGHT_COUNT, skyColor);
+ *     gProbes.Bake(gridMin, gridMax, glm::ivec3(8, 4, 8));
+ *     GLuint probeTextureId = gProbes.CreateTexture();
+ *     ... bind it to IRRADIANCE_PROBE_UNIT, set probeGridMin/probeGridMax ...
+ *
+ * The texture is RGB16F and 3D, nine slabs deep: coefficient k of probe
+ * (x, y, z) is texel (x, y, k * gridZ + z). The fragment shader samples all
+ * nine slabs with hardware trilinear filtering, clamped inside each slab, in
+ * probeIrradiance() of IRRADIANCE_PROBES_GLSL.
+ *
+ * Probes buried inside geometry see mostly back faces; they take the average
+ * of their valid neighbours instead, so they do not leak darkness.
+ */
+
+#ifndef IRRADIANCE_PROBES_H
+#define IRRADIANCE_PROBES_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <engine/lightmap_baker.h>  // LightmapMesh, BakeLight and the triangle BVH
+
+const int IRRADIANCE_SH_COEFFICIENTS = 9;
+const GLuint IRRADIANCE_PROBE_UNIT = 2;     // texture unit IRRADIANCE_PROBES_GLSL samples
+
+// Receiver side, for fragment shaders: ambient light for a world position and normal
+const char* const IRRADIANCE_PROBES_GLSL = R"(
+layout (binding = 2) uniform sampler3D irradianceProbes;
+uniform vec3 probeGridMin;
+uniform vec3 probeGridMax;
+
+vec3 probeIrradiance(vec3 position, vec3 normal)
+{
+    ivec3 size = textureSize(irradianceProbes, 0);
+    vec3 dims = vec3(size.xy, size.z / 9);
+
+    // Texel coordinates within one slab; clamping keeps filtering out of the neighbouring slabs
+    vec3 cell = clamp((position - probeGridMin) / (probeGridMax - probeGridMin), 0.0, 1.0) * (dims - 1.0) + 0.5;
+    vec2 uv = cell.xy / dims.xy;
+    float slabDepth = 1.0 / 9.0;
+    vec3 sh[9];
+    for (int k = 0; k < 9; ++k)
+        sh[k] = texture(irradianceProbes, vec3(uv, (k + cell.z / dims.z) * slabDepth)).rgb;
+
+    vec3 n = normal;
+    return max(vec3(0.0),
+          sh[0] * 0.282095
+        + sh[1] * 0.488603 * n.y + sh[2] * 0.488603 * n.z + sh[3] * 0.488603 * n.x
+        + sh[4] * 1.092548 * n.x * n.y + sh[5] * 1.092548 * n.y * n.z
+        + sh[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + sh[7] * 1.092548 * n.x * n.z + sh[8] * 0.546274 * (n.x * n.x - n.y * n.y));
+}
+)";
+
+
+namespace irradiance_probes
+{
+// Real L2 spherical-harmonic basis in the order IRRADIANCE_PROBES_GLSL evaluates it
+inline void basis(const glm::vec3 &n, float out[IRRADIANCE_SH_COEFFICIENTS])
+{
+    out[0] = 0.282095f;
+    out[1] = 0.488603f * n.y;
+    out[2] = 0.488603f * n.z;
+    out[3] = 0.488603f * n.x;
+    out[4] = 1.092548f * n.x * n.y;
+    out[5] = 1.092548f * n.y * n.z;
+    out[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+    out[7] = 1.092548f * n.x * n.z;
+    out[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+}
+
+// Cosine-lobe convolution per band, divided by pi: 1, 2/3, 1/4
+const float BAND_SCALE[IRRADIANCE_SH_COEFFICIENTS] =
+{
+    1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f
+};
+}
+
+
+class IrradianceProbeGrid
+{
+public:
+    IrradianceProbeGrid() : mDims(0), mGridMin(0.0f), mGridMax(0.0f), mSkyColor(0.0f), mRays(0)
+    {
+    }
+
+    // The meshes' data must stay alive until Bake()
+    void SetScene(const LightmapMesh *meshes, size_t meshCount, const BakeLight *lights, size_t lightCount,
+                  const glm::vec3 &skyColor = glm::vec3(0.0f))
+    {
+        mMeshes.assign(meshes, meshes + meshCount);
+        mLights.assign(lights, lights + lightCount);
+        mSkyColor = skyColor;
+
+        mTriangles.clear();
+        for (size_t m = 0; m < meshCount; ++m)
+        {
+            const glm::vec3 center = lightmap_baker::meshCenter(meshes[m]);
+            for (size_t t = 0; t < meshes[m].indexCount / 3; ++t)
+                mTriangles.push_back(lightmap_baker::worldTriangle(meshes[m], static_cast<int>(m), t, center));
+        }
+        mBvh.Build(mTriangles);
+    }
+
+    // Bakes dims.x * dims.y * dims.z probes spread evenly from gridMin to gridMax (corners included)
+    void Bake(const glm::vec3 &gridMin, const glm::vec3 &gridMax, const glm::ivec3 &dims, int rays = 512, int threads = 0)
+    {
+        mGridMin = gridMin;
+        mGridMax = gridMax;
+        mDims = glm::max(dims, glm::ivec3(1));
+        mRays = rays;
+
+        const size_t probeCount = static_cast<size_t>(mDims.x) * mDims.y * mDims.z;
+        mCoefficients.assign(probeCount * IRRADIANCE_SH_COEFFICIENTS, glm::vec3(0.0f));
+        mValid.assign(probeCount, 1);
+
+        unsigned threadCount = threads > 0 ? static_cast<unsigned>(threads) : std::thread::hardware_concurrency();
+        threadCount = std::max(1u, std::min<unsigned>(threadCount, static_cast<unsigned>(probeCount)));
+        std::atomic<size_t> nextProbe(0);
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threadCount; ++i)
+            workers.push_back(std::thread(&IrradianceProbeGrid::bakeProbes, this, &nextProbe));
+        bakeProbes(&nextProbe);
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+
+        fillInvalidProbes();
+    }
+
+    // RGB16F 3D texture, nine slabs of the grid deep; 0 before Bake()
+    GLuint CreateTexture() const
+    {
+        if (mCoefficients.empty())
+            return 0;
+
+        // Reorder probe-major coefficients into slabs
+        std::vector<float> texels(mCoefficients.size() * 3);
+        const size_t slabSize = static_cast<size_t>(mDims.x) * mDims.y * mDims.z;
+        for (size_t probe = 0; probe < slabSize; ++probe)
+        {
+            for (int k = 0; k < IRRADIANCE_SH_COEFFICIENTS; ++k)
+            {
+                const glm::vec3 &c = mCoefficients[probe * IRRADIANCE_SH_COEFFICIENTS + k];
+                float *texel = &texels[(k * slabSize + probe) * 3];
+                texel[0] = c.r;
+                texel[1] = c.g;
+                texel[2] = c.b;
+            }
+        }
+
+        GLuint textureId;
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_3D, textureId);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, mDims.x, mDims.y, mDims.z * IRRADIANCE_SH_COEFFICIENTS, 0, GL_RGB, GL_FLOAT, &texels[0]);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        return textureId;
+    }
+
+    // CPU evaluation of one probe, matching probeIrradiance() at the probe's position
+    glm::vec3 Evaluate(int x, int y, int z, const glm::vec3 &normal) const
+    {
+        float weights[IRRADIANCE_SH_COEFFICIENTS];
+        irradiance_probes::basis(normal, weights);
+        const glm::vec3 *c = &mCoefficients[probeIndex(x, y, z) * IRRADIANCE_SH_COEFFICIENTS];
+        glm::vec3 sum(0.0f);
+        for (int k = 0; k < IRRADIANCE_SH_COEFFICIENTS; ++k)
+            sum += c[k] * weights[k];
+        return glm::max(sum, glm::vec3(0.0f));
+    }
+
+    const glm::vec3& GetGridMin() const { return mGridMin; }
+    const glm::vec3& GetGridMax() const { return mGridMax; }
+    const glm::ivec3& GetDims() const { return mDims; }
+
+private:
+    std::vector<LightmapMesh> mMeshes;
+    std::vector<BakeLight> mLights;
+    std::vector<lightmap_baker::Triangle> mTriangles;   // reordered by the BVH
+    lightmap_baker::TriangleBvh mBvh;
+    glm::ivec3 mDims;
+    glm::vec3 mGridMin;
+    glm::vec3 mGridMax;
+    glm::vec3 mSkyColor;
+    int mRays;
+    std::vector<glm::vec3> mCoefficients;   // nine per probe, x fastest
+    std::vector<char> mValid;
+
+    size_t probeIndex(int x, int y, int z) const
+    {
+        return (static_cast<size_t>(z) * mDims.y + y) * mDims.x + x;
+    }
+
+    glm::vec3 probePosition(int x, int y, int z) const
+    {
+        const glm::vec3 steps = glm::max(glm::vec3(mDims - 1), glm::vec3(1.0f));
+        return mGridMin + (mGridMax - mGridMin) * glm::vec3(x, y, z) / steps;
+    }
+
+    void bakeProbes(std::atomic<size_t> *nextProbe)
+    {
+        const size_t probeCount = mValid.size();
+        for (size_t probe = (*nextProbe)++; probe < probeCount; probe = (*nextProbe)++)
+        {
+            const int x = static_cast<int>(probe % mDims.x);
+            const int y = static_cast<int>(probe / mDims.x % mDims.y);
+            const int z = static_cast<int>(probe / (static_cast<size_t>(mDims.x) * mDims.y));
+            bakeProbe(probePosition(x, y, z), &mCoefficients[probe * IRRADIANCE_SH_COEFFICIENTS], mValid[probe]);
+        }
+    }
+
+    // Projects the radiance seen in 'mRays' directions onto the SH basis
+    void bakeProbe(const glm::vec3 &position, glm::vec3 *coefficients, char &valid) const
+    {
+        int backFaces = 0;
+        float weights[IRRADIANCE_SH_COEFFICIENTS];
+        for (int i = 0; i < mRays; ++i)
+        {
+            // Fibonacci sphere: even coverage without random noise
+            const float z = 1.0f - (2.0f * i + 1.0f) / mRays;
+            const float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            const float phi = 2.39996323f * i;
+            const glm::vec3 direction(r * std::cos(phi), r * std::sin(phi), z);
+
+            glm::vec3 radiance = mSkyColor;
+            const lightmap_baker::Hit hit = mBvh.Closest(position, direction, 1e30f);
+            if (hit.triangle >= 0)
+            {
+                const lightmap_baker::Triangle &triangle = mTriangles[hit.triangle];
+                if (glm::dot(triangle.normal, direction) > 0.0f)
+                {
+                    ++backFaces;
+                    radiance = glm::vec3(0.0f);
+                }
+                else
+                {
+                    // Diffuse surfaces show their albedo times the light reaching them
+                    radiance = mMeshes[triangle.mesh].albedo
+                        * lightmap_baker::directLight(mBvh, mLights, position + direction * hit.t, triangle.normal);
+                }
+            }
+
+            irradiance_probes::basis(direction, weights);
+            for (int k = 0; k < IRRADIANCE_SH_COEFFICIENTS; ++k)
+                coefficients[k] += radiance * weights[k];
+        }
+
+        // Monte Carlo weight of each ray (4 pi / rays), then convolution with the cosine lobe
+        const float rayWeight = 4.0f * 3.14159265f / mRays;
+        for (int k = 0; k < IRRADIANCE_SH_COEFFICIENTS; ++k)
+            coefficients[k] *= rayWeight * irradiance_probes::BAND_SCALE[k];
+
+        valid = backFaces * 4 < mRays;
+    }
+
+    // Invalid probes repeatedly take the average of their valid neighbours
+    void fillInvalidProbes()
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (int z = 0; z < mDims.z; ++z)
+            {
+                for (int y = 0; y < mDims.y; ++y)
+                {
+                    for (int x = 0; x < mDims.x; ++x)
+                    {
+                        const size_t probe = probeIndex(x, y, z);
+                        if (mValid[probe])
+                            continue;
+
+                        static const int OFFSETS[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+                        glm::vec3 sum[IRRADIANCE_SH_COEFFICIENTS];
+                        for (int k = 0; k < IRRADIANCE_SH_COEFFICIENTS; ++k)
+                            sum[k] = glm::vec3(0.0f);
+                        int count = 0;
+                        for (int n = 0; n < 6; ++n)
+                        {
+                            const int nx = x + OFFSETS[n][0];
+                            const int ny = y + OFFSETS[n][1];
+                            const int nz = z + OFFSETS[n][2];
+                            if (nx < 0 || ny < 0 || nz < 0 || nx >= mDims.x || ny >= mDims.y || nz >= mDims.z)
+                                continue;
+                            const size_t neighbour = probeIndex(nx, ny, nz);
+                            if (!mValid[neighbour])
+                                continue;
+                            for (int k = 0; k < IRRADIANCE_SH_COEFFICIENTS; ++k)
+                                sum[k] += mCoefficients[neighbour * IRRADIANCE_SH_COEFFICIENTS + k];
+                            ++count;
+                        }
+                        if (count == 0)
+                            continue;
+
+                        for (int k = 0; k < IRRADIANCE_SH_COEFFICIENTS; ++k)
+                            mCoefficients[probe * IRRADIANCE_SH_COEFFICIENTS + k] = sum[k] / static_cast<float>(count);
+                        mValid[probe] = 1;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,382 @@
+/* SSE2/AVX2 routines for the installable JPEG hooks of stb_image_aug.
+ *
+ * stb_image_aug built with STBI_SIMD decodes every 8x8 block through a
+ * dequantizing IDCT and every output row through a YCbCr->RGB conversion
+ * that can be replaced at runtime. InstallJpegSimd() picks the widest
+ * version the CPU supports and installs it; both produce the same bytes as
+ * the scalar code for conforming baseline JPEGs.
+ *
+ * The IDCT is SSE2 only: one block row of 16-bit coefficients is exactly one
+ * SSE register and the hook receives one block at a time, so AVX2 has
+ * nothing extra to work on. The colour conversion has both versions.
+ */
+
+#ifndef JPEG_SIMD_H
+#define JPEG_SIMD_H
+
+#include <stb_image_aug.h>
+
+#if STBI_SIMD && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define JPEG_SIMD_SSE2 1
+#endif
+
+#ifdef JPEG_SIMD_SSE2
+
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define JPEG_SIMD_TARGET_AVX2
+#else
+#define JPEG_SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Which implementation InstallJpegSimd() chose
+enum JpegSimdLevel
+{
+    JPEG_SIMD_SCALAR,
+    JPEG_SIMD_SSE2_LEVEL,
+    JPEG_SIMD_AVX2_LEVEL
+};
+
+namespace jpeg_simd
+{
+    // Same fixed-point constants as the scalar IDCT_1D (12 fractional bits)
+    inline int f2f(float x) { return static_cast<int>(x * 4096 + 0.5f); }
+
+    inline __m128i pairConstant(int even, int odd)
+    {
+        return _mm_setr_epi16(static_cast<short>(even), static_cast<short>(odd), static_cast<short>(even), static_cast<short>(odd),
+                              static_cast<short>(even), static_cast<short>(odd), static_cast<short>(even), static_cast<short>(odd));
+    }
+
+    // 32-bit halves of an 8-lane row
+    struct Wide
+    {
+        __m128i lo, hi;
+    };
+
+    // x*c[even] + y*c[odd] for every lane, widened to 32 bits
+    inline Wide rotate(__m128i x, __m128i y, __m128i c)
+    {
+        Wide out;
+        out.lo = _mm_madd_epi16(_mm_unpacklo_epi16(x, y), c);
+        out.hi = _mm_madd_epi16(_mm_unpackhi_epi16(x, y), c);
+        return out;
+    }
+
+    // x << 12, widened to 32 bits
+    inline Wide widen(__m128i x)
+    {
+        Wide out;
+        out.lo = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), x), 4);
+        out.hi = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), x), 4);
+        return out;
+    }
+
+    inline Wide add(const Wide &a, const Wide &b)
+    {
+        Wide out;
+        out.lo = _mm_add_epi32(a.lo, b.lo);
+        out.hi = _mm_add_epi32(a.hi, b.hi);
+        return out;
+    }
+
+    inline Wide sub(const Wide &a, const Wide &b)
+    {
+        Wide out;
+        out.lo = _mm_sub_epi32(a.lo, b.lo);
+        out.hi = _mm_sub_epi32(a.hi, b.hi);
+        return out;
+    }
+
+    // (a + bias +- b) >> shift, packed back to 16 bits
+    template <int Shift>
+    inline void butterfly(__m128i &sum, __m128i &difference, const Wide &a, const Wide &b, __m128i bias)
+    {
+        Wide biased;
+        biased.lo = _mm_add_epi32(a.lo, bias);
+        biased.hi = _mm_add_epi32(a.hi, bias);
+        Wide s = add(biased, b), d = sub(biased, b);
+        sum = _mm_packs_epi32(_mm_srai_epi32(s.lo, Shift), _mm_srai_epi32(s.hi, Shift));
+        difference = _mm_packs_epi32(_mm_srai_epi32(d.lo, Shift), _mm_srai_epi32(d.hi, Shift));
+    }
+
+    // One 1D pass of the scalar IDCT_1D over all eight lanes. The (a+b)*c
+    // products are folded into pairwise multiply-adds, which is exact in
+    // integers, so each lane matches the scalar result bit for bit.
+    template <int Shift>
+    inline void idctPass(__m128i row[8], __m128i bias)
+    {
+        const __m128i rot0_0 = pairConstant(f2f(0.5411961f), f2f(0.5411961f) + f2f(-1.847759065f));
+        const __m128i rot0_1 = pairConstant(f2f(0.5411961f) + f2f(0.765366865f), f2f(0.5411961f));
+        const __m128i rot1_0 = pairConstant(f2f(1.175875602f) + f2f(-0.899976223f), f2f(1.175875602f));
+        const __m128i rot1_1 = pairConstant(f2f(1.175875602f), f2f(1.175875602f) + f2f(-2.562915447f));
+        const __m128i rot2_0 = pairConstant(f2f(-1.961570560f) + f2f(0.298631336f), f2f(-1.961570560f));
+        const __m128i rot2_1 = pairConstant(f2f(-1.961570560f), f2f(-1.961570560f) + f2f(3.072711026f));
+        const __m128i rot3_0 = pairConstant(f2f(-0.390180644f) + f2f(2.053119869f), f2f(-0.390180644f));
+        const __m128i rot3_1 = pairConstant(f2f(-0.390180644f), f2f(-0.390180644f) + f2f(1.501321110f));
+
+        // even part
+        Wide t2 = rotate(row[2], row[6], rot0_0);
+        Wide t3 = rotate(row[2], row[6], rot0_1);
+        Wide t0 = widen(_mm_add_epi16(row[0], row[4]));
+        Wide t1 = widen(_mm_sub_epi16(row[0], row[4]));
+        Wide x0 = add(t0, t3), x3 = sub(t0, t3);
+        Wide x1 = add(t1, t2), x2 = sub(t1, t2);
+
+        // odd part
+        Wide y0 = rotate(row[7], row[3], rot2_0);
+        Wide y2 = rotate(row[7], row[3], rot2_1);
+        Wide y1 = rotate(row[5], row[1], rot3_0);
+        Wide y3 = rotate(row[5], row[1], rot3_1);
+        __m128i sum17 = _mm_add_epi16(row[1], row[7]);
+        __m128i sum35 = _mm_add_epi16(row[3], row[5]);
+        Wide y4 = rotate(sum17, sum35, rot1_0);
+        Wide y5 = rotate(sum17, sum35, rot1_1);
+        Wide x4 = add(y0, y4), x5 = add(y1, y5);
+        Wide x6 = add(y2, y5), x7 = add(y3, y4);
+
+        butterfly<Shift>(row[0], row[7], x0, x7, bias);
+        butterfly<Shift>(row[1], row[6], x1, x6, bias);
+        butterfly<Shift>(row[2], row[5], x2, x5, bias);
+        butterfly<Shift>(row[3], row[4], x3, x4, bias);
+    }
+
+    inline void interleave16(__m128i &a, __m128i &b)
+    {
+        __m128i t = a;
+        a = _mm_unpacklo_epi16(a, b);
+        b = _mm_unpackhi_epi16(t, b);
+    }
+
+    inline void interleave8(__m128i &a, __m128i &b)
+    {
+        __m128i t = a;
+        a = _mm_unpacklo_epi8(a, b);
+        b = _mm_unpackhi_epi8(t, b);
+    }
+
+    // Dequantizing 8x8 IDCT with the rounding of stb_image_aug's idct_block
+    inline void IdctSse2(stbi_uc *out, int out_stride, short data[64], unsigned short *dequantize)
+    {
+        __m128i row[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            // Dequantized coefficients of a baseline JPEG fit in 16 bits
+            __m128i coefficients = _mm_load_si128(reinterpret_cast<const __m128i*>(data + i * 8));
+            __m128i quantizer = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dequantize + i * 8));
+            row[i] = _mm_mullo_epi16(coefficients, quantizer);
+        }
+
+        // columns: keep 2 extra bits of precision, like the scalar pass
+        idctPass<10>(row, _mm_set1_epi32(512));
+
+        interleave16(row[0], row[4]);
+        interleave16(row[1], row[5]);
+        interleave16(row[2], row[6]);
+        interleave16(row[3], row[7]);
+        interleave16(row[0], row[2]);
+        interleave16(row[1], row[3]);
+        interleave16(row[4], row[6]);
+        interleave16(row[5], row[7]);
+        interleave16(row[0], row[1]);
+        interleave16(row[2], row[3]);
+        interleave16(row[4], row[5]);
+        interleave16(row[6], row[7]);
+
+        // rows: the +128 level shift of clamp() is folded into the bias
+        idctPass<17>(row, _mm_set1_epi32(65536 + (128 << 17)));
+
+        // saturating packs clamp to 0..255
+        __m128i p0 = _mm_packus_epi16(row[0], row[1]);
+        __m128i p1 = _mm_packus_epi16(row[2], row[3]);
+        __m128i p2 = _mm_packus_epi16(row[4], row[5]);
+        __m128i p3 = _mm_packus_epi16(row[6], row[7]);
+
+        interleave8(p0, p2);
+        interleave8(p1, p3);
+        interleave8(p0, p1);
+        interleave8(p2, p3);
+        interleave8(p0, p2);
+        interleave8(p1, p3);
+
+        const __m128i lines[4] = { p0, p2, p1, p3 };
+        for (int i = 0; i < 4; ++i)
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), lines[i]);
+            out += out_stride;
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi32(lines[i], 0x4e));
+            out += out_stride;
+        }
+    }
+
+    // Scalar conversion of stb_image_aug's YCbCr_to_RGB_row, used for row tails
+    inline void convertPixels(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            int yFixed = (y[i] << 16) + 32768;
+            int cr = pcr[i] - 128;
+            int cb = pcb[i] - 128;
+            int r = (yFixed + cr * 91881) >> 16;
+            int g = (yFixed - cr * 46802 - cb * 22554) >> 16;
+            int b = (yFixed + cb * 116130) >> 16;
+            out[0] = static_cast<stbi_uc>(r < 0 ? 0 : r > 255 ? 255 : r);
+            out[1] = static_cast<stbi_uc>(g < 0 ? 0 : g > 255 ? 255 : g);
+            out[2] = static_cast<stbi_uc>(b < 0 ? 0 : b > 255 ? 255 : b);
+            out[3] = 255;
+            out += step;
+        }
+    }
+
+    // Writes 8 pixels from the low halves of r/g/b as RGB or RGBA.
+    // RGB output is written as overlapping 4-byte stores, so the caller must
+    // leave at least one pixel after these eight to the scalar tail.
+    inline void storePixels(stbi_uc *out, __m128i r, __m128i g, __m128i b, int step)
+    {
+        __m128i rg = _mm_unpacklo_epi8(r, g);
+        __m128i ba = _mm_unpacklo_epi8(b, _mm_set1_epi8(static_cast<char>(-1)));
+        __m128i first = _mm_unpacklo_epi16(rg, ba);
+        __m128i second = _mm_unpackhi_epi16(rg, ba);
+
+        if (step == 4)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), first);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), second);
+            return;
+        }
+
+        int pixels[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + 4), second);
+        for (int i = 0; i < 8; ++i)
+            memcpy(out + i * 3, pixels + i, 4);
+    }
+
+    // Pixels the vector loop may handle before the scalar tail takes over
+    inline int vectorPixels(int count, int step, int width)
+    {
+        int limit = step == 4 ? count : count - 1;
+        return limit < 0 ? 0 : limit - limit % width;
+    }
+
+    // 8 pixels per iteration; cb/cr are split as in the scalar constants
+    // (91881 = 65536 + 26345 and so on) to stay within 16-bit multiplies
+    inline void YCbCrToRgbSse2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi16(128);
+        const __m128i round = _mm_set1_epi32(32768);
+        const __m128i rCoefficient = pairConstant(26345, 0);
+        const __m128i gCoefficient = pairConstant(18734, -22554);
+        const __m128i bCoefficient = pairConstant(0, -14942);
+
+        const int vectorCount = vectorPixels(count, step, 8);
+        int i = 0;
+        for (; i < vectorCount; i += 8)
+        {
+            __m128i y16 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + i)), zero);
+            __m128i cb16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pcb + i)), zero), bias);
+            __m128i cr16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pcr + i)), zero), bias);
+
+            // y + cr, y - cr and y + 2*cb carry the parts of the constants above 1.0
+            __m128i rBase = _mm_add_epi16(y16, cr16);
+            __m128i gBase = _mm_sub_epi16(y16, cr16);
+            __m128i bBase = _mm_add_epi16(y16, _mm_add_epi16(cb16, cb16));
+
+            __m128i crcbLo = _mm_unpacklo_epi16(cr16, cb16);
+            __m128i crcbHi = _mm_unpackhi_epi16(cr16, cb16);
+
+            __m128i channels[3];
+            const __m128i bases[3] = { rBase, gBase, bBase };
+            const __m128i coefficients[3] = { rCoefficient, gCoefficient, bCoefficient };
+            for (int c = 0; c < 3; ++c)
+            {
+                __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(zero, bases[c]), _mm_add_epi32(round, _mm_madd_epi16(crcbLo, coefficients[c])));
+                __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(zero, bases[c]), _mm_add_epi32(round, _mm_madd_epi16(crcbHi, coefficients[c])));
+                __m128i packed = _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16));
+                channels[c] = _mm_packus_epi16(packed, packed);
+            }
+
+            storePixels(out + i * step, channels[0], channels[1], channels[2], step);
+        }
+
+        convertPixels(out + i * step, y + i, pcb + i, pcr + i, count - i, step);
+    }
+
+    JPEG_SIMD_TARGET_AVX2 inline __m128i convertChannelAvx2(__m256i base, __m256i cr, __m256i crFactor, __m256i cb, __m256i cbFactor)
+    {
+        __m256i value = _mm256_add_epi32(base, _mm256_add_epi32(_mm256_mullo_epi32(cr, crFactor), _mm256_mullo_epi32(cb, cbFactor)));
+        value = _mm256_srai_epi32(value, 16);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+        return _mm_packus_epi16(packed, packed);
+    }
+
+    // 8 pixels per step in 32-bit lanes, so the scalar constants are used as is
+    JPEG_SIMD_TARGET_AVX2 inline void YCbCrToRgbAvx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+    {
+        const __m256i bias = _mm256_set1_epi32(128);
+        const __m256i round = _mm256_set1_epi32(32768);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i rCr = _mm256_set1_epi32(91881);
+        const __m256i gCr = _mm256_set1_epi32(-46802);
+        const __m256i gCb = _mm256_set1_epi32(-22554);
+        const __m256i bCb = _mm256_set1_epi32(116130);
+
+        const int vectorCount = vectorPixels(count, step, 8);
+        int i = 0;
+        for (; i < vectorCount; i += 8)
+        {
+            __m256i yFixed = _mm256_add_epi32(_mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + i))), 16), round);
+            __m256i cb = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pcb + i))), bias);
+            __m256i cr = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pcr + i))), bias);
+
+            __m128i r = convertChannelAvx2(yFixed, cr, rCr, cb, zero);
+            __m128i g = convertChannelAvx2(yFixed, cr, gCr, cb, gCb);
+            __m128i b = convertChannelAvx2(yFixed, cr, zero, cb, bCb);
+            storePixels(out + i * step, r, g, b, step);
+        }
+
+        convertPixels(out + i * step, y + i, pcb + i, pcr + i, count - i, step);
+    }
+
+    inline bool cpuHasAvx2()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+}
+
+// Installs the fastest IDCT and colour conversion this CPU supports into
+// stb_image_aug; 'allowAvx2' = false limits it to SSE2 (for comparisons)
+inline JpegSimdLevel InstallJpegSimd(bool allowAvx2 = true)
+{
+    stbi_install_idct(jpeg_simd::IdctSse2);
+    if (allowAvx2 && jpeg_simd::cpuHasAvx2())
+    {
+        stbi_install_YCbCr_to_RGB(jpeg_simd::YCbCrToRgbAvx2);
+        return JPEG_SIMD_AVX2_LEVEL;
+    }
+    stbi_install_YCbCr_to_RGB(jpeg_simd::YCbCrToRgbSse2);
+    return JPEG_SIMD_SSE2_LEVEL;
+}
+
+#endif // JPEG_SIMD_SSE2
+
+#endif
@@ -0,0 +1,728 @@
+/* Offline lightmap baking for static scenes.
+ *
+ * Static surfaces never change their lighting, so it can be computed once on
+ * the CPU and sampled at runtime with a single texture fetch instead of
+ * shading every light per pixel:
+ *
+ *     LightmapBaker baker;
+ *     baker.SetScene(meshes, MESH_COUNT, lights, LIGHT_COUNT, settings);
+ *     if (!baker.Load("desk.lmap"))     // missing, or baked from another scene
+ *     {
+ *         baker.Bake();                 // all cores
+ *         baker.Save("desk.lmap");
+ *     }
+ *     GLuint lightmapId = baker.CreateTexture();
+ *     ... baker.GetUVs(i) is mesh i's second texture coordinate set ...
+ *
+ * Unwrapping: existing UVs usually overlap (every face of the desk boxes maps
+ * to the whole texture), so SetScene() lays out its own. Consecutive
+ * triangles are paired into square atlas cells, the first filling the lower
+ * right half and the second the upper left half; a quad indexed as (a, b, c),
+ * (c, d, a) then covers its cell seamlessly with one UV per vertex. Each cell
+ * has a one texel gutter so bilinear filtering never reaches a neighbour.
+ *
+ * Meshes are assumed closed and roughly convex: a triangle's normal is
+ * taken to face away from its mesh's center rather than from its winding.
+ *
+ * Lighting per texel is direct light from point lights with ray-traced
+ * shadows plus 'bounces' bounces of indirect light, path traced with
+ * cosine-weighted samples against a BVH of all triangles. The indirect part
+ * is blurred lightly within its cell before the direct part is added back,
+ * so shadow edges stay sharp. Texels are distributed over worker threads by
+ * cell; every texel seeds its own random numbers, so results do not depend
+ * on the thread count.
+ *
+ * Stored values are irradiance: the runtime color is the surface texture
+ * times the lightmap.
+ */
+
+#ifndef LIGHTMAP_BAKER_H
+#define LIGHTMAP_BAKER_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <engine/mapped_file.h>
+
+const char     LIGHTMAP_MAGIC[4] = { 'L', 'M', 'A', 'P' };
+const unsigned LIGHTMAP_VERSION  = 1;
+const float    LIGHTMAP_RAY_OFFSET = 1e-3f;     // start rays off the surface so they do not hit it
+
+// Triangle mesh drawn with indexed triangles; positions are the first three floats of each vertex
+struct LightmapMesh
+{
+    const float *vertices;
+    size_t vertexStride;            // floats per vertex
+    size_t vertexCount;
+    const unsigned short *indices;
+    size_t indexCount;
+    glm::mat4 model;
+    glm::vec3 albedo;               // average surface color, for light bounced off it
+};
+
+struct BakeLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    float intensity;                // irradiance at one unit distance
+};
+
+struct LightmapSettings
+{
+    LightmapSettings() : cellTexels(16), samples(128), bounces(2), skyColor(0.0f), threads(0)
+    {
+    }
+
+    int cellTexels;                 // texels along each side of a triangle pair's cell
+    int samples;                    // indirect rays per texel
+    int bounces;                    // 0 bakes direct light only
+    glm::vec3 skyColor;             // irradiance an unoccluded hemisphere receives from the sky
+    int threads;                    // 0 uses every hardware thread
+};
+
+
+namespace lightmap_baker
+{
+struct Triangle
+{
+    glm::vec3 v0;
+    glm::vec3 edge1;
+    glm::vec3 edge2;
+    glm::vec3 normal;               // unit geometric normal, facing out of the mesh
+    int mesh;
+};
+
+struct Node
+{
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    int first;                      // leaf: first triangle; inner: right child (left child follows the node)
+    int count;                      // triangles in a leaf, 0 for inner nodes
+};
+
+struct Hit
+{
+    float t;
+    int triangle;
+};
+
+// Triangle BVH in depth-first order, split at the centroid median of the longest axis
+class TriangleBvh
+{
+public:
+    void Build(std::vector<Triangle> &triangles)
+    {
+        mTriangles = &triangles;
+        mNodes.clear();
+        if (!triangles.empty())
+            build(0, static_cast<int>(triangles.size()));
+    }
+
+    // Nearest hit closer than 'maxDistance'; -1 triangle when there is none
+    Hit Closest(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const
+    {
+        Hit hit = { maxDistance, -1 };
+        traverse(origin, direction, hit, false);
+        return hit;
+    }
+
+    bool Occluded(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const
+    {
+        Hit hit = { maxDistance, -1 };
+        traverse(origin, direction, hit, true);
+        return hit.triangle >= 0;
+    }
+
+private:
+    static const int LEAF_SIZE = 4;
+
+    std::vector<Triangle> *mTriangles;
+    std::vector<Node> mNodes;
+
+    static glm::vec3 centroid(const Triangle &triangle)
+    {
+        return triangle.v0 + (triangle.edge1 + triangle.edge2) * (1.0f / 3.0f);
+    }
+
+    int build(int first, int count)
+    {
+        std::vector<Triangle> &triangles = *mTriangles;
+        const int index = static_cast<int>(mNodes.size());
+        mNodes.push_back(Node());
+
+        glm::vec3 boundsMin(1e30f), boundsMax(-1e30f), centroidMin(1e30f), centroidMax(-1e30f);
+        for (int i = first; i < first + count; ++i)
+        {
+            const Triangle &triangle = triangles[i];
+            const glm::vec3 v1 = triangle.v0 + triangle.edge1;
+            const glm::vec3 v2 = triangle.v0 + triangle.edge2;
+            boundsMin = glm::min(boundsMin, glm::min(triangle.v0, glm::min(v1, v2)));
+            boundsMax = glm::max(boundsMax, glm::max(triangle.v0, glm::max(v1, v2)));
+            centroidMin = glm::min(centroidMin, centroid(triangle));
+            centroidMax = glm::max(centroidMax, centroid(triangle));
+        }
+        mNodes[index].boundsMin = boundsMin;
+        mNodes[index].boundsMax = boundsMax;
+
+        const glm::vec3 extent = centroidMax - centroidMin;
+        const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if (count <= LEAF_SIZE || extent[axis] <= 0.0f)
+        {
+            mNodes[index].first = first;
+            mNodes[index].count = count;
+            return index;
+        }
+
+        const int half = count / 2;
+        std::nth_element(triangles.begin() + first, triangles.begin() + first + half, triangles.begin() + first + count,
+                         [axis](const Triangle &a, const Triangle &b) { return centroid(a)[axis] < centroid(b)[axis]; });
+        build(first, half);
+        const int right = build(first + half, count - half);
+        mNodes[index].first = right;
+        mNodes[index].count = 0;
+        return index;
+    }
+
+    static bool hitsBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance)
+    {
+        const glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+        const glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+        const glm::vec3 tNear = glm::min(t0, t1);
+        const glm::vec3 tFar = glm::max(t0, t1);
+        const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        return enter <= exit;
+    }
+
+    // Moller-Trumbore; both sides count, so closed meshes block light from either direction
+    static bool hitsTriangle(const Triangle &triangle, const glm::vec3 &origin, const glm::vec3 &direction, float &t)
+    {
+        const glm::vec3 p = glm::cross(direction, triangle.edge2);
+        const float det = glm::dot(triangle.edge1, p);
+        if (std::fabs(det) < 1e-12f)
+            return false;
+        const float inverseDet = 1.0f / det;
+        const glm::vec3 s = origin - triangle.v0;
+        const float u = glm::dot(s, p) * inverseDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        const glm::vec3 q = glm::cross(s, triangle.edge1);
+        const float v = glm::dot(direction, q) * inverseDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(triangle.edge2, q) * inverseDet;
+        return t > 0.0f;
+    }
+
+    void traverse(const glm::vec3 &origin, const glm::vec3 &direction, Hit &hit, bool anyHit) const
+    {
+        if (mNodes.empty())
+            return;
+
+        const glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        int stack[64];
+        int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const int index = stack[--depth];
+            const Node &node = mNodes[index];
+            if (!hitsBox(node, origin, inverseDirection, hit.t))
+                continue;
+
+            if (node.count == 0)
+            {
+                stack[depth++] = node.first;
+                stack[depth++] = index + 1;
+                continue;
+            }
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                float t;
+                if (hitsTriangle((*mTriangles)[i], origin, direction, t) && t < hit.t)
+                {
+                    hit.t = t;
+                    hit.triangle = i;
+                    if (anyHit)
+                        return;
+                }
+            }
+        }
+    }
+};
+
+// World-space center of a mesh's vertices
+inline glm::vec3 meshCenter(const LightmapMesh &mesh)
+{
+    glm::vec3 center(0.0f);
+    for (size_t v = 0; v < mesh.vertexCount; ++v)
+        center += glm::vec3(mesh.vertices[v * mesh.vertexStride], mesh.vertices[v * mesh.vertexStride + 1], mesh.vertices[v * mesh.vertexStride + 2]);
+    return glm::vec3(mesh.model * glm::vec4(center / static_cast<float>(std::max<size_t>(mesh.vertexCount, 1)), 1.0f));
+}
+
+// Triangle 'triangle' of 'mesh' in world space. Winding is not trusted (the
+// desk boxes mix both); the normal faces away from the mesh's center.
+inline Triangle worldTriangle(const LightmapMesh &mesh, int meshIndex, size_t triangle, const glm::vec3 &center)
+{
+    glm::vec3 corners[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        const float *position = mesh.vertices + mesh.indices[triangle * 3 + c] * mesh.vertexStride;
+        corners[c] = glm::vec3(mesh.model * glm::vec4(position[0], position[1], position[2], 1.0f));
+    }
+
+    Triangle world;
+    world.v0 = corners[0];
+    world.edge1 = corners[1] - corners[0];
+    world.edge2 = corners[2] - corners[0];
+    const glm::vec3 normal = glm::cross(world.edge1, world.edge2);
+    const float length = glm::length(normal);
+    world.normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+    if (glm::dot(world.normal, corners[0] + corners[1] + corners[2] - 3.0f * center) < 0.0f)
+        world.normal = -world.normal;
+    world.mesh = meshIndex;
+    return world;
+}
+
+// Irradiance from point lights with inverse-square falloff and traced shadows
+inline glm::vec3 directLight(const TriangleBvh &bvh, const std::vector<BakeLight> &lights, const glm::vec3 &position, const glm::vec3 &normal)
+{
+    glm::vec3 irradiance(0.0f);
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        const glm::vec3 toLight = lights[i].position - position;
+        const float distance = glm::length(toLight);
+        const float cosine = glm::dot(normal, toLight) / std::max(distance, 1e-6f);
+        if (cosine <= 0.0f)
+            continue;
+        if (bvh.Occluded(position + normal * LIGHTMAP_RAY_OFFSET, toLight / distance, distance - LIGHTMAP_RAY_OFFSET))
+            continue;
+        irradiance += lights[i].color * (lights[i].intensity * cosine / (distance * distance));
+    }
+    return irradiance;
+}
+
+// xorshift32; cheap and good enough for hemisphere sampling
+inline float random(unsigned &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Cosine-weighted direction around 'normal'
+inline glm::vec3 cosineSample(const glm::vec3 &normal, unsigned &state)
+{
+    const float r = std::sqrt(random(state));
+    const float phi = 6.28318531f * random(state);
+    const glm::vec3 tangent = glm::normalize(std::fabs(normal.x) > 0.5f ? glm::cross(normal, glm::vec3(0.0f, 1.0f, 0.0f))
+                                                                       : glm::cross(normal, glm::vec3(1.0f, 0.0f, 0.0f)));
+    const glm::vec3 bitangent = glm::cross(normal, tangent);
+    return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1.0f - r * r));
+}
+}
+
+
+class LightmapBaker
+{
+public:
+    LightmapBaker() : mWidth(0), mHeight(0), mCellSize(0), mCellsPerRow(0), mKey(0)
+    {
+    }
+
+    // Lays out the atlas and the lightmap UVs. The meshes' data must stay alive until Bake().
+    void SetScene(const LightmapMesh *meshes, size_t meshCount, const BakeLight *lights, size_t lightCount,
+                  const LightmapSettings &settings = LightmapSettings())
+    {
+        mMeshes.assign(meshes, meshes + meshCount);
+        mLights.assign(lights, lights + lightCount);
+        mSettings = settings;
+
+        // One cell per pair of consecutive triangles, laid out in a square grid
+        size_t cellCount = 0;
+        for (size_t m = 0; m < meshCount; ++m)
+            cellCount += (meshes[m].indexCount / 3 + 1) / 2;
+        mCellSize = settings.cellTexels + 2 * GUTTER;
+        mCellsPerRow = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(cellCount)))));
+        mWidth = mCellsPerRow * mCellSize;
+        mHeight = static_cast<int>((cellCount + mCellsPerRow - 1) / mCellsPerRow) * mCellSize;
+
+        mCells.clear();
+        mUVs.assign(meshCount, std::vector<float>());
+        mTriangles.clear();
+        mConflicts.clear();
+        for (size_t m = 0; m < meshCount; ++m)
+        {
+            const LightmapMesh &mesh = meshes[m];
+            mUVs[m].assign(mesh.vertexCount * 2, 0.0f);
+            std::vector<char> assigned(mesh.vertexCount, 0);
+            const glm::vec3 center = lightmap_baker::meshCenter(mesh);
+            const size_t triangleCount = mesh.indexCount / 3;
+            for (size_t t = 0; t < triangleCount; t += 2)
+            {
+                Cell cell;
+                cell.x = static_cast<int>(mCells.size() % mCellsPerRow) * mCellSize + GUTTER;
+                cell.y = static_cast<int>(mCells.size() / mCellsPerRow) * mCellSize + GUTTER;
+                cell.triangles[0] = addTriangle(mesh, static_cast<int>(m), t, center);
+                cell.triangles[1] = t + 1 < triangleCount ? addTriangle(mesh, static_cast<int>(m), t + 1, center) : -1;
+                assignUVs(static_cast<int>(m), t, cell, 0, assigned);
+                if (cell.triangles[1] >= 0)
+                    assignUVs(static_cast<int>(m), t + 1, cell, 1, assigned);
+                mCells.push_back(cell);
+            }
+        }
+        mKey = makeKey();
+        mTexels.clear();
+    }
+
+    // Traces every texel; returns false if SetScene() found the UVs could not be shared per vertex
+    bool Bake()
+    {
+        if (!mConflicts.empty())
+        {
+            std::cout << "ERROR::LIGHTMAP::" << mConflicts.size() << " vertices need different lightmap UVs per triangle; split them" << std::endl;
+            return false;
+        }
+
+        // The BVH reorders its copy; cells keep referring to mTriangles
+        mTraceTriangles = mTriangles;
+        mBvh.Build(mTraceTriangles);
+
+        mTexels.assign(static_cast<size_t>(mWidth) * mHeight * 3, 0.0f);
+        mDirect.assign(static_cast<size_t>(mWidth) * mHeight, glm::vec3(0.0f));
+        mIndirect.assign(static_cast<size_t>(mWidth) * mHeight, glm::vec3(0.0f));
+
+        unsigned threadCount = mSettings.threads > 0 ? static_cast<unsigned>(mSettings.threads) : std::thread::hardware_concurrency();
+        threadCount = std::max(1u, std::min<unsigned>(threadCount, static_cast<unsigned>(mCells.size())));
+        std::atomic<size_t> nextCell(0);
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threadCount; ++i)
+            workers.push_back(std::thread(&LightmapBaker::bakeCells, this, &nextCell));
+        bakeCells(&nextCell);
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+
+        denoiseAndCombine();
+        dilate();
+        mDirect.clear();
+        mIndirect.clear();
+        return true;
+    }
+
+    // Reads a lightmap baked from exactly this scene and these settings
+    bool Load(const char *path)
+    {
+        MappedFile file;
+        if (!file.Open(path) || file.Size() < sizeof(Header))
+            return false;
+
+        Header header;
+        memcpy(&header, file.Data(), sizeof(header));
+        const size_t texelBytes = static_cast<size_t>(mWidth) * mHeight * 3 * sizeof(float);
+        if (memcmp(header.magic, LIGHTMAP_MAGIC, sizeof(header.magic)) != 0 || header.version != LIGHTMAP_VERSION
+            || header.key != mKey || header.width != mWidth || header.height != mHeight
+            || file.Size() != sizeof(Header) + texelBytes)
+            return false;
+
+        mTexels.resize(texelBytes / sizeof(float));
+        memcpy(&mTexels[0], file.Data() + sizeof(Header), texelBytes);
+        return true;
+    }
+
+    bool Save(const char *path) const
+    {
+        if (mTexels.empty())
+            return false;
+
+        Header header;
+        memcpy(header.magic, LIGHTMAP_MAGIC, sizeof(header.magic));
+        header.version = LIGHTMAP_VERSION;
+        header.width = mWidth;
+        header.height = mHeight;
+        header.key = mKey;
+
+        FILE *file = fopen(path, "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(&mTexels[0], sizeof(float), mTexels.size(), file) == mTexels.size();
+        ok = fclose(file) == 0 && ok;
+        if (!ok)
+            remove(path);
+        return ok;
+    }
+
+    // RGB16F texture of the baked or loaded lightmap; 0 if there is none
+    GLuint CreateTexture() const
+    {
+        if (mTexels.empty())
+            return 0;
+
+        GLuint textureId;
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, mWidth, mHeight, 0, GL_RGB, GL_FLOAT, &mTexels[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return textureId;
+    }
+
+    // Lightmap coordinates of mesh 'index', two floats per vertex
+    const std::vector<float>& GetUVs(size_t index) const { return mUVs[index]; }
+    const std::vector<float>& GetTexels() const { return mTexels; }
+    int GetWidth() const { return mWidth; }
+    int GetHeight() const { return mHeight; }
+
+private:
+    static const int GUTTER = 1;
+
+    struct Cell
+    {
+        int x;                      // first inner texel
+        int y;
+        int triangles[2];           // lower right and upper left half; -1 when unpaired
+    };
+
+    struct Header
+    {
+        char magic[4];
+        unsigned version;
+        int width;
+        int height;
+        unsigned long long key;     // hash of the scene and settings
+    };
+
+    std::vector<LightmapMesh> mMeshes;
+    std::vector<BakeLight> mLights;
+    LightmapSettings mSettings;
+    int mWidth;
+    int mHeight;
+    int mCellSize;
+    int mCellsPerRow;
+    unsigned long long mKey;
+
+    std::vector<Cell> mCells;
+    std::vector<std::vector<float> > mUVs;
+    std::vector<lightmap_baker::Triangle> mTriangles;       // world space, in cell order
+    std::vector<lightmap_baker::Triangle> mTraceTriangles;  // the same, reordered by the BVH
+    std::vector<size_t> mConflicts;                         // vertices two triangles want different UVs for
+    lightmap_baker::TriangleBvh mBvh;
+
+    std::vector<glm::vec3> mDirect;
+    std::vector<glm::vec3> mIndirect;
+    std::vector<float> mTexels;     // RGB per texel, row-major from v = 0
+
+    int addTriangle(const LightmapMesh &mesh, int meshIndex, size_t triangle, const glm::vec3 &center)
+    {
+        mTriangles.push_back(lightmap_baker::worldTriangle(mesh, meshIndex, triangle, center));
+        return static_cast<int>(mTriangles.size() - 1);
+    }
+
+    // Cell-space corners of the two halves: the lower right (0,0) (1,0) (1,1), the upper left (1,1) (0,1) (0,0)
+    void assignUVs(int meshIndex, size_t triangle, const Cell &cell, int half, std::vector<char> &assigned)
+    {
+        static const float CORNERS[2][3][2] = { { { 0, 0 }, { 1, 0 }, { 1, 1 } }, { { 1, 1 }, { 0, 1 }, { 0, 0 } } };
+        const LightmapMesh &mesh = mMeshes[meshIndex];
+        std::vector<float> &uvs = mUVs[meshIndex];
+        for (int c = 0; c < 3; ++c)
+        {
+            const size_t vertex = mesh.indices[triangle * 3 + c];
+            const float u = (cell.x + CORNERS[half][c][0] * mSettings.cellTexels) / mWidth;
+            const float v = (cell.y + CORNERS[half][c][1] * mSettings.cellTexels) / mHeight;
+            if (assigned[vertex] && (uvs[vertex * 2] != u || uvs[vertex * 2 + 1] != v))
+                mConflicts.push_back(vertex);
+            assigned[vertex] = 1;
+            uvs[vertex * 2] = u;
+            uvs[vertex * 2 + 1] = v;
+        }
+    }
+
+    // World position and normal of the cell texel at (i, j)
+    void texelSurface(const Cell &cell, int i, int j, glm::vec3 &position, glm::vec3 &normal) const
+    {
+        const float u = (i + 0.5f) / mSettings.cellTexels;
+        const float v = (j + 0.5f) / mSettings.cellTexels;
+        int half = u >= v ? 0 : 1;
+        if (cell.triangles[half] < 0)
+            half = 0;
+
+        // Barycentric weights of corners 1 and 2, from the corner layout in assignUVs()
+        const lightmap_baker::Triangle &triangle = mTriangles[cell.triangles[half]];
+        float w1 = half == 0 ? u - v : v - u;
+        float w2 = half == 0 ? v : 1.0f - v;
+        w1 = std::max(w1, 0.0f);
+        w2 = std::min(w2, 1.0f - w1);
+        position = triangle.v0 + triangle.edge1 * w1 + triangle.edge2 * w2;
+        normal = triangle.normal;
+    }
+
+    glm::vec3 directLight(const glm::vec3 &position, const glm::vec3 &normal) const
+    {
+        return lightmap_baker::directLight(mBvh, mLights, position, normal);
+    }
+
+    // Irradiance bounced in from the hemisphere; each hit reflects albedo times what reaches it directly
+    glm::vec3 indirectLight(glm::vec3 position, glm::vec3 normal, unsigned &state) const
+    {
+        glm::vec3 sum(0.0f);
+        for (int s = 0; s < mSettings.samples; ++s)
+        {
+            glm::vec3 origin = position;
+            glm::vec3 surfaceNormal = normal;
+            glm::vec3 throughput(1.0f);
+            for (int bounce = 0; bounce < mSettings.bounces; ++bounce)
+            {
+                const glm::vec3 direction = lightmap_baker::cosineSample(surfaceNormal, state);
+                const lightmap_baker::Hit hit = mBvh.Closest(origin + surfaceNormal * LIGHTMAP_RAY_OFFSET, direction, 1e30f);
+                if (hit.triangle < 0)
+                {
+                    sum += throughput * mSettings.skyColor;
+                    break;
+                }
+
+                const lightmap_baker::Triangle &triangle = mTraceTriangles[hit.triangle];
+                origin = origin + surfaceNormal * LIGHTMAP_RAY_OFFSET + direction * hit.t;
+                surfaceNormal = glm::dot(triangle.normal, direction) < 0.0f ? triangle.normal : -triangle.normal;
+                throughput *= mMeshes[triangle.mesh].albedo;
+                sum += throughput * directLight(origin, surfaceNormal);
+            }
+        }
+        return mSettings.samples > 0 ? sum / static_cast<float>(mSettings.samples) : sum;
+    }
+
+    void bakeCells(std::atomic<size_t> *nextCell)
+    {
+        for (size_t c = (*nextCell)++; c < mCells.size(); c = (*nextCell)++)
+        {
+            const Cell &cell = mCells[c];
+            for (int j = 0; j < mSettings.cellTexels; ++j)
+            {
+                for (int i = 0; i < mSettings.cellTexels; ++i)
+                {
+                    const size_t texel = static_cast<size_t>(cell.y + j) * mWidth + cell.x + i;
+                    unsigned state = static_cast<unsigned>(texel * 2654435761u) | 1u;
+                    glm::vec3 position, normal;
+                    texelSurface(cell, i, j, position, normal);
+                    mDirect[texel] = directLight(position, normal);
+                    if (mSettings.bounces > 0)
+                        mIndirect[texel] = indirectLight(position, normal, state);
+                }
+            }
+        }
+    }
+
+    // 3x3 blur of the indirect light among texels of the same cell and facing, then direct light added back
+    void denoiseAndCombine()
+    {
+        for (size_t c = 0; c < mCells.size(); ++c)
+        {
+            const Cell &cell = mCells[c];
+            for (int j = 0; j < mSettings.cellTexels; ++j)
+            {
+                for (int i = 0; i < mSettings.cellTexels; ++i)
+                {
+                    glm::vec3 position, normal;
+                    texelSurface(cell, i, j, position, normal);
+
+                    glm::vec3 sum(0.0f);
+                    float weight = 0.0f;
+                    for (int dj = -1; dj <= 1; ++dj)
+                    {
+                        for (int di = -1; di <= 1; ++di)
+                        {
+                            const int ni = i + di;
+                            const int nj = j + dj;
+                            if (ni < 0 || nj < 0 || ni >= mSettings.cellTexels || nj >= mSettings.cellTexels)
+                                continue;
+                            glm::vec3 neighbourPosition, neighbourNormal;
+                            texelSurface(cell, ni, nj, neighbourPosition, neighbourNormal);
+                            if (glm::dot(normal, neighbourNormal) < 0.9f)
+                                continue;
+                            sum += mIndirect[static_cast<size_t>(cell.y + nj) * mWidth + cell.x + ni];
+                            weight += 1.0f;
+                        }
+                    }
+
+                    const size_t texel = static_cast<size_t>(cell.y + j) * mWidth + cell.x + i;
+                    const glm::vec3 color = mDirect[texel] + sum / weight;
+                    mTexels[texel * 3 + 0] = color.r;
+                    mTexels[texel * 3 + 1] = color.g;
+                    mTexels[texel * 3 + 2] = color.b;
+                }
+            }
+        }
+    }
+
+    // Gutter texels repeat the nearest inner texel so filtering at chart edges reads valid light
+    void dilate()
+    {
+        for (size_t c = 0; c < mCells.size(); ++c)
+        {
+            const Cell &cell = mCells[c];
+            for (int j = -GUTTER; j < mSettings.cellTexels + GUTTER; ++j)
+            {
+                for (int i = -GUTTER; i < mSettings.cellTexels + GUTTER; ++i)
+                {
+                    const int si = std::min(std::max(i, 0), mSettings.cellTexels - 1);
+                    const int sj = std::min(std::max(j, 0), mSettings.cellTexels - 1);
+                    if (si == i && sj == j)
+                        continue;
+                    const size_t from = static_cast<size_t>(cell.y + sj) * mWidth + cell.x + si;
+                    const size_t to = static_cast<size_t>(cell.y + j) * mWidth + cell.x + i;
+                    memcpy(&mTexels[to * 3], &mTexels[from * 3], 3 * sizeof(float));
+                }
+            }
+        }
+    }
+
+    // 64-bit FNV-1a over everything that affects the result
+    static void hashBytes(unsigned long long &hash, const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    unsigned long long makeKey() const
+    {
+        unsigned long long hash = 14695981039346656037ULL;
+        for (size_t m = 0; m < mMeshes.size(); ++m)
+        {
+            const LightmapMesh &mesh = mMeshes[m];
+            hashBytes(hash, mesh.vertices, mesh.vertexCount * mesh.vertexStride * sizeof(float));
+            hashBytes(hash, mesh.indices, mesh.indexCount * sizeof(unsigned short));
+            hashBytes(hash, &mesh.model[0][0], 16 * sizeof(float));
+            hashBytes(hash, &mesh.albedo[0], 3 * sizeof(float));
+        }
+        for (size_t i = 0; i < mLights.size(); ++i)
+        {
+            hashBytes(hash, &mLights[i].position[0], 3 * sizeof(float));
+            hashBytes(hash, &mLights[i].color[0], 3 * sizeof(float));
+            hashBytes(hash, &mLights[i].intensity, sizeof(float));
+        }
+        const int settings[] = { mSettings.cellTexels, mSettings.samples, mSettings.bounces };
+        hashBytes(hash, settings, sizeof(settings));
+        hashBytes(hash, &mSettings.skyColor[0], 3 * sizeof(float));
+        return hash;
+    }
+};
+
+#endif
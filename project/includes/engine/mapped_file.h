@@ -0,0 +1,126 @@
+/* Read-only memory mapping of a whole file.
+ *
+ * Shared by the caches that read their files in one piece: decoded pixels
+ * (image_cache.h), program binaries (program_cache.h), baked lightmaps and
+ * the texture registry's content hashes. mmap on POSIX, a file mapping
+ * view on Windows.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+// Read-only mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() : mData(NULL), mSize(0)
+#ifdef _WIN32
+        , mFile(INVALID_HANDLE_VALUE), mMapping(NULL)
+#endif
+    {
+    }
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const char *path)
+    {
+        Close();
+#ifdef _WIN32
+        mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (mFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        mSize = static_cast<size_t>(size.QuadPart);
+
+        mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mMapping)
+            mData = static_cast<const unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            mSize = static_cast<size_t>(info.st_size);
+            void *data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                madvise(data, mSize, MADV_WILLNEED);
+                mData = static_cast<const unsigned char*>(data);
+            }
+        }
+        close(fd);  // the mapping keeps its own reference
+#endif
+        if (!mData)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (mData)
+            UnmapViewOfFile(mData);
+        if (mMapping)
+            CloseHandle(mMapping);
+        if (mFile != INVALID_HANDLE_VALUE)
+            CloseHandle(mFile);
+        mMapping = NULL;
+        mFile = INVALID_HANDLE_VALUE;
+#else
+        if (mData)
+            munmap(const_cast<unsigned char*>(mData), mSize);
+#endif
+        mData = NULL;
+        mSize = 0;
+    }
+
+    const unsigned char* Data() const { return mData; }
+    size_t Size() const { return mSize; }
+
+private:
+    const unsigned char *mData;
+    size_t mSize;
+#ifdef _WIN32
+    HANDLE mFile;
+    HANDLE mMapping;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+#endif
@@ -0,0 +1,76 @@
+/* GLM configuration shared by the engine, and what it may assume about it.
+ *
+ * By default GLM compiles its scalar code: the vendored copy has SSE/AVX
+ * versions of the vec4 and mat4 operations, but they are only used for
+ * aligned types and only when GLM_FORCE_INTRINSICS is set. The Makefiles
+ * build that mode with "make GLM_SIMD=1", which adds
+ *
+ *     -DGLM_FORCE_INTRINSICS -DGLM_FORCE_DEFAULT_ALIGNED_GENTYPES -msse4.1
+ *
+ * to every translation unit. The defines must be the same everywhere (they
+ * change the size of glm::vec3 and glm::mat3), so they come from the command
+ * line and not from a header that might be included after <glm/glm.hpp>.
+ * It stays off by default: GCC already vectorizes most of GLM's scalar
+ * code, so check bench/glm_math_bench against glm_math_bench_simd on the
+ * target compiler before switching.
+ *
+ * In that mode vec4 and mat4 keep their sizes and become 16-byte aligned,
+ * which malloc and operator new already guarantee on every platform we
+ * build for, so containers of them need nothing special. vec3 and mat3 are
+ * padded to four floats per column, so any layout shared with the GPU or a
+ * file must not use them:
+ *
+ *   - use GpuVec3 (always three tightly packed floats) in structs that are
+ *     uploaded or saved, like clustered_lights.h's PointLight;
+ *   - vertex data stays in float arrays;
+ *   - pass glm::mat3 uniforms through PackedMat3() (program_reflection.h
+ *     does this for UniformHandle<glm::mat3>).
+ */
+
+#ifndef MATH_CONFIG_H
+#define MATH_CONFIG_H
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#if GLM_CONFIG_SIMD == GLM_ENABLE
+#define ENGINE_GLM_SIMD 1
+#else
+#define ENGINE_GLM_SIMD 0
+#endif
+
+// Three floats with no padding in either mode
+typedef glm::vec<3, float, glm::packed_highp> GpuVec3;
+typedef glm::mat<3, 3, float, glm::packed_highp> GpuMat3;
+
+static_assert(sizeof(GpuVec3) == 3 * sizeof(float), "GpuVec3 must be tightly packed");
+static_assert(sizeof(GpuMat3) == 9 * sizeof(float), "GpuMat3 must be tightly packed");
+static_assert(sizeof(glm::vec4) == 4 * sizeof(float) && sizeof(glm::mat4) == 16 * sizeof(float),
+              "vec4 and mat4 are copied to buffers as plain floats");
+static_assert(alignof(glm::mat4) <= alignof(std::max_align_t),
+              "containers of glm::mat4 rely on the default allocator's alignment");
+
+// glm::mat3 as nine consecutive floats, for glUniformMatrix3fv
+inline GpuMat3 PackedMat3(const glm::mat3 &m)
+{
+    return GpuMat3(m);
+}
+
+// "scalar" or the instruction set GLM's intrinsics were built for
+inline const char* GlmSimdName()
+{
+#if !ENGINE_GLM_SIMD
+    return "scalar";
+#elif GLM_ARCH & GLM_ARCH_AVX2_BIT
+    return "avx2";
+#elif GLM_ARCH & GLM_ARCH_AVX_BIT
+    return "avx";
+#elif GLM_ARCH & GLM_ARCH_SSE41_BIT
+    return "sse4.1";
+#else
+    return "sse2";
+#endif
+}
+
+#endif
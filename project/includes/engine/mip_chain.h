@@ -0,0 +1,69 @@
+/* CPU-side image helpers shared by the texture loaders: vertical flip and
+ * box-filtered mip chain generation for 8-bit images.
+ */
+
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+typedef std::vector<std::vector<unsigned char> > MipChain;
+
+inline int MipLevelCount(int width, int height)
+{
+    int levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        ++levels;
+    }
+    return levels;
+}
+
+// Images are loaded with Y axis going down, but OpenGL's Y axis goes up
+inline void FlipImageVertically(unsigned char *image, int width, int height, int channels)
+{
+    const size_t rowBytes = static_cast<size_t>(width) * channels;
+    for (int j = 0; j < height / 2; ++j)
+        std::swap_ranges(image + j * rowBytes, image + (j + 1) * rowBytes, image + (height - 1 - j) * rowBytes);
+}
+
+// Box-filters level 0 down to 1x1; odd edges reuse the last row/column
+inline void BuildMipChain(const unsigned char *image, int width, int height, int channels, MipChain &mips)
+{
+    const int c = channels;
+    mips.clear();
+    mips.push_back(std::vector<unsigned char>(image, image + static_cast<size_t>(width) * height * c));
+
+    int w = width, h = height;
+    while (w > 1 || h > 1)
+    {
+        int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        std::vector<unsigned char> dst(static_cast<size_t>(nw) * nh * c);
+        const std::vector<unsigned char> &src = mips.back();
+
+        for (int y = 0; y < nh; ++y)
+        {
+            int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+            for (int x = 0; x < nw; ++x)
+            {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                for (int k = 0; k < c; ++k)
+                {
+                    int sum = src[(y0 * w + x0) * c + k] + src[(y0 * w + x1) * c + k]
+                            + src[(y1 * w + x0) * c + k] + src[(y1 * w + x1) * c + k];
+                    dst[(y * nw + x) * c + k] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+
+        mips.push_back(dst);
+        w = nw;
+        h = nh;
+    }
+}
+
+#endif
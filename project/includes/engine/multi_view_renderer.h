@@ -0,0 +1,447 @@
+/* Several cameras rendering one scene into their own viewports.
+ *
+ * Split screens and picture-in-picture insets draw the same objects from
+ * different cameras. Each view is culled against one SceneBvh of the
+ * objects' world boxes (in parallel on large scenes, on a WorkerPool kept
+ * between frames) and gets a draw list sorted by material. What a draw
+ * needs is then split by who it belongs to:
+ *
+ *   - ViewConstants (view-projection, camera position): one per view;
+ *   - ObjectTransforms (model and normal matrix): one per object visible in
+ *     any view, shared by every view that sees it;
+ *   - MaterialConstants: one per material used by any view.
+ *
+ * All three go up in one buffer with one call per frame, so when two
+ * frusta overlap, the second view only adds its view constants and the
+ * objects the first view did not see. The transforms are one tightly packed
+ * std430 array, bound once as a storage buffer; each draw only sets its
+ * slot in that array as the constant value of a vertex attribute, which
+ * belongs to the context rather than a program. Render() sets each view's
+ * viewport and scissor, clears it, binds the view and material slices, and
+ * calls back per draw:
+ *
+ *     MultiViewRenderer views;
+ *     const int red = views.AddMaterial(glm::vec3(1.0f, 0.2f, 0.0f));
+ *     const int cube = views.AddObject(glm::vec3(-0.5f), glm::vec3(0.5f), cubeModel, red);
+ *     views.AddView(flyView);
+ *     views.AddView(overviewInset);
+ *     ...
+ *     views.SetModel(cube, cubeModel);
+ *     views.SetView(0, flyView);
+ *     views.Prepare();                                     // cull, then one upload
+ *     views.Render([](int view, int object) { glDrawArrays(...); });
+ *
+ * Shaders use the SHADER_MULTI_VIEW permutation of engine/standard_shader.h,
+ * which reads the three blocks instead of ObjectConstants and the
+ * objectColor/viewPosition uniforms. The callback must leave vertex
+ * attribute MULTI_VIEW_SLOT_LOCATION disabled in the VAOs it draws.
+ */
+
+#ifndef MULTI_VIEW_RENDERER_H
+#define MULTI_VIEW_RENDERER_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <engine/quaternion_camera.h>    // ExtractFrustumPlanes
+#include <engine/scene_bvh.h>
+#include <engine/worker_pool.h>
+
+// Uniform buffer bindings of the ViewConstants and MaterialConstants blocks
+const GLuint VIEW_CONSTANTS_BINDING = 3;
+const GLuint MATERIAL_CONSTANTS_BINDING = 4;
+// Storage buffer binding of the ObjectTransforms array, and the attribute holding a draw's slot in it
+const GLuint MULTI_VIEW_OBJECTS_BINDING = 1;
+const GLuint MULTI_VIEW_SLOT_LOCATION = 4;
+// Views are culled on their own threads from this many objects on
+const size_t MULTI_VIEW_THREADING_THRESHOLD = 4096;
+
+// std140 images of the uniform blocks, and the std430 element of the transforms array
+struct ViewConstants
+{
+    float viewProjection[16];
+    float viewPosition[4];      // vec3; w is padding
+};
+
+struct ObjectTransforms
+{
+    float model[16];
+    float normalMatrix[12];     // mat3 as three vec4 columns; w is padding
+};
+
+struct MaterialConstants
+{
+    float objectColor[4];       // vec3; w is padding
+};
+
+static_assert(sizeof(ViewConstants) == 80, "ViewConstants must match the std140 block layout");
+static_assert(sizeof(ObjectTransforms) == 112, "ObjectTransforms must match the std430 array stride");
+static_assert(sizeof(MaterialConstants) == 16, "MaterialConstants must match the std140 block layout");
+
+// A camera and the part of the window it draws to
+struct RenderView
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 position;         // camera position, for specular highlights
+    glm::ivec4 viewport;        // x, y, width, height in pixels, origin bottom left
+    glm::vec4 clearColor;       // the viewport is cleared to this before drawing
+
+    RenderView() : view(1.0f), projection(1.0f), position(0.0f), viewport(0), clearColor(0.0f, 0.0f, 0.0f, 1.0f)
+    {
+    }
+};
+
+// One entry of a view's draw list
+struct ViewDraw
+{
+    int material;
+    int object;
+};
+
+
+class MultiViewRenderer
+{
+public:
+    MultiViewRenderer() : mBufferId(0), mAlignment(0), mViewStride(0), mMaterialStride(0),
+                          mObjectsOffset(0), mMaterialsOffset(0), mViewBytes(0), mObjectBytes(0), mMaterialBytes(0)
+    {
+    }
+
+    int AddMaterial(const glm::vec3 &objectColor)
+    {
+        mMaterials.push_back(objectColor);
+        mMaterialSlots.push_back(-1);
+        return static_cast<int>(mMaterials.size() - 1);
+    }
+
+    void SetMaterial(int material, const glm::vec3 &objectColor)
+    {
+        mMaterials[material] = objectColor;
+    }
+
+    // An object drawn with 'material', whose model-space bounds are [boundsMin, boundsMax]
+    int AddObject(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model, int material)
+    {
+        Object object;
+        object.localCenter = 0.5f * (boundsMin + boundsMax);
+        object.localExtent = 0.5f * (boundsMax - boundsMin);
+        object.model = model;
+        object.material = material;
+        mObjects.push_back(object);
+        mObjectSlots.push_back(-1);
+
+        glm::vec3 worldMin, worldMax;
+        worldBounds(object, worldMin, worldMax);
+        return mBvh.Add(worldMin, worldMax);
+    }
+
+    void SetModel(int object, const glm::mat4 &model)
+    {
+        Object &placed = mObjects[object];
+        if (placed.model == model)
+            return;
+        placed.model = model;
+        glm::vec3 worldMin, worldMax;
+        worldBounds(placed, worldMin, worldMax);
+        mBvh.SetBounds(object, worldMin, worldMax);
+    }
+
+    int AddView(const RenderView &view)
+    {
+        mViews.push_back(view);
+        mDrawLists.push_back(std::vector<ViewDraw>());
+        mVisible.push_back(std::vector<int>());
+        mMaterialStarts.push_back(std::vector<size_t>());
+        return static_cast<int>(mViews.size() - 1);
+    }
+
+    void SetView(int index, const RenderView &view)
+    {
+        mViews[index] = view;
+    }
+
+    // Culls every view and fills the frame's constants; needs no GL context
+    void Cull()
+    {
+        mBvh.Update();
+
+        const size_t viewCount = mViews.size();
+        if (viewCount > 1 && mObjects.size() >= MULTI_VIEW_THREADING_THRESHOLD && std::thread::hardware_concurrency() > 1)
+        {
+            const size_t workers = std::min<size_t>(viewCount, std::thread::hardware_concurrency());
+            mWorkers.Start(static_cast<unsigned>(workers - 1));    // once; the threads wait between frames
+            mWorkers.Run(cullTask, this);
+        }
+        else
+        {
+            for (size_t v = 0; v < viewCount; ++v)
+                cullView(v);
+        }
+
+        // Last frame's slots are stale; clear only the ones that were set
+        for (size_t i = 0; i < mSharedObjects.size(); ++i)
+            mObjectSlots[mSharedObjects[i]] = -1;
+        for (size_t i = 0; i < mSharedMaterials.size(); ++i)
+            mMaterialSlots[mSharedMaterials[i]] = -1;
+        mSharedObjects.clear();
+        mSharedMaterials.clear();
+
+        // Every object and material seen by any view gets one slot, in first-seen order
+        for (size_t v = 0; v < viewCount; ++v)
+        {
+            const std::vector<ViewDraw> &draws = mDrawLists[v];
+            for (size_t d = 0; d < draws.size(); ++d)
+            {
+                if (mObjectSlots[draws[d].object] < 0)
+                {
+                    mObjectSlots[draws[d].object] = static_cast<int>(mSharedObjects.size());
+                    mSharedObjects.push_back(draws[d].object);
+                }
+                if (mMaterialSlots[draws[d].material] < 0)
+                {
+                    mMaterialSlots[draws[d].material] = static_cast<int>(mSharedMaterials.size());
+                    mSharedMaterials.push_back(draws[d].material);
+                }
+            }
+        }
+
+        fillStaging();
+    }
+
+    // Uploads what Cull() computed, in one call; the previous contents are orphaned
+    void Upload()
+    {
+        if (!mBufferId)
+            glGenBuffers(1, &mBufferId);
+        if (mStaging.empty())
+            return;
+        glBindBuffer(GL_UNIFORM_BUFFER, mBufferId);
+        glBufferData(GL_UNIFORM_BUFFER, mStaging.size(), &mStaging[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void Prepare()
+    {
+        if (!mAlignment)
+        {
+            GLint uniformAlignment = 256, storageAlignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+            SetOffsetAlignment(static_cast<size_t>(std::max(uniformAlignment, storageAlignment)));
+        }
+        Cull();
+        Upload();
+    }
+
+    // Draws every view in order; 'draw(view, object)' issues the object's draw calls with its slices bound.
+    // Leaves the scissor test off and the viewport at the last view's.
+    template <typename DrawObject>
+    void Render(DrawObject draw)
+    {
+        if (mObjectBytes)
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, MULTI_VIEW_OBJECTS_BINDING, mBufferId, mObjectsOffset, mObjectBytes);
+        glEnable(GL_SCISSOR_TEST);
+        for (size_t v = 0; v < mViews.size(); ++v)
+        {
+            const RenderView &view = mViews[v];
+            glViewport(view.viewport.x, view.viewport.y, view.viewport.z, view.viewport.w);
+            glScissor(view.viewport.x, view.viewport.y, view.viewport.z, view.viewport.w);
+            glClearColor(view.clearColor.r, view.clearColor.g, view.clearColor.b, view.clearColor.a);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBindBufferRange(GL_UNIFORM_BUFFER, VIEW_CONSTANTS_BINDING, mBufferId, v * mViewStride, sizeof(ViewConstants));
+
+            int boundMaterial = -1;
+            const std::vector<ViewDraw> &draws = mDrawLists[v];
+            for (size_t d = 0; d < draws.size(); ++d)
+            {
+                if (draws[d].material != boundMaterial)
+                {
+                    boundMaterial = draws[d].material;
+                    glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_CONSTANTS_BINDING, mBufferId,
+                                      mMaterialsOffset + mMaterialSlots[boundMaterial] * mMaterialStride, sizeof(MaterialConstants));
+                }
+                glVertexAttribI1i(MULTI_VIEW_SLOT_LOCATION, mObjectSlots[draws[d].object]);
+                draw(static_cast<int>(v), draws[d].object);
+            }
+        }
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    // The larger of the context's uniform and storage buffer offset alignments; Prepare() queries them,
+    // Cull() alone needs it set. Only bound ranges are aligned; the transforms array is packed.
+    void SetOffsetAlignment(size_t alignment)
+    {
+        mAlignment = std::max<size_t>(alignment, 16);
+        mViewStride = alignUp(sizeof(ViewConstants));
+        mMaterialStride = alignUp(sizeof(MaterialConstants));
+    }
+
+    const std::vector<ViewDraw>& GetDrawList(int view) const { return mDrawLists[view]; }
+    size_t GetViewCount() const { return mViews.size(); }
+    size_t GetObjectCount() const { return mObjects.size(); }
+    // Objects and materials uploaded by the last Cull(), each once however many views drew it
+    size_t GetSharedObjectCount() const { return mSharedObjects.size(); }
+    size_t GetSharedMaterialCount() const { return mSharedMaterials.size(); }
+    size_t GetUploadBytes() const { return mStaging.size(); }
+    // Bytes of the upload that were view constants, object transforms and materials
+    size_t GetViewBytes() const { return mViewBytes; }
+    size_t GetObjectBytes() const { return mObjectBytes; }
+    size_t GetMaterialBytes() const { return mMaterialBytes; }
+
+    void Destroy()
+    {
+        mWorkers.Stop();
+        if (mBufferId)
+            glDeleteBuffers(1, &mBufferId);
+        mBufferId = 0;
+        mStaging.clear();
+    }
+
+private:
+    struct Object
+    {
+        glm::vec3 localCenter;
+        glm::vec3 localExtent;
+        glm::mat4 model;
+        int material;
+    };
+
+    std::vector<Object> mObjects;
+    std::vector<glm::vec3> mMaterials;
+    SceneBvh mBvh;                              // world boxes of mObjects
+    std::vector<RenderView> mViews;
+    std::vector<std::vector<int> > mVisible;    // per view, reused every frame
+    std::vector<std::vector<ViewDraw> > mDrawLists;
+    std::vector<std::vector<size_t> > mMaterialStarts;     // per view, for the counting sort
+
+    // Slots of this frame's upload; -1 for objects and materials no view draws
+    std::vector<int> mObjectSlots;
+    std::vector<int> mMaterialSlots;
+    std::vector<int> mSharedObjects;
+    std::vector<int> mSharedMaterials;
+
+    GLuint mBufferId;
+    std::vector<unsigned char> mStaging;        // views, then objects, then materials
+    size_t mAlignment;
+    size_t mViewStride, mMaterialStride;
+    size_t mObjectsOffset, mMaterialsOffset;
+    size_t mViewBytes, mObjectBytes, mMaterialBytes;
+    WorkerPool mWorkers;
+
+    size_t alignUp(size_t bytes) const
+    {
+        return (bytes + mAlignment - 1) / mAlignment * mAlignment;
+    }
+
+    // Box around the transformed model-space box: center moved, extent through |upper 3x3|
+    static void worldBounds(const Object &object, glm::vec3 &worldMin, glm::vec3 &worldMax)
+    {
+        const glm::vec3 center(object.model * glm::vec4(object.localCenter, 1.0f));
+        const glm::mat3 m(object.model);
+        const glm::vec3 extent = glm::abs(m[0]) * object.localExtent.x + glm::abs(m[1]) * object.localExtent.y
+                               + glm::abs(m[2]) * object.localExtent.z;
+        worldMin = center - extent;
+        worldMax = center + extent;
+    }
+
+    static void cullTask(void *context, unsigned worker, unsigned workers)
+    {
+        MultiViewRenderer *renderer = static_cast<MultiViewRenderer*>(context);
+        for (size_t v = worker; v < renderer->mViews.size(); v += workers)
+            renderer->cullView(v);
+    }
+
+    // Touches only its own view's vectors, so views can be culled on separate threads
+    void cullView(size_t v)
+    {
+        glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+        ExtractFrustumPlanes(mViews[v].projection * mViews[v].view, planes);
+
+        std::vector<int> &visible = mVisible[v];
+        visible.clear();
+        mBvh.QueryFrustum(planes, visible);
+
+        // Counting sort by material; objects keep the tree's order, which groups them spatially
+        std::vector<size_t> &starts = mMaterialStarts[v];
+        starts.assign(mMaterials.size() + 1, 0);
+        for (size_t i = 0; i < visible.size(); ++i)
+            ++starts[mObjects[visible[i]].material + 1];
+        for (size_t m = 1; m < starts.size(); ++m)
+            starts[m] += starts[m - 1];
+
+        std::vector<ViewDraw> &draws = mDrawLists[v];
+        draws.resize(visible.size());
+        for (size_t i = 0; i < visible.size(); ++i)
+        {
+            const int material = mObjects[visible[i]].material;
+            ViewDraw &draw = draws[starts[material]++];
+            draw.material = material;
+            draw.object = visible[i];
+        }
+    }
+
+    void fillStaging()
+    {
+        if (!mAlignment)
+            SetOffsetAlignment(256);
+
+        // Each section starts aligned so it can be bound; the transforms inside are back to back
+        mViewBytes = mViews.size() * mViewStride;
+        mObjectBytes = mSharedObjects.size() * sizeof(ObjectTransforms);
+        mMaterialBytes = mSharedMaterials.size() * mMaterialStride;
+        mObjectsOffset = mViewBytes;
+        mMaterialsOffset = alignUp(mObjectsOffset + mObjectBytes);
+        mStaging.resize(mMaterialsOffset + mMaterialBytes);
+
+        for (size_t v = 0; v < mViews.size(); ++v)
+        {
+            ViewConstants &constants = *reinterpret_cast<ViewConstants*>(&mStaging[v * mViewStride]);
+            const glm::mat4 viewProjection = mViews[v].projection * mViews[v].view;
+            memcpy(constants.viewProjection, &viewProjection[0][0], sizeof(constants.viewProjection));
+            const glm::vec4 position(mViews[v].position, 0.0f);
+            memcpy(constants.viewPosition, &position[0], sizeof(constants.viewPosition));
+        }
+
+        for (size_t i = 0; i < mSharedObjects.size(); ++i)
+        {
+            ObjectTransforms &transforms = *reinterpret_cast<ObjectTransforms*>(&mStaging[mObjectsOffset + i * sizeof(ObjectTransforms)]);
+            const glm::mat4 &model = mObjects[mSharedObjects[i]].model;
+            memcpy(transforms.model, &model[0][0], sizeof(transforms.model));
+
+            // Inverse transpose of the upper 3x3 from its cofactor columns, as ComputeObjectConstants does
+            const glm::vec3 a(model[0]), b(model[1]), c(model[2]);
+            const glm::vec3 bc = glm::cross(b, c);
+            const float det = glm::dot(a, bc);
+            const float invDet = std::fabs(det) > 1e-20f ? 1.0f / det : 1.0f;
+            const glm::vec3 columns[3] = { bc * invDet, glm::cross(c, a) * invDet, glm::cross(a, b) * invDet };
+            for (int column = 0; column < 3; ++column)
+            {
+                transforms.normalMatrix[4 * column + 0] = columns[column].x;
+                transforms.normalMatrix[4 * column + 1] = columns[column].y;
+                transforms.normalMatrix[4 * column + 2] = columns[column].z;
+                transforms.normalMatrix[4 * column + 3] = 0.0f;
+            }
+        }
+
+        for (size_t i = 0; i < mSharedMaterials.size(); ++i)
+        {
+            MaterialConstants &constants = *reinterpret_cast<MaterialConstants*>(&mStaging[mMaterialsOffset + i * mMaterialStride]);
+            const glm::vec3 &color = mMaterials[mSharedMaterials[i]];
+            constants.objectColor[0] = color.r;
+            constants.objectColor[1] = color.g;
+            constants.objectColor[2] = color.b;
+            constants.objectColor[3] = 0.0f;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,223 @@
+/* Per-object shader constants computed once per frame on the CPU.
+ *
+ * Deriving the normal matrix in the vertex shader
+ * (mat3(transpose(inverse(model)))) repeats a 3x3 inversion for every
+ * vertex although it only changes per object. ComputeObjectConstants()
+ * instead computes the model, normal and model-view-projection matrices of
+ * a whole batch of objects in one SSE pass, and ObjectConstantsBuffer
+ * uploads them to a uniform buffer with one call per frame. Each draw then
+ * only binds its object's slice:
+ *
+ *     const glm::mat4 models[OBJECT_COUNT] = { cubeModel, lampModel };
+ *     gObjectConstants.Update(models, OBJECT_COUNT, projection * view);
+ *     ...
+ *     gObjectConstants.Bind(CUBE_OBJECT);
+ *     glDrawArrays(...);
+ *
+ * The shader side is the std140 block
+ *
+ *     layout (std140, binding = 1) uniform ObjectConstants
+ *     {
+ *         mat4 model;
+ *         mat4 modelViewProjection;
+ *         mat3 normalMatrix;
+ *     };
+ */
+
+#ifndef OBJECT_CONSTANTS_H
+#define OBJECT_CONSTANTS_H
+
+#include <GL/glew.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OBJECT_CONSTANTS_SSE
+#include <emmintrin.h>
+#endif
+
+// Uniform buffer binding the ObjectConstants block is declared with
+const GLuint OBJECT_CONSTANTS_BINDING = 1;
+
+// std140 image of the ObjectConstants block
+struct ObjectConstants
+{
+    float model[16];
+    float modelViewProjection[16];
+    float normalMatrix[12];     // mat3 as three vec4 columns; w is padding
+};
+
+static_assert(sizeof(ObjectConstants) == 176, "ObjectConstants must match the std140 block layout");
+
+
+#ifdef OBJECT_CONSTANTS_SSE
+
+namespace object_constants
+{
+inline __m128 splat(__m128 v, int lane)
+{
+    switch (lane)
+    {
+    case 0:  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+    case 1:  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+    case 2:  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+    default: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+}
+
+// a x b in xyz; w stays a.w * b.w - a.w * b.w = 0
+inline __m128 cross(__m128 a, __m128 b)
+{
+    const __m128 aYzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 bYzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYzx), _mm_mul_ps(aYzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+inline float dot3(__m128 a, __m128 b)
+{
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_mul_ps(a, b));
+    return lanes[0] + lanes[1] + lanes[2];
+}
+}
+
+#endif
+
+
+// Fills 'count' ObjectConstants spaced 'stride' bytes apart in 'out'. The
+// normal matrix is the inverse transpose of the model's upper 3x3, built from
+// the cofactor columns (b x c, c x a, a x b) / det.
+inline void ComputeObjectConstants(const glm::mat4 *models, size_t count, const glm::mat4 &viewProjection,
+                                   unsigned char *out, size_t stride)
+{
+#ifdef OBJECT_CONSTANTS_SSE
+    using namespace object_constants;
+
+    const __m128 vp0 = _mm_loadu_ps(&viewProjection[0][0]);
+    const __m128 vp1 = _mm_loadu_ps(&viewProjection[1][0]);
+    const __m128 vp2 = _mm_loadu_ps(&viewProjection[2][0]);
+    const __m128 vp3 = _mm_loadu_ps(&viewProjection[3][0]);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        ObjectConstants &constants = *reinterpret_cast<ObjectConstants*>(out + i * stride);
+        __m128 column[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            column[c] = _mm_loadu_ps(&models[i][c][0]);
+            _mm_storeu_ps(constants.model + 4 * c, column[c]);
+
+            __m128 mvp = _mm_mul_ps(vp0, splat(column[c], 0));
+            mvp = _mm_add_ps(mvp, _mm_mul_ps(vp1, splat(column[c], 1)));
+            mvp = _mm_add_ps(mvp, _mm_mul_ps(vp2, splat(column[c], 2)));
+            mvp = _mm_add_ps(mvp, _mm_mul_ps(vp3, splat(column[c], 3)));
+            _mm_storeu_ps(constants.modelViewProjection + 4 * c, mvp);
+        }
+
+        // The 3x3 part only; the w lanes of the first three columns are 0 for affine models
+        const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        const __m128 a = _mm_and_ps(column[0], xyzMask);
+        const __m128 b = _mm_and_ps(column[1], xyzMask);
+        const __m128 c = _mm_and_ps(column[2], xyzMask);
+        const __m128 bc = cross(b, c);
+        const float det = dot3(a, bc);
+        // A degenerate scale has no inverse; the unscaled cofactors still point the right way
+        const __m128 invDet = _mm_set1_ps(std::fabs(det) > 1e-20f ? 1.0f / det : 1.0f);
+
+        _mm_storeu_ps(constants.normalMatrix + 0, _mm_mul_ps(bc, invDet));
+        _mm_storeu_ps(constants.normalMatrix + 4, _mm_mul_ps(cross(c, a), invDet));
+        _mm_storeu_ps(constants.normalMatrix + 8, _mm_mul_ps(cross(a, b), invDet));
+    }
+#else
+    for (size_t i = 0; i < count; ++i)
+    {
+        ObjectConstants &constants = *reinterpret_cast<ObjectConstants*>(out + i * stride);
+        const glm::mat4 mvp = viewProjection * models[i];
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(models[i])));
+        memcpy(constants.model, &models[i][0][0], sizeof(constants.model));
+        memcpy(constants.modelViewProjection, &mvp[0][0], sizeof(constants.modelViewProjection));
+        for (int c = 0; c < 3; ++c)
+        {
+            constants.normalMatrix[4 * c + 0] = normalMatrix[c][0];
+            constants.normalMatrix[4 * c + 1] = normalMatrix[c][1];
+            constants.normalMatrix[4 * c + 2] = normalMatrix[c][2];
+            constants.normalMatrix[4 * c + 3] = 0.0f;
+        }
+    }
+#endif
+}
+
+
+// One uniform buffer holding the constants of every object drawn in a frame
+class ObjectConstantsBuffer
+{
+public:
+    explicit ObjectConstantsBuffer(GLuint binding = OBJECT_CONSTANTS_BINDING)
+        : mBinding(binding), mBufferId(0), mStride(0), mCount(0)
+    {
+    }
+
+    // Recomputes all objects and uploads them in one call; the previous
+    // contents are orphaned so the driver never waits for draws still using them
+    void Update(const glm::mat4 *models, size_t count, const glm::mat4 &viewProjection)
+    {
+        if (!mBufferId)
+        {
+            glGenBuffers(1, &mBufferId);
+
+            // Each object's slice must start at a multiple of the offset alignment
+            GLint alignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            mStride = (sizeof(ObjectConstants) + alignment - 1) / alignment * alignment;
+        }
+
+        mCount = count;
+        mStaging.assign(count * mStride, 0);
+        if (count == 0)
+            return;
+        ComputeObjectConstants(models, count, viewProjection, &mStaging[0], mStride);
+
+        glBindBuffer(GL_UNIFORM_BUFFER, mBufferId);
+        glBufferData(GL_UNIFORM_BUFFER, mStaging.size(), &mStaging[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Points the ObjectConstants block at object 'index' for the next draws
+    void Bind(size_t index) const
+    {
+        if (index < mCount)
+            glBindBufferRange(GL_UNIFORM_BUFFER, mBinding, mBufferId, index * mStride, sizeof(ObjectConstants));
+    }
+
+    // CPU copy of the last upload
+    const ObjectConstants& Get(size_t index) const
+    {
+        return *reinterpret_cast<const ObjectConstants*>(&mStaging[index * mStride]);
+    }
+
+    size_t GetCount() const { return mCount; }
+
+    void Destroy()
+    {
+        if (mBufferId)
+            glDeleteBuffers(1, &mBufferId);
+        mBufferId = 0;
+        mCount = 0;
+        mStaging.clear();
+    }
+
+private:
+    GLuint mBinding;
+    GLuint mBufferId;
+    size_t mStride;
+    size_t mCount;
+    std::vector<unsigned char> mStaging;
+};
+
+#endif
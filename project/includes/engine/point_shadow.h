@@ -0,0 +1,378 @@
+/* Omnidirectional shadows of one point light, cached per cube face.
+ *
+ * Distances from the light are rendered into a depth cube map in a single
+ * layered pass: a geometry shader instanced six times (one invocation per
+ * face) routes each triangle to its face with gl_Layer, so the casters are
+ * drawn once, not once per face.
+ *
+ * Faces are only redrawn when something they see changed. Begin() compares
+ * the light position and every caster's model matrix with the previous
+ * frame; a moving light invalidates all six faces, a moving caster only the
+ * faces its old and new bounds overlap. When nothing changed, Begin()
+ * returns false and the pass costs nothing:
+ *
+ *     if (gPointShadow.Begin(gLightPosition, casters, CASTER_COUNT))
+ *     {
+ *         for (size_t i = 0; i < CASTER_COUNT; ++i)
+ *             if (gPointShadow.NeedsCaster(i))
+ *                 ... bind caster i's ObjectConstants and draw it ...
+ *         gPointShadow.End();
+ *     }
+ *     gPointShadow.Bind(POINT_SHADOW_UNIT);
+ *
+ * The shadow program reads 'model' from the ObjectConstants block of
+ * engine/object_constants.h. Receivers sample the map with the
+ * pointShadow() function of POINT_SHADOW_GLSL.
+ */
+
+#ifndef POINT_SHADOW_H
+#define POINT_SHADOW_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <engine/program_builder.h>
+#include <engine/program_reflection.h>
+
+const int POINT_SHADOW_FACES = 6;
+const GLuint POINT_SHADOW_UNIT = 1;     // texture unit POINT_SHADOW_GLSL samples
+
+// View direction and up vector of each face, in cube map order +X, -X, +Y, -Y, +Z, -Z
+const glm::vec3 POINT_SHADOW_FACE_DIRECTIONS[POINT_SHADOW_FACES] =
+{
+    glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+    glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+    glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+const glm::vec3 POINT_SHADOW_FACE_UPS[POINT_SHADOW_FACES] =
+{
+    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+    glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+};
+
+// Receiver side, for fragment shaders: fraction of the light reaching a point
+const char* const POINT_SHADOW_GLSL = R"(
+layout (binding = 1) uniform samplerCubeShadow shadowMap;
+uniform float shadowFarPlane;
+
+// 1 when 'fragmentPos' sees 'lightPosition', 0 in shadow; linear filtering gives soft edges
+float pointShadow(vec3 fragmentPos, vec3 norm, vec3 lightPosition)
+{
+    // Offsetting along the normal keeps lit surfaces from shadowing themselves
+    vec3 fromLight = fragmentPos + norm * 0.02 - lightPosition;
+    float depth = length(fromLight) / shadowFarPlane;
+    return texture(shadowMap, vec4(fromLight, depth - 0.002));
+}
+)";
+
+const char* const POINT_SHADOW_VERTEX_SHADER = R"(#version 440 core
+
+layout (location = 0) in vec3 position;
+
+layout (std140, binding = 1) uniform ObjectConstants
+{
+    mat4 model;
+    mat4 modelViewProjection;
+    mat3 normalMatrix;
+};
+
+void main()
+{
+    gl_Position = model * vec4(position, 1.0f); // world space; the geometry shader projects per face
+}
+)";
+
+const char* const POINT_SHADOW_GEOMETRY_SHADER = R"(#version 440 core
+
+layout (triangles, invocations = 6) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+uniform mat4 faceViewProjections[6];
+uniform int faceMask; // faces to redraw this frame; the others keep their cached depth
+
+out vec3 worldPosition;
+
+void main()
+{
+    if ((faceMask & (1 << gl_InvocationID)) == 0)
+        return;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        worldPosition = gl_in[i].gl_Position.xyz;
+        gl_Layer = gl_InvocationID;
+        gl_Position = faceViewProjections[gl_InvocationID] * gl_in[i].gl_Position;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
+)";
+
+const char* const POINT_SHADOW_FRAGMENT_SHADER = R"(#version 440 core
+
+in vec3 worldPosition;
+
+uniform vec3 lightPosition;
+uniform float farPlane;
+
+void main()
+{
+    // Linear distance, so receivers compare against length(fragment - light)
+    gl_FragDepth = length(worldPosition - lightPosition) / farPlane;
+}
+)";
+
+
+// An object drawn into the shadow map; bounds are in model space
+struct ShadowCaster
+{
+    glm::mat4 model;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+
+class PointShadowMap
+{
+public:
+    PointShadowMap() : mSize(0), mFarPlane(0.0f), mTexture(0), mFramebuffer(0), mProgramId(0),
+                       mFaceMask(0), mHasLight(false), mRenderedFaces(0)
+    {
+    }
+
+    // Allocates the cube map and queues the shadow program on 'builder'
+    bool Create(int size, float farPlane, ProgramBuilder &builder)
+    {
+        mSize = size;
+        mFarPlane = farPlane;
+
+        glGenTextures(1, &mTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, mTexture);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT24, size, size);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        // Attaching the whole cube map makes the framebuffer layered; gl_Layer picks the face
+        glGenFramebuffers(1, &mFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::FRAMEBUFFER::POINT_SHADOW_INCOMPLETE 0x" << std::hex << status << std::dec << std::endl;
+            return false;
+        }
+
+        builder.Add(POINT_SHADOW_VERTEX_SHADER, POINT_SHADOW_FRAGMENT_SHADER, mProgramId, POINT_SHADOW_GEOMETRY_SHADER);
+        return true;
+    }
+
+    // Call after the builder finished; looks up the shadow pass uniforms
+    bool Reflect()
+    {
+        if (!mReflection.Reflect(mProgramId))
+            return false;
+        mFaceViewProjections = mReflection.Uniform<glm::mat4>("faceViewProjections");
+        mFaceMaskUniform = mReflection.Uniform<int>("faceMask");
+        mLightPosition = mReflection.Uniform<glm::vec3>("lightPosition");
+        mReflection.Uniform<float>("farPlane").Set(mFarPlane);
+        return true;
+    }
+
+    // Works out which faces need redrawing and, if any do, clears them and
+    // binds the shadow pass. Returns false when every face is still valid.
+    bool Begin(const glm::vec3 &lightPosition, const ShadowCaster *casters, size_t count)
+    {
+        mFaceMask = 0;
+        const bool lightMoved = !mHasLight || lightPosition != mLight;
+        if (lightMoved || count != mPrevious.size())
+            mFaceMask = ALL_FACES;
+
+        mLight = lightPosition;
+        mHasLight = true;
+        mPrevious.resize(count);
+        mCasterFaces.assign(count, 0);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Bounds bounds;
+            worldBounds(casters[i], bounds);
+            mCasterFaces[i] = facesOverlapping(bounds);
+
+            CasterState &previous = mPrevious[i];
+            if (memcmp(&previous.model[0][0], &casters[i].model[0][0], sizeof(float) * 16) != 0)
+            {
+                // The faces that saw the caster where it was, and where it is now
+                mFaceMask |= facesOverlapping(previous.bounds) | mCasterFaces[i];
+                previous.model = casters[i].model;
+                previous.bounds = bounds;
+            }
+        }
+        if (mFaceMask == 0)
+            return false;
+
+        const float clearDepth = 1.0f;
+        for (int face = 0; face < POINT_SHADOW_FACES; ++face)
+        {
+            if (mFaceMask & (1u << face))
+            {
+                glClearTexSubImage(mTexture, 0, 0, 0, face, mSize, mSize, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+                ++mRenderedFaces;
+            }
+        }
+
+        glGetIntegerv(GL_VIEWPORT, mViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glViewport(0, 0, mSize, mSize);
+        glEnable(GL_DEPTH_TEST);
+
+        glm::mat4 faceViewProjections[POINT_SHADOW_FACES];
+        const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, mFarPlane);
+        for (int face = 0; face < POINT_SHADOW_FACES; ++face)
+            faceViewProjections[face] = projection * glm::lookAt(mLight, mLight + POINT_SHADOW_FACE_DIRECTIONS[face], POINT_SHADOW_FACE_UPS[face]);
+
+        glUseProgram(mProgramId);
+        mFaceViewProjections.Set(faceViewProjections, POINT_SHADOW_FACES);
+        mFaceMaskUniform.Set(static_cast<int>(mFaceMask));
+        mLightPosition.Set(mLight);
+        mReflection.Flush();
+        return true;
+    }
+
+    // True when caster 'index' of the last Begin() overlaps a face being redrawn
+    bool NeedsCaster(size_t index) const
+    {
+        return index < mCasterFaces.size() && (mCasterFaces[index] & mFaceMask) != 0;
+    }
+
+    // Returns to the default framebuffer and the viewport Begin() found
+    void End()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(mViewport[0], mViewport[1], mViewport[2], mViewport[3]);
+    }
+
+    // Binds the cube map for receivers
+    void Bind(GLuint unit = POINT_SHADOW_UNIT) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, mTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Forces every face to redraw, e.g. after the scene was rebuilt
+    void Invalidate() { mHasLight = false; }
+
+    float GetFarPlane() const { return mFarPlane; }
+    // Faces redrawn since creation; six per frame without caching
+    unsigned long long GetRenderedFaceCount() const { return mRenderedFaces; }
+
+    void Destroy()
+    {
+        glDeleteFramebuffers(1, &mFramebuffer);
+        glDeleteTextures(1, &mTexture);
+        if (mProgramId)
+            glDeleteProgram(mProgramId);
+        mFramebuffer = mTexture = mProgramId = 0;
+        mPrevious.clear();
+        mCasterFaces.clear();
+        mHasLight = false;
+    }
+
+private:
+    static const unsigned ALL_FACES = (1u << POINT_SHADOW_FACES) - 1;
+
+    struct Bounds
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    struct CasterState
+    {
+        CasterState() : model(0.0f)     // never equal to a real model, so new casters start dirty
+        {
+            bounds.min = bounds.max = glm::vec3(0.0f);
+        }
+        glm::mat4 model;
+        Bounds bounds;
+    };
+
+    int mSize;
+    float mFarPlane;
+    GLuint mTexture;
+    GLuint mFramebuffer;
+    GLuint mProgramId;
+    ProgramReflection mReflection;
+    UniformHandle<glm::mat4> mFaceViewProjections;
+    UniformHandle<int> mFaceMaskUniform;
+    UniformHandle<glm::vec3> mLightPosition;
+
+    unsigned mFaceMask;                     // faces redrawn by the current pass
+    glm::vec3 mLight;
+    bool mHasLight;
+    std::vector<CasterState> mPrevious;     // per caster, as last drawn
+    std::vector<unsigned> mCasterFaces;     // per caster, faces its current bounds overlap
+    GLint mViewport[4];
+    unsigned long long mRenderedFaces;
+
+    // World-space box around the caster's transformed model-space box
+    static void worldBounds(const ShadowCaster &caster, Bounds &out)
+    {
+        const glm::vec3 center = (caster.boundsMin + caster.boundsMax) * 0.5f;
+        const glm::vec3 extent = (caster.boundsMax - caster.boundsMin) * 0.5f;
+        const glm::vec3 worldCenter = glm::vec3(caster.model * glm::vec4(center, 1.0f));
+        glm::vec3 worldExtent(0.0f);
+        for (int c = 0; c < 3; ++c)
+            worldExtent += glm::abs(glm::vec3(caster.model[c])) * extent[c];
+        out.min = worldCenter - worldExtent;
+        out.max = worldCenter + worldExtent;
+    }
+
+    // Faces whose 90 degree frustum the box may intersect. Face +X holds the
+    // directions with x >= |y| and x >= |z|; the box misses it when one of
+    // those four half-spaces excludes all of its corners.
+    unsigned facesOverlapping(const Bounds &bounds) const
+    {
+        const glm::vec3 lo = bounds.min - mLight;
+        const glm::vec3 hi = bounds.max - mLight;
+
+        // Beyond the far plane nothing is drawn
+        const glm::vec3 nearest = glm::clamp(glm::vec3(0.0f), lo, hi);
+        if (glm::dot(nearest, nearest) > mFarPlane * mFarPlane)
+            return 0;
+
+        unsigned faces = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const int u = (axis + 1) % 3;
+            const int v = (axis + 2) % 3;
+            for (int side = 0; side < 2; ++side)
+            {
+                // Largest distance along the face axis any corner reaches
+                const float reach = side == 0 ? hi[axis] : -lo[axis];
+                if (reach - lo[u] >= 0.0f && reach + hi[u] >= 0.0f && reach - lo[v] >= 0.0f && reach + hi[v] >= 0.0f)
+                    faces |= 1u << (axis * 2 + side);
+            }
+        }
+        return faces;
+    }
+};
+
+#endif
@@ -0,0 +1,267 @@
+/* Batch shader program builder.
+ *
+ * Checking GL_COMPILE_STATUS right after glCompileShader makes the driver
+ * finish that compile before the next one is even issued. ProgramBuilder
+ * instead issues every glCompileShader and glLinkProgram of a batch first,
+ * with GL_KHR/ARB_parallel_shader_compile enabled where available, and only
+ * queries status and info logs once all of them have completed:
+ *
+ *     ProgramBuilder programs(&gProgramCache);
+ *     programs.Add(cubeVertexShaderSource, cubeFragmentShaderSource, gCubeProgramId);
+ *     programs.Add(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId);
+ *     programs.Submit();
+ *     ... other start-up work (e.g. texture loading) overlaps the compiles ...
+ *     if (!programs.Finish())
+ *         return EXIT_FAILURE;
+ *
+ * Add() takes an optional geometry shader as its last argument.
+ *
+ * With a ProgramCache, programs that have a valid cached binary skip
+ * compilation, and freshly linked ones are stored for the next run.
+ *
+ * BuildProgram() does all of this for one program, for the tutorials'
+ * UCreateShaderProgram:
+ *
+ *     if (!BuildProgram(vtxShaderSource, fragShaderSource, programId, &gProgramCache))
+ *         return false;
+ */
+
+#ifndef PROGRAM_BUILDER_H
+#define PROGRAM_BUILDER_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <engine/program_cache.h>
+
+
+class ProgramBuilder
+{
+public:
+    explicit ProgramBuilder(ProgramCache *cache = NULL) : mCache(cache), mSubmitted(false)
+    {
+    }
+
+    // Queues a program; 'programId' is written by Submit() and must outlive Finish()
+    void Add(const char *vtxShaderSource, const char *fragShaderSource, GLuint &programId,
+             const char *geomShaderSource = NULL)
+    {
+        Job job;
+        job.vtxShaderSource = vtxShaderSource;
+        job.fragShaderSource = fragShaderSource;
+        job.geomShaderSource = geomShaderSource;
+        job.programId = &programId;
+        job.vertexShaderId = 0;
+        job.fragmentShaderId = 0;
+        job.geometryShaderId = 0;
+        job.cached = false;
+        mJobs.push_back(job);
+    }
+
+    // Issues every compile and link without waiting on any of them
+    void Submit()
+    {
+        if (mSubmitted)
+            return;
+        mSubmitted = true;
+        enableParallelCompile();
+
+        for (size_t i = 0; i < mJobs.size(); ++i)
+        {
+            Job &job = mJobs[i];
+            job.cached = mCache && mCache->Load(job.vtxShaderSource, job.fragShaderSource, *job.programId, job.geomShaderSource);
+            if (job.cached)
+                continue;
+
+            job.vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+            job.fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(job.vertexShaderId, 1, &job.vtxShaderSource, NULL);
+            glShaderSource(job.fragmentShaderId, 1, &job.fragShaderSource, NULL);
+            glCompileShader(job.vertexShaderId);
+            glCompileShader(job.fragmentShaderId);
+            if (job.geomShaderSource)
+            {
+                job.geometryShaderId = glCreateShader(GL_GEOMETRY_SHADER);
+                glShaderSource(job.geometryShaderId, 1, &job.geomShaderSource, NULL);
+                glCompileShader(job.geometryShaderId);
+            }
+        }
+
+        // Links are queued behind their compiles; a failed compile just makes the link fail
+        for (size_t i = 0; i < mJobs.size(); ++i)
+        {
+            Job &job = mJobs[i];
+            if (job.cached)
+                continue;
+
+            *job.programId = glCreateProgram();
+            glAttachShader(*job.programId, job.vertexShaderId);
+            glAttachShader(*job.programId, job.fragmentShaderId);
+            if (job.geometryShaderId)
+                glAttachShader(*job.programId, job.geometryShaderId);
+            if (mCache)
+                ProgramCache::PrepareLink(*job.programId);
+            glLinkProgram(*job.programId);
+        }
+    }
+
+    // True once every link has completed. Without parallel compile support
+    // the driver cannot be asked, so this reports true and Finish() blocks.
+    bool IsComplete() const
+    {
+        if (!parallelCompileSupported())
+            return true;
+
+        for (size_t i = 0; i < mJobs.size(); ++i)
+        {
+            if (mJobs[i].cached)
+                continue;
+            GLint done = GL_FALSE;
+            glGetProgramiv(*mJobs[i].programId, GL_COMPLETION_STATUS_KHR, &done);
+            if (!done)
+                return false;
+        }
+        return true;
+    }
+
+    // Waits for the batch, then reports compile/link errors. Returns false if
+    // any program failed; failed programs are deleted and set to 0.
+    bool Finish()
+    {
+        Submit();
+        while (!IsComplete())
+            std::this_thread::yield();
+
+        bool ok = true;
+        for (size_t i = 0; i < mJobs.size(); ++i)
+        {
+            Job &job = mJobs[i];
+            if (job.cached)
+                continue;
+
+            bool linked = checkShader(job.vertexShaderId, "VERTEX") & checkShader(job.fragmentShaderId, "FRAGMENT");
+            if (job.geometryShaderId)
+                linked = checkShader(job.geometryShaderId, "GEOMETRY") && linked;
+            linked = linked && checkProgram(*job.programId);
+
+            glDetachShader(*job.programId, job.vertexShaderId);
+            glDetachShader(*job.programId, job.fragmentShaderId);
+            glDeleteShader(job.vertexShaderId);
+            glDeleteShader(job.fragmentShaderId);
+            if (job.geometryShaderId)
+            {
+                glDetachShader(*job.programId, job.geometryShaderId);
+                glDeleteShader(job.geometryShaderId);
+            }
+
+            if (!linked)
+            {
+                glDeleteProgram(*job.programId);
+                *job.programId = 0;
+                ok = false;
+            }
+            else if (mCache)
+            {
+                mCache->Store(job.vtxShaderSource, job.fragShaderSource, *job.programId, job.geomShaderSource);
+            }
+        }
+
+        mJobs.clear();
+        mSubmitted = false;
+        return ok;
+    }
+
+    // Compile and link errors reported by Finish(), as printed
+    const std::string& GetErrors() const { return mErrors; }
+
+    // Submit() and Finish() in one call
+    bool Build()
+    {
+        Submit();
+        return Finish();
+    }
+
+private:
+    struct Job
+    {
+        const char *vtxShaderSource;
+        const char *fragShaderSource;
+        const char *geomShaderSource;   // NULL when the program has no geometry stage
+        GLuint *programId;
+        GLuint vertexShaderId;
+        GLuint fragmentShaderId;
+        GLuint geometryShaderId;
+        bool cached;
+    };
+
+    ProgramCache *mCache;
+    std::vector<Job> mJobs;
+    bool mSubmitted;
+    std::string mErrors;
+
+    static bool parallelCompileSupported()
+    {
+        return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    }
+
+    // Lets the driver pick how many compiler threads to use
+    static void enableParallelCompile()
+    {
+        if (GLEW_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        else if (GLEW_ARB_parallel_shader_compile)
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    }
+
+    bool checkShader(GLuint shaderId, const char *stage)
+    {
+        int success = 0;
+        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+        if (success)
+            return true;
+
+        char infoLog[512];
+        glGetShaderInfoLog(shaderId, sizeof(infoLog), NULL, infoLog);
+        reportError(std::string("ERROR::SHADER::") + stage + "::COMPILATION_FAILED\n" + infoLog);
+        return false;
+    }
+
+    bool checkProgram(GLuint programId)
+    {
+        int success = 0;
+        glGetProgramiv(programId, GL_LINK_STATUS, &success);
+        if (success)
+            return true;
+
+        char infoLog[512];
+        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+        reportError(std::string("ERROR::SHADER::PROGRAM::LINKING_FAILED\n") + infoLog);
+        return false;
+    }
+
+    void reportError(const std::string &error)
+    {
+        std::cout << error << std::endl;
+        mErrors += error + "\n";
+    }
+};
+
+
+// Builds one program through the cache; on failure 'programId' is 0 and 'errors' (if given) holds the info logs
+inline bool BuildProgram(const char *vtxShaderSource, const char *fragShaderSource, GLuint &programId,
+                         ProgramCache *cache = NULL, std::string *errors = NULL)
+{
+    ProgramBuilder builder(cache);
+    builder.Add(vtxShaderSource, fragShaderSource, programId);
+    const bool built = builder.Build();
+    if (errors)
+        *errors = builder.GetErrors();
+    return built;
+}
+
+#endif
@@ -0,0 +1,232 @@
+/* On-disk cache of linked shader program binaries.
+ *
+ * Programs are keyed by a hash of their vertex, fragment and optional
+ * geometry source together with the GL vendor, renderer and version strings, so a driver update or a
+ * different GPU never sees another driver's binary. Load() recreates a
+ * program with glProgramBinary; when there is no entry, or the driver
+ * rejects it, the caller compiles from source as before and hands the linked
+ * program to Store(), which writes glGetProgramBinary's output to
+ * "<directory>/<key>.glbin".
+ *
+ *     if (!gProgramCache.Load(vtxSource, fragSource, programId))
+ *     {
+ *         ... compile and attach shaders ...
+ *         ProgramCache::PrepareLink(programId);
+ *         glLinkProgram(programId);
+ *         ... check link status ...
+ *         gProgramCache.Store(vtxSource, fragSource, programId);
+ *     }
+ *
+ * BuildProgram() in program_builder.h does exactly this for one program.
+ */
+
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GL/glew.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>     // _mkdir
+#endif
+
+#include <engine/mapped_file.h>
+
+const char     PROGRAM_CACHE_MAGIC[4]  = { 'G', 'L', 'P', 'B' };
+const unsigned PROGRAM_CACHE_VERSION   = 1;
+const char     PROGRAM_CACHE_DIRECTORY[] = "shader_cache";
+
+
+class ProgramCache
+{
+public:
+    explicit ProgramCache(const char *directory = PROGRAM_CACHE_DIRECTORY)
+        : mDirectory(directory), mHits(0), mMisses(0), mRejected(0)
+    {
+    }
+
+    // Creates 'programId' from a cached binary; returns false when the
+    // program has to be compiled from source instead
+    bool Load(const char *vtxShaderSource, const char *fragShaderSource, GLuint &programId,
+              const char *geomShaderSource = NULL)
+    {
+        if (!supported())
+            return false;
+
+        const unsigned long long key = makeKey(vtxShaderSource, fragShaderSource, geomShaderSource);
+        const std::string path = entryPath(key);
+
+        MappedFile file;
+        if (!file.Open(path.c_str()) || file.Size() < sizeof(Header))
+        {
+            ++mMisses;
+            return false;
+        }
+
+        Header header;
+        memcpy(&header, file.Data(), sizeof(header));
+        if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGRAM_CACHE_VERSION
+            || header.key != key || header.length != file.Size() - sizeof(Header))
+        {
+            file.Close();
+            remove(path.c_str());
+            ++mMisses;
+            return false;
+        }
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, header.format, file.Data() + sizeof(Header), static_cast<GLsizei>(header.length));
+
+        GLint success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // The driver may reject binaries it produced itself (e.g. after an update that kept its version string)
+            glDeleteProgram(program);
+            file.Close();
+            remove(path.c_str());
+            ++mRejected;
+            ++mMisses;
+            return false;
+        }
+
+        programId = program;
+        ++mHits;
+        return true;
+    }
+
+    // Asks the driver to keep a retrievable binary; call before glLinkProgram
+    static void PrepareLink(GLuint programId)
+    {
+        if (supported())
+            glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Writes the binary of a successfully linked program (best effort)
+    bool Store(const char *vtxShaderSource, const char *fragShaderSource, GLuint programId,
+               const char *geomShaderSource = NULL)
+    {
+        if (!supported())
+            return false;
+
+        GLint length = 0;
+        glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return false;
+
+        std::vector<unsigned char> binary(length);
+        GLenum format = 0;
+        GLsizei written = 0;
+        glGetProgramBinary(programId, length, &written, &format, &binary[0]);
+        if (written <= 0)
+            return false;
+
+        Header header;
+        memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+        header.version = PROGRAM_CACHE_VERSION;
+        header.format = format;
+        header.key = makeKey(vtxShaderSource, fragShaderSource, geomShaderSource);
+        header.length = static_cast<unsigned long long>(written);
+
+        makeDirectory(mDirectory.c_str());
+        const std::string path = entryPath(header.key);
+
+        // Write under a temporary name so a concurrent reader never maps a half-written file
+        const std::string tempPath = path + ".tmp";
+        FILE *file = fopen(tempPath.c_str(), "wb");
+        if (!file)
+            return false;
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(&binary[0], 1, written, file) == static_cast<size_t>(written);
+        ok = fclose(file) == 0 && ok;
+
+        if (ok)
+        {
+            remove(path.c_str());
+            ok = rename(tempPath.c_str(), path.c_str()) == 0;
+        }
+        if (!ok)
+            remove(tempPath.c_str());
+        return ok;
+    }
+
+    // Load() calls that reused a binary / had to compile, and binaries the driver refused
+    unsigned GetHitCount() const { return mHits; }
+    unsigned GetMissCount() const { return mMisses; }
+    unsigned GetRejectedCount() const { return mRejected; }
+
+private:
+    struct Header
+    {
+        char magic[4];
+        unsigned version;
+        unsigned long long key;
+        unsigned format;            // GLenum returned by glGetProgramBinary
+        unsigned reserved;
+        unsigned long long length;  // bytes of binary following the header
+    };
+
+    std::string mDirectory;
+    unsigned mHits;
+    unsigned mMisses;
+    unsigned mRejected;
+
+    static bool supported()
+    {
+        if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+            return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    // 64-bit FNV-1a; strings are hashed with their terminator so "ab"+"c" != "a"+"bc"
+    static void hashString(unsigned long long &hash, const char *text)
+    {
+        if (!text)
+            text = "";
+        do
+        {
+            hash ^= static_cast<unsigned char>(*text);
+            hash *= 1099511628211ULL;
+        } while (*text++);
+    }
+
+    static unsigned long long makeKey(const char *vtxShaderSource, const char *fragShaderSource, const char *geomShaderSource)
+    {
+        unsigned long long hash = 14695981039346656037ULL;
+        hashString(hash, vtxShaderSource);
+        hashString(hash, fragShaderSource);
+        if (geomShaderSource)
+            hashString(hash, geomShaderSource);     // absent for most programs; keeps their keys unchanged
+        hashString(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+        hashString(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+        hashString(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+        return hash;
+    }
+
+    std::string entryPath(unsigned long long key) const
+    {
+        char name[32];
+        sprintf(name, "%016llx.glbin", key);
+        return mDirectory + "/" + name;
+    }
+
+    static void makeDirectory(const char *path)
+    {
+#ifdef _WIN32
+        _mkdir(path);
+#else
+        mkdir(path, 0755);
+#endif
+    }
+};
+
+#endif
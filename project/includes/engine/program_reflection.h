@@ -0,0 +1,548 @@
+/* Program reflection with typed uniform handles.
+ *
+ * ProgramReflection::Reflect() lists a linked program's uniforms, uniform
+ * blocks and vertex inputs through glGetProgramInterfaceiv /
+ * glGetProgramResourceiv, ordered by location. Uniform<T>(name) returns a
+ * handle that is type-checked against the reflected GLSL type once, instead
+ * of looking the name up every frame. Handles write into a CPU shadow copy
+ * of the default uniform block, read back from the program when it is
+ * reflected; Flush() then sends only the uniforms that actually changed,
+ * with glProgramUniform*, once per draw. A partial write to an array
+ * re-sends the elements around it with the values the program already has:
+ *
+ *     UniformHandle<glm::mat4> model = gCubeReflection.Uniform<glm::mat4>("model");
+ *     ...
+ *     model.Set(modelMatrix);      // no GL call, no-op if unchanged
+ *     gCubeReflection.Flush();     // right before the draw
+ *
+ * CheckInputs() compares the reflected vertex inputs with the slots and
+ * types the mesh code binds, so a layout mismatch is reported after linking
+ * instead of showing up as garbage on screen. Uses the GL 4.3 interface
+ * queries where available and the glGetActive* queries otherwise; Flush()
+ * needs GL 4.1 or ARB_separate_shader_objects.
+ */
+
+#ifndef PROGRAM_REFLECTION_H
+#define PROGRAM_REFLECTION_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <engine/math_config.h>    // GpuMat3
+
+class ProgramReflection;
+
+struct ReflectedUniform
+{
+    std::string name;
+    GLenum type;
+    GLint location;     // -1 for members of a uniform block
+    GLint arraySize;
+    GLint blockIndex;   // -1 for the default block
+    GLint blockOffset;  // byte offset inside the block, -1 for the default block
+    size_t shadowOffset;
+    size_t elementBytes;
+};
+
+struct ReflectedBlock
+{
+    std::string name;
+    GLint binding;
+    GLint dataSize;
+};
+
+struct ReflectedInput
+{
+    std::string name;
+    GLenum type;
+    GLint location;
+};
+
+// Slot and type a mesh binds for a vertex input, for CheckInputs()
+struct ExpectedInput
+{
+    const char *name;
+    GLint location;
+    GLenum type;
+};
+
+
+// GLSL types each C++ type may be written to
+template <typename T> struct UniformTraits;
+
+template <> struct UniformTraits<float>
+{
+    static bool Accepts(GLenum type) { return type == GL_FLOAT; }
+    static const void* Data(const float &value) { return &value; }
+};
+
+template <> struct UniformTraits<int>
+{
+    static bool Accepts(GLenum type);   // ints, bools and samplers; defined below
+    static const void* Data(const int &value) { return &value; }
+};
+
+template <> struct UniformTraits<glm::vec2>
+{
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC2; }
+    static const void* Data(const glm::vec2 &value) { return glm::value_ptr(value); }
+};
+
+template <> struct UniformTraits<glm::vec3>
+{
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC3; }
+    static const void* Data(const glm::vec3 &value) { return glm::value_ptr(value); }
+};
+
+template <> struct UniformTraits<glm::vec4>
+{
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC4; }
+    static const void* Data(const glm::vec4 &value) { return glm::value_ptr(value); }
+};
+
+template <> struct UniformTraits<glm::mat3>
+{
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_MAT3; }
+    static const void* Data(const glm::mat3 &value)
+    {
+        if (sizeof(glm::mat3) == sizeof(GpuMat3))
+            return glm::value_ptr(value);
+        // Aligned mat3 columns are padded to four floats; the shadow copy wants nine
+        static GpuMat3 packed;
+        packed = PackedMat3(value);
+        return glm::value_ptr(packed);
+    }
+};
+
+template <> struct UniformTraits<glm::mat4>
+{
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_MAT4; }
+    static const void* Data(const glm::mat4 &value) { return glm::value_ptr(value); }
+};
+
+
+// Writes one uniform of a reflected program. A default-constructed handle,
+// or one whose uniform was optimized out, silently ignores writes.
+template <typename T>
+class UniformHandle
+{
+public:
+    UniformHandle() : mReflection(NULL), mIndex(0)
+    {
+    }
+
+    bool IsValid() const { return mReflection != NULL; }
+
+    void Set(const T &value);
+    // Writes 'count' array elements starting at 'first'
+    void Set(const T *values, int count, int first = 0);
+
+private:
+    friend class ProgramReflection;
+
+    UniformHandle(ProgramReflection *reflection, size_t index) : mReflection(reflection), mIndex(index)
+    {
+    }
+
+    ProgramReflection *mReflection;
+    size_t mIndex;
+};
+
+
+class ProgramReflection
+{
+public:
+    ProgramReflection() : mProgramId(0)
+    {
+    }
+
+    // Rebuilds the tables for a linked program and reads the shadow copy from it
+    bool Reflect(GLuint programId)
+    {
+        mProgramId = programId;
+        mUniforms.clear();
+        mBlocks.clear();
+        mInputs.clear();
+        mShadow.clear();
+        mState.clear();
+        if (!programId || !(GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects))
+            return false;
+
+        if (GLEW_VERSION_4_3 || GLEW_ARB_program_interface_query)
+            queryResources();
+        else
+            queryActive();
+
+        // Default-block uniforms by location, block members by block and offset, inputs by slot
+        std::sort(mUniforms.begin(), mUniforms.end(), uniformOrder);
+        std::sort(mInputs.begin(), mInputs.end(), inputOrder);
+
+        size_t shadowBytes = 0;
+        for (size_t i = 0; i < mUniforms.size(); ++i)
+        {
+            if (mUniforms[i].location < 0)
+                continue;
+            mUniforms[i].shadowOffset = shadowBytes;
+            shadowBytes += mUniforms[i].elementBytes * mUniforms[i].arraySize;
+        }
+        mShadow.assign(shadowBytes, 0);
+        mState.assign(mUniforms.size(), CLEAN);
+        readBack();
+        return true;
+    }
+
+    // Typed handle to a default-block uniform; arrays are looked up by their base name
+    template <typename T>
+    UniformHandle<T> Uniform(const char *name)
+    {
+        for (size_t i = 0; i < mUniforms.size(); ++i)
+        {
+            const ReflectedUniform &uniform = mUniforms[i];
+            if (uniform.name != name && uniform.name != std::string(name) + "[0]")
+                continue;
+
+            if (uniform.location < 0)
+            {
+                std::cout << "ERROR::REFLECTION::" << name << " is in a uniform block and has no handle" << std::endl;
+                return UniformHandle<T>();
+            }
+            if (!UniformTraits<T>::Accepts(uniform.type) || uniform.elementBytes == 0)
+            {
+                std::cout << "ERROR::REFLECTION::" << name << " has GLSL type 0x" << std::hex << uniform.type << std::dec
+                          << ", which does not match the handle type" << std::endl;
+                return UniformHandle<T>();
+            }
+            return UniformHandle<T>(this, i);
+        }
+        // Not an error: the linker drops uniforms the shader never reads
+        return UniformHandle<T>();
+    }
+
+    // Reports reflected inputs whose slot or type differs from what the mesh binds
+    bool CheckInputs(const ExpectedInput *expected, size_t count) const
+    {
+        bool ok = true;
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (size_t j = 0; j < mInputs.size(); ++j)
+            {
+                const ReflectedInput &input = mInputs[j];
+                if (input.name != expected[i].name)
+                    continue;
+                if (input.location != expected[i].location || input.type != expected[i].type)
+                {
+                    std::cout << "ERROR::REFLECTION::INPUT_MISMATCH " << input.name
+                              << ": shader has location " << input.location << ", type 0x" << std::hex << input.type
+                              << "; mesh binds location " << std::dec << expected[i].location
+                              << ", type 0x" << std::hex << expected[i].type << std::dec << std::endl;
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    }
+
+    // Sends every changed uniform to the program; call once before each draw
+    void Flush()
+    {
+        for (size_t i = 0; i < mUniforms.size(); ++i)
+        {
+            if (mState[i] != DIRTY)
+                continue;
+            upload(mUniforms[i]);
+            mState[i] = CLEAN;
+        }
+    }
+
+    // Re-reads the shadow copy, e.g. after something else wrote the uniforms directly
+    void Invalidate()
+    {
+        readBack();
+        std::fill(mState.begin(), mState.end(), static_cast<unsigned char>(CLEAN));
+    }
+
+    GLuint GetProgram() const { return mProgramId; }
+    const std::vector<ReflectedUniform>& GetUniforms() const { return mUniforms; }
+    const std::vector<ReflectedBlock>& GetBlocks() const { return mBlocks; }
+    const std::vector<ReflectedInput>& GetInputs() const { return mInputs; }
+
+private:
+    template <typename T> friend class UniformHandle;
+
+    enum ShadowState { CLEAN, DIRTY };
+
+    GLuint mProgramId;
+    std::vector<ReflectedUniform> mUniforms;
+    std::vector<ReflectedBlock> mBlocks;
+    std::vector<ReflectedInput> mInputs;
+    std::vector<unsigned char> mShadow;
+    std::vector<unsigned char> mState;
+
+    // Copies into the shadow copy; marks the uniform dirty only if the bytes changed
+    void write(size_t index, const void *data, int count, int first)
+    {
+        const ReflectedUniform &uniform = mUniforms[index];
+        if (first < 0 || count <= 0 || first + count > uniform.arraySize)
+            return;
+
+        unsigned char *target = &mShadow[uniform.shadowOffset + uniform.elementBytes * first];
+        const size_t bytes = uniform.elementBytes * count;
+        if (memcmp(target, data, bytes) == 0)
+            return;
+
+        memcpy(target, data, bytes);
+        mState[index] = DIRTY;
+    }
+
+    void upload(const ReflectedUniform &uniform) const
+    {
+        const void *data = &mShadow[uniform.shadowOffset];
+        const GLfloat *f = static_cast<const GLfloat*>(data);
+        const GLint *i = static_cast<const GLint*>(data);
+        switch (uniform.type)
+        {
+        case GL_FLOAT:       glProgramUniform1fv(mProgramId, uniform.location, uniform.arraySize, f); break;
+        case GL_FLOAT_VEC2:  glProgramUniform2fv(mProgramId, uniform.location, uniform.arraySize, f); break;
+        case GL_FLOAT_VEC3:  glProgramUniform3fv(mProgramId, uniform.location, uniform.arraySize, f); break;
+        case GL_FLOAT_VEC4:  glProgramUniform4fv(mProgramId, uniform.location, uniform.arraySize, f); break;
+        case GL_FLOAT_MAT3:  glProgramUniformMatrix3fv(mProgramId, uniform.location, uniform.arraySize, GL_FALSE, f); break;
+        case GL_FLOAT_MAT4:  glProgramUniformMatrix4fv(mProgramId, uniform.location, uniform.arraySize, GL_FALSE, f); break;
+        default:             glProgramUniform1iv(mProgramId, uniform.location, uniform.arraySize, i); break;
+        }
+    }
+
+    // Fills the shadow copy with the program's current values, element by element
+    void readBack()
+    {
+        for (size_t u = 0; u < mUniforms.size(); ++u)
+        {
+            const ReflectedUniform &uniform = mUniforms[u];
+            if (uniform.location < 0 || uniform.elementBytes == 0)
+                continue;
+
+            // Array elements are looked up by name; only GL 4.3 promises consecutive locations
+            std::string base = uniform.name;
+            if (base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0)
+                base.erase(base.size() - 3);
+            for (GLint e = 0; e < uniform.arraySize; ++e)
+            {
+                char element[16];
+                sprintf(element, "[%d]", e);
+                const GLint location = e == 0 ? uniform.location : glGetUniformLocation(mProgramId, (base + element).c_str());
+                if (location < 0)
+                    continue;
+
+                void *target = &mShadow[uniform.shadowOffset + uniform.elementBytes * e];
+                if (UniformTraits<int>::Accepts(uniform.type))
+                    glGetUniformiv(mProgramId, location, static_cast<GLint*>(target));
+                else
+                    glGetUniformfv(mProgramId, location, static_cast<GLfloat*>(target));
+            }
+        }
+    }
+
+    // GL 4.3 program interface queries
+    void queryResources()
+    {
+        GLint count = 0;
+        glGetProgramInterfaceiv(mProgramId, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const GLenum properties[] = { GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE, GL_BLOCK_INDEX, GL_OFFSET };
+            GLint values[5];
+            glGetProgramResourceiv(mProgramId, GL_UNIFORM, i, 5, properties, 5, NULL, values);
+            addUniform(resourceName(GL_UNIFORM, i), values[0], values[1], values[2], values[3], values[4]);
+        }
+
+        glGetProgramInterfaceiv(mProgramId, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const GLenum properties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+            GLint values[2];
+            glGetProgramResourceiv(mProgramId, GL_UNIFORM_BLOCK, i, 2, properties, 2, NULL, values);
+
+            ReflectedBlock block;
+            block.name = resourceName(GL_UNIFORM_BLOCK, i);
+            block.binding = values[0];
+            block.dataSize = values[1];
+            mBlocks.push_back(block);
+        }
+
+        glGetProgramInterfaceiv(mProgramId, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const GLenum properties[] = { GL_TYPE, GL_LOCATION };
+            GLint values[2];
+            glGetProgramResourceiv(mProgramId, GL_PROGRAM_INPUT, i, 2, properties, 2, NULL, values);
+
+            ReflectedInput input;
+            input.name = resourceName(GL_PROGRAM_INPUT, i);
+            input.type = static_cast<GLenum>(values[0]);
+            input.location = values[1];
+            mInputs.push_back(input);
+        }
+    }
+
+    // The same tables from the older glGetActive* queries (e.g. GL 4.1 contexts on macOS)
+    void queryActive()
+    {
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(mProgramId, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(mProgramId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(std::max(1, maxLength));
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(mProgramId, i, static_cast<GLsizei>(name.size()), NULL, &size, &type, &name[0]);
+
+            const GLuint index = i;
+            GLint blockIndex = -1;
+            GLint offset = -1;
+            glGetActiveUniformsiv(mProgramId, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+            glGetActiveUniformsiv(mProgramId, 1, &index, GL_UNIFORM_OFFSET, &offset);
+            addUniform(&name[0], type, glGetUniformLocation(mProgramId, &name[0]), size, blockIndex, offset);
+        }
+
+        glGetProgramiv(mProgramId, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        glGetProgramiv(mProgramId, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+        name.assign(std::max(1, maxLength), 0);
+        for (GLint i = 0; i < count; ++i)
+        {
+            ReflectedBlock block;
+            glGetActiveUniformBlockName(mProgramId, i, static_cast<GLsizei>(name.size()), NULL, &name[0]);
+            block.name = &name[0];
+            glGetActiveUniformBlockiv(mProgramId, i, GL_UNIFORM_BLOCK_BINDING, &block.binding);
+            glGetActiveUniformBlockiv(mProgramId, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+            mBlocks.push_back(block);
+        }
+
+        glGetProgramiv(mProgramId, GL_ACTIVE_ATTRIBUTES, &count);
+        glGetProgramiv(mProgramId, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+        name.assign(std::max(1, maxLength), 0);
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint size = 0;
+            ReflectedInput input;
+            glGetActiveAttrib(mProgramId, i, static_cast<GLsizei>(name.size()), NULL, &size, &input.type, &name[0]);
+            input.name = &name[0];
+            input.location = glGetAttribLocation(mProgramId, &name[0]);
+            mInputs.push_back(input);
+        }
+    }
+
+    void addUniform(const std::string &name, GLint type, GLint location, GLint arraySize, GLint blockIndex, GLint blockOffset)
+    {
+        ReflectedUniform uniform;
+        uniform.name = name;
+        uniform.type = static_cast<GLenum>(type);
+        uniform.location = blockIndex >= 0 ? -1 : location;
+        uniform.arraySize = std::max(1, arraySize);
+        uniform.blockIndex = blockIndex;
+        uniform.blockOffset = blockIndex >= 0 ? blockOffset : -1;
+        uniform.elementBytes = typeBytes(uniform.type);
+        uniform.shadowOffset = 0;
+        mUniforms.push_back(uniform);
+    }
+
+    std::string resourceName(GLenum interface, GLint index) const
+    {
+        const GLenum property = GL_NAME_LENGTH;
+        GLint length = 0;
+        glGetProgramResourceiv(mProgramId, interface, index, 1, &property, 1, NULL, &length);
+        std::vector<char> name(std::max(1, length));
+        glGetProgramResourceName(mProgramId, interface, index, static_cast<GLsizei>(name.size()), NULL, &name[0]);
+        return std::string(&name[0]);
+    }
+
+    // Bytes of one element in the shadow copy; 0 for types handles cannot write
+    static size_t typeBytes(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_FLOAT:      return sizeof(GLfloat);
+        case GL_FLOAT_VEC2: return 2 * sizeof(GLfloat);
+        case GL_FLOAT_VEC3: return 3 * sizeof(GLfloat);
+        case GL_FLOAT_VEC4: return 4 * sizeof(GLfloat);
+        case GL_FLOAT_MAT3: return 9 * sizeof(GLfloat);
+        case GL_FLOAT_MAT4: return 16 * sizeof(GLfloat);
+        default:            return UniformTraits<int>::Accepts(type) ? sizeof(GLint) : 0;
+        }
+    }
+
+    static bool uniformOrder(const ReflectedUniform &a, const ReflectedUniform &b)
+    {
+        if ((a.location < 0) != (b.location < 0))
+            return a.location >= 0;
+        if (a.location >= 0)
+            return a.location < b.location;
+        if (a.blockIndex != b.blockIndex)
+            return a.blockIndex < b.blockIndex;
+        return a.blockOffset < b.blockOffset;
+    }
+
+    static bool inputOrder(const ReflectedInput &a, const ReflectedInput &b)
+    {
+        return a.location < b.location;
+    }
+};
+
+
+inline bool UniformTraits<int>::Accepts(GLenum type)
+{
+    switch (type)
+    {
+    case GL_INT:
+    case GL_BOOL:
+    case GL_SAMPLER_1D:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_1D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_CUBE_MAP_ARRAY:
+    case GL_SAMPLER_CUBE_MAP_ARRAY_SHADOW:
+    case GL_SAMPLER_2D_MULTISAMPLE:
+    case GL_SAMPLER_BUFFER:
+    case GL_INT_SAMPLER_2D:
+    case GL_INT_SAMPLER_3D:
+    case GL_UNSIGNED_INT_SAMPLER_2D:
+    case GL_UNSIGNED_INT_SAMPLER_3D:
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <typename T>
+void UniformHandle<T>::Set(const T &value)
+{
+    if (mReflection)
+        mReflection->write(mIndex, UniformTraits<T>::Data(value), 1, 0);
+}
+
+template <typename T>
+void UniformHandle<T>::Set(const T *values, int count, int first)
+{
+    if (!mReflection)
+        return;
+    // Elements are written one by one so padded or aligned T layouts still pack tightly
+    for (int i = 0; i < count; ++i)
+        mReflection->write(mIndex, UniformTraits<T>::Data(values[i]), 1, first + i);
+}
+
+#endif
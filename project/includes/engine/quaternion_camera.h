@@ -0,0 +1,214 @@
+/* First-person camera with a quaternion orientation and cached matrices.
+ *
+ * learnOpengl's Camera keeps Euler angles and rebuilds its basis with four
+ * trig calls and two cross products on every mouse event, then rebuilds
+ * lookAt on every GetViewMatrix(). Here the orientation is a unit quaternion
+ * and each yaw/pitch step is composed onto it with the small-angle form
+ * (1, axis * angle / 2), normalized: no trig, and for per-event angles the
+ * error is far below a pixel. The basis is read off the rotation matrix.
+ *
+ * View, projection and view-projection matrices, and the six frustum
+ * planes, are rebuilt lazily, only when something changed since the last
+ * query. GetRevision() changes with every edit, so callers can skip their
+ * own uploads while the camera is idle:
+ *
+ *     if (camera.GetRevision() != uploadedRevision)
+ *     {
+ *         viewProjectionUniform.Set(camera.GetViewProjection());
+ *         uploadedRevision = camera.GetRevision();
+ *     }
+ */
+
+#ifndef QUATERNION_CAMERA_H
+#define QUATERNION_CAMERA_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Order of GetFrustumPlanes(); each plane is (normal, distance), normal pointing inwards
+enum FrustumPlane
+{
+    FRUSTUM_LEFT, FRUSTUM_RIGHT, FRUSTUM_BOTTOM, FRUSTUM_TOP, FRUSTUM_NEAR, FRUSTUM_FAR, FRUSTUM_PLANE_COUNT
+};
+
+const float QUATERNION_CAMERA_MAX_PITCH = 1.55334303f;     // 89 degrees, keeps the view from flipping over
+
+// The six planes bounding what 'viewProjection' maps into clip space, indexed by FrustumPlane and
+// normalized so dot(plane.xyz, p) + plane.w is a distance
+inline void ExtractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 *planes)
+{
+    const glm::mat4 &m = viewProjection;
+    const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[FRUSTUM_LEFT] = row3 + row0;
+    planes[FRUSTUM_RIGHT] = row3 - row0;
+    planes[FRUSTUM_BOTTOM] = row3 + row1;
+    planes[FRUSTUM_TOP] = row3 - row1;
+    planes[FRUSTUM_NEAR] = row3 + row2;
+    planes[FRUSTUM_FAR] = row3 - row2;
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+
+class QuaternionCamera
+{
+public:
+    // Yaw and pitch in degrees with learnOpengl's convention: yaw -90 looks down -Z
+    explicit QuaternionCamera(const glm::vec3 &position = glm::vec3(0.0f), float yawDegrees = -90.0f, float pitchDegrees = 0.0f)
+        : mPosition(position), mPitch(glm::radians(pitchDegrees)), mRevision(0), mDirty(DIRTY_ALL)
+    {
+        mOrientation = glm::angleAxis(glm::radians(-90.0f - yawDegrees), glm::vec3(0.0f, 1.0f, 0.0f))
+                     * glm::angleAxis(mPitch, glm::vec3(1.0f, 0.0f, 0.0f));
+        SetPerspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    }
+
+    void SetPerspective(float fovyRadians, float aspect, float nearPlane, float farPlane)
+    {
+        mFovy = fovyRadians;
+        mAspect = aspect;
+        mNear = nearPlane;
+        mFar = farPlane;
+        changed(DIRTY_PROJECTION);
+    }
+
+    void SetAspect(float aspect)
+    {
+        if (aspect == mAspect)
+            return;
+        mAspect = aspect;
+        changed(DIRTY_PROJECTION);
+    }
+
+    void SetPosition(const glm::vec3 &position)
+    {
+        mPosition = position;
+        changed(DIRTY_VIEW);
+    }
+
+    // Moves in world space; use GetFront()/GetRight()/GetUp() for camera-relative motion
+    void Translate(const glm::vec3 &offset)
+    {
+        mPosition += offset;
+        changed(DIRTY_VIEW);
+    }
+
+    // Turns by yaw (positive to the right, about world up) and pitch (positive up, about the camera's right)
+    void Rotate(float yawRadians, float pitchRadians)
+    {
+        const float pitch = glm::clamp(mPitch + pitchRadians, -QUATERNION_CAMERA_MAX_PITCH, QUATERNION_CAMERA_MAX_PITCH);
+        pitchRadians = pitch - mPitch;
+        mPitch = pitch;
+        if (yawRadians == 0.0f && pitchRadians == 0.0f)
+            return;
+
+        // Yaw in world space on the left, pitch in camera space on the right
+        const glm::quat yaw(1.0f, 0.0f, -0.5f * yawRadians, 0.0f);
+        const glm::quat tilt(1.0f, 0.5f * pitchRadians, 0.0f, 0.0f);
+        mOrientation = glm::normalize(glm::normalize(yaw) * mOrientation * glm::normalize(tilt));
+        changed(DIRTY_BASIS | DIRTY_VIEW);
+    }
+
+    const glm::vec3& GetPosition() const { return mPosition; }
+    const glm::quat& GetOrientation() const { return mOrientation; }
+    float GetFovy() const { return mFovy; }
+    unsigned GetRevision() const { return mRevision; }
+
+    glm::vec3 GetFront() { updateBasis(); return -mBasis[2]; }
+    glm::vec3 GetRight() { updateBasis(); return mBasis[0]; }
+    glm::vec3 GetUp() { updateBasis(); return mBasis[1]; }
+
+    const glm::mat4& GetView()
+    {
+        if (mDirty & DIRTY_VIEW)
+        {
+            updateBasis();
+            // Inverse of a rotation then translation: transposed rotation, rotated negative position
+            const glm::mat3 inverse = glm::transpose(mBasis);
+            mView = glm::mat4(inverse);
+            mView[3] = glm::vec4(-(inverse * mPosition), 1.0f);
+            mDirty &= ~DIRTY_VIEW;
+        }
+        return mView;
+    }
+
+    const glm::mat4& GetProjection()
+    {
+        if (mDirty & DIRTY_PROJECTION)
+        {
+            mProjection = glm::perspective(mFovy, mAspect, mNear, mFar);
+            mDirty &= ~DIRTY_PROJECTION;
+        }
+        return mProjection;
+    }
+
+    const glm::mat4& GetViewProjection()
+    {
+        if (mDirty & DIRTY_VIEW_PROJECTION)
+        {
+            mViewProjection = GetProjection() * GetView();
+            mDirty &= ~DIRTY_VIEW_PROJECTION;
+            mDirty |= DIRTY_FRUSTUM;
+        }
+        return mViewProjection;
+    }
+
+    // Six world-space planes indexed by FrustumPlane, normalized so dot(plane.xyz, p) + plane.w is a distance
+    const glm::vec4* GetFrustumPlanes()
+    {
+        const glm::mat4 &viewProjection = GetViewProjection();
+        if (mDirty & DIRTY_FRUSTUM)
+        {
+            ExtractFrustumPlanes(viewProjection, mFrustum);
+            mDirty &= ~DIRTY_FRUSTUM;
+        }
+        return mFrustum;
+    }
+
+private:
+    enum DirtyFlags
+    {
+        DIRTY_BASIS = 1 << 0,
+        DIRTY_VIEW = 1 << 1,
+        DIRTY_PROJECTION = 1 << 2,
+        DIRTY_VIEW_PROJECTION = 1 << 3,
+        DIRTY_FRUSTUM = 1 << 4,
+        DIRTY_ALL = (1 << 5) - 1
+    };
+
+    glm::vec3 mPosition;
+    glm::quat mOrientation;
+    float mPitch;               // accumulated, only to clamp against
+    float mFovy;
+    float mAspect;
+    float mNear;
+    float mFar;
+    unsigned mRevision;
+    unsigned mDirty;
+
+    glm::mat3 mBasis;           // right, up, back
+    glm::mat4 mView;
+    glm::mat4 mProjection;
+    glm::mat4 mViewProjection;
+    glm::vec4 mFrustum[FRUSTUM_PLANE_COUNT];
+
+    void changed(unsigned flags)
+    {
+        mDirty |= flags | DIRTY_VIEW_PROJECTION;
+        ++mRevision;
+    }
+
+    void updateBasis()
+    {
+        if (mDirty & DIRTY_BASIS)
+        {
+            mBasis = glm::mat3_cast(mOrientation);
+            mDirty &= ~DIRTY_BASIS;
+        }
+    }
+};
+
+#endif
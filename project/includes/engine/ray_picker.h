@@ -0,0 +1,410 @@
+/* Click-to-select: which object, and where on it, is under the cursor.
+ *
+ * Meshes are registered once, in model space; objects place a mesh with a
+ * model matrix. A pick unprojects the cursor through the inverse of the
+ * view-projection matrix (recomputed only when that matrix changes), then
+ * walks two levels of SceneBvh nearest first:
+ *
+ *   - the object level holds every object's world-space box;
+ *   - each mesh holds boxes around blocks of eight triangles, which are
+ *     grouped along a Morton curve so a block covers a compact area.
+ *
+ * The ray is taken into model space with the object's cached inverse model
+ * matrix, without normalizing its direction, so a distance along it means
+ * the same at both levels and every hit shortens the search everywhere.
+ * A block's eight triangles sit in structure-of-arrays form and are tested
+ * together with an AVX Moller-Trumbore when the CPU has AVX, otherwise one
+ * at a time:
+ *
+ *     RayPicker picker;
+ *     const int cube = picker.AddMesh(vertices, 8, vertexCount);
+ *     const int crate = picker.AddObject(cube, crateModel);
+ *     ...
+ *     PickHit hit;
+ *     if (picker.Pick(projection * view, ndcX, ndcY, hit))
+ *         cout << "INFO: picked object " << hit.object << endl;
+ *
+ * Nothing is allocated per pick, so picking every frame during a drag is
+ * fine. SetModel() only refits the object level.
+ */
+
+#ifndef RAY_PICKER_H
+#define RAY_PICKER_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <engine/scene_bvh.h>
+#include <engine/transform_soa.h>  // cpuHasAvx, TRANSFORM_SOA_TARGET_AVX
+
+const int RAY_PICKER_BLOCK_SIZE = 8;
+
+
+// Closest hit of a pick
+struct PickHit
+{
+    int object;                     // -1 when nothing was hit
+    int triangle;                   // index of the triangle in the object's mesh
+    float distance;                 // world units from the near plane along the pick ray
+    glm::vec3 point;                // world space
+};
+
+
+namespace ray_picker
+{
+// Eight triangles as v0 and two edges, one array per component; unused lanes are degenerate
+struct TriangleBlock
+{
+    float v0[3][RAY_PICKER_BLOCK_SIZE];
+    float edge1[3][RAY_PICKER_BLOCK_SIZE];
+    float edge2[3][RAY_PICKER_BLOCK_SIZE];
+    int triangles[RAY_PICKER_BLOCK_SIZE];
+};
+
+struct Mesh
+{
+    std::vector<TriangleBlock> blocks;
+    SceneBvh bvh;                   // one box per block
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+struct Object
+{
+    int mesh;
+    glm::mat4 model;
+    glm::mat4 inverseModel;
+};
+
+// Spreads the low 10 bits of 'v' to every third bit
+inline unsigned spreadBits(unsigned v)
+{
+    v = (v | (v << 16)) & 0x030000FFu;
+    v = (v | (v << 8)) & 0x0300F00Fu;
+    v = (v | (v << 4)) & 0x030C30C3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+// Closest lane of 'block' hit before 'maxDistance'; -1 when none is
+inline int intersectBlockScalar(const TriangleBlock &block, const glm::vec3 &origin, const glm::vec3 &direction, float &maxDistance)
+{
+    int closest = -1;
+    for (int lane = 0; lane < RAY_PICKER_BLOCK_SIZE; ++lane)
+    {
+        const glm::vec3 v0(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+        const glm::vec3 edge1(block.edge1[0][lane], block.edge1[1][lane], block.edge1[2][lane]);
+        const glm::vec3 edge2(block.edge2[0][lane], block.edge2[1][lane], block.edge2[2][lane]);
+        const glm::vec3 p = glm::cross(direction, edge2);
+        const float det = glm::dot(edge1, p);
+        if (std::fabs(det) < 1e-12f)
+            continue;
+        const float inverseDet = 1.0f / det;
+        const glm::vec3 s = origin - v0;
+        const float u = glm::dot(s, p) * inverseDet;
+        if (u < 0.0f || u > 1.0f)
+            continue;
+        const glm::vec3 q = glm::cross(s, edge1);
+        const float v = glm::dot(direction, q) * inverseDet;
+        if (v < 0.0f || u + v > 1.0f)
+            continue;
+        const float t = glm::dot(edge2, q) * inverseDet;
+        if (t > 0.0f && t < maxDistance)
+        {
+            maxDistance = t;
+            closest = lane;
+        }
+    }
+    return closest;
+}
+
+#ifdef TRANSFORM_SOA_SSE
+// The same test on all eight lanes at once
+TRANSFORM_SOA_TARGET_AVX inline int intersectBlockAvx(const TriangleBlock &block, const glm::vec3 &origin, const glm::vec3 &direction, float &maxDistance)
+{
+    const __m256 dx = _mm256_set1_ps(direction.x), dy = _mm256_set1_ps(direction.y), dz = _mm256_set1_ps(direction.z);
+    const __m256 e1x = _mm256_loadu_ps(block.edge1[0]), e1y = _mm256_loadu_ps(block.edge1[1]), e1z = _mm256_loadu_ps(block.edge1[2]);
+    const __m256 e2x = _mm256_loadu_ps(block.edge2[0]), e2y = _mm256_loadu_ps(block.edge2[1]), e2z = _mm256_loadu_ps(block.edge2[2]);
+
+    // p = direction x edge2, det = edge1 . p
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 mask = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-12f), _CMP_GE_OQ);
+    const __m256 inverseDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    // s = origin - v0, u = (s . p) / det
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_loadu_ps(block.v0[0]));
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_loadu_ps(block.v0[1]));
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_loadu_ps(block.v0[2]));
+    const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inverseDet);
+
+    // q = s x edge1, v = (direction . q) / det, t = (edge2 . q) / det
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverseDet);
+    const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverseDet);
+
+    const __m256 zero = _mm256_setzero_ps();
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(maxDistance), _CMP_LT_OQ));
+    int hits = _mm256_movemask_ps(mask);
+    if (hits == 0)
+        return -1;
+
+    float distances[RAY_PICKER_BLOCK_SIZE];
+    _mm256_storeu_ps(distances, t);
+    int closest = -1;
+    for (; hits; hits &= hits - 1)
+    {
+#ifdef _MSC_VER
+        unsigned long lane;     // <intrin.h> comes with transform_soa.h
+        _BitScanForward(&lane, static_cast<unsigned long>(hits));
+#else
+        const int lane = __builtin_ctz(hits);
+#endif
+        if (distances[lane] < maxDistance)
+        {
+            maxDistance = distances[lane];
+            closest = static_cast<int>(lane);
+        }
+    }
+    return closest;
+}
+#endif
+}
+
+
+class RayPicker
+{
+public:
+    RayPicker() : mUseAvx(cpuAvx()), mViewProjection(0.0f), mInverseViewProjection(1.0f)
+    {
+    }
+
+    // Non-indexed triangles (glDrawArrays); positions are the first three floats of every 'stride' floats
+    int AddMesh(const float *vertices, size_t stride, size_t vertexCount)
+    {
+        std::vector<unsigned> indices(vertexCount - vertexCount % 3);
+        for (size_t i = 0; i < indices.size(); ++i)
+            indices[i] = static_cast<unsigned>(i);
+        return AddMesh(vertices, stride, vertexCount, indices.empty() ? NULL : &indices[0], indices.size());
+    }
+
+    // Indexed triangles (glDrawElements) with GLushort or GLuint indices; returns the mesh id
+    template <typename Index>
+    int AddMesh(const float *vertices, size_t stride, size_t vertexCount, const Index *indices, size_t indexCount)
+    {
+        mMeshes.push_back(ray_picker::Mesh());
+        ray_picker::Mesh &mesh = mMeshes.back();
+        const size_t triangleCount = indexCount / 3;
+
+        // Order the triangles along a Morton curve through the mesh bounds
+        mesh.boundsMin = glm::vec3(FLT_MAX);
+        mesh.boundsMax = glm::vec3(-FLT_MAX);
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            const glm::vec3 position(vertices[v * stride], vertices[v * stride + 1], vertices[v * stride + 2]);
+            mesh.boundsMin = glm::min(mesh.boundsMin, position);
+            mesh.boundsMax = glm::max(mesh.boundsMax, position);
+        }
+        const glm::vec3 cellScale = 1023.0f / glm::max(mesh.boundsMax - mesh.boundsMin, glm::vec3(1e-20f));
+        std::vector<std::pair<unsigned, unsigned> > order(triangleCount);
+        for (size_t i = 0; i < triangleCount; ++i)
+        {
+            glm::vec3 centroid(0.0f);
+            for (int c = 0; c < 3; ++c)
+                centroid += position(vertices, stride, indices[i * 3 + c]);
+            const glm::uvec3 cell((centroid / 3.0f - mesh.boundsMin) * cellScale);
+            order[i].first = ray_picker::spreadBits(cell.x) | (ray_picker::spreadBits(cell.y) << 1) | (ray_picker::spreadBits(cell.z) << 2);
+            order[i].second = static_cast<unsigned>(i);
+        }
+        std::sort(order.begin(), order.end());
+
+        // Pack consecutive runs of eight into blocks, boxed for the mesh's BVH
+        mesh.blocks.resize((triangleCount + RAY_PICKER_BLOCK_SIZE - 1) / RAY_PICKER_BLOCK_SIZE);
+        for (size_t b = 0; b < mesh.blocks.size(); ++b)
+        {
+            ray_picker::TriangleBlock &block = mesh.blocks[b];
+            memset(&block, 0, sizeof(block));
+            glm::vec3 blockMin(FLT_MAX), blockMax(-FLT_MAX);
+            for (int lane = 0; lane < RAY_PICKER_BLOCK_SIZE; ++lane)
+            {
+                const size_t sorted = b * RAY_PICKER_BLOCK_SIZE + lane;
+                block.triangles[lane] = -1;
+                if (sorted >= triangleCount)
+                    continue;
+                const unsigned triangle = order[sorted].second;
+                const glm::vec3 v0 = position(vertices, stride, indices[triangle * 3]);
+                const glm::vec3 v1 = position(vertices, stride, indices[triangle * 3 + 1]);
+                const glm::vec3 v2 = position(vertices, stride, indices[triangle * 3 + 2]);
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    block.v0[axis][lane] = v0[axis];
+                    block.edge1[axis][lane] = v1[axis] - v0[axis];
+                    block.edge2[axis][lane] = v2[axis] - v0[axis];
+                }
+                block.triangles[lane] = static_cast<int>(triangle);
+                blockMin = glm::min(blockMin, glm::min(v0, glm::min(v1, v2)));
+                blockMax = glm::max(blockMax, glm::max(v0, glm::max(v1, v2)));
+            }
+            mesh.bvh.Add(blockMin, blockMax);
+        }
+        mesh.bvh.Update();
+        return static_cast<int>(mMeshes.size() - 1);
+    }
+
+    // Places 'mesh' in the scene; returns the object id reported by picks
+    int AddObject(int mesh, const glm::mat4 &model)
+    {
+        ray_picker::Object object;
+        object.mesh = mesh;
+        object.model = model;
+        object.inverseModel = glm::inverse(model);
+        mObjects.push_back(object);
+        glm::vec3 boundsMin, boundsMax;
+        worldBounds(object, boundsMin, boundsMax);
+        return mObjectBvh.Add(boundsMin, boundsMax);
+    }
+
+    void SetModel(int object, const glm::mat4 &model)
+    {
+        ray_picker::Object &placed = mObjects[object];
+        if (placed.model == model)
+            return;
+        placed.model = model;
+        placed.inverseModel = glm::inverse(model);
+        glm::vec3 boundsMin, boundsMax;
+        worldBounds(placed, boundsMin, boundsMax);
+        mObjectBvh.SetBounds(object, boundsMin, boundsMax);
+    }
+
+    // Picks at normalized device coordinates (-1..1, y up) through 'viewProjection'
+    bool Pick(const glm::mat4 &viewProjection, float ndcX, float ndcY, PickHit &hit)
+    {
+        if (viewProjection != mViewProjection)
+        {
+            mViewProjection = viewProjection;
+            mInverseViewProjection = glm::inverse(viewProjection);
+        }
+        const glm::vec4 nearPoint = mInverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+        const glm::vec4 farPoint = mInverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+        const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+        const glm::vec3 segment = glm::vec3(farPoint) / farPoint.w - origin;
+        const float length = glm::length(segment);
+        return Intersect(origin, segment / length, length, hit);
+    }
+
+    // Picks at a window position in pixels (origin top left, as GLFW reports the cursor)
+    bool Pick(const glm::mat4 &viewProjection, double cursorX, double cursorY, int windowWidth, int windowHeight, PickHit &hit)
+    {
+        const float ndcX = static_cast<float>(2.0 * cursorX / windowWidth - 1.0);
+        const float ndcY = static_cast<float>(1.0 - 2.0 * cursorY / windowHeight);
+        return Pick(viewProjection, ndcX, ndcY, hit);
+    }
+
+    // Closest hit along a world-space ray with unit 'direction'
+    bool Intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, PickHit &hit)
+    {
+        mObjectBvh.Update();
+        hit.object = -1;
+        hit.triangle = -1;
+        hit.distance = maxDistance;
+        mObjectBvh.Raycast(origin, direction, hit.distance, [this, &origin, &direction, &hit](int object, float &distance)
+        {
+            return intersectObject(object, origin, direction, distance, hit);
+        });
+        if (hit.object < 0)
+            return false;
+        hit.point = origin + direction * hit.distance;
+        return true;
+    }
+
+    size_t GetObjectCount() const { return mObjects.size(); }
+    bool UsesAvx() const { return mUseAvx; }
+
+    // Benchmarks turn the AVX test off to compare; it is only ever on when the CPU has AVX
+    void SetUseAvx(bool useAvx) { mUseAvx = useAvx && cpuAvx(); }
+
+private:
+    std::vector<ray_picker::Mesh> mMeshes;
+    std::vector<ray_picker::Object> mObjects;
+    SceneBvh mObjectBvh;
+    bool mUseAvx;                   // test blocks with intersectBlockAvx
+    glm::mat4 mViewProjection;      // of the last pick, with its inverse
+    glm::mat4 mInverseViewProjection;
+
+    template <typename Index>
+    static glm::vec3 position(const float *vertices, size_t stride, Index index)
+    {
+        const float *p = vertices + static_cast<size_t>(index) * stride;
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+
+    static bool cpuAvx()
+    {
+#ifdef TRANSFORM_SOA_SSE
+        return transform_soa::cpuHasAvx();
+#else
+        return false;
+#endif
+    }
+
+    // Box around the eight transformed corners of the mesh's box
+    void worldBounds(const ray_picker::Object &object, glm::vec3 &boundsMin, glm::vec3 &boundsMax) const
+    {
+        const ray_picker::Mesh &mesh = mMeshes[object.mesh];
+        boundsMin = glm::vec3(FLT_MAX);
+        boundsMax = glm::vec3(-FLT_MAX);
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            const glm::vec3 local((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x,
+                                  (corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y,
+                                  (corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+            const glm::vec3 world(object.model * glm::vec4(local, 1.0f));
+            boundsMin = glm::min(boundsMin, world);
+            boundsMax = glm::max(boundsMax, world);
+        }
+    }
+
+    // Walks the object's mesh with the ray in model space; the direction keeps its length, so distances stay world units
+    bool intersectObject(int object, const glm::vec3 &origin, const glm::vec3 &direction, float &distance, PickHit &hit) const
+    {
+        const ray_picker::Object &placed = mObjects[object];
+        const ray_picker::Mesh &mesh = mMeshes[placed.mesh];
+        const glm::vec3 localOrigin(placed.inverseModel * glm::vec4(origin, 1.0f));
+        const glm::vec3 localDirection(placed.inverseModel * glm::vec4(direction, 0.0f));
+        const bool avx = mUseAvx;
+        return mesh.bvh.Raycast(localOrigin, localDirection, distance, [&](int block, float &blockDistance)
+        {
+            const ray_picker::TriangleBlock &triangles = mesh.blocks[block];
+#ifdef TRANSFORM_SOA_SSE
+            const int lane = avx ? ray_picker::intersectBlockAvx(triangles, localOrigin, localDirection, blockDistance)
+                                 : ray_picker::intersectBlockScalar(triangles, localOrigin, localDirection, blockDistance);
+#else
+            (void)avx;
+            const int lane = ray_picker::intersectBlockScalar(triangles, localOrigin, localDirection, blockDistance);
+#endif
+            if (lane < 0)
+                return false;
+            hit.object = object;
+            hit.triangle = triangles.triangles[lane];
+            return true;
+        });
+    }
+};
+
+#endif
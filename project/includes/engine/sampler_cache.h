@@ -0,0 +1,130 @@
+/* Shared sampler objects keyed by wrap/filter/anisotropy state.
+ *
+ * Textures keep only their image data; how they are sampled is decided per
+ * texture unit with glBindSampler. Identical states share one sampler
+ * object, so switching a wrap mode is a bind instead of re-parameterizing
+ * every texture that uses it.
+ */
+
+#ifndef SAMPLER_CACHE_H
+#define SAMPLER_CACHE_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include <engine/mip_chain.h>
+
+// Sampling state of one texture unit
+struct SamplerState
+{
+    GLint wrapS;
+    GLint wrapT;
+    GLint minFilter;
+    GLint magFilter;
+    float maxAnisotropy;    // 1 disables anisotropic filtering
+    float borderColor[4];   // only used with GL_CLAMP_TO_BORDER
+
+    SamplerState(GLint wrap = GL_REPEAT, GLint minFilter = GL_LINEAR_MIPMAP_LINEAR, GLint magFilter = GL_LINEAR, float maxAnisotropy = 1.0f)
+        : wrapS(wrap), wrapT(wrap), minFilter(minFilter), magFilter(magFilter), maxAnisotropy(maxAnisotropy)
+    {
+        borderColor[0] = borderColor[1] = borderColor[2] = 0.0f;
+        borderColor[3] = 0.0f;
+    }
+
+    SamplerState& SetBorderColor(float r, float g, float b, float a)
+    {
+        borderColor[0] = r;
+        borderColor[1] = g;
+        borderColor[2] = b;
+        borderColor[3] = a;
+        return *this;
+    }
+
+    bool operator<(const SamplerState &other) const
+    {
+        if (wrapS != other.wrapS) return wrapS < other.wrapS;
+        if (wrapT != other.wrapT) return wrapT < other.wrapT;
+        if (minFilter != other.minFilter) return minFilter < other.minFilter;
+        if (magFilter != other.magFilter) return magFilter < other.magFilter;
+        if (maxAnisotropy != other.maxAnisotropy) return maxAnisotropy < other.maxAnisotropy;
+        return memcmp(borderColor, other.borderColor, sizeof(borderColor)) < 0;
+    }
+};
+
+
+class SamplerCache
+{
+public:
+    SamplerCache() : mMaxAnisotropy(-1.0f)
+    {
+    }
+
+    // Returns the shared sampler for the state, creating it on first use
+    GLuint Get(const SamplerState &requested)
+    {
+        SamplerState state = requested;
+        state.maxAnisotropy = std::max(1.0f, std::min(state.maxAnisotropy, maxSupportedAnisotropy()));
+        if (state.wrapS != GL_CLAMP_TO_BORDER && state.wrapT != GL_CLAMP_TO_BORDER)
+            state.SetBorderColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+        std::map<SamplerState, GLuint>::iterator it = mSamplers.find(state);
+        if (it != mSamplers.end())
+            return it->second;
+
+        GLuint sampler;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, state.wrapS);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, state.wrapT);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, state.minFilter);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, state.magFilter);
+        glSamplerParameterfv(sampler, GL_TEXTURE_BORDER_COLOR, state.borderColor);
+        if (state.maxAnisotropy > 1.0f)
+            glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, state.maxAnisotropy);
+
+        mSamplers[state] = sampler;
+        return sampler;
+    }
+
+    // Binds the shared sampler for the state to texture unit 'unit'
+    void Bind(GLuint unit, const SamplerState &state)
+    {
+        glBindSampler(unit, Get(state));
+    }
+
+    // Sampler objects belong to the GL context; call this before it is destroyed
+    void Clear()
+    {
+        for (std::map<SamplerState, GLuint>::iterator it = mSamplers.begin(); it != mSamplers.end(); ++it)
+            glDeleteSamplers(1, &it->second);
+        mSamplers.clear();
+    }
+
+    size_t Size() const { return mSamplers.size(); }
+
+private:
+    std::map<SamplerState, GLuint> mSamplers;
+    float mMaxAnisotropy;
+
+    float maxSupportedAnisotropy()
+    {
+        if (mMaxAnisotropy < 0.0f)
+        {
+            mMaxAnisotropy = 1.0f;
+            if (GLEW_EXT_texture_filter_anisotropic || GLEW_ARB_texture_filter_anisotropic)
+                glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &mMaxAnisotropy);
+        }
+        return mMaxAnisotropy;
+    }
+};
+
+
+// Allocates immutable storage for the complete mip chain of the bound GL_TEXTURE_2D
+inline void AllocateTextureStorage(GLenum internalFormat, int width, int height)
+{
+    glTexStorage2D(GL_TEXTURE_2D, MipLevelCount(width, height), internalFormat, width, height);
+}
+
+#endif
@@ -0,0 +1,790 @@
+/* Bounding volume hierarchy over the world-space boxes of scene objects.
+ *
+ * Culling, picking and collision otherwise loop over every object. The
+ * tree is built top-down with a binned surface area heuristic and stored
+ * flat in depth-first order: a node is 32 bytes, its left child is the next
+ * node and only the right child needs an index, so a traversal mostly reads
+ * memory forwards. Leaves index a list of object ids and boxes kept in leaf
+ * order, and every subtree owns a contiguous range of that list:
+ *
+ *     SceneBvh bvh;
+ *     const int cup = bvh.Add(cupMin, cupMax);
+ *     ...
+ *     bvh.Update();                                // first call builds
+ *     bvh.SetBounds(cup, newMin, newMax);          // objects that moved
+ *     bvh.Update();                                // refits, rebuilds only worn-out subtrees
+ *     bvh.QueryFrustum(camera.GetFrustumPlanes(), visible);
+ *
+ * Update() refits the boxes of moved objects: their leaves and ancestors are
+ * flagged, then one backwards pass over the flags recomputes each of those
+ * nodes once, children before parents.
+ * Refitting keeps the tree correct, but its quality decays as objects drift
+ * apart. Once a subtree's surface area has grown SCENE_BVH_REBUILD_GROWTH
+ * times since it was built, only that subtree is rebuilt: in place when the
+ * new one needs no more nodes than the old, otherwise by relinking the tree
+ * in one linear pass. Adding objects rebuilds the whole tree on the next
+ * Update().
+ *
+ * Each query makes one traversal and appends ids to a caller-owned vector.
+ * A subtree that lies entirely inside the query volume is copied as a whole
+ * range, without testing its children. Raycast() visits boxes nearest
+ * first, so a closest-hit callback can shorten the ray as it goes.
+ */
+
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <engine/math_config.h>    // GpuVec3
+
+const int SCENE_BVH_MAX_LEAF_SIZE = 8;
+const int SCENE_BVH_BINS = 16;
+const int SCENE_BVH_MAX_DEPTH = 64;            // traversal stack size; ranges that reach it become leaves
+const float SCENE_BVH_REBUILD_GROWTH = 2.0f;
+
+
+namespace scene_bvh
+{
+// GpuVec3 stays three floats in both math modes, so a node is always 32 bytes
+struct Node
+{
+    GpuVec3 boundsMin;
+    int first;                      // leaf: first entry of the object list; inner: right child (left child follows the node)
+    GpuVec3 boundsMax;
+    int count;                      // objects in a leaf, 0 for inner nodes
+};
+
+struct Box
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BuildItem
+{
+    Box box;
+    glm::vec3 centroid;
+    int object;
+};
+
+// Half the surface area; SAH only compares areas, so the factor 2 is dropped
+inline float halfArea(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    const glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+inline bool overlaps(const Node &node, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    return node.boundsMin.x <= boundsMax.x && node.boundsMax.x >= boundsMin.x
+        && node.boundsMin.y <= boundsMax.y && node.boundsMax.y >= boundsMin.y
+        && node.boundsMin.z <= boundsMax.z && node.boundsMax.z >= boundsMin.z;
+}
+
+// Entry distance of the ray into the box, or FLT_MAX when it misses within 'maxDistance'
+inline float rayEnter(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance)
+{
+    const glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+    const glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+    const glm::vec3 tNear = glm::min(t0, t1);
+    const glm::vec3 tFar = glm::max(t0, t1);
+    const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+    return enter <= exit ? enter : FLT_MAX;
+}
+}
+
+
+class SceneBvh
+{
+public:
+    SceneBvh() : mNeedsBuild(false), mItemBase(0)
+    {
+    }
+
+    // Id of the new object; the tree includes it after the next Update()
+    int Add(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        scene_bvh::Box box = { boundsMin, boundsMax };
+        const int object = static_cast<int>(mBoxes.size());
+        mBoxes.push_back(box);
+        mObjects.push_back(object);
+        mEntryOf.push_back(object);
+        mLeafOf.push_back(-1);
+        mMoved.push_back(0);
+        mNeedsBuild = true;
+        return object;
+    }
+
+    void SetBounds(int object, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        scene_bvh::Box &box = mBoxes[mEntryOf[object]];
+        box.min = boundsMin;
+        box.max = boundsMax;
+        if (!mNeedsBuild && !mMoved[object])
+        {
+            mMoved[object] = 1;
+            mMovedObjects.push_back(object);
+        }
+    }
+
+    // Builds the whole tree from scratch
+    void Build()
+    {
+        const int count = static_cast<int>(mBoxes.size());
+        mNodes.clear();
+        mBuildAreas.clear();
+        clearMoved();
+        mNeedsBuild = false;
+        if (count == 0)
+        {
+            mParents.clear();
+            return;
+        }
+
+        mNodes.reserve(2 * count);
+        mBuildAreas.reserve(2 * count);
+        gatherItems(0, count);
+        build(0, count, 0, mNodes, mBuildAreas);
+        link();
+    }
+
+    // Brings the tree up to date with Add() and SetBounds() since the last call
+    void Update()
+    {
+        if (mNeedsBuild)
+        {
+            Build();
+            return;
+        }
+        if (mMovedObjects.empty())
+            return;
+
+        // Flag the paths from the moved objects' leaves up to the root, stopping where another path already did
+        for (size_t i = 0; i < mMovedObjects.size(); ++i)
+        {
+            for (int index = mLeafOf[mMovedObjects[i]]; index >= 0 && !mTouched[index]; index = mParents[index])
+            {
+                mTouched[index] = 1;
+                mTouchedNodes.push_back(index);
+            }
+        }
+        clearMoved();
+
+        // Children come after their parents, so refitting in falling index order visits each flagged node once;
+        // a short list is sorted, a long one read off the flags in a backwards pass
+        std::vector<int> worn;
+        if (mTouchedNodes.size() * 16 < mNodes.size())
+        {
+            std::sort(mTouchedNodes.begin(), mTouchedNodes.end(), std::greater<int>());
+            for (size_t i = 0; i < mTouchedNodes.size(); ++i)
+                refitAndCheck(mTouchedNodes[i], worn);
+        }
+        else
+        {
+            for (int i = static_cast<int>(mNodes.size()) - 1; i >= 0; --i)
+            {
+                if (mTouched[i])
+                    refitAndCheck(i, worn);
+            }
+        }
+
+        // Keep the outermost worn subtrees; the inner ones are rebuilt with them
+        size_t outermost = 0;
+        bool rebuildRoot = false;
+        for (size_t i = 0; i < worn.size(); ++i)
+        {
+            int parent = mParents[worn[i]];
+            while (parent >= 0 && mTouched[parent] != WORN)
+                parent = mParents[parent];
+            if (parent < 0)
+            {
+                worn[outermost++] = worn[i];
+                rebuildRoot = rebuildRoot || worn[i] == 0;
+            }
+        }
+        worn.resize(outermost);
+        for (size_t i = 0; i < mTouchedNodes.size(); ++i)
+            mTouched[mTouchedNodes[i]] = 0;
+        mTouchedNodes.clear();
+
+        if (worn.empty())
+            return;
+        if (rebuildRoot)
+        {
+            Build();
+            return;
+        }
+        rebuildSubtrees(worn);
+    }
+
+    // Objects whose boxes overlap [boundsMin, boundsMax]
+    void QueryAabb(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, std::vector<int> &results) const
+    {
+        if (mNodes.empty())
+            return;
+
+        int stack[SCENE_BVH_MAX_DEPTH];
+        int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const int index = stack[--depth];
+            const scene_bvh::Node &node = mNodes[index];
+            if (!scene_bvh::overlaps(node, boundsMin, boundsMax))
+                continue;
+
+            if (glm::all(glm::lessThanEqual(boundsMin, glm::vec3(node.boundsMin))) && glm::all(glm::greaterThanEqual(boundsMax, glm::vec3(node.boundsMax))))
+                appendSubtree(index, results);
+            else if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    const scene_bvh::Box &box = mBoxes[i];
+                    if (glm::all(glm::lessThanEqual(box.min, boundsMax)) && glm::all(glm::greaterThanEqual(box.max, boundsMin)))
+                        results.push_back(mObjects[i]);
+                }
+            }
+            else
+            {
+                stack[depth++] = node.first;
+                stack[depth++] = index + 1;
+            }
+        }
+    }
+
+    // Objects whose boxes come within 'radius' of 'center'
+    void QuerySphere(const glm::vec3 &center, float radius, std::vector<int> &results) const
+    {
+        if (mNodes.empty())
+            return;
+
+        const float radiusSquared = radius * radius;
+        int stack[SCENE_BVH_MAX_DEPTH];
+        int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const int index = stack[--depth];
+            const scene_bvh::Node &node = mNodes[index];
+            const glm::vec3 boundsMin(node.boundsMin), boundsMax(node.boundsMax);
+            const glm::vec3 nearest = glm::clamp(center, boundsMin, boundsMax);
+            if (glm::dot(nearest - center, nearest - center) > radiusSquared)
+                continue;
+
+            // The farthest corner inside the sphere means the whole box is
+            const glm::vec3 farthest = glm::max(glm::abs(boundsMin - center), glm::abs(boundsMax - center));
+            if (glm::dot(farthest, farthest) <= radiusSquared)
+                appendSubtree(index, results);
+            else if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    const scene_bvh::Box &box = mBoxes[i];
+                    const glm::vec3 point = glm::clamp(center, box.min, box.max);
+                    if (glm::dot(point - center, point - center) <= radiusSquared)
+                        results.push_back(mObjects[i]);
+                }
+            }
+            else
+            {
+                stack[depth++] = node.first;
+                stack[depth++] = index + 1;
+            }
+        }
+    }
+
+    // Objects whose boxes are not entirely outside any of six planes in
+    // QuaternionCamera::GetFrustumPlanes() form (normals pointing inwards)
+    void QueryFrustum(const glm::vec4 *planes, std::vector<int> &results) const
+    {
+        if (mNodes.empty())
+            return;
+
+        // Each entry carries the planes its parent was not yet fully inside of
+        struct Entry
+        {
+            int index;
+            unsigned planeMask;
+        };
+        Entry stack[SCENE_BVH_MAX_DEPTH];
+        int depth = 0;
+        stack[depth].index = 0;
+        stack[depth++].planeMask = (1u << 6) - 1;
+        while (depth > 0)
+        {
+            const Entry entry = stack[--depth];
+            const scene_bvh::Node &node = mNodes[entry.index];
+            unsigned planeMask = entry.planeMask;
+            if (!frustumTest(planes, glm::vec3(node.boundsMin), glm::vec3(node.boundsMax), planeMask))
+                continue;
+
+            if (planeMask == 0)
+                appendSubtree(entry.index, results);
+            else if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    unsigned objectMask = planeMask;
+                    const scene_bvh::Box &box = mBoxes[i];
+                    if (frustumTest(planes, box.min, box.max, objectMask))
+                        results.push_back(mObjects[i]);
+                }
+            }
+            else
+            {
+                stack[depth].index = node.first;
+                stack[depth++].planeMask = planeMask;
+                stack[depth].index = entry.index + 1;
+                stack[depth++].planeMask = planeMask;
+            }
+        }
+    }
+
+    // Objects whose boxes the segment from 'origin' along 'direction' for 'maxDistance' crosses, in no particular order
+    void QueryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, std::vector<int> &results) const
+    {
+        Raycast(origin, direction, maxDistance, [&results](int object, float &) { results.push_back(object); return false; });
+    }
+
+    // Nearest-first traversal. 'test(object, maxDistance)' is called for every
+    // object whose box the ray enters before maxDistance; it returns true on a
+    // hit and may lower maxDistance to the hit, which culls everything behind
+    // it. Returns whether any test hit.
+    template <typename ObjectTest>
+    bool Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &maxDistance, ObjectTest test) const
+    {
+        if (mNodes.empty())
+            return false;
+
+        const glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        struct Entry
+        {
+            int index;
+            float enter;
+        };
+        Entry stack[SCENE_BVH_MAX_DEPTH];
+        int depth = 0;
+        bool hit = false;
+
+        stack[depth].index = 0;
+        stack[depth++].enter = scene_bvh::rayEnter(glm::vec3(mNodes[0].boundsMin), glm::vec3(mNodes[0].boundsMax), origin, inverseDirection, maxDistance);
+        while (depth > 0)
+        {
+            const Entry entry = stack[--depth];
+            if (entry.enter > maxDistance)
+                continue;
+            const scene_bvh::Node &node = mNodes[entry.index];
+
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    const scene_bvh::Box &box = mBoxes[i];
+                    if (scene_bvh::rayEnter(box.min, box.max, origin, inverseDirection, maxDistance) != FLT_MAX && test(mObjects[i], maxDistance))
+                        hit = true;
+                }
+                continue;
+            }
+
+            // Push the farther child first so the nearer one is visited next
+            const int left = entry.index + 1, right = node.first;
+            const float leftEnter = scene_bvh::rayEnter(glm::vec3(mNodes[left].boundsMin), glm::vec3(mNodes[left].boundsMax), origin, inverseDirection, maxDistance);
+            const float rightEnter = scene_bvh::rayEnter(glm::vec3(mNodes[right].boundsMin), glm::vec3(mNodes[right].boundsMax), origin, inverseDirection, maxDistance);
+            const bool leftFirst = leftEnter <= rightEnter;
+            const float nearEnter = leftFirst ? leftEnter : rightEnter, farEnter = leftFirst ? rightEnter : leftEnter;
+            if (farEnter != FLT_MAX)
+            {
+                stack[depth].index = leftFirst ? right : left;
+                stack[depth++].enter = farEnter;
+            }
+            if (nearEnter != FLT_MAX)
+            {
+                stack[depth].index = leftFirst ? left : right;
+                stack[depth++].enter = nearEnter;
+            }
+        }
+        return hit;
+    }
+
+    const glm::vec3& GetBoundsMin(int object) const { return mBoxes[mEntryOf[object]].min; }
+    const glm::vec3& GetBoundsMax(int object) const { return mBoxes[mEntryOf[object]].max; }
+    size_t GetObjectCount() const { return mBoxes.size(); }
+    size_t GetNodeCount() const { return mNodes.size(); }
+
+    void Clear()
+    {
+        mBoxes.clear();
+        mEntryOf.clear();
+        mLeafOf.clear();
+        mMoved.clear();
+        mMovedObjects.clear();
+        mObjects.clear();
+        mNodes.clear();
+        mParents.clear();
+        mBuildAreas.clear();
+        mTouched.clear();
+        mNeedsBuild = false;
+    }
+
+private:
+    static const int UNUSED_NODE = -1;          // count of nodes left over by an in-place rebuild
+    static const unsigned char WORN = 2;        // mTouched value of a refit node that needs a rebuild
+
+    std::vector<scene_bvh::Box> mBoxes;         // in leaf order, like mObjects
+    std::vector<int> mEntryOf;                  // per object id, its entry in mBoxes and mObjects
+    std::vector<int> mLeafOf;                   // per object id, the leaf holding it
+    std::vector<unsigned char> mMoved;
+    std::vector<int> mMovedObjects;
+    bool mNeedsBuild;
+
+    std::vector<int> mObjects;                  // object ids in leaf order; subtrees own contiguous ranges
+    std::vector<scene_bvh::Node> mNodes;        // depth-first
+    std::vector<int> mParents;                  // per node, -1 for the root
+    std::vector<float> mBuildAreas;             // per node, half area when it was built
+
+    std::vector<unsigned char> mTouched;        // nodes refit by the current Update(), WORN when they need a rebuild
+    std::vector<int> mTouchedNodes;
+    std::vector<scene_bvh::BuildItem> mItems;   // build scratch for object list entries mItemBase onwards
+    int mItemBase;
+
+    float halfArea(int index) const
+    {
+        return scene_bvh::halfArea(glm::vec3(mNodes[index].boundsMin), glm::vec3(mNodes[index].boundsMax));
+    }
+
+    void clearMoved()
+    {
+        for (size_t i = 0; i < mMovedObjects.size(); ++i)
+            mMoved[mMovedObjects[i]] = 0;
+        mMovedObjects.clear();
+    }
+
+    // Copies the boxes of object list entries [first, first + count) into the build scratch
+    void gatherItems(int first, int count)
+    {
+        mItems.resize(count);
+        mItemBase = first;
+        for (int i = 0; i < count; ++i)
+        {
+            scene_bvh::BuildItem &item = mItems[i];
+            item.object = mObjects[first + i];
+            item.box = mBoxes[first + i];
+            item.centroid = (item.box.min + item.box.max) * 0.5f;
+        }
+    }
+
+    // Appends the subtree over entries [first, first + count) to 'nodes'; returns its root
+    int build(int first, int count, int depth, std::vector<scene_bvh::Node> &nodes, std::vector<float> &areas)
+    {
+        scene_bvh::BuildItem *items = &mItems[first - mItemBase];
+        const int index = static_cast<int>(nodes.size());
+        nodes.push_back(scene_bvh::Node());
+
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (int i = 0; i < count; ++i)
+        {
+            boundsMin = glm::min(boundsMin, items[i].box.min);
+            boundsMax = glm::max(boundsMax, items[i].box.max);
+            centroidMin = glm::min(centroidMin, items[i].centroid);
+            centroidMax = glm::max(centroidMax, items[i].centroid);
+        }
+        nodes[index].boundsMin = GpuVec3(boundsMin);
+        nodes[index].boundsMax = GpuVec3(boundsMax);
+        const float area = scene_bvh::halfArea(boundsMin, boundsMax);
+        areas.push_back(area);
+
+        if (count == 1 || depth >= SCENE_BVH_MAX_DEPTH - 1)
+            return makeLeaf(nodes, index, first, count);
+
+        // Binned SAH on all three axes: cost of a split is the objects on each side times that side's area.
+        // One pass over the objects fills the bins of every axis; small ranges use fewer bins, which dominate near the leaves.
+        const int bins = std::min(SCENE_BVH_BINS, count);
+        const glm::vec3 extent = centroidMax - centroidMin;
+        glm::vec3 scale;
+        for (int axis = 0; axis < 3; ++axis)
+            scale[axis] = extent[axis] > 0.0f ? bins / extent[axis] : 0.0f;
+        glm::vec3 binMin[3][SCENE_BVH_BINS], binMax[3][SCENE_BVH_BINS];
+        int binCount[3][SCENE_BVH_BINS] = { { 0 } };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int b = 0; b < bins; ++b)
+            {
+                binMin[axis][b] = glm::vec3(FLT_MAX);
+                binMax[axis][b] = glm::vec3(-FLT_MAX);
+            }
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const int b = binOf(items[i].centroid[axis], centroidMin[axis], scale[axis], bins);
+                binMin[axis][b] = glm::min(binMin[axis][b], items[i].box.min);
+                binMax[axis][b] = glm::max(binMax[axis][b], items[i].box.max);
+                ++binCount[axis][b];
+            }
+        }
+
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (extent[axis] <= 0.0f)
+                continue;
+
+            // Right-hand costs from a backwards sweep, then compare while sweeping forwards
+            float rightCost[SCENE_BVH_BINS];
+            glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+            int sweepCount = 0;
+            for (int b = bins - 1; b > 0; --b)
+            {
+                sweepMin = glm::min(sweepMin, binMin[axis][b]);
+                sweepMax = glm::max(sweepMax, binMax[axis][b]);
+                sweepCount += binCount[axis][b];
+                rightCost[b] = sweepCount * scene_bvh::halfArea(sweepMin, sweepMax);
+            }
+            sweepMin = glm::vec3(FLT_MAX);
+            sweepMax = glm::vec3(-FLT_MAX);
+            sweepCount = 0;
+            for (int b = 0; b < bins - 1; ++b)
+            {
+                sweepMin = glm::min(sweepMin, binMin[axis][b]);
+                sweepMax = glm::max(sweepMax, binMax[axis][b]);
+                sweepCount += binCount[axis][b];
+                const float cost = sweepCount * scene_bvh::halfArea(sweepMin, sweepMax) + rightCost[b + 1];
+                if (sweepCount > 0 && sweepCount < count && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        // A leaf costs one test per object; a split one box test plus its children
+        if (count <= SCENE_BVH_MAX_LEAF_SIZE && (bestAxis < 0 || area + bestCost >= count * area))
+            return makeLeaf(nodes, index, first, count);
+
+        int middle;
+        if (bestAxis >= 0)
+        {
+            const int axis = bestAxis, bin = bestBin;
+            const float origin = centroidMin[axis], axisScale = scale[axis];
+            middle = static_cast<int>(std::partition(items, items + count, [axis, bin, origin, axisScale, bins](const scene_bvh::BuildItem &item)
+                                                     { return binOf(item.centroid[axis], origin, axisScale, bins) <= bin; }) - items);
+        }
+        else
+        {
+            // Every centroid in the same spot; halve the list to keep leaves small
+            middle = count / 2;
+        }
+
+        build(first, middle, depth + 1, nodes, areas);
+        const int right = build(first + middle, count - middle, depth + 1, nodes, areas);
+        nodes[index].first = right;
+        nodes[index].count = 0;
+        return index;
+    }
+
+    static int binOf(float value, float origin, float scale, int bins)
+    {
+        return std::min(bins - 1, static_cast<int>((value - origin) * scale));
+    }
+
+    int makeLeaf(std::vector<scene_bvh::Node> &nodes, int index, int first, int count)
+    {
+        for (int i = first; i < first + count; ++i)
+        {
+            const scene_bvh::BuildItem &item = mItems[i - mItemBase];
+            mObjects[i] = item.object;
+            mBoxes[i] = item.box;
+            mEntryOf[item.object] = i;
+        }
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    // Parents and object-to-leaf links from the node array
+    void link()
+    {
+        mParents.assign(mNodes.size(), -1);
+        linkRange(0, static_cast<int>(mNodes.size()));
+        mTouched.assign(mNodes.size(), 0);
+    }
+
+    void linkRange(int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const scene_bvh::Node &node = mNodes[i];
+            if (node.count == 0)
+            {
+                mParents[i + 1] = i;
+                mParents[node.first] = i;
+            }
+            for (int j = node.first; j < node.first + node.count; ++j)
+                mLeafOf[mObjects[j]] = i;
+        }
+    }
+
+    // Refits a flagged node, and marks it worn once its area outgrew the build's
+    void refitAndCheck(int index, std::vector<int> &worn)
+    {
+        refitNode(index);
+        if (mNodes[index].count == 0 && halfArea(index) > mBuildAreas[index] * SCENE_BVH_REBUILD_GROWTH)
+        {
+            mTouched[index] = WORN;
+            worn.push_back(index);
+        }
+    }
+
+    void refitNode(int index)
+    {
+        scene_bvh::Node &node = mNodes[index];
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+        if (node.count > 0)
+        {
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                boundsMin = glm::min(boundsMin, mBoxes[i].min);
+                boundsMax = glm::max(boundsMax, mBoxes[i].max);
+            }
+        }
+        else
+        {
+            const scene_bvh::Node &left = mNodes[index + 1], &right = mNodes[node.first];
+            boundsMin = glm::min(glm::vec3(left.boundsMin), glm::vec3(right.boundsMin));
+            boundsMax = glm::max(glm::vec3(left.boundsMax), glm::vec3(right.boundsMax));
+        }
+        node.boundsMin = GpuVec3(boundsMin);
+        node.boundsMax = GpuVec3(boundsMax);
+    }
+
+    // Object list range [first, first + count) of a subtree: from its leftmost to its rightmost leaf
+    void subtreeRange(int index, int &first, int &count) const
+    {
+        int leftmost = index, rightmost = index;
+        while (mNodes[leftmost].count == 0)
+            leftmost = leftmost + 1;
+        while (mNodes[rightmost].count == 0)
+            rightmost = mNodes[rightmost].first;
+        first = mNodes[leftmost].first;
+        count = mNodes[rightmost].first + mNodes[rightmost].count - first;
+    }
+
+    void appendSubtree(int index, std::vector<int> &results) const
+    {
+        int first, count;
+        subtreeRange(index, first, count);
+        results.insert(results.end(), mObjects.begin() + first, mObjects.begin() + first + count);
+    }
+
+    // False when the box is outside a plane; clears the bits of planes it is entirely inside
+    static bool frustumTest(const glm::vec4 *planes, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, unsigned &planeMask)
+    {
+        for (int p = 0; p < 6; ++p)
+        {
+            if (!(planeMask & (1u << p)))
+                continue;
+            const glm::vec3 normal(planes[p]);
+            const glm::bvec3 positive = glm::greaterThanEqual(normal, glm::vec3(0.0f));
+            const glm::vec3 farCorner = glm::mix(boundsMin, boundsMax, positive);
+            if (glm::dot(normal, farCorner) + planes[p].w < 0.0f)
+                return false;
+            const glm::vec3 nearCorner = glm::mix(boundsMax, boundsMin, positive);
+            if (glm::dot(normal, nearCorner) + planes[p].w >= 0.0f)
+                planeMask &= ~(1u << p);
+        }
+        return true;
+    }
+
+    // Rebuilds the worn subtrees; a rebuilt subtree that fits in the old one's
+    // nodes replaces it in place, otherwise the whole array is relinked
+    void rebuildSubtrees(const std::vector<int> &worn)
+    {
+        std::vector<unsigned char> rebuild(mNodes.size(), 0);
+        bool relinkAll = false;
+        for (size_t i = 0; i < worn.size(); ++i)
+        {
+            if (!rebuildInPlace(worn[i]))
+            {
+                rebuild[worn[i]] = 1;
+                relinkAll = true;
+            }
+        }
+        if (!relinkAll)
+            return;
+
+        std::vector<scene_bvh::Node> nodes;
+        std::vector<float> areas;
+        nodes.reserve(mNodes.size() + mNodes.size() / 8);
+        areas.reserve(nodes.capacity());
+        relink(0, 0, rebuild, nodes, areas);
+        mNodes.swap(nodes);
+        mBuildAreas.swap(areas);
+        link();
+    }
+
+    bool rebuildInPlace(int index)
+    {
+        int depth = 0;
+        for (int parent = mParents[index]; parent >= 0; parent = mParents[parent])
+            ++depth;
+        int last = index;
+        while (mNodes[last].count == 0)
+            last = mNodes[last].first;
+
+        int first, count;
+        subtreeRange(index, first, count);
+        gatherItems(first, count);
+        std::vector<scene_bvh::Node> nodes;
+        std::vector<float> areas;
+        build(first, count, depth, nodes, areas);
+        if (static_cast<int>(nodes.size()) > last + 1 - index)
+            return false;
+
+        // Right child indices were local to 'nodes'; nodes past the new subtree stay unreferenced until the next relink
+        for (int i = 0; i < static_cast<int>(nodes.size()); ++i)
+        {
+            if (nodes[i].count == 0)
+                nodes[i].first += index;
+            mNodes[index + i] = nodes[i];
+            mBuildAreas[index + i] = areas[i];
+        }
+        for (int i = index + static_cast<int>(nodes.size()); i <= last; ++i)
+            mNodes[i].count = UNUSED_NODE;
+        linkRange(index, last + 1);
+        return true;
+    }
+
+    int relink(int index, int depth, const std::vector<unsigned char> &rebuild, std::vector<scene_bvh::Node> &nodes, std::vector<float> &areas)
+    {
+        if (rebuild[index])
+        {
+            int first, count;
+            subtreeRange(index, first, count);
+            gatherItems(first, count);
+            return build(first, count, depth, nodes, areas);
+        }
+
+        const int copy = static_cast<int>(nodes.size());
+        nodes.push_back(mNodes[index]);
+        areas.push_back(mBuildAreas[index]);
+        if (mNodes[index].count == 0)
+        {
+            relink(index + 1, depth + 1, rebuild, nodes, areas);
+            nodes[copy].first = relink(mNodes[index].first, depth + 1, rebuild, nodes, areas);
+        }
+        return copy;
+    }
+};
+
+#endif
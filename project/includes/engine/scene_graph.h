@@ -0,0 +1,204 @@
+/* Parent/child transforms kept in depth-first order in flat arrays.
+ *
+ * Every node stores a local matrix (relative to its parent) and a world
+ * matrix. Nodes live in depth-first order, so a node's subtree is the
+ * contiguous range [index, subtree end) and a parent always comes before
+ * its children; Update() is then one forward walk with no recursion:
+ *
+ *     SceneGraph scene;
+ *     const int book = scene.AddNode(SCENE_GRAPH_NO_PARENT, bookLocal);
+ *     const int glasses = scene.AddNode(book, glassesLocal);   // rests on the book
+ *     ...
+ *     scene.SetPosition(book, newPosition);    // marks the book and the glasses
+ *     scene.Update();                          // recomputes those two only
+ *     for (size_t i = begin; i < end; ++i)     // from GetUpdatedRange()
+ *         transforms.Set(i, scene.GetWorldMatrices()[i]);
+ *
+ * Edits only set a flag and remember the first dirty index. Update()
+ * returns at once when nothing changed, and otherwise starts at that index
+ * and skips clean subtrees whole, so a large scene where little moves
+ * costs almost nothing per frame.
+ *
+ * Node handles stay valid for the lifetime of the graph. GetIndex() maps a
+ * handle to its slot in GetWorldMatrices(), which is the order to upload
+ * them in. Adding a child under an earlier node shifts the slots after it,
+ * so build the scene before handing out slot indices; appending in
+ * depth-first order never shifts anything.
+ */
+
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Parent handle of root nodes
+const int SCENE_GRAPH_NO_PARENT = -1;
+
+
+class SceneGraph
+{
+public:
+    SceneGraph() : mFirstDirty(SCENE_GRAPH_CLEAN), mUpdatedBegin(0), mUpdatedEnd(0)
+    {
+    }
+
+    // Handle of a new node placed last among 'parent's children, or -1 when 'parent' is not a node
+    int AddNode(int parent, const glm::mat4 &local = glm::mat4(1.0f))
+    {
+        if (parent != SCENE_GRAPH_NO_PARENT && !isNode(parent))
+            return -1;
+
+        const int parentIndex = parent == SCENE_GRAPH_NO_PARENT ? -1 : mIndices[parent];
+        const size_t index = parentIndex < 0 ? GetCount() : mSubtreeEnds[parentIndex];
+        const int node = static_cast<int>(mIndices.size());
+
+        mParents.insert(mParents.begin() + index, parentIndex);
+        mSubtreeEnds.insert(mSubtreeEnds.begin() + index, index + 1);
+        mLocals.insert(mLocals.begin() + index, local);
+        mWorlds.insert(mWorlds.begin() + index, local);
+        mDirty.insert(mDirty.begin() + index, 1);
+        mNodes.insert(mNodes.begin() + index, node);
+        mIndices.push_back(static_cast<int>(index));
+
+        // Every ancestor's subtree grew by one
+        for (int ancestor = parentIndex; ancestor >= 0; ancestor = mParents[ancestor])
+            ++mSubtreeEnds[ancestor];
+
+        // Nodes after the new one moved up a slot; mark them so the renderer re-reads them
+        for (size_t i = index + 1; i < GetCount(); ++i)
+        {
+            if (mParents[i] >= static_cast<int>(index))
+                ++mParents[i];
+            ++mSubtreeEnds[i];
+            mIndices[mNodes[i]] = static_cast<int>(i);
+            mDirty[i] = 1;
+        }
+
+        markDirty(index);
+        return node;
+    }
+
+    void SetLocal(int node, const glm::mat4 &local)
+    {
+        const size_t index = mIndices[node];
+        mLocals[index] = local;
+        markDirty(index);
+    }
+
+    // Same result as translate(position) * mat4_cast(rotation) * scale(scale); rotation must be a unit quaternion
+    void SetLocal(int node, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale)
+    {
+        const glm::mat3 r = glm::mat3_cast(rotation);
+        glm::mat4 local(1.0f);
+        local[0] = glm::vec4(r[0] * scale.x, 0.0f);
+        local[1] = glm::vec4(r[1] * scale.y, 0.0f);
+        local[2] = glm::vec4(r[2] * scale.z, 0.0f);
+        local[3] = glm::vec4(position, 1.0f);
+        SetLocal(node, local);
+    }
+
+    // Moves a node relative to its parent, keeping its rotation and scale
+    void SetPosition(int node, const glm::vec3 &position)
+    {
+        const size_t index = mIndices[node];
+        mLocals[index][3] = glm::vec4(position, 1.0f);
+        markDirty(index);
+    }
+
+    // Recomputes the world matrices of every dirty subtree; returns how many were recomputed
+    size_t Update()
+    {
+        mUpdatedBegin = mUpdatedEnd = 0;
+        if (mFirstDirty >= GetCount())
+            return 0;
+
+        size_t recomputed = 0;
+        size_t i = mFirstDirty;
+        while (i < GetCount())
+        {
+            if (!mDirty[i])
+            {
+                ++i;
+                continue;
+            }
+
+            // A dirty node invalidates its whole subtree; parents come first, so one pass is enough
+            const size_t end = mSubtreeEnds[i];
+            for (size_t j = i; j < end; ++j)
+            {
+                mWorlds[j] = mParents[j] < 0 ? mLocals[j] : mWorlds[mParents[j]] * mLocals[j];
+                mDirty[j] = 0;
+            }
+            if (recomputed == 0)
+                mUpdatedBegin = i;
+            mUpdatedEnd = end;
+            recomputed += end - i;
+            i = end;
+        }
+
+        mFirstDirty = SCENE_GRAPH_CLEAN;
+        return recomputed;
+    }
+
+    // Half-open range of GetWorldMatrices() slots the last Update() may have changed
+    void GetUpdatedRange(size_t &begin, size_t &end) const
+    {
+        begin = mUpdatedBegin;
+        end = mUpdatedEnd;
+    }
+
+    // World matrices in depth-first order, valid after Update()
+    const glm::mat4* GetWorldMatrices() const { return mWorlds.empty() ? NULL : &mWorlds[0]; }
+
+    const glm::mat4& GetWorld(int node) const { return mWorlds[mIndices[node]]; }
+    const glm::mat4& GetLocal(int node) const { return mLocals[mIndices[node]]; }
+    int GetIndex(int node) const { return mIndices[node]; }
+    size_t GetCount() const { return mNodes.size(); }
+
+    void Clear()
+    {
+        mParents.clear();
+        mSubtreeEnds.clear();
+        mLocals.clear();
+        mWorlds.clear();
+        mDirty.clear();
+        mNodes.clear();
+        mIndices.clear();
+        mFirstDirty = SCENE_GRAPH_CLEAN;
+        mUpdatedBegin = mUpdatedEnd = 0;
+    }
+
+private:
+    static const size_t SCENE_GRAPH_CLEAN = static_cast<size_t>(-1);
+
+    // Depth-first order, one entry per node
+    std::vector<int> mParents;              // index of the parent, -1 for roots
+    std::vector<size_t> mSubtreeEnds;       // one past the node's last descendant
+    std::vector<glm::mat4> mLocals;
+    std::vector<glm::mat4> mWorlds;
+    std::vector<unsigned char> mDirty;
+    std::vector<int> mNodes;                // handle stored at each index
+
+    std::vector<int> mIndices;              // index of each handle
+    size_t mFirstDirty;                     // no dirty node before this index; SCENE_GRAPH_CLEAN when none is dirty
+    size_t mUpdatedBegin;
+    size_t mUpdatedEnd;
+
+    bool isNode(int node) const
+    {
+        return node >= 0 && static_cast<size_t>(node) < mIndices.size();
+    }
+
+    void markDirty(size_t index)
+    {
+        mDirty[index] = 1;
+        if (index < mFirstDirty)
+            mFirstDirty = index;
+    }
+};
+
+#endif
@@ -0,0 +1,147 @@
+/* Shader permutations selected by feature bitmask.
+ *
+ * One annotated GLSL source is compiled once per combination of features an
+ * object actually uses. Each feature becomes a "#define NAME 1" line after
+ * the source's #version line, so the source picks its code paths with
+ * #ifdef and every variant contains only the work it needs. Compiled
+ * variants live in a map keyed by the bitmask, so only the combinations in
+ * use take space:
+ *
+ *     ShaderPermutations gShaders(STANDARD_VERTEX_SHADER, STANDARD_FRAGMENT_SHADER, &gProgramCache);
+ *     ...
+ *     glUseProgram(gShaders.Get(SHADER_TEXTURED | SHADER_LIT));
+ *
+ * Get() compiles a missing variant on the spot; Add() queues it on a
+ * ProgramBuilder instead so several variants compile as one batch.
+ */
+
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <GL/glew.h>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <engine/program_builder.h>
+#include <engine/program_cache.h>
+
+enum ShaderFeature
+{
+    SHADER_TEXTURED           = 1u << 0,    // samples uTexture at textureCoordinate * uvScale
+    SHADER_LIT                = 1u << 1,    // Phong lighting from lightPos/lightColor; needs normals
+    SHADER_VERTEX_COLOR       = 1u << 2,    // multiplies in a per-vertex color
+    SHADER_INSTANCED          = 1u << 3,    // model matrix comes from a per-instance attribute
+    SHADER_QUANTIZED_VERTICES = 1u << 4,    // positions are normalized shorts, rescaled in the shader
+    SHADER_CLUSTERED_LIGHTS   = 1u << 5,    // with LIT: point lights from the ClusteredLights buffers
+    SHADER_GBUFFER            = 1u << 6,    // with LIT: writes the deferred G-buffer instead of shading
+    SHADER_POINT_SHADOW       = 1u << 7,    // with LIT: lightPos casts shadows from a PointShadowMap
+    SHADER_IRRADIANCE_PROBES  = 1u << 8,    // with LIT: ambient from an IrradianceProbeGrid
+    SHADER_MULTI_VIEW         = 1u << 9     // transforms, camera and color from a MultiViewRenderer
+};
+
+const unsigned SHADER_FEATURE_COUNT = 10;
+const char* const SHADER_FEATURE_NAMES[SHADER_FEATURE_COUNT] =
+{
+    "TEXTURED", "LIT", "VERTEX_COLOR", "INSTANCED", "QUANTIZED_VERTICES", "CLUSTERED_LIGHTS", "GBUFFER", "POINT_SHADOW",
+    "IRRADIANCE_PROBES", "MULTI_VIEW"
+};
+
+
+// Inserts the feature defines after the #version line (which must stay first)
+inline std::string ExpandShaderFeatures(const char *source, unsigned features)
+{
+    std::string defines;
+    for (unsigned i = 0; i < SHADER_FEATURE_COUNT; ++i)
+    {
+        if (features & (1u << i))
+            defines += std::string("#define ") + SHADER_FEATURE_NAMES[i] + " 1\n";
+    }
+
+    const char *version = strstr(source, "#version");
+    const char *lineEnd = version ? strchr(version, '\n') : NULL;
+    if (!lineEnd)
+        return defines + source;
+
+    // Count the lines up to and including #version so compile errors keep the source's line numbers
+    int lines = 1;
+    for (const char *c = source; c <= lineEnd; ++c)
+        lines += *c == '\n';
+
+    char lineDirective[32];
+    sprintf(lineDirective, "#line %d\n", lines);
+    return std::string(source, lineEnd + 1) + defines + lineDirective + std::string(lineEnd + 1);
+}
+
+
+class ShaderPermutations
+{
+public:
+    static const unsigned FEATURE_MASK = (1u << SHADER_FEATURE_COUNT) - 1;
+
+    ShaderPermutations(const char *vtxShaderSource, const char *fragShaderSource, ProgramCache *cache = NULL)
+        : mVtxShaderSource(vtxShaderSource), mFragShaderSource(fragShaderSource), mCache(cache)
+    {
+    }
+
+    // Queues the variant on 'builder'; its program is available after builder.Finish()
+    void Add(ProgramBuilder &builder, unsigned features)
+    {
+        Variant &variant = mVariants[features & FEATURE_MASK];
+        if (variant.requested)
+            return;
+
+        variant.requested = true;
+        variant.vtxShaderSource = ExpandShaderFeatures(mVtxShaderSource, features);
+        variant.fragShaderSource = ExpandShaderFeatures(mFragShaderSource, features);
+        builder.Add(variant.vtxShaderSource.c_str(), variant.fragShaderSource.c_str(), variant.programId);
+    }
+
+    // Program for the feature set, built now if it was never requested; 0 if it failed to build
+    GLuint Get(unsigned features)
+    {
+        Variant &variant = mVariants[features & FEATURE_MASK];
+        if (!variant.requested)
+        {
+            ProgramBuilder builder(mCache);
+            Add(builder, features);
+            builder.Build();
+        }
+        return variant.programId;
+    }
+
+    // Deletes every built variant
+    void Clear()
+    {
+        for (std::map<unsigned, Variant>::iterator it = mVariants.begin(); it != mVariants.end(); ++it)
+        {
+            if (it->second.programId)
+                glDeleteProgram(it->second.programId);
+        }
+        mVariants.clear();
+    }
+
+private:
+    struct Variant
+    {
+        std::string vtxShaderSource;    // expanded sources; the builder keeps pointers into them
+        std::string fragShaderSource;
+        GLuint programId;
+        bool requested;
+
+        Variant() : programId(0), requested(false) {}
+    };
+
+    const char *mVtxShaderSource;
+    const char *mFragShaderSource;
+    ProgramCache *mCache;
+    std::map<unsigned, Variant> mVariants;     // map nodes never move, so pending builder pointers stay valid
+
+    // Variants hold pointers into themselves while a batch is pending
+    ShaderPermutations(const ShaderPermutations&);
+    ShaderPermutations& operator=(const ShaderPermutations&);
+};
+
+#endif
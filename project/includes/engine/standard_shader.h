@@ -0,0 +1,305 @@
+/* The standard object shader, annotated for ShaderPermutations.
+ *
+ * Vertex attribute slots are fixed across all permutations:
+ *   0 position (vec3, or normalized shorts with QUANTIZED_VERTICES)
+ *   1 normal              (LIT)
+ *   2 texture coordinate  (TEXTURED)
+ *   3 color, vec4         (VERTEX_COLOR)
+ *   4-7 model matrix, one column per slot, divisor 1 (INSTANCED)
+ *   8-10 normal matrix, one column per slot, divisor 1 (INSTANCED and LIT)
+ *   4 object slot, int, a constant attribute (MULTI_VIEW)
+ *
+ * Transforms come precomputed from the CPU: the ObjectConstants block of
+ * engine/object_constants.h (binding 1) supplies model, modelViewProjection
+ * and normalMatrix per draw; INSTANCED variants take model and normal
+ * matrices per instance and use the view and projection uniforms instead.
+ *
+ * Uniforms: objectColor; plus lightColor, lightPos, viewPosition with LIT;
+ * uTexture, uvScale with TEXTURED; positionScale, positionOffset with
+ * QUANTIZED_VERTICES. Without TEXTURED the surface color is objectColor.
+ *
+ * LIT with CLUSTERED_LIGHTS replaces the single lightPos/lightColor with the
+ * point lights binned by engine/clustered_lights.h (storage buffers 3-5).
+ * Their falloff is a smooth window reaching 0 at the light's radius, without
+ * an inverse-square term, so a light with a large radius looks like the
+ * single-light path.
+ *
+ * LIT with GBUFFER writes the surface for engine/deferred_renderer.h instead
+ * of shading it: albedo and specular intensity to target 0, the octahedral
+ * encoded normal to target 1. Like the other lighting features, GBUFFER
+ * without LIT is ignored and the variant shades unlit into fragmentColor.
+ *
+ * LIT with POINT_SHADOW (single-light path) darkens what the PointShadowMap
+ * of engine/point_shadow.h hides from lightPos; the cube map is sampled on
+ * texture unit 1 and shadowFarPlane must match the map's far plane.
+ *
+ * MULTI_VIEW (not INSTANCED) takes its constants from the blocks of
+ * engine/multi_view_renderer.h: the objects[] storage buffer (model,
+ * normalMatrix) at binding 1, indexed by the objectSlot attribute at
+ * location 4, in place of ObjectConstants, ViewConstants (viewProjection,
+ * viewPosition) at binding 3 and MaterialConstants (objectColor) at
+ * binding 4, so one program draws every view of a MultiViewRenderer.
+ *
+ * LIT with IRRADIANCE_PROBES (forward paths) replaces the constant ambient
+ * term with the light an IrradianceProbeGrid of engine/irradiance_probes.h
+ * baked around the fragment; the probe texture is sampled on texture unit 2
+ * and probeGridMin/probeGridMax must match the grid's bounds.
+ */
+
+#ifndef STANDARD_SHADER_H
+#define STANDARD_SHADER_H
+
+#include <string>
+
+#include <engine/clustered_lights.h>  // CLUSTERED_LIGHTS_GLSL
+#include <engine/point_shadow.h>      // POINT_SHADOW_GLSL
+#include <engine/irradiance_probes.h> // IRRADIANCE_PROBES_GLSL
+
+// Lighting model shared by the forward and deferred paths
+const char* const PHONG_LIGHTING_GLSL = R"(
+// Diffuse and specular terms of one light
+vec3 phong(vec3 norm, vec3 lightDirection, vec3 viewDir, vec3 lightColor, float specularIntensity)
+{
+    float impact = max(dot(norm, lightDirection), 0.0); // Calculate diffuse impact by generating dot product of normal and light
+    vec3 diffuse = impact * lightColor; // Generate diffuse light color
+
+    float highlightSize = 16.0f; // Set specular highlight size
+    vec3 reflectDir = reflect(-lightDirection, norm); // Calculate reflection vector
+    float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+    vec3 specular = specularIntensity * specularComponent * lightColor;
+
+    return diffuse + specular;
+}
+)";
+
+// Normals folded onto an octahedron, two components in [-1, 1]
+const char* const OCTAHEDRAL_NORMAL_GLSL = R"(
+vec2 encodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signs;
+}
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+)";
+
+const char* const STANDARD_VERTEX_SHADER = R"(#version 440 core
+
+layout (location = 0) in vec3 position; // VAP position 0 for vertex position data
+#ifdef LIT
+layout (location = 1) in vec3 normal; // VAP position 1 for normals
+out vec3 vertexNormal; // For outgoing normals to fragment shader
+out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+#endif
+#ifdef TEXTURED
+layout (location = 2) in vec2 textureCoordinate;
+out vec2 vertexTextureCoordinate;
+#endif
+#ifdef VERTEX_COLOR
+layout (location = 3) in vec4 color;
+out vec4 vertexColor;
+#endif
+
+#ifdef INSTANCED
+layout (location = 4) in mat4 instanceModel; // occupies locations 4-7
+#ifdef LIT
+layout (location = 8) in mat3 instanceNormalMatrix; // occupies locations 8-10
+#endif
+uniform mat4 view;
+uniform mat4 projection;
+#elif defined(MULTI_VIEW)
+// Shared by every view that draws the object; the camera comes per view
+struct ObjectTransforms
+{
+    mat4 model;
+    mat3 normalMatrix;
+};
+layout (std430, binding = 1) readonly buffer MultiViewObjects
+{
+    ObjectTransforms objects[];
+};
+layout (location = 4) in int objectSlot;    // constant per draw
+layout (std140, binding = 3) uniform ViewConstants
+{
+    mat4 viewProjection;
+    vec3 viewPosition;
+};
+#else
+// Computed once per object on the CPU
+layout (std140, binding = 1) uniform ObjectConstants
+{
+    mat4 model;
+    mat4 modelViewProjection;
+    mat3 normalMatrix; // inverse transpose of the model's upper 3x3
+};
+#endif
+
+#ifdef QUANTIZED_VERTICES
+// Positions are stored as normalized shorts in [-1, 1]; this maps them back to model space
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+#endif
+
+void main()
+{
+#ifdef QUANTIZED_VERTICES
+    vec3 modelPosition = position * positionScale + positionOffset;
+#else
+    vec3 modelPosition = position;
+#endif
+#if defined(MULTI_VIEW) && !defined(INSTANCED)
+    mat4 model = objects[objectSlot].model;
+    mat3 normalMatrix = objects[objectSlot].normalMatrix;
+#endif
+
+#ifdef INSTANCED
+    vec4 worldPosition = instanceModel * vec4(modelPosition, 1.0f);
+    gl_Position = projection * view * worldPosition; // Transforms vertices into clip coordinates
+#elif defined(MULTI_VIEW)
+    gl_Position = viewProjection * (model * vec4(modelPosition, 1.0f)); // Transforms vertices into clip coordinates
+#else
+    gl_Position = modelViewProjection * vec4(modelPosition, 1.0f); // Transforms vertices into clip coordinates
+#endif
+
+#ifdef LIT
+#ifdef INSTANCED
+    vertexNormal = instanceNormalMatrix * normal;
+#else
+    vec4 worldPosition = model * vec4(modelPosition, 1.0f);
+    vertexNormal = normalMatrix * normal; // get normal vectors in world space only and exclude normal translation properties
+#endif
+    vertexFragmentPos = vec3(worldPosition); // Gets fragment / pixel position in world space only (exclude view and projection)
+#endif
+#ifdef TEXTURED
+    vertexTextureCoordinate = textureCoordinate;
+#endif
+#ifdef VERTEX_COLOR
+    vertexColor = color;
+#endif
+}
+)";
+
+
+const std::string STANDARD_FRAGMENT_SHADER_SOURCE = std::string(R"(#version 440 core
+
+#ifdef LIT
+in vec3 vertexNormal; // For incoming normals
+in vec3 vertexFragmentPos; // For incoming fragment position
+#ifdef MULTI_VIEW
+layout (std140, binding = 3) uniform ViewConstants
+{
+    mat4 viewProjection;
+    vec3 viewPosition;
+};
+#else
+uniform vec3 viewPosition;
+#endif
+#ifdef IRRADIANCE_PROBES
+)") + IRRADIANCE_PROBES_GLSL + R"(
+#endif
+#ifdef CLUSTERED_LIGHTS
+)" + CLUSTERED_LIGHTS_GLSL + R"(
+#else
+uniform vec3 lightColor;
+uniform vec3 lightPos;
+#ifdef POINT_SHADOW
+)" + POINT_SHADOW_GLSL + R"(
+#endif
+#endif
+#endif
+#ifdef TEXTURED
+in vec2 vertexTextureCoordinate;
+uniform sampler2D uTexture;
+uniform vec2 uvScale;
+#elif defined(MULTI_VIEW)
+layout (std140, binding = 4) uniform MaterialConstants
+{
+    vec3 objectColor;
+};
+#else
+uniform vec3 objectColor;
+#endif
+#ifdef VERTEX_COLOR
+in vec4 vertexColor;
+#endif
+
+#if defined(LIT) && defined(GBUFFER)
+layout (location = 0) out vec4 gAlbedoSpecular;
+layout (location = 1) out vec2 gNormal;
+)" + OCTAHEDRAL_NORMAL_GLSL + R"(
+#else
+out vec4 fragmentColor;
+#endif
+
+#ifdef LIT
+)" + PHONG_LIGHTING_GLSL + R"(
+#endif
+
+void main()
+{
+#ifdef TEXTURED
+    // Texture holds the color to be used for all three components
+    vec3 surfaceColor = texture(uTexture, vertexTextureCoordinate * uvScale).xyz;
+#else
+    vec3 surfaceColor = objectColor;
+#endif
+#ifdef VERTEX_COLOR
+    surfaceColor *= vertexColor.rgb;
+#endif
+
+#if defined(LIT) && defined(GBUFFER)
+    gAlbedoSpecular = vec4(surfaceColor, 0.8f); // Specular strength rides in alpha
+    gNormal = encodeOctahedral(normalize(vertexNormal));
+#elif defined(LIT)
+    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+
+    float ambientStrength = 0.1f; // Set ambient or global lighting strength
+    float specularIntensity = 0.8f; // Set specular light strength
+    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
+    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+
+#ifdef CLUSTERED_LIGHTS
+    uvec2 range = clusterRange(gl_FragCoord.xy, clusterViewDepth(gl_FragCoord.z));
+#ifdef IRRADIANCE_PROBES
+    vec3 lighting = probeIrradiance(vertexFragmentPos, norm);
+#else
+    vec3 lighting = vec3(ambientStrength);
+#endif
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        PointLight light = lights[lightIndices[range.x + i]];
+        vec3 toLight = light.position - vertexFragmentPos;
+        float lightDistance = length(toLight);
+        lighting += lightFalloff(light, lightDistance) * phong(norm, toLight / max(lightDistance, 1e-4), viewDir, light.color, specularIntensity);
+    }
+#else
+#ifdef IRRADIANCE_PROBES
+    vec3 ambient = probeIrradiance(vertexFragmentPos, norm); // Baked light arriving from every direction
+#else
+    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+#endif
+    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels
+#ifdef POINT_SHADOW
+    float shadow = pointShadow(vertexFragmentPos, norm, lightPos);
+#else
+    float shadow = 1.0f;
+#endif
+    vec3 lighting = ambient + shadow * phong(norm, lightDirection, viewDir, lightColor, specularIntensity);
+#endif
+
+    fragmentColor = vec4(lighting * surfaceColor, 1.0f); // Send lighting results to GPU
+#else
+    fragmentColor = vec4(surfaceColor, 1.0f);
+#endif
+}
+)";
+const char* const STANDARD_FRAGMENT_SHADER = STANDARD_FRAGMENT_SHADER_SOURCE.c_str();
+
+#endif
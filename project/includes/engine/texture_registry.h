@@ -0,0 +1,258 @@
+/* Content-addressed texture registry.
+ *
+ * Acquire() returns the texture already loaded for a file instead of
+ * decoding and uploading it again. Files are matched first by canonical
+ * path (while their size and modification time are unchanged) and then by a
+ * hash of their bytes, so the same image stored under two paths is loaded
+ * once. Every Acquire() must be paired with a Release(); the texture is
+ * destroyed when its last reference goes away.
+ *
+ * The registry does not decode anything itself: it calls the load/destroy
+ * functions it is given, e.g. UCreateTexture/UDestroyTexture. Textures made
+ * by different load functions are never shared, since they may differ in
+ * orientation or format. A texture whose storage changes after loading,
+ * such as a streamed one, is given a size function as well, and
+ * GetResidentBytes() asks it for the current size instead of using the size
+ * measured at load time.
+ */
+
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <GL/glew.h>
+
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <engine/mapped_file.h>
+#include <engine/mip_chain.h>
+
+typedef bool (*TextureLoadFunc)(const char* filename, GLuint &textureId);
+typedef void (*TextureDestroyFunc)(GLuint textureId);
+typedef size_t (*TextureSizeFunc)(GLuint textureId);
+
+
+class TextureRegistry
+{
+public:
+    TextureRegistry() : mLoads(0), mHits(0)
+    {
+    }
+
+    // Returns a shared texture for the file, loading it with 'load' on a miss. 'size' reports the
+    // texture's current storage when it can change after loading; without it, the storage is measured once.
+    bool Acquire(const char* filename, GLuint &textureId, TextureLoadFunc load, TextureDestroyFunc destroy, TextureSizeFunc size = NULL)
+    {
+        const std::string path = canonicalPath(filename);
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+
+        // Same path, unchanged file: no need to read it
+        std::map<PathKey, PathEntry>::iterator byPath = mPaths.find(PathKey(path, load));
+        if (byPath != mPaths.end())
+        {
+            if (byPath->second.size == static_cast<unsigned long long>(info.st_size) && byPath->second.modified == static_cast<long long>(info.st_mtime))
+                return addReference(byPath->second.key, textureId);
+            mPaths.erase(byPath);
+        }
+
+        ContentKey key;
+        if (!hashFile(path.c_str(), key.hash))
+            return false;
+        key.size = static_cast<unsigned long long>(info.st_size);
+        key.load = load;
+
+        PathEntry &pathEntry = mPaths[PathKey(path, load)];
+        pathEntry.key = key;
+        pathEntry.size = key.size;
+        pathEntry.modified = static_cast<long long>(info.st_mtime);
+
+        if (addReference(key, textureId))
+            return true;
+
+        if (!load(filename, textureId))
+        {
+            mPaths.erase(PathKey(path, load));
+            return false;
+        }
+
+        Entry &entry = mEntries[key];
+        entry.textureId = textureId;
+        entry.references = 1;
+        entry.destroy = destroy;
+        entry.size = size;
+        entry.bytes = size ? 0 : measureTexture(textureId);
+        mKeys[textureId] = key;
+        ++mLoads;
+        return true;
+    }
+
+    // Drops one reference; the last one destroys the texture
+    void Release(GLuint textureId)
+    {
+        std::map<GLuint, ContentKey>::iterator key = mKeys.find(textureId);
+        if (key == mKeys.end())
+            return;
+
+        std::map<ContentKey, Entry>::iterator entry = mEntries.find(key->second);
+        if (--entry->second.references > 0)
+            return;
+
+        if (entry->second.destroy)
+            entry->second.destroy(textureId);
+
+        for (std::map<PathKey, PathEntry>::iterator it = mPaths.begin(); it != mPaths.end();)
+        {
+            if (!(it->second.key < key->second) && !(key->second < it->second.key))
+                mPaths.erase(it++);
+            else
+                ++it;
+        }
+        mEntries.erase(entry);
+        mKeys.erase(key);
+    }
+
+    // Bytes of texture storage held by the registry right now
+    size_t GetResidentBytes() const
+    {
+        size_t total = 0;
+        for (std::map<ContentKey, Entry>::const_iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+            total += it->second.size ? it->second.size(it->second.textureId) : it->second.bytes;
+        return total;
+    }
+
+    size_t GetTextureCount() const { return mEntries.size(); }
+    // Acquire() calls that had to load / that reused a texture
+    unsigned GetLoadCount() const { return mLoads; }
+    unsigned GetHitCount() const { return mHits; }
+
+private:
+    struct ContentKey
+    {
+        unsigned long long hash;
+        unsigned long long size;
+        TextureLoadFunc load;
+
+        bool operator<(const ContentKey &other) const
+        {
+            if (hash != other.hash) return hash < other.hash;
+            if (size != other.size) return size < other.size;
+            return std::less<TextureLoadFunc>()(load, other.load);
+        }
+    };
+
+    struct PathKey
+    {
+        std::string path;
+        TextureLoadFunc load;
+
+        PathKey(const std::string &path, TextureLoadFunc load) : path(path), load(load) {}
+
+        bool operator<(const PathKey &other) const
+        {
+            if (path != other.path) return path < other.path;
+            return std::less<TextureLoadFunc>()(load, other.load);
+        }
+    };
+
+    struct Entry
+    {
+        GLuint textureId;
+        int references;
+        TextureDestroyFunc destroy;
+        TextureSizeFunc size;
+        size_t bytes;           // measured at load time when there is no size function
+    };
+
+    struct PathEntry
+    {
+        ContentKey key;
+        unsigned long long size;
+        long long modified;
+    };
+
+    std::map<ContentKey, Entry> mEntries;
+    std::map<GLuint, ContentKey> mKeys;
+    std::map<PathKey, PathEntry> mPaths;
+    unsigned mLoads;
+    unsigned mHits;
+
+    bool addReference(const ContentKey &key, GLuint &textureId)
+    {
+        std::map<ContentKey, Entry>::iterator it = mEntries.find(key);
+        if (it == mEntries.end())
+            return false;
+
+        ++it->second.references;
+        textureId = it->second.textureId;
+        ++mHits;
+        return true;
+    }
+
+    static std::string canonicalPath(const char *filename)
+    {
+#ifdef _WIN32
+        char resolved[_MAX_PATH];
+        if (_fullpath(resolved, filename, _MAX_PATH))
+            return resolved;
+#else
+        char resolved[PATH_MAX];
+        if (realpath(filename, resolved))
+            return resolved;
+#endif
+        return filename;
+    }
+
+    // 64-bit FNV-1a over the whole file
+    static bool hashFile(const char *path, unsigned long long &hash)
+    {
+        MappedFile file;
+        if (!file.Open(path))
+            return false;
+
+        hash = 14695981039346656037ULL;
+        const unsigned char *data = file.Data();
+        for (size_t i = 0; i < file.Size(); ++i)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return true;
+    }
+
+    // Sums the storage of every allocated level of a 2D texture
+    static size_t measureTexture(GLuint textureId)
+    {
+        GLint previous = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+        size_t bytes = 0;
+        for (int level = 0; level < MipLevelCount(maxSize, maxSize); ++level)
+        {
+            // Streamed textures leave their finest levels empty until needed
+            GLint width = 0, height = 0, internalFormat = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+            if (width == 0 || height == 0)
+                continue;
+
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+            // RGB8 is padded to four bytes per texel by the drivers we target
+            size_t texel = internalFormat == GL_R8 ? 1u : internalFormat == GL_RG8 ? 2u : 4u;
+            bytes += static_cast<size_t>(width) * height * texel;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, previous);
+        return bytes;
+    }
+};
+
+#endif
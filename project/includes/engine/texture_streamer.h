@@ -0,0 +1,359 @@
+/* Mip-level texture streaming with a VRAM residency budget.
+ *
+ * Textures are opened through the pixel cache, whose mapped .pxc file holds
+ * every mip level, so the streamer keeps no copy of the pixels: a level is
+ * read from the mapping when it is uploaded, and the OS pages it in and
+ * drops it again as needed (should the .pxc file fail to write, the image
+ * holds its decoded levels instead). Only the coarsest levels are uploaded
+ * at load time; finer levels are uploaded on demand, one level per texture
+ * per Update(), based on how large the texture appears on screen. When the
+ * resident total would exceed the budget, the finest levels of the least
+ * recently used textures are released again.
+ *
+ * Resident levels are exposed to the sampler through GL_TEXTURE_BASE_LEVEL.
+ * A freshly uploaded level is faded in through GL_TEXTURE_MIN_LOD so the
+ * switch to the sharper mip does not pop. Storage stays mutable (one
+ * glTexImage2D per level) since immutable storage cannot give levels back,
+ * and MIN_LOD is texture state here: do not bind a sampler object over a
+ * streamed texture.
+ */
+
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <engine/image_cache.h>
+#include <engine/mip_chain.h>
+
+// Default streamer values
+const size_t STREAM_BUDGET_BYTES      = 64u * 1024u * 1024u;
+const int    STREAM_UPLOADS_PER_FRAME = 4;
+const int    STREAM_MIN_RESIDENT_SIZE = 32;     // levels at or below this size are always resident
+const float  STREAM_LOD_FADE_STEP     = 0.25f;  // MIN_LOD fade per Update() after an upload
+
+
+class TextureStreamer
+{
+public:
+    TextureStreamer(size_t budgetBytes = STREAM_BUDGET_BYTES, int uploadsPerFrame = STREAM_UPLOADS_PER_FRAME, int minResidentSize = STREAM_MIN_RESIDENT_SIZE)
+        : mBudgetBytes(budgetBytes), mUploadsPerFrame(uploadsPerFrame), mMinResidentSize(minResidentSize), mResidentBytes(0), mFrame(0)
+    {
+    }
+
+    ~TextureStreamer()
+    {
+        ReleaseAll();
+    }
+
+    // Opens the image through the pixel cache and uploads only the coarse tail. Mirrors UCreateTexture.
+    bool Load(const char* filename, GLuint &textureId, bool flipVertically = false)
+    {
+        glGenTextures(1, &textureId);
+        Entry &entry = mEntries[textureId];
+
+        // The entry keeps the image open; finer levels are read from its mapping when they stream in
+        if (!entry.image.Open(filename, flipVertically) || !checkChannels(entry.image.Channels()))
+        {
+            mEntries.erase(textureId);
+            glDeleteTextures(1, &textureId);
+            textureId = 0;
+            return false;
+        }
+
+        createEntry(entry, textureId, entry.image.Width(), entry.image.Height(), entry.image.Channels(), entry.image.LevelCount());
+        return true;
+    }
+
+    // Same as Load, for pixels that were already decoded by the caller. There is no file to read
+    // levels back from, so the levels that can be evicted stay in a CPU copy.
+    bool LoadPixels(const unsigned char *image, int width, int height, int channels, GLuint &textureId)
+    {
+        if (!checkChannels(channels))
+            return false;
+
+        glGenTextures(1, &textureId);
+        Entry &entry = mEntries[textureId];
+        BuildMipChain(image, width, height, channels, entry.mips);
+        createEntry(entry, textureId, width, height, channels, static_cast<int>(entry.mips.size()));
+
+        // Levels at or below the floor are never evicted, so never uploaded again
+        for (int level = entry.floorLevel; level < entry.levelCount; ++level)
+            MipChain::value_type().swap(entry.mips[level]);
+        return true;
+    }
+
+    // Releases the GL texture and closes its image. Mirrors UDestroyTexture.
+    void Release(GLuint textureId)
+    {
+        std::map<GLuint, Entry>::iterator it = mEntries.find(textureId);
+        if (it == mEntries.end())
+            return;
+
+        mResidentBytes -= residentBytes(it->second);
+        glDeleteTextures(1, &textureId);
+        mEntries.erase(it);
+    }
+
+    void ReleaseAll()
+    {
+        while (!mEntries.empty())
+            Release(mEntries.begin()->first);
+    }
+
+    // Records that the texture is drawn this frame covering roughly screenPixels texels along its longest edge
+    void RequestSize(GLuint textureId, float screenPixels)
+    {
+        std::map<GLuint, Entry>::iterator it = mEntries.find(textureId);
+        if (it == mEntries.end())
+            return;
+
+        Entry &entry = it->second;
+        int longest = std::max(entry.width, entry.height);
+        int wanted = 0;
+        if (screenPixels > 0.0f && screenPixels < longest)
+            wanted = static_cast<int>(std::floor(std::log2(longest / screenPixels)));
+        wanted = std::min(wanted, entry.floorLevel);
+
+        // Several draws may reference the same texture; keep the sharpest request of the frame
+        if (entry.lastUsedFrame != mFrame || wanted < entry.wantedLevel)
+            entry.wantedLevel = wanted;
+        entry.lastUsedFrame = mFrame;
+    }
+
+    // Approximate on-screen size in pixels of an object with the given bounding radius
+    static float ProjectedSize(float radius, float distance, float fovDegrees, float viewportHeight)
+    {
+        distance = std::max(distance, radius);
+        if (distance <= 0.0f)
+            return viewportHeight;
+        float halfHeight = distance * std::tan(fovDegrees * 0.5f * 3.14159265f / 180.0f);
+        return viewportHeight * radius / halfHeight;
+    }
+
+    // Streams levels in and out. Call once per frame, after the RequestSize calls and before drawing.
+    void Update()
+    {
+        // Fade in levels uploaded on earlier frames
+        for (std::map<GLuint, Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+        {
+            Entry &entry = it->second;
+            if (entry.minLod > 0.0f)
+            {
+                entry.minLod = std::max(0.0f, entry.minLod - STREAM_LOD_FADE_STEP);
+                glBindTexture(GL_TEXTURE_2D, it->first);
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.minLod);
+            }
+        }
+
+        // The budget may have been lowered since the last frame
+        while (mResidentBytes > mBudgetBytes && evictOne(0))
+            ;
+
+        // Biggest residency deficit first
+        std::vector<std::pair<int, GLuint> > pending;
+        for (std::map<GLuint, Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+        {
+            const Entry &entry = it->second;
+            if (entry.lastUsedFrame == mFrame && entry.wantedLevel < entry.residentLevel)
+                pending.push_back(std::make_pair(entry.residentLevel - entry.wantedLevel, it->first));
+        }
+        std::sort(pending.begin(), pending.end(), std::greater<std::pair<int, GLuint> >());
+
+        int uploads = 0;
+        for (size_t i = 0; i < pending.size() && uploads < mUploadsPerFrame; ++i)
+        {
+            Entry &entry = mEntries[pending[i].second];
+            int level = entry.residentLevel - 1;
+            size_t bytes = levelBytes(entry, level);
+
+            bool fits = true;
+            while (mResidentBytes + bytes > mBudgetBytes)
+            {
+                if (!evictOne(pending[i].second))
+                {
+                    fits = false;
+                    break;
+                }
+            }
+            if (!fits)
+                continue;
+
+            glBindTexture(GL_TEXTURE_2D, pending[i].second);
+            uploadLevel(entry, level);
+            entry.minLod = 1.0f;
+            applyLevelClamp(entry);
+            ++uploads;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        ++mFrame;
+    }
+
+    void SetBudget(size_t budgetBytes) { mBudgetBytes = budgetBytes; }
+    size_t GetBudget() const { return mBudgetBytes; }
+    size_t GetResidentBytes() const { return mResidentBytes; }
+
+    // Bytes of VRAM the texture's resident levels take, or 0 for an unknown texture
+    size_t GetResidentBytes(GLuint textureId) const
+    {
+        std::map<GLuint, Entry>::const_iterator it = mEntries.find(textureId);
+        return it == mEntries.end() ? 0 : residentBytes(it->second);
+    }
+
+    // Finest mip level currently in VRAM, or -1 for an unknown texture
+    int GetResidentLevel(GLuint textureId) const
+    {
+        std::map<GLuint, Entry>::const_iterator it = mEntries.find(textureId);
+        return it == mEntries.end() ? -1 : it->second.residentLevel;
+    }
+
+private:
+    struct Entry
+    {
+        int width, height, channels;
+        int levelCount;
+        int residentLevel;      // finest level uploaded; levels [residentLevel, levelCount) are in VRAM
+        int wantedLevel;        // finest level requested on lastUsedFrame
+        int floorLevel;         // levels at or coarser than this are never evicted
+        unsigned long lastUsedFrame;
+        float minLod;           // current GL_TEXTURE_MIN_LOD while fading in a new level
+        CachedImage image;      // mapped pixel cache the levels are read from
+        MipChain mips;          // LoadPixels only: CPU copy of the levels finer than floorLevel
+    };
+
+    std::map<GLuint, Entry> mEntries;
+    size_t mBudgetBytes;
+    int mUploadsPerFrame;
+    int mMinResidentSize;
+    size_t mResidentBytes;
+    unsigned long mFrame;
+
+    static int levelWidth(const Entry &entry, int level) { return std::max(1, entry.width >> level); }
+    static int levelHeight(const Entry &entry, int level) { return std::max(1, entry.height >> level); }
+
+    // Drivers pad RGB8 to four bytes per texel, so account for it that way
+    static size_t levelBytes(const Entry &entry, int level)
+    {
+        return static_cast<size_t>(levelWidth(entry, level)) * levelHeight(entry, level) * 4u;
+    }
+
+    static size_t residentBytes(const Entry &entry)
+    {
+        size_t total = 0;
+        for (int level = entry.residentLevel; level < entry.levelCount; ++level)
+            total += levelBytes(entry, level);
+        return total;
+    }
+
+    static bool checkChannels(int channels)
+    {
+        if (channels == 3 || channels == 4)
+            return true;
+
+        std::cout << "Not implemented to handle image with " << channels << " channels" << std::endl;
+        return false;
+    }
+
+    void createEntry(Entry &entry, GLuint textureId, int width, int height, int channels, int levelCount)
+    {
+        entry.width = width;
+        entry.height = height;
+        entry.channels = channels;
+        entry.lastUsedFrame = mFrame;
+        entry.minLod = 0.0f;
+
+        // Every level above the resident floor starts out empty
+        entry.levelCount = levelCount;
+        entry.residentLevel = entry.levelCount;
+        entry.wantedLevel = entry.levelCount - 1;
+        entry.floorLevel = entry.levelCount - 1;
+        while (entry.floorLevel > 0 && std::max(levelWidth(entry, entry.floorLevel - 1), levelHeight(entry, entry.floorLevel - 1)) <= mMinResidentSize)
+            --entry.floorLevel;
+
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.levelCount - 1);
+
+        // Smallest mips first: the texture is sampleable as soon as the 1x1 level lands
+        for (int level = entry.levelCount - 1; level >= entry.floorLevel; --level)
+            uploadLevel(entry, level);
+        applyLevelClamp(entry);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static const unsigned char* levelPixels(const Entry &entry, int level)
+    {
+        return entry.mips.empty() ? entry.image.Level(level) : &entry.mips[level][0];
+    }
+
+    // Expects the texture to be bound to GL_TEXTURE_2D
+    void uploadLevel(Entry &entry, int level)
+    {
+        GLenum format = entry.channels == 4 ? GL_RGBA : GL_RGB;
+        GLint internalFormat = entry.channels == 4 ? GL_RGBA8 : GL_RGB8;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, levelWidth(entry, level), levelHeight(entry, level), 0, format, GL_UNSIGNED_BYTE, levelPixels(entry, level));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        entry.residentLevel = level;
+        mResidentBytes += levelBytes(entry, level);
+    }
+
+    // Expects the texture to be bound to GL_TEXTURE_2D
+    void applyLevelClamp(const Entry &entry)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.residentLevel);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.minLod);
+    }
+
+    // Drops the finest level of the best eviction candidate other than 'keep'; false if nothing can go
+    bool evictOne(GLuint keep)
+    {
+        std::map<GLuint, Entry>::iterator victim = mEntries.end();
+        for (std::map<GLuint, Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+        {
+            const Entry &entry = it->second;
+            if (it->first == keep || entry.residentLevel >= entry.floorLevel)
+                continue;
+
+            // Textures used this frame only give up levels they did not ask for
+            if (entry.lastUsedFrame == mFrame && entry.residentLevel >= entry.wantedLevel)
+                continue;
+
+            if (victim == mEntries.end() || entry.lastUsedFrame < victim->second.lastUsedFrame)
+                victim = it;
+        }
+
+        if (victim == mEntries.end())
+            return false;
+
+        Entry &entry = victim->second;
+        int level = entry.residentLevel;
+        entry.residentLevel = level + 1;
+        entry.minLod = 0.0f;
+
+        glBindTexture(GL_TEXTURE_2D, victim->first);
+        applyLevelClamp(entry);
+        // Re-specifying the level as empty lets the driver release its storage
+        glTexImage2D(GL_TEXTURE_2D, level, entry.channels == 4 ? GL_RGBA8 : GL_RGB8, 0, 0, 0, entry.channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+        mResidentBytes -= levelBytes(entry, level);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,137 @@
+/* Scene-wide buffer of per-object model matrices.
+ *
+ * Every object gets a slot in one uniform buffer, and a draw selects its
+ * matrix with an index uniform, so the vertex shader does one model
+ * transform per vertex whatever the object count:
+ *
+ *     layout (std140) uniform Transforms
+ *     {
+ *         mat4 models[256];
+ *     };
+ *     uniform int objectIndex;
+ *     ...
+ *     gl_Position = viewProjection * models[objectIndex] * vec4(aPos, 1.0);
+ *
+ * Set() compares against the CPU copy and only marks slots whose matrix
+ * changed; Upload() sends the dirty range with one glBufferSubData, so a
+ * static scene uploads nothing after its first frame. The capacity fits the
+ * 16 KB uniform block size every GL 3.1+ implementation guarantees.
+ */
+
+#ifndef TRANSFORM_BUFFER_H
+#define TRANSFORM_BUFFER_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Must match the array length in the shader's Transforms block
+const size_t TRANSFORM_BUFFER_CAPACITY = 256;
+const GLuint TRANSFORM_BUFFER_BINDING = 2;
+
+
+class TransformBuffer
+{
+public:
+    explicit TransformBuffer(GLuint binding = TRANSFORM_BUFFER_BINDING)
+        : mBinding(binding), mBufferId(0), mDirtyBegin(0), mDirtyEnd(0)
+    {
+    }
+
+    // Reserves a slot holding 'model'; returns its index, or -1 when the buffer is full
+    int Add(const glm::mat4 &model)
+    {
+        if (mModels.size() >= TRANSFORM_BUFFER_CAPACITY)
+            return -1;
+        mModels.push_back(model);
+        markDirty(mModels.size() - 1);
+        return static_cast<int>(mModels.size() - 1);
+    }
+
+    // Replaces a slot's matrix; unchanged matrices leave the slot clean
+    void Set(int index, const glm::mat4 &model)
+    {
+        if (index < 0 || static_cast<size_t>(index) >= mModels.size())
+            return;
+        if (memcmp(&mModels[index][0][0], &model[0][0], sizeof(float) * 16) == 0)
+            return;
+        mModels[index] = model;
+        markDirty(index);
+    }
+
+    const glm::mat4& Get(int index) const { return mModels[index]; }
+    size_t GetCount() const { return mModels.size(); }
+
+    // Sends the changed slots to the GPU and binds the buffer to its binding point
+    void Upload()
+    {
+        if (!mBufferId)
+        {
+            glGenBuffers(1, &mBufferId);
+            glBindBuffer(GL_UNIFORM_BUFFER, mBufferId);
+            glBufferData(GL_UNIFORM_BUFFER, TRANSFORM_BUFFER_CAPACITY * MATRIX_BYTES, NULL, GL_DYNAMIC_DRAW);
+        }
+        glBindBufferBase(GL_UNIFORM_BUFFER, mBinding, mBufferId);
+
+        if (mDirtyBegin < mDirtyEnd)
+        {
+            // glm::mat4 may be padded or aligned by GLM build options; pack the range tightly
+            std::vector<float> staging((mDirtyEnd - mDirtyBegin) * 16);
+            for (size_t i = mDirtyBegin; i < mDirtyEnd; ++i)
+                memcpy(&staging[(i - mDirtyBegin) * 16], &mModels[i][0][0], MATRIX_BYTES);
+
+            glBindBuffer(GL_UNIFORM_BUFFER, mBufferId);
+            glBufferSubData(GL_UNIFORM_BUFFER, mDirtyBegin * MATRIX_BYTES, staging.size() * sizeof(float), &staging[0]);
+            mDirtyBegin = mDirtyEnd = 0;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Points 'blockName' of 'programId' at this buffer's binding
+    bool AttachTo(GLuint programId, const char *blockName) const
+    {
+        const GLuint blockIndex = glGetUniformBlockIndex(programId, blockName);
+        if (blockIndex == GL_INVALID_INDEX)
+            return false;
+        glUniformBlockBinding(programId, blockIndex, mBinding);
+        return true;
+    }
+
+    void Destroy()
+    {
+        if (mBufferId)
+            glDeleteBuffers(1, &mBufferId);
+        mBufferId = 0;
+        mModels.clear();
+        mDirtyBegin = mDirtyEnd = 0;
+    }
+
+private:
+    static const size_t MATRIX_BYTES = 16 * sizeof(float);
+
+    GLuint mBinding;
+    GLuint mBufferId;
+    std::vector<glm::mat4> mModels;
+    size_t mDirtyBegin;     // half-open range of slots changed since the last Upload()
+    size_t mDirtyEnd;
+
+    void markDirty(size_t index)
+    {
+        if (mDirtyBegin == mDirtyEnd)
+        {
+            mDirtyBegin = index;
+            mDirtyEnd = index + 1;
+            return;
+        }
+        if (index < mDirtyBegin)
+            mDirtyBegin = index;
+        if (index + 1 > mDirtyEnd)
+            mDirtyEnd = index + 1;
+    }
+};
+
+#endif
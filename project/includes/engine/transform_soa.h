@@ -0,0 +1,310 @@
+/* Object transforms as position/rotation/scale arrays, composed in batches.
+ *
+ * glm::translate(...) * glm::rotate(...) * glm::scale(...) costs three full
+ * 4x4 multiplies (and a trig pair inside rotate) per object. The product
+ * only has twelve interesting values, though: the rotation matrix of the
+ * quaternion with each column multiplied by its scale, and the position.
+ * TransformSoA keeps every component in its own array, so SSE composes four
+ * objects per instruction and AVX eight, then transposes the columns back
+ * into glm::mat4 layout:
+ *
+ *     TransformSoA transforms;
+ *     transforms.Add(position, glm::angleAxis(angle, axis), scale);
+ *     ...
+ *     transforms.Compose(&models[0]);     // 64 bytes per object, ready for glBufferSubData
+ *
+ * Rotations must be unit quaternions. Compose() picks the widest version the
+ * CPU supports; the others stay public for comparisons. All of them give
+ * the same result as glm::mat4_cast up to rounding.
+ */
+
+#ifndef TRANSFORM_SOA_H
+#define TRANSFORM_SOA_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_SOA_SSE 1
+#endif
+
+#ifdef TRANSFORM_SOA_SSE
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TRANSFORM_SOA_TARGET_AVX
+#else
+#define TRANSFORM_SOA_TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+// Which implementation Compose() uses on this CPU
+enum TransformSimdLevel
+{
+    TRANSFORM_SIMD_SCALAR,
+    TRANSFORM_SIMD_SSE,
+    TRANSFORM_SIMD_AVX
+};
+
+
+namespace transform_soa
+{
+#ifdef TRANSFORM_SOA_SSE
+    inline bool cpuHasAvx()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+        return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx") != 0;
+#endif
+    }
+
+    // Rows in, columns out: row r of the result is lane r of every input
+    TRANSFORM_SOA_TARGET_AVX inline void transpose8(__m256 rows[8])
+    {
+        const __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+        const __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+        const __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+        const __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+        const __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+        const __m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+        const __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+        const __m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+        const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+        rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+#endif
+}
+
+
+class TransformSoA
+{
+public:
+    TransformSoA() : mLevel(TRANSFORM_SIMD_SCALAR)
+    {
+#ifdef TRANSFORM_SOA_SSE
+        mLevel = transform_soa::cpuHasAvx() ? TRANSFORM_SIMD_AVX : TRANSFORM_SIMD_SSE;
+#endif
+    }
+
+    // Index of the new object
+    size_t Add(const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale)
+    {
+        for (int i = 0; i < COMPONENT_COUNT; ++i)
+            mComponents[i].push_back(0.0f);
+        const size_t index = Size() - 1;
+        Set(index, position, rotation, scale);
+        return index;
+    }
+
+    void Set(size_t index, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale)
+    {
+        mComponents[POSITION_X][index] = position.x;
+        mComponents[POSITION_Y][index] = position.y;
+        mComponents[POSITION_Z][index] = position.z;
+        mComponents[ROTATION_X][index] = rotation.x;
+        mComponents[ROTATION_Y][index] = rotation.y;
+        mComponents[ROTATION_Z][index] = rotation.z;
+        mComponents[ROTATION_W][index] = rotation.w;
+        mComponents[SCALE_X][index] = scale.x;
+        mComponents[SCALE_Y][index] = scale.y;
+        mComponents[SCALE_Z][index] = scale.z;
+    }
+
+    void SetPosition(size_t index, const glm::vec3 &position)
+    {
+        mComponents[POSITION_X][index] = position.x;
+        mComponents[POSITION_Y][index] = position.y;
+        mComponents[POSITION_Z][index] = position.z;
+    }
+
+    void Clear()
+    {
+        for (int i = 0; i < COMPONENT_COUNT; ++i)
+            mComponents[i].clear();
+    }
+
+    size_t Size() const { return mComponents[0].size(); }
+    TransformSimdLevel GetLevel() const { return mLevel; }
+
+    // Writes the model matrix of every object, T * R * S, to 'out' (Size() matrices)
+    void Compose(glm::mat4 *out) const
+    {
+#ifdef TRANSFORM_SOA_SSE
+        if (mLevel == TRANSFORM_SIMD_AVX)
+        {
+            ComposeAvx(out);
+            return;
+        }
+        ComposeSse(out);
+#else
+        ComposeScalar(out);
+#endif
+    }
+
+    void ComposeScalar(glm::mat4 *out, size_t first = 0) const
+    {
+        for (size_t i = first; i < Size(); ++i)
+        {
+            const float x = mComponents[ROTATION_X][i], y = mComponents[ROTATION_Y][i];
+            const float z = mComponents[ROTATION_Z][i], w = mComponents[ROTATION_W][i];
+            const float sx = mComponents[SCALE_X][i], sy = mComponents[SCALE_Y][i], sz = mComponents[SCALE_Z][i];
+
+            glm::mat4 &m = out[i];
+            m[0] = glm::vec4((1.0f - 2.0f * (y * y + z * z)) * sx, 2.0f * (x * y + w * z) * sx, 2.0f * (x * z - w * y) * sx, 0.0f);
+            m[1] = glm::vec4(2.0f * (x * y - w * z) * sy, (1.0f - 2.0f * (x * x + z * z)) * sy, 2.0f * (y * z + w * x) * sy, 0.0f);
+            m[2] = glm::vec4(2.0f * (x * z + w * y) * sz, 2.0f * (y * z - w * x) * sz, (1.0f - 2.0f * (x * x + y * y)) * sz, 0.0f);
+            m[3] = glm::vec4(mComponents[POSITION_X][i], mComponents[POSITION_Y][i], mComponents[POSITION_Z][i], 1.0f);
+        }
+    }
+
+#ifdef TRANSFORM_SOA_SSE
+    void ComposeSse(glm::mat4 *out) const
+    {
+        const size_t count = Size() & ~static_cast<size_t>(3);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 zero = _mm_setzero_ps();
+        for (size_t i = 0; i < count; i += 4)
+        {
+            const __m128 x = _mm_loadu_ps(&mComponents[ROTATION_X][i]);
+            const __m128 y = _mm_loadu_ps(&mComponents[ROTATION_Y][i]);
+            const __m128 z = _mm_loadu_ps(&mComponents[ROTATION_Z][i]);
+            const __m128 w = _mm_loadu_ps(&mComponents[ROTATION_W][i]);
+            const __m128 sx = _mm_loadu_ps(&mComponents[SCALE_X][i]);
+            const __m128 sy = _mm_loadu_ps(&mComponents[SCALE_Y][i]);
+            const __m128 sz = _mm_loadu_ps(&mComponents[SCALE_Z][i]);
+
+            // Doubled products shared by the nine rotation terms
+            const __m128 x2 = _mm_mul_ps(x, two), y2 = _mm_mul_ps(y, two), z2 = _mm_mul_ps(z, two);
+            const __m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+            const __m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+            const __m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+            __m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+            __m128 c0y = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+            __m128 c0z = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+            __m128 c0w = zero;
+            __m128 c1x = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+            __m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+            __m128 c1z = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+            __m128 c1w = zero;
+            __m128 c2x = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+            __m128 c2y = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+            __m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+            __m128 c2w = zero;
+            __m128 c3x = _mm_loadu_ps(&mComponents[POSITION_X][i]);
+            __m128 c3y = _mm_loadu_ps(&mComponents[POSITION_Y][i]);
+            __m128 c3z = _mm_loadu_ps(&mComponents[POSITION_Z][i]);
+            __m128 c3w = one;
+
+            // Four objects per column; transpose into one column per object
+            _MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+            _MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+            _MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+            _MM_TRANSPOSE4_PS(c3x, c3y, c3z, c3w);
+            const __m128 columns[4][4] =
+            {
+                { c0x, c1x, c2x, c3x }, { c0y, c1y, c2y, c3y }, { c0z, c1z, c2z, c3z }, { c0w, c1w, c2w, c3w }
+            };
+            float *target = &out[i][0][0];
+            for (int object = 0; object < 4; ++object)
+                for (int column = 0; column < 4; ++column)
+                    _mm_storeu_ps(target + object * 16 + column * 4, columns[object][column]);
+        }
+        ComposeScalar(out, count);
+    }
+
+    TRANSFORM_SOA_TARGET_AVX void ComposeAvx(glm::mat4 *out) const
+    {
+        const size_t count = Size() & ~static_cast<size_t>(7);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 two = _mm256_set1_ps(2.0f);
+        const __m256 zero = _mm256_setzero_ps();
+        for (size_t i = 0; i < count; i += 8)
+        {
+            const __m256 x = _mm256_loadu_ps(&mComponents[ROTATION_X][i]);
+            const __m256 y = _mm256_loadu_ps(&mComponents[ROTATION_Y][i]);
+            const __m256 z = _mm256_loadu_ps(&mComponents[ROTATION_Z][i]);
+            const __m256 w = _mm256_loadu_ps(&mComponents[ROTATION_W][i]);
+            const __m256 sx = _mm256_loadu_ps(&mComponents[SCALE_X][i]);
+            const __m256 sy = _mm256_loadu_ps(&mComponents[SCALE_Y][i]);
+            const __m256 sz = _mm256_loadu_ps(&mComponents[SCALE_Z][i]);
+
+            const __m256 x2 = _mm256_mul_ps(x, two), y2 = _mm256_mul_ps(y, two), z2 = _mm256_mul_ps(z, two);
+            const __m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+            const __m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+            const __m256 wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+
+            // Columns 0-1 and 2-3 of eight objects, one matrix half per row after the transpose
+            __m256 low[8] =
+            {
+                _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx),
+                _mm256_mul_ps(_mm256_add_ps(xy, wz), sx),
+                _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx),
+                zero,
+                _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy),
+                _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy),
+                _mm256_mul_ps(_mm256_add_ps(yz, wx), sy),
+                zero
+            };
+            __m256 high[8] =
+            {
+                _mm256_mul_ps(_mm256_add_ps(xz, wy), sz),
+                _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz),
+                _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz),
+                zero,
+                _mm256_loadu_ps(&mComponents[POSITION_X][i]),
+                _mm256_loadu_ps(&mComponents[POSITION_Y][i]),
+                _mm256_loadu_ps(&mComponents[POSITION_Z][i]),
+                one
+            };
+            transform_soa::transpose8(low);
+            transform_soa::transpose8(high);
+
+            float *target = &out[i][0][0];
+            for (int object = 0; object < 8; ++object)
+            {
+                _mm256_storeu_ps(target + object * 16, low[object]);
+                _mm256_storeu_ps(target + object * 16 + 8, high[object]);
+            }
+        }
+        ComposeScalar(out, count);
+    }
+#endif
+
+private:
+    enum Component
+    {
+        POSITION_X, POSITION_Y, POSITION_Z,
+        ROTATION_X, ROTATION_Y, ROTATION_Z, ROTATION_W,
+        SCALE_X, SCALE_Y, SCALE_Z,
+        COMPONENT_COUNT
+    };
+
+    std::vector<float> mComponents[COMPONENT_COUNT];
+    TransformSimdLevel mLevel;
+};
+
+#endif
@@ -0,0 +1,140 @@
+/* Worker threads kept alive between frames.
+ *
+ * Per-frame jobs such as light binning and view culling split their work
+ * into a fixed number of parts. Creating and joining a std::thread for each
+ * part every frame costs tens of microseconds per thread. That fixed cost
+ * can be as large as the work itself, so the pool creates its threads once
+ * and wakes them for each Run():
+ *
+ *     gPool.Start(3);                          // three helpers plus the caller
+ *     ...
+ *     gPool.Run(binPart, this);                // binPart(this, 0..3, 4), returns when all are done
+ *     ...
+ *     gPool.Stop();
+ *
+ * The calling thread runs part 0 itself, so Run() on a pool that was never
+ * started simply calls the task once with one worker.
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One part of a job: 'worker' goes from 0 to 'workers' - 1
+typedef void (*WorkerTask)(void *context, unsigned worker, unsigned workers);
+
+
+class WorkerPool
+{
+public:
+    WorkerPool() : mTask(NULL), mContext(NULL), mWorkers(1), mGeneration(0), mPending(0), mStopping(false)
+    {
+    }
+
+    ~WorkerPool()
+    {
+        Stop();
+    }
+
+    // Starts 'helpers' threads; does nothing when that many are already running
+    void Start(unsigned helpers)
+    {
+        if (helpers == mThreads.size())
+            return;
+        Stop();
+        mStopping = false;
+        for (unsigned i = 0; i < helpers; ++i)
+            mThreads.push_back(std::thread(&WorkerPool::workerLoop, this, i + 1, mGeneration));
+    }
+
+    // Helpers plus the calling thread
+    unsigned GetWorkerCount() const { return static_cast<unsigned>(mThreads.size()) + 1; }
+
+    // Runs every part of the task and returns once all of them finished; not reentrant
+    void Run(WorkerTask task, void *context)
+    {
+        const unsigned workers = GetWorkerCount();
+        if (workers > 1)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTask = task;
+            mContext = context;
+            mWorkers = workers;
+            mPending = workers - 1;
+            ++mGeneration;
+        }
+        mWake.notify_all();
+
+        task(context, 0, workers);
+
+        if (workers > 1)
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mDone.wait(lock, [this]() { return mPending == 0; });
+        }
+    }
+
+    // Joins the helpers; Run() then works on the calling thread alone
+    void Stop()
+    {
+        if (mThreads.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mWake.notify_all();
+        for (size_t t = 0; t < mThreads.size(); ++t)
+            mThreads[t].join();
+        mThreads.clear();
+    }
+
+private:
+    std::vector<std::thread> mThreads;
+    std::mutex mMutex;
+    std::condition_variable mWake;      // a new generation or a stop request
+    std::condition_variable mDone;      // the last helper of a generation finished
+    WorkerTask mTask;
+    void *mContext;
+    unsigned mWorkers;
+    unsigned mGeneration;
+    unsigned mPending;
+    bool mStopping;
+
+    // 'seen' is the generation at Start(), so a restarted pool does not rerun the last task
+    void workerLoop(unsigned worker, unsigned seen)
+    {
+        for (;;)
+        {
+            WorkerTask task;
+            void *context;
+            unsigned workers;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [this, seen]() { return mStopping || mGeneration != seen; });
+                if (mStopping)
+                    return;
+                seen = mGeneration;
+                task = mTask;
+                context = mContext;
+                workers = mWorkers;
+            }
+
+            task(context, worker, workers);
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (--mPending == 0)
+                mDone.notify_one();
+        }
+    }
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+};
+
+#endif
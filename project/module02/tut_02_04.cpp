@@ -2,6 +2,7 @@
 #include <cstdlib>          // EXIT_FAILURE
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
+#include <engine/program_builder.h> // Shader builds over the program binary cache
 
 using namespace std; // Uses the standard namespace
 
@@ -26,6 +27,8 @@ struct GLMesh
 GLFWwindow* gWindow = nullptr;
 // Triangle mesh data
 GLMesh gMesh;
+// Linked program binaries from earlier runs
+ProgramCache gProgramCache;
 // Shader program
 GLuint gProgramId;
 }
@@ -222,26 +225,8 @@ void UDestroyMesh(GLMesh &mesh)
 // Implements the UCreateShaders function
 void UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId)
 {
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile both shaders
-    glCompileShader(vertexShaderId);
-    glCompileShader(fragmentShaderId);
-
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-
-    glLinkProgram(programId);
+    // Compiles and links the program, or reuses its binary from an earlier run
+    BuildProgram(vtxShaderSource, fragShaderSource, programId, &gProgramCache);
 }
 
 
@@ -2,6 +2,9 @@
 #include <cstdlib>              // EXIT_FAILURE
 #include <GL/glew.h>            // GLEW library
 #include <GLFW/glfw3.h>         // GLFW library
+#include <engine/program_builder.h> // Shader builds over the program binary cache
+#include <engine/transform_soa.h> // Batched model matrix composition
+#include <engine/ray_picker.h> // Click-to-select
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -38,6 +41,8 @@ struct GLMesh
 GLFWwindow* gWindow = nullptr;
 // Triangle mesh data
 GLMesh gMesh;
+// Linked program binaries from earlier runs
+ProgramCache gProgramCache;
 // Shader program
 GLuint gProgramId;
 
@@ -51,6 +56,21 @@ bool gFirstMouse = true;
 float gDeltaTime = 0.0f; // time between current frame and last frame
 float gLastFrame = 0.0f;
 
+// Grid of copies of the mesh
+const int GRID_ROWS = 1;
+const int GRID_COLUMNS = 1;
+const int GRID_LEVELS = 1;
+const glm::vec3 GRID_SPACING(10.0f, 10.0f, 10.0f);
+// Model matrices of the grid; it never moves, so they are composed once
+std::vector<glm::mat4> gGridModels;
+
+// Click-to-select: one object per grid cell, ids are gGridModels indices
+RayPicker gPicker;
+int gPickMesh = -1;
+glm::mat4 gViewProjection(1.0f); // of the last frame drawn
+bool gIsPicking = false; // left button held: pick every frame
+int gSelectedObject = -1;
+
 }
 
 /* User-defined Function prototypes to:
@@ -67,6 +87,8 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void UCreateMesh(GLMesh &mesh);
 void UDestroyMesh(GLMesh &mesh);
 void URender();
+void UCreateGrid();
+void UPick();
 bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId);
 void UDestroyShaderProgram(GLuint programId);
 
@@ -116,6 +138,9 @@ int main(int argc, char* argv[])
     if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
         return EXIT_FAILURE;
 
+    // Compose the grid's model matrices
+    UCreateGrid();
+
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
@@ -267,10 +292,10 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     {
         case GLFW_MOUSE_BUTTON_LEFT:
         {
-            if (action == GLFW_PRESS)
-                cout << "Left mouse button pressed" << endl;
-            else
-                cout << "Left mouse button released" << endl;
+            // Selects what is under the cursor, and keeps picking while the button is held
+            gIsPicking = action == GLFW_PRESS;
+            if (gIsPicking)
+                UPick();
         }
         break;
 
@@ -302,14 +327,6 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 // Function called to render a frame
 void URender()
 {
-    const int nrows = 1;
-    const int ncols = 1;
-    const int nlevels = 1;
-
-    const float xsize = 10.0f;
-    const float ysize = 10.0f;
-    const float zsize = 10.0f;
-
     // Enable z-depth
     glEnable(GL_DEPTH_TEST);
     
@@ -323,6 +340,11 @@ void URender()
     // Creates a perspective projection
     glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
+    // Picks see the scene as it was drawn
+    gViewProjection = projection * view;
+    if (gIsPicking)
+        UPick();
+
     // Set the shader to be used
     glUseProgram(gProgramId);
 
@@ -337,28 +359,12 @@ void URender()
     // Activate the VBOs contained within the mesh's VAO
     glBindVertexArray(gMesh.vao);
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-    // 2. Rotates shape by 15 degrees in the x axis
-    glm::mat4 rotation = glm::rotate(45.0f, glm::vec3(1.0, 1.0f, 1.0f));
-
-    for (int i = 0; i < nrows; ++i)
+    for (size_t i = 0; i < gGridModels.size(); ++i)
     {
-        for (int j = 0; j < ncols; ++j)
-        {
-            for (int k = 0; k < nlevels; ++k)
-            {
-                glm::vec3 location = glm::vec3(i * xsize, j * ysize, k * zsize);
-                // 3. Place object at the origin
-                glm::mat4 translation = glm::translate(location);
-                // Model matrix: transformations are applied right-to-left order
-                glm::mat4 model = translation * rotation * scale;
-                glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-            
-                // Draws the triangles
-                glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
-            }
-        }
+        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(gGridModels[i]));
+
+        // Draws the triangles
+        glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
     }
 
     // Deactivate the Vertex Array Object
@@ -369,6 +375,49 @@ void URender()
 }
 
 
+// Composes the model matrix of every grid cell in one batch
+void UCreateGrid()
+{
+    // Scaled by 2, rotated about (1, 1, 1), then placed at its grid cell
+    const glm::quat rotation = glm::angleAxis(45.0f, glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
+    const glm::vec3 scale(2.0f, 2.0f, 2.0f);
+
+    TransformSoA transforms;
+    for (int i = 0; i < GRID_ROWS; ++i)
+        for (int j = 0; j < GRID_COLUMNS; ++j)
+            for (int k = 0; k < GRID_LEVELS; ++k)
+                transforms.Add(glm::vec3(i, j, k) * GRID_SPACING, rotation, scale);
+
+    gGridModels.resize(transforms.Size());
+    transforms.Compose(&gGridModels[0]);
+
+    // The grid never moves, so the picker's object level is built once too
+    for (size_t i = 0; i < gGridModels.size(); ++i)
+        gPicker.AddObject(gPickMesh, gGridModels[i]);
+}
+
+
+// Selects the grid cell under the cursor; the cursor is captured for the camera, so that is the center of the window
+void UPick()
+{
+    double cursorX = WINDOW_WIDTH / 2.0, cursorY = WINDOW_HEIGHT / 2.0;
+    if (glfwGetInputMode(gWindow, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+        glfwGetCursorPos(gWindow, &cursorX, &cursorY);
+
+    PickHit hit;
+    gPicker.Pick(gViewProjection, cursorX, cursorY, WINDOW_WIDTH, WINDOW_HEIGHT, hit);
+    if (hit.object == gSelectedObject)
+        return;
+
+    gSelectedObject = hit.object;
+    if (hit.object < 0)
+        cout << "INFO: nothing selected" << endl;
+    else
+        cout << "INFO: selected grid cell " << hit.object << " at (" << hit.point.x << ", "
+             << hit.point.y << ", " << hit.point.z << ")" << endl;
+}
+
+
 // Implements the UCreateMesh function
 void UCreateMesh(GLMesh &mesh)
 {
@@ -423,6 +472,9 @@ void UCreateMesh(GLMesh &mesh)
 
     mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor));
 
+    // Model-space triangles for picking; UCreateGrid places them
+    gPickMesh = gPicker.AddMesh(verts, floatsPerVertex + floatsPerColor, mesh.nVertices);
+
     glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
     glBindVertexArray(mesh.vao);
 
@@ -453,58 +505,9 @@ void UDestroyMesh(GLMesh &mesh)
 // Implements the UCreateShaders function
 bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
+    // Compiles and links the program, or reuses its binary from an earlier run
+    if (!BuildProgram(vtxShaderSource, fragShaderSource, programId, &gProgramCache))
         return false;
-    }
-
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
-
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
 
     glUseProgram(programId);    // Uses the shader program
 
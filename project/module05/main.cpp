@@ -3,7 +3,6 @@
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #include <stb_image.h>      // Image loading Utility functions
-#include <fstream>
 #include <sstream>
 
 // GLM Math Header inclusions
@@ -15,6 +14,16 @@
 #define STB_IMAGE_IMPLEMENTATION   
 #include "stb_image.h"
 
+#include <engine/texture_streamer.h>  // Mip streaming under a VRAM budget
+#include <engine/sampler_cache.h>     // Immutable texture storage helper
+#include <engine/texture_registry.h>  // Shares textures loaded from identical files
+#include <engine/program_builder.h>   // Shader builds over the program binary cache
+#include <engine/program_reflection.h> // Typed uniform handles with a shadow copy
+#include <engine/transform_buffer.h>   // One model matrix per object in a uniform buffer
+#include <engine/lightmap_baker.h>     // Static lighting baked once on the CPU
+#include <engine/quaternion_camera.h>  // Camera matrices rebuilt only when it moves
+#include <engine/scene_graph.h>        // Parent/child transforms, only dirty subtrees recomputed
+#include <engine/async_logger.h>       // Errors queued for a background writer thread
 
 // Vertex Shader Source Code
 const GLchar* vertexShaderSource = R"(
@@ -24,23 +33,26 @@ const GLchar* vertexShaderSource = R"(
 layout(location = 0) in vec3 aPos;      // Position attribute
 layout(location = 1) in vec3 aColor;    // Color attribute
 layout(location = 2) in vec2 aTexCoord; // Texture coordinate attribute
+layout(location = 3) in vec2 aLightmapCoord; // Lightmap coordinate attribute, laid out by the baker
 
 out vec3 vertexColor; // Output variable to fragment shader
 out vec2 TexCoord;    // Output variable for texture coordinates
+out vec2 LightmapCoord; // Output variable for lightmap coordinates
 
-uniform mat4 bookModel;   // Model matrix from application
-uniform mat4 penModel;   // Model matrix from application
-uniform mat4 cupModel;   // Model matrix from application
-uniform mat4 glassesModel;   // Model matrix from application
-uniform mat4 view;    // View matrix from application
-uniform mat4 projection; // Projection matrix from application
+// Model matrices of every object in the scene, filled by TransformBuffer
+layout(std140) uniform Transforms {
+    mat4 models[256];
+};
+uniform int objectIndex;       // Slot of the object being drawn
+uniform mat4 viewProjection;   // Projection * view from application
 
 void main() {
-    // Combine matrices to transform the vertex position
-    gl_Position = projection * view * bookModel * penModel * cupModel * glassesModel *vec4(aPos, 1.0);
+    // Transform the vertex position by its object's model matrix, then the camera
+    gl_Position = viewProjection * models[objectIndex] * vec4(aPos, 1.0);
 
     vertexColor = aColor; // Pass color to fragment shader
     TexCoord = aTexCoord; // Pass texture coordinates to fragment shader
+    LightmapCoord = aLightmapCoord; // Pass lightmap coordinates to fragment shader
 }
 )";
 
@@ -50,6 +62,7 @@ const GLchar* fragmentShaderSource = R"(
 
 in vec3 vertexColor; // Input variable from vertex shader
 in vec2 TexCoord;    // Input variable for texture coordinates
+in vec2 LightmapCoord; // Input variable for lightmap coordinates
 
 out vec4 FragColor;  // Output variable: final color of the fragment
 
@@ -57,6 +70,7 @@ uniform sampler2D textureSampler1; // Texture sampler
 uniform sampler2D textureSampler2; // Texture sampler
 uniform sampler2D textureSampler3; // Texture sampler
 uniform sampler2D textureSampler4; // Texture sampler
+uniform sampler2D lightmapSampler; // Baked light reaching the surface
 
 void main() {
     // Sample the texture using the texture coordinates
@@ -65,6 +79,9 @@ void main() {
     // Combine the texture color with the interpolated vertex color
     vec4 finalColor = textureColor * vec4(vertexColor, 1.0);
 
+    // Static lighting is one fetch instead of shading every light
+    finalColor.rgb *= texture(lightmapSampler, LightmapCoord).rgb;
+
     // Output the final color of the fragment
     FragColor = finalColor;
 }
@@ -72,16 +89,36 @@ void main() {
 
 //shader program
 GLuint gProgramId = 0;
+// linked program binaries from earlier runs
+ProgramCache gProgramCache;
+// reflected uniforms and inputs of the shader program
+ProgramReflection gProgramReflection;
+// model matrices of all objects, indexed per draw
+TransformBuffer gTransforms;
+// object placement; the glasses are a child of the book
+SceneGraph gScene;
+// writes error_log.txt (and stderr) off the render thread
+AsyncLogger gLog;
 //texture id
 GLuint bookTextureId = 0;
 GLuint penTextureId = 0;
 GLuint glassesTextureId = 0;
 GLuint cupTextureId = 0;
+// streams texture mips in and out under a VRAM budget
+TextureStreamer gTextureStreamer;
+// shares streamed textures by path and content
+TextureRegistry gTextureRegistry;
+// bakes the desk's static lighting, or loads it from an earlier bake
+LightmapBaker gLightmapBaker;
+const char* const lightmapPath = "desk_lightmap.lmap";
+GLuint lightmapTextureId = 0;
+const GLuint lightmapTextureUnit = 4;
 
 GLuint bookVAO, bookVBO, bookEBO;
 GLuint penVAO, penVBO, penEBO;
 GLuint glassesVAO, glassesVBO, glassesEBO;
 GLuint cupVAO, cupVBO, cupEBO;
+GLuint bookLightmapVBO, penLightmapVBO, glassesLightmapVBO, cupLightmapVBO;
 
 float windowWidth = 800;
 float windowHeight = 600;
@@ -303,20 +340,9 @@ GLushort penIndices[] = {
 const GLsizei penVerticesSize = sizeof(penVertices);
 const GLsizei penIndicesSize = sizeof(penIndices);
 
-// Function to log error messages to a file
+// Function to log error messages to a file; queues the line, so it is cheap even when repeated every frame
 void LogError(const std::string& errorMessage) {
-    std::ofstream errorLog("error_log.txt", std::ios::app); // Opens log file for appending
-    if (errorLog.is_open()) {
-        errorLog << errorMessage << std::endl;
-        errorLog.close();
-    }
-    else {
-        // If unable to open log file, output to console
-        std::cerr << "Error: Unable to open log file." << std::endl;
-        
-    }
-
-    std::cerr << errorMessage << std::endl;
+    gLog.Log(LOG_ERROR, errorMessage);
 }
 
 void LogError(GLuint shader, const std::string& type) {
@@ -462,15 +488,19 @@ bool createTexture(const char* filename, GLuint& textureId) {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+        // Immutable storage sized for the full mip chain
         if (channels == 3) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+            AllocateTextureStorage(GL_RGB8, width, height);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, image);
         }
         else if (channels == 4) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+            AllocateTextureStorage(GL_RGBA8, width, height);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, image);
         }
         else {
             std::cout << "Not implemented to handle image with " << channels << " channels" << std::endl;
             stbi_image_free(image);
+            glDeleteTextures(1, &textureId);
             return false;
         }
 
@@ -613,19 +643,93 @@ glm::mat4 initModleMatrixs() {
     return  createModelMatrix(position, rotationAxis, rotationAngle, scale);
 }
 
+// Registry load/destroy functions for textures owned by the streamer
+bool loadStreamedTexture(const char* filename, GLuint& textureId) {
+    return gTextureStreamer.Load(filename, textureId);
+}
+
+void destroyStreamedTexture(GLuint textureId) {
+    gTextureStreamer.Release(textureId);
+}
+
+// Levels stream in and out, so the registry asks for the current size
+size_t streamedTextureBytes(GLuint textureId) {
+    return gTextureStreamer.GetResidentBytes(textureId);
+}
+
+// Only the coarse mips are uploaded here; the rest stream in from the render loop
 void loadTextures() {
-    if (!createTexture("..\\book.png", bookTextureId)) {
+    if (!gTextureRegistry.Acquire("..\\book.png", bookTextureId, loadStreamedTexture, destroyStreamedTexture, streamedTextureBytes)) {
         std::cerr << "failed to load book texture" << std::endl;
     }
-    if (!createTexture("..\\cup.png", cupTextureId)) {
+    if (!gTextureRegistry.Acquire("..\\cup.png", cupTextureId, loadStreamedTexture, destroyStreamedTexture, streamedTextureBytes)) {
         std::cerr << "failed to load cup texture" << std::endl;
     }
-    if (!createTexture("..\\glasses.png", glassesTextureId)) {
+    if (!gTextureRegistry.Acquire("..\\glasses.png", glassesTextureId, loadStreamedTexture, destroyStreamedTexture, streamedTextureBytes)) {
         std::cerr << "failed to load glasses texture" << std::endl;
     }
-    if (!createTexture("..\\pen.png", penTextureId)) {
+    if (!gTextureRegistry.Acquire("..\\pen.png", penTextureId, loadStreamedTexture, destroyStreamedTexture, streamedTextureBytes)) {
         std::cerr << "failed to load pen texture" << std::endl;
     }
+    std::cout << "Resident texture memory: " << gTextureRegistry.GetResidentBytes() << " bytes in "
+              << gTextureRegistry.GetTextureCount() << " textures" << std::endl;
+}
+
+void releaseTextures() {
+    gTextureRegistry.Release(bookTextureId);
+    gTextureRegistry.Release(cupTextureId);
+    gTextureRegistry.Release(glassesTextureId);
+    gTextureRegistry.Release(penTextureId);
+}
+
+// Adds the baker's lightmap coordinates to an object's VAO as attribute 3
+void setupLightmapCoords(GLuint VAO, GLuint& VBO, const std::vector<float>& lightmapCoords) {
+    glBindVertexArray(VAO);
+
+    glGenBuffers(1, &VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * lightmapCoords.size(), lightmapCoords.data(), GL_STATIC_DRAW);
+
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (GLvoid*)0);
+    glEnableVertexAttribArray(3);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+// Bakes the desk's lighting on all cores, unless an earlier run already baked this exact scene.
+// Mesh i of the baker is book, pen, glasses, cup in that order.
+bool loadLightmap(const glm::mat4& bookModel, const glm::mat4& penModel, const glm::mat4& glassesModel, const glm::mat4& cupModel) {
+    const size_t stride = 8; // position, color, texture coordinate
+    const LightmapMesh deskMeshes[] = {
+        { bookVertices, stride, sizeof(bookVertices) / (stride * sizeof(GLfloat)), bookIndices, sizeof(bookIndices) / sizeof(GLushort), bookModel, glm::vec3(0.55f, 0.35f, 0.25f) },
+        { penVertices, stride, sizeof(penVertices) / (stride * sizeof(GLfloat)), penIndices, sizeof(penIndices) / sizeof(GLushort), penModel, glm::vec3(0.2f, 0.2f, 0.6f) },
+        { glassesVertices, stride, sizeof(glassesVertices) / (stride * sizeof(GLfloat)), glassesIndices, sizeof(glassesIndices) / sizeof(GLushort), glassesModel, glm::vec3(0.3f, 0.3f, 0.3f) },
+        { cupVertices, stride, sizeof(cupVertices) / (stride * sizeof(GLfloat)), cupIndices, sizeof(cupIndices) / sizeof(GLushort), cupModel, glm::vec3(0.85f, 0.85f, 0.8f) }
+    };
+    // A warm desk lamp above and in front of the objects
+    const BakeLight deskLights[] = {
+        { glm::vec3(1.0f, 3.0f, 2.5f), glm::vec3(1.0f, 0.95f, 0.85f), 10.0f }
+    };
+    LightmapSettings settings;
+    settings.skyColor = glm::vec3(0.15f, 0.17f, 0.2f); // dim fill so unlit faces are not black
+
+    gLightmapBaker.SetScene(deskMeshes, sizeof(deskMeshes) / sizeof(deskMeshes[0]), deskLights, sizeof(deskLights) / sizeof(deskLights[0]), settings);
+    if (!gLightmapBaker.Load(lightmapPath)) {
+        const double start = glfwGetTime();
+        if (!gLightmapBaker.Bake()) {
+            LogError("Lightmap bake failed");
+            return false;
+        }
+        std::cout << "Baked " << gLightmapBaker.GetWidth() << "x" << gLightmapBaker.GetHeight() << " lightmap in "
+                  << (glfwGetTime() - start) * 1000.0 << " ms" << std::endl;
+        if (!gLightmapBaker.Save(lightmapPath)) {
+            LogError("Could not write lightmap file");
+        }
+    }
+
+    lightmapTextureId = gLightmapBaker.CreateTexture();
+    return true;
 }
 
 void setupObject(GLuint& VAO, GLuint& VBO, GLfloat vertices[], int vertexCount) {
@@ -644,6 +748,12 @@ void setupObject(GLuint& VAO, GLuint& VBO, GLfloat vertices[], int vertexCount)
     glBindVertexArray(0);
 }
 int main() {
+    // Errors are appended to error_log.txt and echoed to stderr by the logger's thread
+    gLog.SetEchoLevel(LOG_ERROR);
+    if (!gLog.Start("error_log.txt")) {
+        std::cerr << "Error: Unable to open log file; errors go to stderr." << std::endl;
+    }
+
     // Initialize GLFW
     if (!glfwInit()) {
         std::cerr << "GLFW initialization failed" << std::endl;
@@ -673,63 +783,66 @@ int main() {
 
     glViewport(0, 0, windowWidth, windowHeight);
 
-    // Compile vertex shader
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-    glCompileShader(vertexShader);
-
-    // Compile fragment shader
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-    glCompileShader(fragmentShader);
-
-    // Link shaders into a shader program
-    gProgramId = glCreateProgram();
-    glAttachShader(gProgramId, vertexShader);
-    glAttachShader(gProgramId, fragmentShader);
-    glLinkProgram(gProgramId);
-
-    // Check if shader compilation and linking were successful
-    GLint success;
-    glGetProgramiv(gProgramId, GL_LINK_STATUS, &success);
-    if (!success) {
-        GLchar infoLog[512];
-        glGetProgramInfoLog(gProgramId, 512, nullptr, infoLog);
-        std::string errorMessage = "Shader linking error: ";
-        errorMessage += infoLog;
-        LogError(errorMessage);
+    // Compile and link the shaders, or reuse the program binary from an earlier run
+    std::string buildErrors;
+    if (!BuildProgram(vertexShaderSource, fragmentShaderSource, gProgramId, &gProgramCache, &buildErrors)) {
+        LogError("Shader program build failed: " + buildErrors);
     }
 
-    // Delete shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
     //start the shader program
     glUseProgram(gProgramId);
 
-    // Define the model, view, and projection matrices
-    glm::mat4 bookModel = glm::mat4(1.0f); // Identity matrix for the model
-    glm::mat4 penModel = glm::mat4(1.0f); // Identity matrix for the model
-    glm::mat4 glassesModel = glm::mat4(1.0f); // Identity matrix for the model
-    glm::mat4 cupModel = glm::mat4(1.0f); // Identity matrix for the model
+    // Place the objects in the scene graph: the book 2 units along X with the glasses lying on it,
+    // the pen 1 unit along -X, and the cup 2 units along -Z
+    const glm::quat noRotation(1.0f, 0.0f, 0.0f, 0.0f);
+    const int bookNode = gScene.AddNode(SCENE_GRAPH_NO_PARENT);
+    gScene.SetLocal(bookNode, glm::vec3(2.0f, 0.0f, 0.0f), noRotation, glm::vec3(1.0f));
+    const int glassesNode = gScene.AddNode(bookNode);
+    gScene.SetLocal(glassesNode, glm::vec3(0.0f, 0.6f, 0.0f), noRotation, glm::vec3(0.8f, 0.2f, 0.4f)); // flat, on the book's top face
+    const int penNode = gScene.AddNode(SCENE_GRAPH_NO_PARENT);
+    gScene.SetLocal(penNode, glm::vec3(-1.0f, 0.0f, 0.0f), noRotation, glm::vec3(1.0f));
+    const int cupNode = gScene.AddNode(SCENE_GRAPH_NO_PARENT);
+    gScene.SetLocal(cupNode, glm::vec3(0.0f, 0.0f, -2.0f), noRotation, glm::vec3(1.0f));
+    gScene.Update();
+
+    // Define the view and projection matrices
     glm::mat4 view = glm::mat4(1.0f); // Identity matrix for the view
     glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
 
-    // Get the uniform locations from the shader program
-    GLint bookModelLoc = glGetUniformLocation(gProgramId, "bookModel");
-    GLint penModelLoc = glGetUniformLocation(gProgramId, "penModel");
-    GLint glassesModelLoc = glGetUniformLocation(gProgramId, "glassesModel");
-    GLint cupModelLoc = glGetUniformLocation(gProgramId, "cupModel");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projectionLoc = glGetUniformLocation(gProgramId, "projection");
-
-    // Pass matrices to the shader
-    glUniformMatrix4fv(bookModelLoc, 1, GL_FALSE, glm::value_ptr(bookModel));
-    glUniformMatrix4fv(penModelLoc, 1, GL_FALSE, glm::value_ptr(penModel));
-    glUniformMatrix4fv(glassesModelLoc, 1, GL_FALSE, glm::value_ptr(glassesModel));
-    glUniformMatrix4fv(cupModelLoc, 1, GL_FALSE, glm::value_ptr(cupModel));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Reflect the program once, and check its inputs against the layout setupObject binds
+    if (!gProgramReflection.Reflect(gProgramId)) {
+        LogError("Program reflection is not supported by this context");
+        return EXIT_FAILURE;
+    }
+    const ExpectedInput objectInputs[] = {
+        { "aPos", 0, GL_FLOAT_VEC3 },
+        { "aColor", 1, GL_FLOAT_VEC3 },
+        { "aTexCoord", 2, GL_FLOAT_VEC2 },
+        { "aLightmapCoord", 3, GL_FLOAT_VEC2 }
+    };
+    if (!gProgramReflection.CheckInputs(objectInputs, sizeof(objectInputs) / sizeof(objectInputs[0]))) {
+        LogError("Vertex attribute layout does not match the shader inputs");
+        return EXIT_FAILURE;
+    }
+
+    // Get typed handles to the shader's uniforms
+    UniformHandle<int> objectIndexUniform = gProgramReflection.Uniform<int>("objectIndex");
+    UniformHandle<glm::mat4> viewProjectionUniform = gProgramReflection.Uniform<glm::mat4>("viewProjection");
+
+    // Give each object a slot in the transform buffer
+    if (!gTransforms.AttachTo(gProgramId, "Transforms")) {
+        LogError("Shader has no Transforms block");
+        return EXIT_FAILURE;
+    }
+    // Slot i holds the scene graph's world matrix i, so one range copy keeps them in sync
+    for (size_t i = 0; i < gScene.GetCount(); ++i) {
+        gTransforms.Add(gScene.GetWorldMatrices()[i]);
+    }
+    const int bookObject = gScene.GetIndex(bookNode);
+    const int penObject = gScene.GetIndex(penNode);
+
+    // Pass the camera matrices to the shader; they are uploaded by the next Flush()
+    viewProjectionUniform.Set(projection * view);
 
     // Set up buffers for each object
     GLuint bookVAO, bookVBO;
@@ -823,54 +936,35 @@ int main() {
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)0);
     glEnableVertexAttribArray(0);
 
-    // Load textures 
-    if (!createTexture("..\\book.png", bookTextureId)) {
-        std::cerr << "failed to load book texture" << std::endl;
-    }
-    if (!createTexture("..\\cup.png", cupTextureId)) {
-        std::cerr << "failed to load cup texture" << std::endl;
-    }
-    if (!createTexture("..\\glasses.png", glassesTextureId)) {
-        std::cerr << "failed to load glasses texture" << std::endl;
-    }
-    if (!createTexture("..\\pen.png", penTextureId)) {
-        std::cerr << "failed to load pen texture" << std::endl;
-    }
+    // Load textures
+    loadTextures();
 
     // set texture uniforms
-    glUniform1i(glGetUniformLocation(gProgramId, "textureSampler1"), 0); //book texture is bound to texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "textureSampler2"), 1); // the pen texture is bound to texture unit 1
-    glUniform1i(glGetUniformLocation(gProgramId, "textureSampler3"), 2); //  the glasses texture is bound to texture unit 2
-    glUniform1i(glGetUniformLocation(gProgramId, "textureSampler4"), 3); // the cup texture is bound to texture unit 3
-
-    // Translate the book along the X-axis by 2 units
-    bookModel = glm::translate(bookModel, glm::vec3(2.0f, 0.0f, 0.0f));
-
-    // Translate the pen along the X-axis by -2 units (opposite direction of the book)
-    penModel = glm::translate(penModel, glm::vec3(-1.0f, 0.0f, 0.0f));
+    gProgramReflection.Uniform<int>("textureSampler1").Set(0); //book texture is bound to texture unit 0
+    gProgramReflection.Uniform<int>("textureSampler2").Set(1); // the pen texture is bound to texture unit 1
+    gProgramReflection.Uniform<int>("textureSampler3").Set(2); //  the glasses texture is bound to texture unit 2
+    gProgramReflection.Uniform<int>("textureSampler4").Set(3); // the cup texture is bound to texture unit 3
 
-    // Translate the glasses along the Z-axis by 2 units
-    glassesModel = glm::translate(glassesModel, glm::vec3(0.0f, 0.0f, 2.0f));
-
-    // Translate the cup along the Z-axis by -2 units (opposite direction of the glasses)
-    cupModel = glm::translate(cupModel, glm::vec3(0.0f, 0.0f, -2.0f));
+    // The objects are placed for good; bake (or load) their lighting
+    if (!loadLightmap(gScene.GetWorld(bookNode), gScene.GetWorld(penNode), gScene.GetWorld(glassesNode), gScene.GetWorld(cupNode))) {
+        return EXIT_FAILURE;
+    }
+    setupLightmapCoords(bookVAO, bookLightmapVBO, gLightmapBaker.GetUVs(0));
+    setupLightmapCoords(penVAO, penLightmapVBO, gLightmapBaker.GetUVs(1));
+    setupLightmapCoords(glassesVAO, glassesLightmapVBO, gLightmapBaker.GetUVs(2));
+    setupLightmapCoords(cupVAO, cupLightmapVBO, gLightmapBaker.GetUVs(3));
+    gProgramReflection.Uniform<int>("lightmapSampler").Set(lightmapTextureUnit);
 
 
     // sets the camera speed
     float cameraSpeed = .005f;
-    float rotationSpeed = 1.0f;
-
-    // Define initial camera position, target, and camera up vector
-    glm::vec3 cameraPosition = glm::vec3(0.0f, 0.0f, 3.0f);
-    glm::vec3 cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+    float rotationSpeed = glm::radians(1.0f);
 
-    // Define initial Euler angles for rotation
-    float yaw = -90.0f; // Initial yaw angle (facing towards -Z axis)
-    float pitch = 0.0f; // Initial pitch angle (horizontal plane)
+    // Camera at (0, 0, 3) facing towards -Z, on the horizontal plane
+    QuaternionCamera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+    camera.SetPerspective(glm::radians(fov), aspectRatio, nearPlane, farPlane);
+    unsigned uploadedCameraRevision = camera.GetRevision() - 1; // upload on the first frame
 
- 
-   
 
     // Main render loop
     while (!glfwWindowShouldClose(window)) {
@@ -884,41 +978,61 @@ int main() {
         // Use the shader program
         glUseProgram(gProgramId);
 
-        //messing with the view materix to move camera
-        // Calculate the front vector using Euler angles
-        glm::vec3 front;
-        front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-        front.y = sin(glm::radians(pitch));
-        front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-        glm::vec3 cameraFront = glm::normalize(front);
-
+        // Move the camera; its basis and matrices are only rebuilt when it actually moved
         if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-            cameraPosition += cameraSpeed * cameraFront;
+            camera.Translate(cameraSpeed * camera.GetFront());
         }
         if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-            cameraPosition -= cameraSpeed * cameraFront;
+            camera.Translate(-cameraSpeed * camera.GetFront());
         }
         if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-            cameraPosition -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+            camera.Translate(-cameraSpeed * camera.GetRight());
         }
         if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-            cameraPosition += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+            camera.Translate(cameraSpeed * camera.GetRight());
         }
         if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
-            pitch += rotationSpeed;
+            camera.Rotate(0.0f, rotationSpeed);
         }
         if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
-            pitch -= rotationSpeed;
+            camera.Rotate(0.0f, -rotationSpeed);
         }
 
-        // Update the view matrix based on the new camera position and target
-        glm::mat4 view = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        // Send the view-projection matrix only on frames the camera changed
+        if (camera.GetRevision() != uploadedCameraRevision) {
+            viewProjectionUniform.Set(camera.GetViewProjection());
+            uploadedCameraRevision = camera.GetRevision();
+        }
+        const glm::vec3 cameraPosition = camera.GetPosition();
+
+        // Recompute only the subtrees that moved, then send the model matrices that changed
+        // (neither does any work while the scene is static)
+        if (gScene.Update() > 0) {
+            size_t first, last;
+            gScene.GetUpdatedRange(first, last);
+            for (size_t i = first; i < last; ++i) {
+                gTransforms.Set(static_cast<int>(i), gScene.GetWorldMatrices()[i]);
+            }
+        }
+        gTransforms.Upload();
+
+        // Ask for the mip level each object needs at its current distance, then stream
+        gTextureStreamer.RequestSize(bookTextureId, TextureStreamer::ProjectedSize(0.87f, glm::length(glm::vec3(gScene.GetWorld(bookNode)[3]) - cameraPosition), fov, windowHeight));
+        gTextureStreamer.RequestSize(penTextureId, TextureStreamer::ProjectedSize(0.87f, glm::length(glm::vec3(gScene.GetWorld(penNode)[3]) - cameraPosition), fov, windowHeight));
+        gTextureStreamer.Update();
+
+        // Shared by every object
+        glActiveTexture(GL_TEXTURE0 + lightmapTextureUnit);
+        glBindTexture(GL_TEXTURE_2D, lightmapTextureId);
 
         // Render book
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, bookTextureId);
 
+        // Upload only the uniforms that changed since the last draw
+        objectIndexUniform.Set(bookObject);
+        gProgramReflection.Flush();
+
         glBindVertexArray(bookVAO);
         glDrawElements(GL_TRIANGLES, bookVerticesSize, GL_UNSIGNED_SHORT, 0);
         glBindVertexArray(0);
@@ -927,6 +1041,8 @@ int main() {
         glActiveTexture(GL_TEXTURE1); // Activate texture unit 1
         glBindTexture(GL_TEXTURE_2D, penTextureId); // Bind pen texture
    
+        objectIndexUniform.Set(penObject);
+        gProgramReflection.Flush();
         glBindVertexArray(penVAO); // Bind pen VAO
        // glDrawElements(GL_TRIANGLES, penVerticesSize, GL_UNSIGNED_SHORT, 0);
         glBindVertexArray(0); // Unbind VAO
@@ -942,9 +1058,17 @@ int main() {
     glDeleteVertexArrays(1, &bookVAO);
     glDeleteBuffers(1, &bookVBO);
     glDeleteBuffers(1, &bookEBO);
+    gTransforms.Destroy();
+    glDeleteBuffers(1, &bookLightmapVBO);
+    glDeleteBuffers(1, &penLightmapVBO);
+    glDeleteBuffers(1, &glassesLightmapVBO);
+    glDeleteBuffers(1, &cupLightmapVBO);
+    glDeleteTextures(1, &lightmapTextureId);
 
     // Delete other VAOs, VBOs, textures, etc., for other objects
+    releaseTextures();
 
     glfwTerminate();
+    gLog.Stop();
     return 0;
 }
\ No newline at end of file
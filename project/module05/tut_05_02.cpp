@@ -4,6 +4,10 @@
 #include <GLFW/glfw3.h>     // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>      // Image loading Utility functions
+#include <engine/image_cache.h> // Memory-mapped loading and decoded-pixel cache
+#include <engine/sampler_cache.h> // Shared sampler objects
+#include <engine/texture_registry.h> // Shares textures loaded from identical files
+#include <engine/program_builder.h> // Shader builds over the program binary cache
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -40,6 +44,12 @@ GLFWwindow* gWindow = nullptr;
 GLMesh gMesh;
 // Texture id
 GLuint gTextureId;
+// Shared sampler objects
+SamplerCache gSamplerCache;
+// Loaded textures, shared by path and content
+TextureRegistry gTextureRegistry;
+// Linked program binaries from earlier runs
+ProgramCache gProgramCache;
 // Shader program
 GLuint gProgramId;
 }
@@ -91,26 +101,6 @@ const GLchar * fragmentShaderSource = GLSL(440,
 );
 
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char *image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
-}
-
-
 int main(int argc, char* argv[])
 {
     if (!UInitialize(argc, argv, &gWindow))
@@ -125,11 +115,12 @@ int main(int argc, char* argv[])
 
     // Load texture (relative to project's directory)
     const char * texFilename = "../../resources/textures/smiley.png";
-    if (!UCreateTexture(texFilename, gTextureId))
+    if (!gTextureRegistry.Acquire(texFilename, gTextureId, UCreateTexture, UDestroyTexture))
     {
         cout << "Failed to load texture " << texFilename << endl;
         return EXIT_FAILURE;
     }
+    cout << "INFO: Resident texture memory: " << gTextureRegistry.GetResidentBytes() << " bytes" << endl;
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
     glUseProgram(gProgramId);
     // We set the texture as texture unit 0
@@ -156,7 +147,8 @@ int main(int argc, char* argv[])
     UDestroyMesh(gMesh);
 
     // Release texture
-    UDestroyTexture(gTextureId);
+    gTextureRegistry.Release(gTextureId);
+    gSamplerCache.Clear();
 
     // Release shader program
     UDestroyShaderProgram(gProgramId);
@@ -258,6 +250,7 @@ void URender()
     // bind textures on corresponding texture units
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, gTextureId);
+    gSamplerCache.Bind(0, SamplerState(GL_REPEAT, GL_LINEAR, GL_LINEAR));
 
     // Draws the triangle
     glDrawElements(GL_TRIANGLES, gMesh.nIndices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
@@ -328,35 +321,23 @@ void UDestroyMesh(GLMesh &mesh)
 /*Generate and load the texture*/
 bool UCreateTexture(const char* filename, GLuint &textureId)
 {
-    int width, height, channels;
-    unsigned char *image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    // Maps and decodes the file, or maps the pixels an earlier run cached, already flipped
+    CachedImage image;
+    if (image.Open(filename, true))
     {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+        if (image.Channels() != 3 && image.Channels() != 4)
         {
-        	cout << "Not implemented to handle image with " << channels << " channels" << endl;
+        	cout << "Not implemented to handle image with " << image.Channels() << " channels" << endl;
         	return false;
         }
 
-		glGenerateMipmap(GL_TEXTURE_2D);
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+
+        // Immutable storage for level 0 and the cached mip chain, so there is no glGenerateMipmap.
+        // Wrapping and filtering come from the shared sampler bound with the texture.
+        UploadCachedImage(image);
 
-        stbi_image_free(image);
         glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
         return true;
@@ -369,65 +350,16 @@ bool UCreateTexture(const char* filename, GLuint &textureId)
 
 void UDestroyTexture(GLuint textureId)
 {
-    glGenTextures(1, &textureId);
+    glDeleteTextures(1, &textureId);
 }
 
 
 // Implements the UCreateShaders function
 bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
-
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-
+    // Compiles and links the program, or reuses its binary from an earlier run
+    if (!BuildProgram(vtxShaderSource, fragShaderSource, programId, &gProgramCache))
         return false;
-    }
-
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
 
     glUseProgram(programId);    // Uses the shader program
 
@@ -2,8 +2,12 @@
 #include <cstdlib>          // EXIT_FAILURE
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>      // Image loading Utility functions
+#include <engine/program_builder.h> // Batched shader builds over the program binary cache
+#include <engine/shader_permutations.h> // Shader variants selected by feature bitmask
+#include <engine/standard_shader.h> // Annotated source of those variants
+#include <engine/object_constants.h> // Per-object matrices computed on the CPU
+#include <engine/multi_view_renderer.h> // Several cameras sharing one upload
+#include <engine/program_reflection.h> // Uniform locations looked up once
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -14,11 +18,6 @@
 
 using namespace std; // Standard namespace
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
-
 // Unnamed namespace
 namespace
 {
@@ -40,9 +39,30 @@ struct GLMesh
 GLFWwindow* gWindow = nullptr;
 // Triangle mesh data
 GLMesh gMesh;
+// Linked program binaries from earlier runs
+ProgramCache gProgramCache;
+// Compiled variants of the standard shader, one per feature set in use
+ShaderPermutations gShaders(STANDARD_VERTEX_SHADER, STANDARD_FRAGMENT_SHADER, &gProgramCache);
+const unsigned CUBE_SHADER_FEATURES = SHADER_LIT;
+const unsigned LAMP_SHADER_FEATURES = 0; // flat color, no lighting
 // Shader programs
 GLuint gCubeProgramId;
 GLuint gLampProgramId;
+// Model, normal and MVP matrices of every object, refreshed once per frame
+ObjectConstantsBuffer gObjectConstants;
+enum SceneObject { CUBE_OBJECT, LAMP_OBJECT, OBJECT_COUNT };
+
+// Press V for the operator view: the fly camera plus a top-down overview inset in the top right
+// corner; both views share one upload of the objects' transforms and colors
+MultiViewRenderer gViews;
+enum ViewIndex { FLY_VIEW, OVERVIEW_VIEW, VIEW_COUNT };
+bool gIsMultiView = false;
+GLuint gCubeMultiViewProgramId;
+GLuint gLampMultiViewProgramId;
+ProgramReflection gCubeMultiViewReflection;
+UniformHandle<glm::vec3> gMultiViewLightColorUniform;
+UniformHandle<glm::vec3> gMultiViewLightPosUniform;
+const float OVERVIEW_HALF_HEIGHT = 8.0f; // world units shown above and below the center of the inset
 
 // camera
 Camera gCamera(glm::vec3(0.0f, 0.0f, 7.0f));
@@ -81,130 +101,8 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void UCreateMesh(GLMesh &mesh);
 void UDestroyMesh(GLMesh &mesh);
-bool UCreateTexture(const char* filename, GLuint &textureId);
-void UDestroyTexture(GLuint textureId);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId);
-void UDestroyShaderProgram(GLuint programId);
-
-
-/* Cube Vertex Shader Source Code*/
-const GLchar * cubeVertexShaderSource = GLSL(440,
-
-    layout (location = 0) in vec3 position; // VAP position 0 for vertex position data
-    layout (location = 1) in vec3 normal; // VAP position 1 for normals
-
-    out vec3 vertexNormal; // For outgoing normals to fragment shader
-    out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-
-    //Uniform / Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main()
-    {
-     gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-
-     vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-
-     vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-    }
-);
-
-
-/* Cube Fragment Shader Source Code*/
-const GLchar * cubeFragmentShaderSource = GLSL(440,
-
-    in vec3 vertexNormal; // For incoming normals
-    in vec3 vertexFragmentPos; // For incoming fragment position
-
-    out vec4 fragmentColor; // For outgoing cube color to the GPU
-
-    // Uniform / Global variables for object color, light color, light position, and camera/view position
-    uniform vec3 objectColor;
-    uniform vec3 lightColor;
-    uniform vec3 lightPos;
-    uniform vec3 viewPosition;
-
-    void main()
-    {
-        /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
-
-        //Calculate Ambient lighting*/
-        float ambientStrength = 0.1f; // Set ambient or global lighting strength
-        vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
-
-        //Calculate Diffuse lighting*/
-        vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-        vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-        float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-        vec3 diffuse = impact * lightColor; // Generate diffuse light color
-
-        //Calculate Specular lighting*/
-        float specularIntensity = 0.8f; // Set specular light strength
-        float highlightSize = 16.0f; // Set specular highlight size
-        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-        vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-        //Calculate specular component
-        float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-        vec3 specular = specularIntensity * specularComponent * lightColor;
-
-        // Calculate phong result
-        vec3 phong = (ambient + diffuse + specular) * objectColor;
-
-        fragmentColor = vec4(phong, 1.0f); // Send lighting results to GPU
-    }
-);
-
-
-/* Lamp Shader Source Code*/
-const GLchar * lampVertexShaderSource = GLSL(440,
-
-    layout (location = 0) in vec3 position; // VAP position 0 for vertex position data
-
-        //Uniform / Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main()
-    {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-    }
-);
-
-
-/* Fragment Shader Source Code*/
-const GLchar * lampFragmentShaderSource = GLSL(440,
-
-    out vec4 fragmentColor; // For outgoing lamp color (smaller cube) to the GPU
-
-    void main()
-    {
-        fragmentColor = vec4(1.0f); // Set color to white (1.0f,1.0f,1.0f) with alpha 1.0
-    }
-);
-
-
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char *image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
-}
+void URenderViews(const glm::mat4 *models, const glm::mat4 &view, const glm::mat4 &projection);
 
 
 int main(int argc, char* argv[])
@@ -215,12 +113,33 @@ int main(int argc, char* argv[])
     // Create the mesh
     UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
 
-    // Create the shader programs
-    if (!UCreateShaderProgram(cubeVertexShaderSource, cubeFragmentShaderSource, gCubeProgramId))
+    // Create the shader programs; both are compiled and linked as one batch
+    ProgramBuilder programs(&gProgramCache);
+    gShaders.Add(programs, CUBE_SHADER_FEATURES);
+    gShaders.Add(programs, LAMP_SHADER_FEATURES);
+    gShaders.Add(programs, CUBE_SHADER_FEATURES | SHADER_MULTI_VIEW);
+    gShaders.Add(programs, LAMP_SHADER_FEATURES | SHADER_MULTI_VIEW);
+    if (!programs.Build())
         return EXIT_FAILURE;
-
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
+    gCubeProgramId = gShaders.Get(CUBE_SHADER_FEATURES);
+    gLampProgramId = gShaders.Get(LAMP_SHADER_FEATURES);
+    gCubeMultiViewProgramId = gShaders.Get(CUBE_SHADER_FEATURES | SHADER_MULTI_VIEW);
+    gLampMultiViewProgramId = gShaders.Get(LAMP_SHADER_FEATURES | SHADER_MULTI_VIEW);
+    if (!gCubeMultiViewReflection.Reflect(gCubeMultiViewProgramId))
+    {
+        cout << "ERROR::REFLECTION::Program interface queries are not supported" << endl;
         return EXIT_FAILURE;
+    }
+    gMultiViewLightColorUniform = gCubeMultiViewReflection.Uniform<glm::vec3>("lightColor");
+    gMultiViewLightPosUniform = gCubeMultiViewReflection.Uniform<glm::vec3>("lightPos");
+
+    // Both objects are the unit cube; URender keeps their model matrices and the cameras current
+    const int cubeMaterial = gViews.AddMaterial(gObjectColor);
+    const int lampMaterial = gViews.AddMaterial(glm::vec3(1.0f)); // plain white
+    gViews.AddObject(glm::vec3(-0.5f), glm::vec3(0.5f), glm::mat4(1.0f), cubeMaterial);
+    gViews.AddObject(glm::vec3(-0.5f), glm::vec3(0.5f), glm::mat4(1.0f), lampMaterial);
+    for (int i = 0; i < VIEW_COUNT; ++i)
+        gViews.AddView(RenderView());
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -248,9 +167,10 @@ int main(int argc, char* argv[])
     // Release mesh data
     UDestroyMesh(gMesh);
 
-    // Release shader programs
-    UDestroyShaderProgram(gCubeProgramId);
-    UDestroyShaderProgram(gLampProgramId);
+    // Release shader programs and their constants
+    gShaders.Clear();
+    gObjectConstants.Destroy();
+    gViews.Destroy();
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -323,6 +243,16 @@ void UProcessInput(GLFWwindow* window)
         gCamera.ProcessKeyboard(LEFT, gDeltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
+
+    // Switch between the single view and the operator view
+    static bool isVKeyDown = false;
+    const bool vKeyPressed = glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS;
+    if (vKeyPressed && !isVKeyDown)
+    {
+        gIsMultiView = !gIsMultiView;
+        cout << "Current view: " << (gIsMultiView ? "FLY CAMERA + OVERVIEW" : "FLY CAMERA") << endl;
+    }
+    isVKeyDown = vKeyPressed;
 }
 
 
@@ -419,8 +349,11 @@ void URender()
     // Set the shader to be used
     glUseProgram(gCubeProgramId);
 
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = glm::translate(gCubePosition) * glm::scale(gCubeScale);
+    // Model matrices: transformations are applied right-to-left order
+    glm::mat4 models[OBJECT_COUNT];
+    models[CUBE_OBJECT] = glm::translate(gCubePosition) * glm::scale(gCubeScale);
+    //Transform the smaller cube used as a visual que for the light source
+    models[LAMP_OBJECT] = glm::translate(gLightPosition) * glm::scale(gLightScale);
 
     // camera/view transformation
     glm::mat4 view = gCamera.GetViewMatrix();
@@ -428,14 +361,15 @@ void URender()
     // Creates a perspective projection
     glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gCubeProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gCubeProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gCubeProgramId, "projection");
+    if (gIsMultiView)
+    {
+        URenderViews(models, view, projection);
+        return;
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Model, normal and MVP matrices of both objects in one batch; each draw binds its own
+    gObjectConstants.Update(models, OBJECT_COUNT, projection * view);
+    gObjectConstants.Bind(CUBE_OBJECT);
 
     // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
     GLint objectColorLoc = glGetUniformLocation(gCubeProgramId, "objectColor");
@@ -457,18 +391,10 @@ void URender()
     //----------------
     glUseProgram(gLampProgramId);
 
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(gLightPosition) * glm::scale(gLightScale);
-
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(gLampProgramId, "model");
-    viewLoc = glGetUniformLocation(gLampProgramId, "view");
-    projLoc = glGetUniformLocation(gLampProgramId, "projection");
+    gObjectConstants.Bind(LAMP_OBJECT);
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // The unlit permutation draws the lamp in plain white
+    glUniform3f(glGetUniformLocation(gLampProgramId, "objectColor"), 1.0f, 1.0f, 1.0f);
 
     glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
 
@@ -569,117 +495,57 @@ void UDestroyMesh(GLMesh &mesh)
 }
 
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint &textureId)
+// Draws the fly camera full window and the overview inset on top of it
+void URenderViews(const glm::mat4 *models, const glm::mat4 &view, const glm::mat4 &projection)
 {
-    int width, height, channels;
-    unsigned char *image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    for (int i = 0; i < OBJECT_COUNT; ++i)
+        gViews.SetModel(i, models[i]);
+
+    RenderView fly;
+    fly.view = view;
+    fly.projection = projection;
+    fly.position = gCamera.Position;
+    fly.viewport = glm::ivec4(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    gViews.SetView(FLY_VIEW, fly);
+
+    // Looking straight down on the cube, with -Z at the top of the inset
+    const int insetWidth = WINDOW_WIDTH / 3, insetHeight = WINDOW_HEIGHT / 3;
+    const float insetAspect = static_cast<float>(insetWidth) / insetHeight;
+    RenderView overview;
+    overview.position = gCubePosition + glm::vec3(0.0f, 20.0f, 0.0f);
+    overview.view = glm::lookAt(overview.position, gCubePosition, glm::vec3(0.0f, 0.0f, -1.0f));
+    overview.projection = glm::ortho(-OVERVIEW_HALF_HEIGHT * insetAspect, OVERVIEW_HALF_HEIGHT * insetAspect,
+                                     -OVERVIEW_HALF_HEIGHT, OVERVIEW_HALF_HEIGHT, 0.1f, 40.0f);
+    overview.viewport = glm::ivec4(WINDOW_WIDTH - insetWidth - 10, WINDOW_HEIGHT - insetHeight - 10, insetWidth, insetHeight);
+    overview.clearColor = glm::vec4(0.15f, 0.15f, 0.2f, 1.0f);
+    gViews.SetView(OVERVIEW_VIEW, overview);
+
+    // Culls both views, then uploads every visible object once however many views see it
+    gViews.Prepare();
+
+    gMultiViewLightColorUniform.Set(gLightColor);
+    gMultiViewLightPosUniform.Set(gLightPosition);
+    gCubeMultiViewReflection.Flush();
+
+    // Draw lists are sorted by material, and each material has its own program, so each
+    // view switches programs at most once per material
+    GLuint boundProgram = 0;
+    gViews.Render([&boundProgram](int, int object)
     {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+        const GLuint program = object == LAMP_OBJECT ? gLampMultiViewProgramId : gCubeMultiViewProgramId;
+        if (program != boundProgram)
         {
-        	cout << "Not implemented to handle image with " << channels << " channels" << endl;
-        	return false;
+            glUseProgram(program);
+            boundProgram = program;
         }
+        glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+    });
+    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-        return true;
-    }
-
-    // Error loading the image
-    return false;
-}
-
-
-void UDestroyTexture(GLuint textureId)
-{
-    glGenTextures(1, &textureId);
-}
-
-
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId)
-{
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
-
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
-
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
-
-    glUseProgram(programId);    // Uses the shader program
-
-    return true;
-}
-
+    // Deactivate the Vertex Array Object and shader program
+    glBindVertexArray(0);
+    glUseProgram(0);
 
-void UDestroyShaderProgram(GLuint programId)
-{
-    glDeleteProgram(programId);
+    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
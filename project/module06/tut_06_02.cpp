@@ -2,8 +2,14 @@
 #include <cstdlib>          // EXIT_FAILURE
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>      // Image loading Utility functions
+#include <engine/program_builder.h> // Batched shader builds over the program binary cache
+#include <engine/shader_permutations.h> // Shader variants selected by feature bitmask
+#include <engine/standard_shader.h> // Annotated source of those variants
+#include <engine/object_constants.h> // Per-object matrices computed on the CPU
+#include <engine/point_shadow.h> // Cube-map shadows of the lamp
+#include <engine/irradiance_probes.h> // Baked ambient light
+#include <engine/ray_picker.h> // Click-to-select
+#include <engine/program_reflection.h> // Typed uniform handles with a shadow copy
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -14,11 +20,6 @@
 
 using namespace std; // Standard namespace
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
-
 // Unnamed namespace
 namespace
 {
@@ -40,9 +41,96 @@ struct GLMesh
 GLFWwindow* gWindow = nullptr;
 // Triangle mesh data
 GLMesh gMesh;
+// Linked program binaries from earlier runs
+ProgramCache gProgramCache;
+// Compiled variants of the standard shader, one per feature set in use
+ShaderPermutations gShaders(STANDARD_VERTEX_SHADER, STANDARD_FRAGMENT_SHADER, &gProgramCache);
+const unsigned CUBE_SHADER_FEATURES = SHADER_LIT | SHADER_POINT_SHADOW | SHADER_IRRADIANCE_PROBES;
+const unsigned LAMP_SHADER_FEATURES = 0; // flat color, no lighting
 // Shader programs
 GLuint gCubeProgramId;
 GLuint gLampProgramId;
+// Cube program uniforms that only change at startup, looked up once by reflection
+ProgramReflection gCubeReflection;
+UniformHandle<float> gShadowFarPlaneUniform;
+UniformHandle<glm::vec3> gProbeGridMinUniform;
+UniformHandle<glm::vec3> gProbeGridMaxUniform;
+// Model, normal and MVP matrices of every object, refreshed once per frame
+ObjectConstantsBuffer gObjectConstants;
+enum SceneObject { CUBE_OBJECT, FLOOR_OBJECT, LAMP_OBJECT, OBJECT_COUNT };
+
+// Unit cube used by every object; uploaded by UCreateMesh and traced by the probe bake
+const GLfloat CUBE_VERTICES[] = {
+    //Positions          //Normals
+    // --------------------------------------
+    //Back Face          //Negative Z Normals
+   -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+    0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+    0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+    0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+   -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+   -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+
+    //Front Face         //Positive Z Normals
+   -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+    0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+    0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+    0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+   -0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+   -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+
+    //Left Face          //Negative X Normals
+   -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
+   -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
+   -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
+   -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
+   -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
+   -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
+
+    //Right Face         //Positive X Normals
+    0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
+    0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
+    0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
+    0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
+    0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
+    0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
+
+    //Bottom Face        //Negative Y Normals
+   -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
+    0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
+    0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
+    0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
+   -0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
+   -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
+
+    //Top Face           //Positive Y Normals
+   -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
+    0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
+    0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
+    0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
+   -0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
+   -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f
+};
+const size_t CUBE_VERTEX_COUNT = sizeof(CUBE_VERTICES) / (sizeof(CUBE_VERTICES[0]) * 6);
+
+// Shadows of the lamp; faces are only redrawn when the lamp or a caster moves
+PointShadowMap gPointShadow;
+const int POINT_SHADOW_SIZE = 1024;
+const float POINT_SHADOW_FAR_PLANE = 25.0f;
+// The lamp itself casts no shadow, it sits inside its light
+const SceneObject SHADOW_CASTERS[] = { CUBE_OBJECT, FLOOR_OBJECT };
+const size_t SHADOW_CASTER_COUNT = sizeof(SHADOW_CASTERS) / sizeof(SHADOW_CASTERS[0]);
+
+// Ambient light baked once at startup; the moving lamp is baked as a ring of
+// dimmer lights along its orbit, so the probes hold its average bounce light
+IrradianceProbeGrid gProbes;
+GLuint gProbeTextureId = 0;
+const glm::vec3 PROBE_GRID_MIN(-6.0f, -0.95f, -6.0f); // just above the floor
+const glm::vec3 PROBE_GRID_MAX(6.0f, 3.0f, 6.0f);
+const glm::ivec3 PROBE_GRID_DIMS(8, 4, 8);
+const int PROBE_ORBIT_LIGHTS = 8;
+const float PROBE_ORBIT_INTENSITY = 9.0f; // shared by the ring
+const glm::vec3 PROBE_SKY_COLOR(0.05f, 0.05f, 0.07f);
 
 // camera
 Camera gCamera(glm::vec3(0.0f, 0.0f, 7.0f));
@@ -58,6 +146,11 @@ float gLastFrame = 0.0f;
 glm::vec3 gCubePosition(0.0f, 0.0f, 0.0f);
 glm::vec3 gCubeScale(2.0f);
 
+// Floor slab the cube rests on, to catch its shadow
+glm::vec3 gFloorPosition(0.0f, -1.05f, 0.0f);
+glm::vec3 gFloorScale(12.0f, 0.1f, 12.0f);
+glm::vec3 gFloorColor(0.6f, 0.6f, 0.6f);
+
 // Cube and light color
 //m::vec3 gObjectColor(0.6f, 0.5f, 0.75f);
 glm::vec3 gObjectColor(1.f, 0.2f, 0.0f);
@@ -69,6 +162,13 @@ glm::vec3 gLightScale(0.3f);
 
 // Lamp animation
 bool gIsLampOrbiting = true;
+
+// Click-to-select: object ids are the SceneObject values
+RayPicker gPicker;
+const char* const SCENE_OBJECT_NAMES[OBJECT_COUNT] = { "cube", "floor", "lamp" };
+glm::mat4 gViewProjection(1.0f); // of the last frame drawn
+bool gIsPicking = false; // left button held: pick every frame
+int gSelectedObject = -1;
 }
 
 /* User-defined Function prototypes to:
@@ -84,130 +184,9 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void UCreateMesh(GLMesh &mesh);
 void UDestroyMesh(GLMesh &mesh);
-bool UCreateTexture(const char* filename, GLuint &textureId);
-void UDestroyTexture(GLuint textureId);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId);
-void UDestroyShaderProgram(GLuint programId);
-
-
-/* Cube Vertex Shader Source Code*/
-const GLchar * cubeVertexShaderSource = GLSL(440,
-
-    layout (location = 0) in vec3 position; // VAP position 0 for vertex position data
-    layout (location = 1) in vec3 normal; // VAP position 1 for normals
-
-    out vec3 vertexNormal; // For outgoing normals to fragment shader
-    out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-
-    //Uniform / Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main()
-    {
-         gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-
-         vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-
-         vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-    }
-);
-
-
-/* Cube Fragment Shader Source Code*/
-const GLchar * cubeFragmentShaderSource = GLSL(440,
-
-    in vec3 vertexNormal; // For incoming normals
-    in vec3 vertexFragmentPos; // For incoming fragment position
-
-    out vec4 fragmentColor; // For outgoing cube color to the GPU
-
-    // Uniform / Global variables for object color, light color, light position, and camera/view position
-    uniform vec3 objectColor;
-    uniform vec3 lightColor;
-    uniform vec3 lightPos;
-    uniform vec3 viewPosition;
-
-    void main()
-    {
-        /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
-
-        //Calculate Ambient lighting*/
-        float ambientStrength = 0.1f; // Set ambient or global lighting strength
-        vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
-
-        //Calculate Diffuse lighting*/
-        vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-        vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-        float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-        vec3 diffuse = impact * lightColor; // Generate diffuse light color
-
-        //Calculate Specular lighting*/
-        float specularIntensity = 0.8f; // Set specular light strength
-        float highlightSize = 16.0f; // Set specular highlight size
-        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-        vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-        //Calculate specular component
-        float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-        vec3 specular = specularIntensity * specularComponent * lightColor;
-
-        // Calculate phong result
-        vec3 phong = (ambient + diffuse + specular) * objectColor;
-
-        fragmentColor = vec4(phong, 1.0f); // Send lighting results to GPU
-    }
-);
-
-
-/* Lamp Shader Source Code*/
-const GLchar * lampVertexShaderSource = GLSL(440,
-
-    layout (location = 0) in vec3 position; // VAP position 0 for vertex position data
-
-        //Uniform / Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main()
-    {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-    }
-);
-
-
-/* Fragment Shader Source Code*/
-const GLchar * lampFragmentShaderSource = GLSL(440,
-
-    out vec4 fragmentColor; // For outgoing lamp color (smaller cube) to the GPU
-
-    void main()
-    {
-        fragmentColor = vec4(1.0f); // Set color to white (1.0f,1.0f,1.0f) with alpha 1.0
-    }
-);
-
-
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char *image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
-}
+void UBakeProbes();
+void UPick();
 
 
 int main(int argc, char* argv[])
@@ -218,12 +197,37 @@ int main(int argc, char* argv[])
     // Create the mesh
     UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
 
-    // Create the shader programs
-    if (!UCreateShaderProgram(cubeVertexShaderSource, cubeFragmentShaderSource, gCubeProgramId))
+    // Every object is the unit cube; URender keeps their model matrices current
+    const int cubePickMesh = gPicker.AddMesh(CUBE_VERTICES, 6, CUBE_VERTEX_COUNT);
+    for (int i = 0; i < OBJECT_COUNT; ++i)
+        gPicker.AddObject(cubePickMesh, glm::mat4(1.0f));
+
+    // Create the shader programs; both are compiled and linked as one batch
+    ProgramBuilder programs(&gProgramCache);
+    gShaders.Add(programs, CUBE_SHADER_FEATURES);
+    gShaders.Add(programs, LAMP_SHADER_FEATURES);
+    if (!gPointShadow.Create(POINT_SHADOW_SIZE, POINT_SHADOW_FAR_PLANE, programs))
         return EXIT_FAILURE;
+    if (!programs.Build() || !gPointShadow.Reflect())
+        return EXIT_FAILURE;
+    gCubeProgramId = gShaders.Get(CUBE_SHADER_FEATURES);
+    gLampProgramId = gShaders.Get(LAMP_SHADER_FEATURES);
 
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
+    if (!gCubeReflection.Reflect(gCubeProgramId))
+    {
+        cout << "ERROR::REFLECTION::Program interface queries are not supported" << endl;
         return EXIT_FAILURE;
+    }
+    gShadowFarPlaneUniform = gCubeReflection.Uniform<float>("shadowFarPlane");
+    gProbeGridMinUniform = gCubeReflection.Uniform<glm::vec3>("probeGridMin");
+    gProbeGridMaxUniform = gCubeReflection.Uniform<glm::vec3>("probeGridMax");
+
+    // Receivers compare against distances stored relative to the shadow map's far plane
+    gShadowFarPlaneUniform.Set(gPointShadow.GetFarPlane());
+    gCubeReflection.Flush();
+
+    // Bake the ambient light probes and point the cube program at them
+    UBakeProbes();
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -251,9 +255,11 @@ int main(int argc, char* argv[])
     // Release mesh data
     UDestroyMesh(gMesh);
 
-    // Release shader programs
-    UDestroyShaderProgram(gCubeProgramId);
-    UDestroyShaderProgram(gLampProgramId);
+    // Release shader programs and their constants
+    gShaders.Clear();
+    gObjectConstants.Destroy();
+    gPointShadow.Destroy();
+    glDeleteTextures(1, &gProbeTextureId);
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -380,10 +386,10 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     {
         case GLFW_MOUSE_BUTTON_LEFT:
         {
-            if (action == GLFW_PRESS)
-                cout << "Left mouse button pressed" << endl;
-            else
-                cout << "Left mouse button released" << endl;
+            // Selects what is under the cursor, and keeps picking while the button is held
+            gIsPicking = action == GLFW_PRESS;
+            if (gIsPicking)
+                UPick();
         }
         break;
 
@@ -437,13 +443,12 @@ void URender()
     // Activate the cube VAO (used by cube and lamp)
     glBindVertexArray(gMesh.vao);
 
-    // CUBE: draw cube
-    //----------------
-    // Set the shader to be used
-    glUseProgram(gCubeProgramId);
-
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = glm::translate(gCubePosition) * glm::scale(gCubeScale);
+    // Model matrices: transformations are applied right-to-left order
+    glm::mat4 models[OBJECT_COUNT];
+    models[CUBE_OBJECT] = glm::translate(gCubePosition) * glm::scale(gCubeScale);
+    models[FLOOR_OBJECT] = glm::translate(gFloorPosition) * glm::scale(gFloorScale);
+    //Transform the smaller cube used as a visual que for the light source
+    models[LAMP_OBJECT] = glm::translate(gLightPosition) * glm::scale(gLightScale);
 
     // camera/view transformation
     glm::mat4 view = gCamera.GetViewMatrix();
@@ -451,14 +456,46 @@ void URender()
     // Creates a perspective projection
     glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gCubeProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gCubeProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gCubeProgramId, "projection");
+    // Model, normal and MVP matrices of both objects in one batch; each draw binds its own
+    gObjectConstants.Update(models, OBJECT_COUNT, projection * view);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Picks see the scene as it was drawn
+    gViewProjection = projection * view;
+    for (int i = 0; i < OBJECT_COUNT; ++i)
+        gPicker.SetModel(i, models[i]);
+    if (gIsPicking)
+        UPick();
+
+    // SHADOWS: redraw the cube map faces the lamp or a moving caster invalidated
+    //----------------
+    ShadowCaster casters[SHADOW_CASTER_COUNT];
+    for (size_t i = 0; i < SHADOW_CASTER_COUNT; ++i)
+    {
+        casters[i].model = models[SHADOW_CASTERS[i]];
+        casters[i].boundsMin = glm::vec3(-0.5f); // the unit cube mesh
+        casters[i].boundsMax = glm::vec3(0.5f);
+    }
+    if (gPointShadow.Begin(gLightPosition, casters, SHADOW_CASTER_COUNT))
+    {
+        for (size_t i = 0; i < SHADOW_CASTER_COUNT; ++i)
+        {
+            if (!gPointShadow.NeedsCaster(i))
+                continue;
+            gObjectConstants.Bind(SHADOW_CASTERS[i]);
+            glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+        }
+        gPointShadow.End();
+    }
+    gPointShadow.Bind(POINT_SHADOW_UNIT);
+    glActiveTexture(GL_TEXTURE0 + IRRADIANCE_PROBE_UNIT);
+    glBindTexture(GL_TEXTURE_3D, gProbeTextureId);
+    glActiveTexture(GL_TEXTURE0);
+
+    // CUBE: draw cube
+    //----------------
+    // Set the shader to be used
+    glUseProgram(gCubeProgramId);
+    gObjectConstants.Bind(CUBE_OBJECT);
 
     // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
     GLint objectColorLoc = glGetUniformLocation(gCubeProgramId, "objectColor");
@@ -476,22 +513,20 @@ void URender()
     // Draws the triangles
     glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
 
+    // FLOOR: same program, its own matrices and color
+    //----------------
+    gObjectConstants.Bind(FLOOR_OBJECT);
+    glUniform3f(objectColorLoc, gFloorColor.r, gFloorColor.g, gFloorColor.b);
+    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+
     // LAMP: draw lamp
     //----------------
     glUseProgram(gLampProgramId);
 
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(gLightPosition) * glm::scale(gLightScale);
-
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(gLampProgramId, "model");
-    viewLoc = glGetUniformLocation(gLampProgramId, "view");
-    projLoc = glGetUniformLocation(gLampProgramId, "projection");
+    gObjectConstants.Bind(LAMP_OBJECT);
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // The unlit permutation draws the lamp in plain white
+    glUniform3f(glGetUniformLocation(gLampProgramId, "objectColor"), 1.0f, 1.0f, 1.0f);
 
     glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
 
@@ -507,63 +542,10 @@ void URender()
 // Implements the UCreateMesh function
 void UCreateMesh(GLMesh &mesh)
 {
-     // Position and Color data
-    GLfloat verts[] = {
-        //Positions          //Normals
-        // --------------------------------------
-        //Back Face          //Negative Z Normals
-       -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-        0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-        0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-        0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-       -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-       -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-
-        //Front Face         //Positive Z Normals
-       -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-        0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-        0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-        0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-       -0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-       -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-
-        //Left Face          //Negative X Normals
-       -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-       -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-       -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-       -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-       -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-       -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-
-        //Right Face         //Positive X Normals
-        0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-        0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-        0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-        0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-        0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-        0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-
-        //Bottom Face        //Negative Y Normals
-       -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-        0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-        0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-        0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-       -0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-       -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-
-        //Top Face           //Positive Y Normals
-       -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
-        0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
-        0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-        0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-       -0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-       -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f
-    };
-
     const GLuint floatsPerVertex = 3;
     const GLuint floatsPerNormal = 3;
 
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal));
+    mesh.nVertices = sizeof(CUBE_VERTICES) / (sizeof(CUBE_VERTICES[0]) * (floatsPerVertex + floatsPerNormal));
 
     glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
     glBindVertexArray(mesh.vao);
@@ -571,7 +553,7 @@ void UCreateMesh(GLMesh &mesh)
     // Create 2 buffers: first one for the vertex data; second one for the indices
     glGenBuffers(1, &mesh.vbo);
     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_VERTICES), CUBE_VERTICES, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
     // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
     GLint stride =  sizeof(float) * (floatsPerVertex + floatsPerNormal);// The number of floats before each
@@ -585,124 +567,74 @@ void UCreateMesh(GLMesh &mesh)
 }
 
 
-void UDestroyMesh(GLMesh &mesh)
-{
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(1, &mesh.vbo);
-}
-
-
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint &textureId)
+// Bakes the irradiance probes over the cube and floor, then uploads them
+void UBakeProbes()
 {
-    int width, height, channels;
-    unsigned char *image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    // The cube vertices are already in draw order
+    unsigned short indices[CUBE_VERTEX_COUNT];
+    for (size_t i = 0; i < CUBE_VERTEX_COUNT; ++i)
+        indices[i] = static_cast<unsigned short>(i);
+
+    LightmapMesh meshes[2];
+    meshes[0].model = glm::translate(gCubePosition) * glm::scale(gCubeScale);
+    meshes[0].albedo = gObjectColor;
+    meshes[1].model = glm::translate(gFloorPosition) * glm::scale(gFloorScale);
+    meshes[1].albedo = gFloorColor;
+    for (int i = 0; i < 2; ++i)
     {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
-        {
-        	cout << "Not implemented to handle image with " << channels << " channels" << endl;
-        	return false;
-        }
-
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-        return true;
-    }
-
-    // Error loading the image
-    return false;
-}
-
-
-void UDestroyTexture(GLuint textureId)
-{
-    glGenTextures(1, &textureId);
-}
-
-
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId)
-{
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
+        meshes[i].vertices = CUBE_VERTICES;
+        meshes[i].vertexStride = 6;
+        meshes[i].vertexCount = CUBE_VERTEX_COUNT;
+        meshes[i].indices = indices;
+        meshes[i].indexCount = CUBE_VERTEX_COUNT;
     }
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    // The lamp's orbit, sampled evenly
+    BakeLight lights[PROBE_ORBIT_LIGHTS];
+    for (int i = 0; i < PROBE_ORBIT_LIGHTS; ++i)
     {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
+        const float angle = glm::two_pi<float>() * i / PROBE_ORBIT_LIGHTS;
+        lights[i].position = glm::vec3(glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(gLightPosition, 1.0f));
+        lights[i].color = gLightColor;
+        lights[i].intensity = PROBE_ORBIT_INTENSITY / PROBE_ORBIT_LIGHTS;
     }
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
+    const double bakeStart = glfwGetTime();
+    gProbes.SetScene(meshes, 2, lights, PROBE_ORBIT_LIGHTS, PROBE_SKY_COLOR);
+    gProbes.Bake(PROBE_GRID_MIN, PROBE_GRID_MAX, PROBE_GRID_DIMS);
+    gProbeTextureId = gProbes.CreateTexture();
+    cout << "INFO: Baked " << PROBE_GRID_DIMS.x * PROBE_GRID_DIMS.y * PROBE_GRID_DIMS.z << " irradiance probes in "
+         << (glfwGetTime() - bakeStart) * 1000.0 << " ms" << endl;
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
+    gProbeGridMinUniform.Set(gProbes.GetGridMin());
+    gProbeGridMaxUniform.Set(gProbes.GetGridMax());
+    gCubeReflection.Flush();
+}
 
-    glUseProgram(programId);    // Uses the shader program
 
-    return true;
+void UDestroyMesh(GLMesh &mesh)
+{
+    glDeleteVertexArrays(1, &mesh.vao);
+    glDeleteBuffers(1, &mesh.vbo);
 }
 
 
-void UDestroyShaderProgram(GLuint programId)
+// Selects the object under the cursor; the cursor is captured for the camera, so that is the center of the window
+void UPick()
 {
-    glDeleteProgram(programId);
+    double cursorX = WINDOW_WIDTH / 2.0, cursorY = WINDOW_HEIGHT / 2.0;
+    if (glfwGetInputMode(gWindow, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+        glfwGetCursorPos(gWindow, &cursorX, &cursorY);
+
+    PickHit hit;
+    gPicker.Pick(gViewProjection, cursorX, cursorY, WINDOW_WIDTH, WINDOW_HEIGHT, hit);
+    if (hit.object == gSelectedObject)
+        return;
+
+    gSelectedObject = hit.object;
+    if (hit.object < 0)
+        cout << "INFO: nothing selected" << endl;
+    else
+        cout << "INFO: selected " << SCENE_OBJECT_NAMES[hit.object] << " at (" << hit.point.x << ", "
+             << hit.point.y << ", " << hit.point.z << ")" << endl;
 }
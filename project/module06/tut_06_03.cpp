@@ -1,9 +1,23 @@
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstring>          // strcmp
+#include <fstream>          // frame time trace
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>      // Image loading Utility functions
+#include <engine/image_cache.h> // Memory-mapped loading and decoded-pixel cache
+#include <engine/sampler_cache.h> // Shared sampler objects
+#include <engine/texture_registry.h> // Shares textures loaded from identical files
+#include <engine/program_builder.h> // Batched shader builds over the program binary cache
+#include <engine/shader_permutations.h> // Shader variants selected by feature bitmask
+#include <engine/standard_shader.h> // Annotated source of those variants
+#include <engine/object_constants.h> // Per-object matrices computed on the CPU
+#include <engine/clustered_lights.h> // Point lights binned into view-space clusters
+#include <engine/deferred_renderer.h> // G-buffer and clustered light pass
+#include <engine/gpu_timer.h> // GPU frame time for comparing the two paths
+#include <engine/program_reflection.h> // Typed uniform handles with a shadow copy
+#include <engine/input_recorder.h> // Recorded input for repeatable timing runs
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -14,11 +28,6 @@
 
 using namespace std; // Standard namespace
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
-
 // Unnamed namespace
 namespace
 {
@@ -44,10 +53,48 @@ GLMesh gMesh;
 GLuint gTextureId;
 glm::vec2 gUVScale(5.0f, 5.0f);
 GLint gTexWrapMode = GL_REPEAT;
-
+// Shared sampler objects, one per wrap mode in use
+SamplerCache gSamplerCache;
+// Loaded textures, shared by path and content
+TextureRegistry gTextureRegistry;
+
+// Linked program binaries from earlier runs
+ProgramCache gProgramCache;
+// Compiled variants of the standard shader, one per feature set in use
+ShaderPermutations gShaders(STANDARD_VERTEX_SHADER, STANDARD_FRAGMENT_SHADER, &gProgramCache);
+const unsigned CUBE_SHADER_FEATURES = SHADER_LIT | SHADER_TEXTURED | SHADER_CLUSTERED_LIGHTS;
+const unsigned CUBE_GBUFFER_SHADER_FEATURES = SHADER_LIT | SHADER_TEXTURED | SHADER_GBUFFER;
+const unsigned LAMP_SHADER_FEATURES = 0; // flat color, no lighting
 // Shader programs
 GLuint gCubeProgramId;
+GLuint gCubeGBufferProgramId;
 GLuint gLampProgramId;
+// Model, normal and MVP matrices of every object, refreshed once per frame
+ObjectConstantsBuffer gObjectConstants;
+enum SceneObject { CUBE_OBJECT, LAMP_OBJECT, OBJECT_COUNT };
+
+// Reflected uniforms of each program, looked up once after linking
+struct ObjectUniforms
+{
+    UniformHandle<glm::vec3> objectColor;
+    UniformHandle<glm::vec3> viewPosition;
+    UniformHandle<glm::vec2> uvScale;
+    UniformHandle<int> uTexture;
+};
+ProgramReflection gCubeReflection;
+ProgramReflection gCubeGBufferReflection;
+ProgramReflection gLampReflection;
+ObjectUniforms gCubeUniforms;
+ObjectUniforms gCubeGBufferUniforms;
+ObjectUniforms gLampUniforms;
+
+// Vertex layout bound by UCreateMesh
+const ExpectedInput MESH_INPUTS[] =
+{
+    { "position", 0, GL_FLOAT_VEC3 },
+    { "normal", 1, GL_FLOAT_VEC3 },
+    { "textureCoordinate", 2, GL_FLOAT_VEC2 }
+};
 
 // camera
 Camera gCamera(glm::vec3(0.0f, 0.0f, 7.0f));
@@ -74,6 +121,35 @@ glm::vec3 gLightScale(0.3f);
 
 // Lamp animation
 bool gIsLampOrbiting = true;
+
+// Point lights lighting the cube; the lamp is light 0, the rest are small lights scattered around the cube
+std::vector<PointLight> gLights;
+ClusteredLights gClusteredLights;
+const int FIELD_LIGHT_COUNT = 2048;
+const float LAMP_LIGHT_RADIUS = 50.0f;
+
+// Framebuffer size in pixels, kept current by UResizeWindow; the cluster tiles and the G-buffer are sized from it
+int gFramebufferWidth = WINDOW_WIDTH;
+int gFramebufferHeight = WINDOW_HEIGHT;
+
+// Forward or deferred shading of the cube, and the GPU time each takes
+DeferredRenderer gDeferredRenderer;
+bool gIsDeferred = false;
+GpuTimer gFrameTimer;
+double gGpuTimeSum = 0.0;
+int gGpuTimeFrames = 0;
+const int GPU_TIME_REPORT_FRAMES = 120;
+
+// Input recording and replay: --record <file> saves this session's input, --replay <file> plays
+// it back in a hidden window (--timestep <seconds> overrides the recorded frame times), and
+// --trace <file.csv> writes every frame's CPU and GPU time, to diff two builds on one recording
+InputRecorder gInput;
+const char* gRecordPath = NULL;
+const char* gReplayPath = NULL;
+const char* gTracePath = NULL;
+float gReplayTimestep = 0.0f;
+std::vector<double> gCpuFrameTimes;
+std::vector<double> gGpuFrameTimes;     // by frame index; negative where the timer skipped the frame
 }
 
 /* User-defined Function prototypes to:
@@ -81,7 +157,7 @@ bool gIsLampOrbiting = true;
  * redraw graphics on the window when resized,
  * and render graphics on the screen
  */
-bool UInitialize(int, char*[], GLFWwindow** window);
+bool UInitialize(int argc, char* argv[], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
@@ -91,137 +167,12 @@ void UCreateMesh(GLMesh &mesh);
 void UDestroyMesh(GLMesh &mesh);
 bool UCreateTexture(const char* filename, GLuint &textureId);
 void UDestroyTexture(GLuint textureId);
+bool UReflectProgram(GLuint programId, ProgramReflection &reflection, ObjectUniforms &uniforms);
+void UCreateLights();
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId);
-void UDestroyShaderProgram(GLuint programId);
-
-
-/* Cube Vertex Shader Source Code*/
-const GLchar * cubeVertexShaderSource = GLSL(440,
-
-    layout (location = 0) in vec3 position; // VAP position 0 for vertex position data
-    layout (location = 1) in vec3 normal; // VAP position 1 for normals
-    layout (location = 2) in vec2 textureCoordinate;
-
-    out vec3 vertexNormal; // For outgoing normals to fragment shader
-    out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-    out vec2 vertexTextureCoordinate;
-
-    //Uniform / Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main()
-    {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-
-        vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-
-        vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-        vertexTextureCoordinate = textureCoordinate;
-    }
-);
-
-
-/* Cube Fragment Shader Source Code*/
-const GLchar * cubeFragmentShaderSource = GLSL(440,
-
-    in vec3 vertexNormal; // For incoming normals
-    in vec3 vertexFragmentPos; // For incoming fragment position
-    in vec2 vertexTextureCoordinate;
-
-    out vec4 fragmentColor; // For outgoing cube color to the GPU
-
-    // Uniform / Global variables for object color, light color, light position, and camera/view position
-    uniform vec3 objectColor;
-    uniform vec3 lightColor;
-    uniform vec3 lightPos;
-    uniform vec3 viewPosition;
-    uniform sampler2D uTexture; // Useful when working with multiple textures
-    uniform vec2 uvScale;
-
-    void main()
-    {
-        /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
-
-        //Calculate Ambient lighting*/
-        float ambientStrength = 0.1f; // Set ambient or global lighting strength
-        vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
-
-        //Calculate Diffuse lighting*/
-        vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-        vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-        float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-        vec3 diffuse = impact * lightColor; // Generate diffuse light color
-
-        //Calculate Specular lighting*/
-        float specularIntensity = 0.8f; // Set specular light strength
-        float highlightSize = 16.0f; // Set specular highlight size
-        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-        vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-        //Calculate specular component
-        float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-        vec3 specular = specularIntensity * specularComponent * lightColor;
-
-        // Texture holds the color to be used for all three components
-        vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
-
-        // Calculate phong result
-        vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
-
-        fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
-    }
-);
-
-
-/* Lamp Shader Source Code*/
-const GLchar * lampVertexShaderSource = GLSL(440,
-
-    layout (location = 0) in vec3 position; // VAP position 0 for vertex position data
-
-        //Uniform / Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main()
-    {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-    }
-);
-
-
-/* Fragment Shader Source Code*/
-const GLchar * lampFragmentShaderSource = GLSL(440,
-
-    out vec4 fragmentColor; // For outgoing lamp color (smaller cube) to the GPU
-
-    void main()
-    {
-        fragmentColor = vec4(1.0f); // Set color to white (1.0f,1.0f,1.0f) with alpha 1.0
-    }
-);
-
-
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char *image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
-}
+void UPollEvents();
+bool UParseArguments(int argc, char* argv[]);
+void UWriteFrameTrace(const char* path);
 
 
 int main(int argc, char* argv[])
@@ -232,28 +183,51 @@ int main(int argc, char* argv[])
     // Create the mesh
     UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
 
-    // Create the shader programs
-    if (!UCreateShaderProgram(cubeVertexShaderSource, cubeFragmentShaderSource, gCubeProgramId))
-        return EXIT_FAILURE;
-
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
+    // Create the shader programs; both compile in parallel while the texture loads
+    ProgramBuilder programs(&gProgramCache);
+    gShaders.Add(programs, CUBE_SHADER_FEATURES);
+    gShaders.Add(programs, CUBE_GBUFFER_SHADER_FEATURES);
+    gShaders.Add(programs, LAMP_SHADER_FEATURES);
+    if (!gDeferredRenderer.Create(gFramebufferWidth, gFramebufferHeight, programs))
         return EXIT_FAILURE;
+    programs.Submit();
 
     // Load texture
     const char * texFilename = "../../resources/textures/smiley.png";
-    if (!UCreateTexture(texFilename, gTextureId))
+    if (!gTextureRegistry.Acquire(texFilename, gTextureId, UCreateTexture, UDestroyTexture))
     {
         cout << "Failed to load texture " << texFilename << endl;
         return EXIT_FAILURE;
     }
+    cout << "INFO: Resident texture memory: " << gTextureRegistry.GetResidentBytes() << " bytes" << endl;
+
+    if (!programs.Finish())
+        return EXIT_FAILURE;
+    gCubeProgramId = gShaders.Get(CUBE_SHADER_FEATURES);
+    gCubeGBufferProgramId = gShaders.Get(CUBE_GBUFFER_SHADER_FEATURES);
+    gLampProgramId = gShaders.Get(LAMP_SHADER_FEATURES);
+    if (!UReflectProgram(gCubeProgramId, gCubeReflection, gCubeUniforms) || !UReflectProgram(gLampProgramId, gLampReflection, gLampUniforms)
+        || !UReflectProgram(gCubeGBufferProgramId, gCubeGBufferReflection, gCubeGBufferUniforms) || !gDeferredRenderer.Reflect())
+        return EXIT_FAILURE;
+
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gCubeProgramId);
     // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gCubeProgramId, "uTexture"), 0);
+    gCubeUniforms.uTexture.Set(0);
+    gCubeGBufferUniforms.uTexture.Set(0);
+    // The lamp is drawn in plain white
+    gLampUniforms.objectColor.Set(glm::vec3(1.0f));
+
+    UCreateLights();
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    // Input starts being recorded or replayed with the first frame
+    if (gRecordPath && !gInput.StartRecording(gRecordPath))
+        return EXIT_FAILURE;
+    if (gReplayPath && !gInput.StartReplay(gReplayPath, gReplayTimestep))
+        return EXIT_FAILURE;
+
     // render loop
     // -----------
     while (!glfwWindowShouldClose(gWindow))
@@ -263,6 +237,8 @@ int main(int argc, char* argv[])
         float currentFrame = glfwGetTime();
         gDeltaTime = currentFrame - gLastFrame;
         gLastFrame = currentFrame;
+        if (!gInput.BeginFrame(gDeltaTime))
+            break; // every recorded frame has been replayed
 
         // input
         // -----
@@ -271,26 +247,69 @@ int main(int argc, char* argv[])
         // Render this frame
         URender();
 
-        glfwPollEvents();
+        UPollEvents();
+        if (gTracePath)
+            gCpuFrameTimes.push_back((glfwGetTime() - currentFrame) * 1000.0);
     }
 
+    if (gInput.IsReplaying())
+        cout << "INFO: Replayed " << gInput.GetFrameCount() << " frames" << endl;
+    gInput.Stop();
+    if (gTracePath)
+        UWriteFrameTrace(gTracePath);
+
     // Release mesh data
     UDestroyMesh(gMesh);
 
     // Release texture
-    UDestroyTexture(gTextureId);
+    gTextureRegistry.Release(gTextureId);
+    gSamplerCache.Clear();
 
-    // Release shader programs
-    UDestroyShaderProgram(gCubeProgramId);
-    UDestroyShaderProgram(gLampProgramId);
+    // Release shader programs and their constants
+    gShaders.Clear();
+    gObjectConstants.Destroy();
+    gClusteredLights.Destroy();
+    gDeferredRenderer.Destroy();
+    gFrameTimer.Destroy();
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
 
 
+// Reads the recording, replay and trace options
+bool UParseArguments(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            gRecordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            gReplayPath = argv[++i];
+        else if (strcmp(argv[i], "--timestep") == 0 && i + 1 < argc)
+            gReplayTimestep = static_cast<float>(atof(argv[++i]));
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            gTracePath = argv[++i];
+        else
+        {
+            cout << "usage: " << argv[0] << " [--record file | --replay file [--timestep seconds]] [--trace file.csv]" << endl;
+            return false;
+        }
+    }
+    if (gRecordPath && gReplayPath)
+    {
+        cout << "Cannot record and replay at the same time" << endl;
+        return false;
+    }
+    return true;
+}
+
+
 // Initialize GLFW, GLEW, and create a window
 bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 {
+    if (!UParseArguments(argc, argv))
+        return false;
+
     // GLFW: initialize and configure
     // ------------------------------
     glfwInit();
@@ -302,6 +321,10 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+    // A replay needs no visible window, and renders as fast as it can
+    if (gReplayPath)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
     // GLFW: window creation
     // ---------------------
     *window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
@@ -313,9 +336,16 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     }
     glfwMakeContextCurrent(*window);
     glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-    glfwSetCursorPosCallback(*window, UMousePositionCallback);
-    glfwSetScrollCallback(*window, UMouseScrollCallback);
-    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+    glfwGetFramebufferSize(*window, &gFramebufferWidth, &gFramebufferHeight); // differs from the window size on high-DPI screens
+    if (gReplayPath)
+        glfwSwapInterval(0);
+    else
+    {
+        // A replay calls these with the recorded events instead
+        glfwSetCursorPosCallback(*window, UMousePositionCallback);
+        glfwSetScrollCallback(*window, UMouseScrollCallback);
+        glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+    }
 
     // tell GLFW to capture our mouse
     glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -344,72 +374,50 @@ void UProcessInput(GLFWwindow* window)
 {
     static const float cameraSpeed = 2.5f;
 
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    if (gInput.GetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if (gInput.GetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (gInput.GetKey(window, GLFW_KEY_S) == GLFW_PRESS)
         gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (gInput.GetKey(window, GLFW_KEY_A) == GLFW_PRESS)
         gCamera.ProcessKeyboard(LEFT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (gInput.GetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
 
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS && gTexWrapMode != GL_REPEAT)
+    // The wrap mode lives in the shared sampler bound in URender, so switching it touches no texture
+    if (gInput.GetKey(window, GLFW_KEY_1) == GLFW_PRESS && gTexWrapMode != GL_REPEAT)
     {
-        glBindTexture(GL_TEXTURE_2D, gTextureId);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
         gTexWrapMode = GL_REPEAT;
 
         cout << "Current Texture Wrapping Mode: REPEAT" << endl;
     }
-    else if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS && gTexWrapMode != GL_MIRRORED_REPEAT)
+    else if (gInput.GetKey(window, GLFW_KEY_2) == GLFW_PRESS && gTexWrapMode != GL_MIRRORED_REPEAT)
     {
-        glBindTexture(GL_TEXTURE_2D, gTextureId);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
         gTexWrapMode = GL_MIRRORED_REPEAT;
 
         cout << "Current Texture Wrapping Mode: MIRRORED REPEAT" << endl;
     }
-    else if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS && gTexWrapMode != GL_CLAMP_TO_EDGE)
+    else if (gInput.GetKey(window, GLFW_KEY_3) == GLFW_PRESS && gTexWrapMode != GL_CLAMP_TO_EDGE)
     {
-        glBindTexture(GL_TEXTURE_2D, gTextureId);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
         gTexWrapMode = GL_CLAMP_TO_EDGE;
 
         cout << "Current Texture Wrapping Mode: CLAMP TO EDGE" << endl;
     }
-    else if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS && gTexWrapMode != GL_CLAMP_TO_BORDER)
+    else if (gInput.GetKey(window, GLFW_KEY_4) == GLFW_PRESS && gTexWrapMode != GL_CLAMP_TO_BORDER)
     {
-        float color[] = {1.0f, 0.0f, 1.0f, 1.0f};
-        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, color);
-
-        glBindTexture(GL_TEXTURE_2D, gTextureId);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
         gTexWrapMode = GL_CLAMP_TO_BORDER;
 
         cout << "Current Texture Wrapping Mode: CLAMP TO BORDER" << endl;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS)
+    if (gInput.GetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS)
     {
         gUVScale += 0.1f;
         cout << "Current scale (" << gUVScale[0] << ", " << gUVScale[1] << ")" << endl;
     }
-    else if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS)
+    else if (gInput.GetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS)
     {
         gUVScale -= 0.1f;
         cout << "Current scale (" << gUVScale[0] << ", " << gUVScale[1] << ")" << endl;
@@ -417,11 +425,23 @@ void UProcessInput(GLFWwindow* window)
 
     // Pause and resume lamp orbiting
     static bool isLKeyDown = false;
-    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !gIsLampOrbiting)
+    if (gInput.GetKey(window, GLFW_KEY_L) == GLFW_PRESS && !gIsLampOrbiting)
         gIsLampOrbiting = true;
-    else if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && gIsLampOrbiting)
+    else if (gInput.GetKey(window, GLFW_KEY_K) == GLFW_PRESS && gIsLampOrbiting)
         gIsLampOrbiting = false;
 
+    // Switch between forward and deferred shading
+    static bool isGKeyDown = false;
+    const bool gKeyPressed = gInput.GetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gKeyPressed && !isGKeyDown)
+    {
+        gIsDeferred = !gIsDeferred;
+        gGpuTimeSum = 0.0;
+        gGpuTimeFrames = 0;
+        cout << "Current shading: " << (gIsDeferred ? "DEFERRED" : "FORWARD") << endl;
+    }
+    isGKeyDown = gKeyPressed;
+
 }
 
 
@@ -429,6 +449,14 @@ void UProcessInput(GLFWwindow* window)
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
+
+    // A minimized window reports 0 x 0; keep the last real size
+    if (width > 0 && height > 0)
+    {
+        gFramebufferWidth = width;
+        gFramebufferHeight = height;
+        gDeferredRenderer.Resize(width, height);
+    }
 }
 
 
@@ -436,6 +464,8 @@ void UResizeWindow(GLFWwindow* window, int width, int height)
 // -------------------------------------------------------
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 {
+    gInput.RecordCursor(xpos, ypos);
+
     if (gFirstMouse)
     {
         gLastX = xpos;
@@ -457,6 +487,7 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 // ----------------------------------------------------------------------
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 {
+    gInput.RecordScroll(xoffset, yoffset);
     gCamera.ProcessMouseScroll(yoffset);
 }
 
@@ -464,6 +495,8 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 // --------------------------------
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
+    gInput.RecordButton(button, action, mods);
+
     switch (button)
     {
         case GLFW_MOUSE_BUTTON_LEFT:
@@ -500,6 +533,94 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 }
 
 
+// Delivers this frame's input: live events through the GLFW callbacks, or the recorded ones during a replay
+void UPollEvents()
+{
+    glfwPollEvents();
+
+    InputEvent event;
+    while (gInput.NextEvent(event))
+    {
+        switch (event.type)
+        {
+            case INPUT_CURSOR:
+                UMousePositionCallback(gWindow, event.x, event.y);
+                break;
+            case INPUT_SCROLL:
+                UMouseScrollCallback(gWindow, event.x, event.y);
+                break;
+            case INPUT_BUTTON:
+                UMouseButtonCallback(gWindow, event.code, event.action, event.mods);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+
+// Reflects a linked program, checks it against the mesh layout and looks up its uniforms
+bool UReflectProgram(GLuint programId, ProgramReflection &reflection, ObjectUniforms &uniforms)
+{
+    if (!reflection.Reflect(programId))
+    {
+        cout << "ERROR::REFLECTION::Program interface queries are not supported" << endl;
+        return false;
+    }
+    if (!reflection.CheckInputs(MESH_INPUTS, sizeof(MESH_INPUTS) / sizeof(MESH_INPUTS[0])))
+        return false;
+
+    // The ObjectConstants block has to match the CPU-side struct byte for byte
+    const std::vector<ReflectedBlock> &blocks = reflection.GetBlocks();
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        if (blocks[i].name == "ObjectConstants" && blocks[i].dataSize != static_cast<GLint>(sizeof(ObjectConstants)))
+        {
+            cout << "ERROR::REFLECTION::ObjectConstants block is " << blocks[i].dataSize << " bytes, expected " << sizeof(ObjectConstants) << endl;
+            return false;
+        }
+    }
+
+    // Uniforms a permutation does not use come back as empty handles
+    uniforms.objectColor = reflection.Uniform<glm::vec3>("objectColor");
+    uniforms.viewPosition = reflection.Uniform<glm::vec3>("viewPosition");
+    uniforms.uvScale = reflection.Uniform<glm::vec2>("uvScale");
+    uniforms.uTexture = reflection.Uniform<int>("uTexture");
+    return true;
+}
+
+
+// Places the lamp light and a shell of small colored lights around the cube
+void UCreateLights()
+{
+    PointLight lamp;
+    lamp.position = gLightPosition;
+    lamp.radius = LAMP_LIGHT_RADIUS;
+    lamp.color = gLightColor;
+    lamp.intensity = 1.0f;
+    gLights.assign(1, lamp);
+
+    for (int i = 0; i < FIELD_LIGHT_COUNT; ++i)
+    {
+        // Fixed seed (rand's default), so every run lights the cube the same way
+        const float u = rand() / static_cast<float>(RAND_MAX);
+        const float v = rand() / static_cast<float>(RAND_MAX);
+        const float theta = glm::two_pi<float>() * u;
+        const float z = 2.0f * v - 1.0f;
+        const float distance = 1.4f + 1.2f * (rand() / static_cast<float>(RAND_MAX));
+        const float ring = std::sqrt(1.0f - z * z);
+
+        PointLight light;
+        light.position = gCubePosition + distance * glm::vec3(ring * std::cos(theta), z, ring * std::sin(theta));
+        light.radius = 0.5f + 0.5f * (rand() / static_cast<float>(RAND_MAX));
+        light.color = glm::vec3(u, v, 1.0f - u);
+        light.intensity = 0.5f;
+        gLights.push_back(light);
+    }
+    cout << "INFO: " << gLights.size() << " point lights" << endl;
+}
+
+
 // Functioned called to render a frame
 void URender()
 {
@@ -525,68 +646,98 @@ void URender()
 
     // CUBE: draw cube
     //----------------
-    // Set the shader to be used
-    glUseProgram(gCubeProgramId);
-
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = glm::translate(gCubePosition) * glm::scale(gCubeScale);
+    // Model matrices: transformations are applied right-to-left order
+    glm::mat4 models[OBJECT_COUNT];
+    models[CUBE_OBJECT] = glm::translate(gCubePosition) * glm::scale(gCubeScale);
+    //Transform the smaller cube used as a visual que for the light source
+    models[LAMP_OBJECT] = glm::translate(gLightPosition) * glm::scale(gLightScale);
 
     // camera/view transformation
     glm::mat4 view = gCamera.GetViewMatrix();
 
     // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)gFramebufferWidth / (GLfloat)gFramebufferHeight, 0.1f, 100.0f);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gCubeProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gCubeProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gCubeProgramId, "projection");
+    // Model, normal and MVP matrices of both objects in one batch; each draw binds its own
+    gObjectConstants.Update(models, OBJECT_COUNT, projection * view);
+    gObjectConstants.Bind(CUBE_OBJECT);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Bin the lights into the clusters of this frame's view; the lamp light follows the lamp
+    gLights[0].position = gLightPosition;
+    gClusteredLights.Configure(gFramebufferWidth, gFramebufferHeight, glm::radians(gCamera.Zoom), 0.1f, 100.0f);
+    gClusteredLights.Build(&gLights[0], gLights.size(), view);
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gCubeProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gCubeProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gCubeProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gCubeProgramId, "viewPosition");
+    gFrameTimer.Begin(static_cast<int>(gCpuFrameTimes.size())); // this frame's trace row
+    if (gIsDeferred)
+    {
+        // Geometry pass: the cube's surface goes into the G-buffer, lighting comes after
+        gDeferredRenderer.BeginGeometry();
+        glUseProgram(gCubeGBufferProgramId);
+        gCubeGBufferUniforms.uvScale.Set(gUVScale);
+        gCubeGBufferReflection.Flush();
+    }
+    else
+    {
+        // Set the shader to be used
+        glUseProgram(gCubeProgramId);
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+        // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
+        gCubeUniforms.objectColor.Set(gObjectColor);
+        gCubeUniforms.viewPosition.Set(gCamera.Position);
+        gCubeUniforms.uvScale.Set(gUVScale);
 
-    GLint UVScaleLoc = glGetUniformLocation(gCubeProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+        // Only the values that changed since the last frame reach the driver
+        gCubeReflection.Flush();
+    }
 
     // bind textures on corresponding texture units
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, gTextureId);
+    SamplerState samplerState(gTexWrapMode, GL_LINEAR, GL_LINEAR);
+    samplerState.SetBorderColor(1.0f, 0.0f, 1.0f, 1.0f); // only used by CLAMP TO BORDER
+    gSamplerCache.Bind(0, samplerState);
 
     // Draws the triangles
     glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
 
+    if (gIsDeferred)
+    {
+        // Light pass: every covered pixel is shaded once; the lamp then depth tests against the scene
+        gDeferredRenderer.Light(projection * view, gCamera.Position);
+        gDeferredRenderer.CopyDepth();
+        glBindVertexArray(gMesh.vao);
+    }
+
     // LAMP: draw lamp
     //----------------
     glUseProgram(gLampProgramId);
 
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(gLightPosition) * glm::scale(gLightScale);
+    gObjectConstants.Bind(LAMP_OBJECT);
+    gLampReflection.Flush();
 
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(gLampProgramId, "model");
-    viewLoc = glGetUniformLocation(gLampProgramId, "view");
-    projLoc = glGetUniformLocation(gLampProgramId, "projection");
+    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    gFrameTimer.End();
 
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+    // Average GPU time of the current path, for comparing forward and deferred on the same scene
+    double milliseconds;
+    int frame;
+    while (gFrameTimer.Read(milliseconds, &frame))
+    {
+        if (gTracePath)
+        {
+            if (gGpuFrameTimes.size() <= static_cast<size_t>(frame))
+                gGpuFrameTimes.resize(frame + 1, -1.0);
+            gGpuFrameTimes[frame] = milliseconds;
+        }
+        gGpuTimeSum += milliseconds;
+        if (++gGpuTimeFrames == GPU_TIME_REPORT_FRAMES)
+        {
+            cout << "INFO: " << (gIsDeferred ? "Deferred" : "Forward") << " shading: " << gGpuTimeSum / gGpuTimeFrames << " ms GPU per frame" << endl;
+            gGpuTimeSum = 0.0;
+            gGpuTimeFrames = 0;
+        }
+    }
 
     // Deactivate the Vertex Array Object and shader program
     glBindVertexArray(0);
@@ -692,35 +843,23 @@ void UDestroyMesh(GLMesh &mesh)
 /*Generate and load the texture*/
 bool UCreateTexture(const char* filename, GLuint &textureId)
 {
-    int width, height, channels;
-    unsigned char *image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    // Maps and decodes the file, or maps the pixels an earlier run cached, already flipped
+    CachedImage image;
+    if (image.Open(filename, true))
     {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-        	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+        if (image.Channels() != 3 && image.Channels() != 4)
         {
-        	cout << "Not implemented to handle image with " << channels << " channels" << endl;
+        	cout << "Not implemented to handle image with " << image.Channels() << " channels" << endl;
         	return false;
         }
 
-		glGenerateMipmap(GL_TEXTURE_2D);
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+
+        // Immutable storage for level 0 and the cached mip chain, so there is no glGenerateMipmap.
+        // Wrapping and filtering come from the shared sampler bound with the texture.
+        UploadCachedImage(image);
 
-        stbi_image_free(image);
         glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
         return true;
@@ -733,73 +872,26 @@ bool UCreateTexture(const char* filename, GLuint &textureId)
 
 void UDestroyTexture(GLuint textureId)
 {
-    glGenTextures(1, &textureId);
+    glDeleteTextures(1, &textureId);
 }
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId)
+// One line per frame; the GPU time is empty for frames the timer skipped or had not returned yet
+void UWriteFrameTrace(const char* path)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
-
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    ofstream trace(path);
+    if (!trace)
     {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
+        cout << "Failed to write frame trace " << path << endl;
+        return;
     }
-
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
+    trace << "frame,cpu_ms,gpu_ms" << endl;
+    for (size_t i = 0; i < gCpuFrameTimes.size(); ++i)
     {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
-        return false;
+        trace << i << "," << gCpuFrameTimes[i] << ",";
+        if (i < gGpuFrameTimes.size() && gGpuFrameTimes[i] >= 0.0)
+            trace << gGpuFrameTimes[i];
+        trace << "\n";
     }
-
-    glUseProgram(programId);    // Uses the shader program
-
-    return true;
-}
-
-
-void UDestroyShaderProgram(GLuint programId)
-{
-    glDeleteProgram(programId);
+    cout << "INFO: Wrote " << gCpuFrameTimes.size() << " frame times to " << path << endl;
 }